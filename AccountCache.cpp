@@ -0,0 +1,609 @@
+#include "AccountCache.h"
+#include <cstring>
+#include <cstdio>
+
+using namespace std;
+
+// Bytes at the start of a page before the history: slot record, held amount
+static const size_t PAGE_HEADER_BYTES = sizeof(AccountRecord) + sizeof(double);
+
+// Account type from a slot record (anything unknown reads as checking)
+static AccountType slotType(int32_t stored) {
+    if (stored >= 0 && stored < ACCOUNT_TYPE_COUNT) {
+        return static_cast<AccountType>(stored);
+    }
+    return CHECKING;
+}
+
+// Holder name from a slot record, stopping at the terminator or the field's end
+static string_view slotName(const AccountRecord& record) {
+    return string_view(record.holderName, strnlen(record.holderName, sizeof(record.holderName) - 1));
+}
+
+// Hash of a slot record as written to the slot file
+static uint64_t recordHash(const AccountRecord& record) {
+    return MerkleTree::hashBytes(&record, sizeof(record));
+}
+
+// Same location and same copy on disk
+bool PageAddress::operator==(const PageAddress& other) const {
+    return generation == other.generation && pageOffset == other.pageOffset && pageBytes == other.pageBytes &&
+           slot == other.slot && digest.recordHash == other.digest.recordHash &&
+           digest.historyDigest == other.digest.historyDigest;
+}
+
+// Constructor
+AccountCache::AccountCache(size_t budget, string pagesFileName, string slotFileName, bool prefetch)
+    : budgetBytes(budget), usedBytes(0), clockHand(0), pinCursor(0), pagesName(pagesFileName),
+      slotReader(slotFileName), slotReaderOpen(false), pageFileBytes(0), liveBytes(0), generation(1),
+      stopping(false), prefetchEnabled(prefetch) {
+    for (auto& index : pinned) {
+        index = -1;
+    }
+}
+
+// Stop the fetch thread and remove the page file
+AccountCache::~AccountCache() {
+    stopFetcher();
+    pages.close();
+    ::remove(pagesName.c_str());
+}
+
+// Slot record for an account, including its limits and today's withdrawals
+AccountRecord AccountCache::recordFor(const BankAccount& account) {
+    AccountRecord record = LedgerFile::makeRecord(account.getAccountNumber(), account.getAccountHolderName(),
+                                                  account.getBalance(), account.getAccountType(),
+                                                  account.getClosedAt());
+    const SpendingControls& controls = account.getControls();
+    record.overdraftLimit = controls.overdraftLimit;
+    record.dailyLimit = controls.dailyLimit;
+    record.withdrawnToday = controls.withdrawnToday;
+    record.withdrawalDay = controls.withdrawalDay;
+    record.currency = Currency::toStored(account.getCurrency());
+    return record;
+}
+
+// The record recordFor() gives for the account built from this one: the
+// name zero-padded, the type and currency clamped to known values
+AccountRecord AccountCache::normalizedRecord(const AccountRecord& record) {
+    AccountRecord normalized = LedgerFile::makeRecord(record.accountNumber, slotName(record), record.balance,
+                                                      slotType(record.accountType), record.closedAt);
+    normalized.overdraftLimit = record.overdraftLimit;
+    normalized.dailyLimit = record.dailyLimit;
+    normalized.withdrawnToday = record.withdrawnToday;
+    normalized.withdrawalDay = record.withdrawalDay;
+    normalized.currency = Currency::toStored(Currency::fromStored(record.currency));
+    return normalized;
+}
+
+// Account as loaded from a slot record (history rebuilt, not yet rebased)
+BankAccount AccountCache::accountFromRecord(const AccountRecord& record) {
+    BankAccount account(record.accountNumber, slotName(record), record.balance, slotType(record.accountType),
+                        Currency::fromStored(record.currency));
+    account.setLimits(record.overdraftLimit, record.dailyLimit);
+    account.restoreUsage(record.withdrawnToday, record.withdrawalDay);
+    if (record.closedAt != 0) {
+        account.close(static_cast<time_t>(record.closedAt));
+    }
+    return account;
+}
+
+// Record hash and history digest of an account as it stands
+SlotDigest AccountCache::digestOf(const BankAccount& account) {
+    SlotDigest digest = { recordHash(recordFor(account)), account.getHistory().getDigest() };
+    return digest;
+}
+
+// Bytes an account is charged against the budget
+size_t AccountCache::footprint(const BankAccount& account) {
+    return sizeof(Frame) + account.getHistory().memoryBytes();
+}
+
+// Forget every account and start an empty page file
+bool AccountCache::clear() {
+    {
+        lock_guard<mutex> lock(fetchMutex);
+        fetchQueue.clear();
+        staged.clear();
+        stagedOrder.clear();
+    }
+    {
+        lock_guard<mutex> lock(ioMutex);
+        pages.close();
+        pages.clear();
+        pages.open(pagesName, ios::in | ios::out | ios::binary | ios::trunc);
+        slotReader.close();
+        slotReaderOpen = false;
+        generation++;
+    }
+    homes.clear();
+    frames.clear();
+    freeFrames.clear();
+    usedBytes = 0;
+    clockHand = 0;
+    for (auto& index : pinned) {
+        index = -1;
+    }
+    pageFileBytes = 0;
+    liveBytes = 0;
+    stats = AccountCacheStats();
+    if (!pages.is_open()) {
+        lastError = "could not open " + pagesName;
+        return false;
+    }
+    return true;
+}
+
+// Register an account that stays in its slot until it is first used
+void AccountCache::addCold(SlotDigest digest) {
+    AccountHome home;
+    home.digest = digest;
+    homes.push_back(home);
+}
+
+// Register a new account, resident from the start
+BankAccount* AccountCache::add(const BankAccount& account) {
+    homes.push_back(AccountHome());
+    SlotDigest none = { 0, 0 };
+    return install(homes.size() - 1, account, none);
+}
+
+// Drop the account at position (its frame and page are freed) and move
+// the last account into its place, as the shard does with its columns
+void AccountCache::remove(size_t position) {
+    AccountHome& home = homes[position];
+    if (home.frame >= 0) {
+        Frame& frame = frames[static_cast<size_t>(home.frame)];
+        usedBytes -= frame.bytes;
+        frame.account.reset();
+        freeFrames.push_back(home.frame);
+    }
+    discardPage(home);
+    size_t last = homes.size() - 1;
+    if (position != last) {
+        homes[position] = homes[last];
+        if (homes[position].frame >= 0) {
+            frames[static_cast<size_t>(homes[position].frame)].position = position;
+        }
+    }
+    homes.pop_back();
+}
+
+// Location of a cold account's copy on disk
+PageAddress AccountCache::addressOf(size_t position, int slot) const {
+    const AccountHome& home = homes[position];
+    PageAddress address;
+    address.generation = generation.load();
+    address.pageOffset = home.pageOffset;
+    address.pageBytes = home.pageBytes;
+    address.slot = slot;
+    address.digest = home.digest;
+    return address;
+}
+
+// Resident account at position, read in from disk if it is cold
+BankAccount* AccountCache::get(size_t position, int slot) {
+    const AccountHome& home = homes[position];
+    if (home.frame >= 0) {
+        stats.hits++;
+        Frame& frame = frames[static_cast<size_t>(home.frame)];
+        frame.referenced = true;
+        pin(home.frame);
+        return &*frame.account;
+    }
+    stats.misses++;
+    PageAddress address = addressOf(position, slot);
+    optional<BankAccount> account;
+    if (takePrefetched(position, address, account)) {
+        stats.prefetchHits++;
+    } else if (!readAt(address, true, account)) {
+        stats.readFailures++;
+        lastError = "could not read the account in slot " + to_string(slot);
+        return nullptr;
+    }
+    return install(position, move(*account), address.digest);
+}
+
+// Resident account at position, or nullptr if it is cold
+const BankAccount* AccountCache::resident(size_t position) const {
+    const AccountHome& home = homes[position];
+    return home.frame >= 0 ? &*frames[static_cast<size_t>(home.frame)].account : nullptr;
+}
+
+// Hashes of the account's copy on disk
+const SlotDigest& AccountCache::getDigest(size_t position) const {
+    return homes[position].digest;
+}
+
+// Recharge a resident account after its history changed size
+void AccountCache::resize(size_t position) {
+    const AccountHome& home = homes[position];
+    if (home.frame >= 0) {
+        Frame& frame = frames[static_cast<size_t>(home.frame)];
+        usedBytes -= frame.bytes;
+        frame.bytes = footprint(*frame.account);
+        usedBytes += frame.bytes;
+    }
+}
+
+// Put an account in a frame, evicting others first to make room for it
+BankAccount* AccountCache::install(size_t position, BankAccount account, SlotDigest loaded) {
+    size_t bytes = footprint(account);
+    makeRoom(bytes);
+    int32_t index;
+    if (!freeFrames.empty()) {
+        index = freeFrames.back();
+        freeFrames.pop_back();
+    } else {
+        index = static_cast<int32_t>(frames.size());
+        frames.emplace_back();
+    }
+    Frame& frame = frames[static_cast<size_t>(index)];
+    frame.account.emplace(move(account));
+    frame.position = position;
+    frame.loaded = loaded;
+    frame.loadedHeld = frame.account->getControls().heldAmount;
+    frame.referenced = true;
+    frame.bytes = bytes;
+    usedBytes += frame.bytes;
+    homes[position].frame = index;
+    pin(index);
+    return &*frame.account;
+}
+
+// Remember a frame as one of the last few looked up
+void AccountCache::pin(int32_t index) {
+    if (pinned[(pinCursor + PINNED_LOOKUPS - 1) % PINNED_LOOKUPS] == index) {
+        return;  // Already the latest
+    }
+    pinned[pinCursor] = index;
+    pinCursor = (pinCursor + 1) % PINNED_LOOKUPS;
+}
+
+// Evict until an account of incoming bytes fits the budget, then compact the
+// page file if most of it is dead
+void AccountCache::makeRoom(size_t incoming) {
+    while (usedBytes > 0 && usedBytes + incoming > budgetBytes) {
+        int32_t victim = pickVictim();
+        if (victim < 0 || !evict(victim)) {
+            break;  // Everything left is pinned, or a page could not be written
+        }
+    }
+    if (pageFileBytes > COMPACT_MIN_BYTES && pageFileBytes > 2 * liveBytes) {
+        compactPages();
+    }
+}
+
+// Advance the CLOCK hand to a frame not referenced since it last passed,
+// clearing reference bits on the way (-1 if every frame is pinned)
+int32_t AccountCache::pickVictim() {
+    size_t count = frames.size();
+    for (size_t step = 0; count > 0 && step <= 2 * count; step++) {
+        size_t index = clockHand;
+        clockHand = (clockHand + 1) % count;
+        Frame& frame = frames[index];
+        if (!frame.account) {
+            continue;
+        }
+        bool isPinned = false;
+        for (int32_t pinnedIndex : pinned) {
+            isPinned = isPinned || pinnedIndex == static_cast<int32_t>(index);
+        }
+        if (isPinned) {
+            continue;
+        }
+        if (frame.referenced) {
+            frame.referenced = false;
+            continue;
+        }
+        return static_cast<int32_t>(index);
+    }
+    return -1;
+}
+
+// Evict one frame, first writing its account to a page if it changed
+// since it was read. False (and the account kept) if the write failed.
+bool AccountCache::evict(int32_t index) {
+    Frame& frame = frames[static_cast<size_t>(index)];
+    const BankAccount& account = *frame.account;
+    AccountRecord record = recordFor(account);
+    SlotDigest digest = { recordHash(record), account.getHistory().getDigest() };
+    if (digest.recordHash != frame.loaded.recordHash || digest.historyDigest != frame.loaded.historyDigest ||
+        account.getControls().heldAmount != frame.loadedHeld) {
+        if (!writePage(frame.position, record, account, digest)) {
+            stats.writeFailures++;
+            frame.referenced = true;
+            return false;
+        }
+        stats.writeBacks++;
+    }
+    usedBytes -= frame.bytes;
+    homes[frame.position].frame = -1;
+    frame.account.reset();
+    freeFrames.push_back(index);
+    stats.evictions++;
+    return true;
+}
+
+// Append an account's page: slot record, held amount, history. The
+// account's previous page, if any, becomes dead space.
+bool AccountCache::writePage(size_t position, const AccountRecord& record, const BankAccount& account,
+                             SlotDigest digest) {
+    vector<uint8_t> bytes(PAGE_HEADER_BYTES);
+    double held = account.getControls().heldAmount;
+    memcpy(bytes.data(), &record, sizeof(record));
+    memcpy(bytes.data() + sizeof(record), &held, sizeof(held));
+    account.getHistory().save(bytes);
+    {
+        lock_guard<mutex> lock(ioMutex);
+        pages.clear();
+        pages.seekp(pageFileBytes);
+        pages.write(reinterpret_cast<const char*>(bytes.data()), static_cast<streamsize>(bytes.size()));
+        if (!pages) {
+            lastError = "could not write " + pagesName;
+            return false;
+        }
+    }
+    AccountHome& home = homes[position];
+    discardPage(home);
+    home.pageOffset = pageFileBytes;
+    home.pageBytes = static_cast<uint32_t>(bytes.size());
+    home.digest = digest;
+    pageFileBytes += static_cast<int64_t>(bytes.size());
+    liveBytes += static_cast<int64_t>(bytes.size());
+    return true;
+}
+
+// Forget an account's page (its slot is not current; a page replaces it)
+void AccountCache::discardPage(AccountHome& home) {
+    if (home.pageOffset >= 0) {
+        liveBytes -= home.pageBytes;
+        home.pageOffset = -1;
+        home.pageBytes = 0;
+    }
+}
+
+// Copy the live pages into a new file and swap it in. Offsets are only
+// changed once the new file is in place, so a failure leaves the old one.
+bool AccountCache::compactPages() {
+    string compactName = pagesName + ".compact";
+    vector<int64_t> offsets(homes.size(), -1);
+    lock_guard<mutex> lock(ioMutex);
+    fstream compacted(compactName, ios::in | ios::out | ios::binary | ios::trunc);
+    int64_t written = 0;
+    vector<char> buffer;
+    for (size_t position = 0; position < homes.size() && compacted; position++) {
+        const AccountHome& home = homes[position];
+        if (home.pageOffset < 0) {
+            continue;
+        }
+        buffer.resize(home.pageBytes);
+        pages.clear();
+        pages.seekg(home.pageOffset);
+        pages.read(buffer.data(), static_cast<streamsize>(buffer.size()));
+        if (!pages) {
+            compacted.setstate(ios::failbit);
+            break;
+        }
+        compacted.write(buffer.data(), static_cast<streamsize>(buffer.size()));
+        offsets[position] = written;
+        written += static_cast<int64_t>(buffer.size());
+    }
+    compacted.close();
+    if (!compacted) {
+        ::remove(compactName.c_str());
+        return false;
+    }
+    pages.close();
+    if (rename(compactName.c_str(), pagesName.c_str()) != 0) {
+        ::remove(compactName.c_str());
+        pages.clear();
+        pages.open(pagesName, ios::in | ios::out | ios::binary);
+        return false;
+    }
+    pages.clear();
+    pages.open(pagesName, ios::in | ios::out | ios::binary);
+    for (size_t position = 0; position < homes.size(); position++) {
+        if (offsets[position] >= 0) {
+            homes[position].pageOffset = offsets[position];
+        }
+    }
+    pageFileBytes = written;
+    liveBytes = written;
+    generation++;
+    stats.compactions++;
+    return true;
+}
+
+// Read a copy from disk and check it against the hashes it was written
+// with, so a slot changed behind the ledger's back is not taken in.
+// Fails if the copy moved since the address was taken.
+bool AccountCache::readAt(const PageAddress& address, bool withHistory, optional<BankAccount>& account) const {
+    AccountRecord record;
+    vector<uint8_t> bytes;
+    {
+        lock_guard<mutex> lock(ioMutex);
+        if (address.generation != generation.load()) {
+            return false;
+        }
+        if (address.pageOffset >= 0) {
+            if (address.pageBytes < PAGE_HEADER_BYTES) {
+                return false;
+            }
+            bytes.resize(withHistory ? address.pageBytes : PAGE_HEADER_BYTES);
+            pages.clear();
+            pages.seekg(address.pageOffset);
+            pages.read(reinterpret_cast<char*>(bytes.data()), static_cast<streamsize>(bytes.size()));
+            if (!pages) {
+                return false;
+            }
+        } else {
+            if (!slotReaderOpen) {
+                LedgerHeader header;
+                slotReaderOpen = slotReader.readHeader(header);
+            }
+            if (!slotReaderOpen || !slotReader.readSlots(address.slot, 1, &record)) {
+                return false;
+            }
+        }
+    }
+
+    if (address.pageOffset < 0) {
+        record = normalizedRecord(record);
+        if (recordHash(record) != address.digest.recordHash) {
+            return false;
+        }
+        account.emplace(accountFromRecord(record));
+        account->rebaseHistory(address.digest.historyDigest);
+        return true;
+    }
+    double held = 0.0;
+    memcpy(&record, bytes.data(), sizeof(record));
+    memcpy(&held, bytes.data() + sizeof(record), sizeof(held));
+    if (recordHash(record) != address.digest.recordHash) {
+        return false;
+    }
+    account.emplace(accountFromRecord(record));
+    account->addHold(held);
+    if (withHistory) {
+        TransactionHistory history;
+        if (!history.restore(bytes, PAGE_HEADER_BYTES) || history.getDigest() != address.digest.historyDigest) {
+            account.reset();
+            return false;
+        }
+        account->restoreHistory(move(history));
+    }
+    return true;
+}
+
+// Copy of a cold account, not cached
+bool AccountCache::read(size_t position, int slot, bool withHistory, optional<BankAccount>& account) const {
+    return readAt(addressOf(position, slot), withHistory, account);
+}
+
+// Slot record of a cold account, as a checkpoint writes it
+bool AccountCache::readRecord(size_t position, int slot, AccountRecord& record) const {
+    optional<BankAccount> account;
+    if (!read(position, slot, false, account)) {
+        return false;
+    }
+    record = recordFor(*account);
+    return true;
+}
+
+// Queue a cold account for the fetch thread (dropped if the queue is full)
+void AccountCache::prefetch(size_t position, int slot) {
+    if (!prefetchEnabled || homes[position].frame >= 0) {
+        return;
+    }
+    if (!fetcher.joinable()) {
+        fetcher = thread(&AccountCache::fetchLoop, this);
+    }
+    PageAddress address = addressOf(position, slot);
+    lock_guard<mutex> lock(fetchMutex);
+    auto it = staged.find(position);
+    if (fetchQueue.size() >= FETCH_QUEUE_LIMIT || (it != staged.end() && it->second.address == address)) {
+        return;
+    }
+    fetchQueue.push_back(Fetch{ position, address });
+    stats.prefetchesQueued++;
+    fetchReady.notify_one();
+}
+
+// Take a prefetched copy if it is still the account's current one
+bool AccountCache::takePrefetched(size_t position, const PageAddress& address, optional<BankAccount>& account) {
+    if (!fetcher.joinable()) {
+        return false;
+    }
+    lock_guard<mutex> lock(fetchMutex);
+    auto it = staged.find(position);
+    if (it == staged.end()) {
+        return false;
+    }
+    bool current = it->second.address == address;
+    if (current) {
+        account.emplace(move(it->second.account));
+    }
+    staged.erase(it);
+    return current;
+}
+
+// Fetch thread: read queued accounts and stage them, keeping at most
+// STAGED_LIMIT (the oldest go first)
+void AccountCache::fetchLoop() {
+    unique_lock<mutex> lock(fetchMutex);
+    while (true) {
+        fetchReady.wait(lock, [this] { return stopping || !fetchQueue.empty(); });
+        if (stopping) {
+            return;
+        }
+        Fetch fetch = fetchQueue.front();
+        fetchQueue.pop_front();
+        lock.unlock();
+        optional<BankAccount> account;
+        bool read = readAt(fetch.address, true, account);
+        lock.lock();
+        if (!read) {
+            continue;
+        }
+        staged.erase(fetch.position);
+        staged.emplace(fetch.position, Staged{ fetch.address, move(*account) });
+        stagedOrder.push_back(fetch.position);
+        while (stagedOrder.size() > STAGED_LIMIT) {
+            staged.erase(stagedOrder.front());
+            stagedOrder.pop_front();
+        }
+    }
+}
+
+// Stop the fetch thread, dropping whatever it had not done
+void AccountCache::stopFetcher() {
+    {
+        lock_guard<mutex> lock(fetchMutex);
+        stopping = true;
+    }
+    fetchReady.notify_all();
+    if (fetcher.joinable()) {
+        fetcher.join();
+    }
+    stopping = false;
+}
+
+// Copies on disk moved: reopen the slot file and drop prefetched copies
+void AccountCache::invalidate() {
+    {
+        lock_guard<mutex> lock(ioMutex);
+        slotReader.close();
+        slotReaderOpen = false;
+        generation++;
+    }
+    lock_guard<mutex> lock(fetchMutex);
+    fetchQueue.clear();
+    staged.clear();
+    stagedOrder.clear();
+}
+
+// Call visit for each resident account, in no particular order
+void AccountCache::forEachResident(const function<void(const BankAccount&)>& visit) const {
+    for (const auto& frame : frames) {
+        if (frame.account) {
+            visit(*frame.account);
+        }
+    }
+}
+
+// Counters and sizes as they stand
+AccountCacheStats AccountCache::getStats() const {
+    AccountCacheStats current = stats;
+    current.residentAccounts = frames.size() - freeFrames.size();
+    current.residentBytes = usedBytes;
+    current.budgetBytes = budgetBytes;
+    current.pageFileBytes = pageFileBytes;
+    current.livePageBytes = liveBytes;
+    return current;
+}
+
+// Reason for the last failed read or write
+const string& AccountCache::getError() const {
+    return lastError;
+}
@@ -0,0 +1,193 @@
+#ifndef ACCOUNTCACHE_H
+#define ACCOUNTCACHE_H
+
+#include "BankAccount.h"
+#include "LedgerFile.h"
+#include "MerkleTree.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <optional>
+#include <functional>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+// Where one account of a shard lives, in the shard's account order. A
+// resident account is in a cache frame; a cold one is read back from its
+// page if it has one, or else from its slot, which is then current for it.
+struct AccountHome {
+    int64_t pageOffset = -1;    // -1 = no page: the slot file holds the account
+    uint32_t pageBytes = 0;
+    int32_t frame = -1;         // Cache frame while resident
+    SlotDigest digest = {0, 0}; // Record hash and history digest of the copy on disk
+};
+
+// A cold account's copy on disk as of one file generation. A prefetched
+// copy is only used if the account has not moved since it was read.
+struct PageAddress {
+    uint64_t generation = 0;
+    int64_t pageOffset = -1;
+    uint32_t pageBytes = 0;
+    int32_t slot = -1;
+    SlotDigest digest = {0, 0};
+
+    bool operator==(const PageAddress& other) const;
+};
+
+// Counters since the cache was last cleared (at load)
+struct AccountCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;            // Read from disk, prefetched or not
+    uint64_t prefetchHits = 0;      // Misses served by the fetch thread
+    uint64_t prefetchesQueued = 0;
+    uint64_t evictions = 0;
+    uint64_t writeBacks = 0;        // Evicted accounts that had changed since they were read
+    uint64_t readFailures = 0;
+    uint64_t writeFailures = 0;
+    uint64_t compactions = 0;
+    size_t residentAccounts = 0;
+    size_t residentBytes = 0;
+    size_t budgetBytes = 0;
+    int64_t pageFileBytes = 0;
+    int64_t livePageBytes = 0;
+};
+
+// Bounded-memory account store for one shard. Accounts are kept in a
+// fixed byte budget of frames, evicted by CLOCK (a reference bit per
+// frame, cleared as the hand passes). An evicted account that changed
+// since it was read is written to a page at the end of a scratch page
+// file: its slot record, its held amount and its whole history, so it
+// comes back exactly as it left. The page file is scratch, emptied at
+// load and removed at exit; the slot file and journal stay the ledger of
+// record, and a checkpoint writes cold accounts' slots from their pages.
+//
+// Callers hold the shard lock, except for read(), which only reads files
+// and may run on several threads at once. get() hands out pointers into
+// frames, so the frames of the last PINNED_LOOKUPS lookups are never
+// evicted; a caller may hold that many accounts at once.
+//
+// prefetch() queues a cold account for a background fetch thread, which
+// reads and parses it into a staging area; the next lookup takes it from
+// there instead of reading it.
+class AccountCache {
+public:
+    static const size_t PINNED_LOOKUPS = 8;
+
+private:
+    static const size_t FETCH_QUEUE_LIMIT = 4096;
+    static const size_t STAGED_LIMIT = 4096;
+    static const int64_t COMPACT_MIN_BYTES = 64LL * 1024 * 1024;
+
+    struct Frame {
+        optional<BankAccount> account;
+        size_t position = 0;
+        size_t bytes = 0;
+        SlotDigest loaded = {0, 0};   // As read; {0, 0} for a new account, so it is always written
+        double loadedHeld = 0.0;
+        bool referenced = false;
+    };
+
+    struct Fetch {
+        size_t position;
+        PageAddress address;
+    };
+
+    struct Staged {
+        PageAddress address;
+        BankAccount account;
+    };
+
+    size_t budgetBytes;
+    size_t usedBytes;
+    vector<AccountHome> homes;            // Parallel to the shard's accounts
+    deque<Frame> frames;                  // Never shrinks, so frame pointers stay valid
+    vector<int32_t> freeFrames;
+    size_t clockHand;
+    int32_t pinned[PINNED_LOOKUPS];
+    size_t pinCursor;
+    AccountCacheStats stats;
+    string lastError;
+
+    // Files, guarded by ioMutex (the fetch thread reads them too)
+    string pagesName;
+    mutable fstream pages;
+    mutable LedgerFile slotReader;
+    mutable bool slotReaderOpen;
+    mutable mutex ioMutex;
+    int64_t pageFileBytes;
+    int64_t liveBytes;
+    atomic<uint64_t> generation;          // Bumped whenever copies on disk move
+
+    // Fetch thread, started at the first prefetch
+    thread fetcher;
+    mutex fetchMutex;
+    condition_variable fetchReady;
+    deque<Fetch> fetchQueue;
+    unordered_map<size_t, Staged> staged;
+    deque<size_t> stagedOrder;
+    bool stopping;
+    bool prefetchEnabled;
+
+    PageAddress addressOf(size_t position, int slot) const;
+    bool readAt(const PageAddress& address, bool withHistory, optional<BankAccount>& account) const;
+    bool takePrefetched(size_t position, const PageAddress& address, optional<BankAccount>& account);
+    BankAccount* install(size_t position, BankAccount account, SlotDigest loaded);
+    void makeRoom(size_t incoming);
+    int32_t pickVictim();
+    bool evict(int32_t index);
+    bool writePage(size_t position, const AccountRecord& record, const BankAccount& account, SlotDigest digest);
+    void discardPage(AccountHome& home);
+    bool compactPages();
+    void pin(int32_t index);
+    void stopFetcher();
+    void fetchLoop();
+    static size_t footprint(const BankAccount& account);
+
+public:
+    // Constructor: budget in bytes and the scratch page file to use
+    AccountCache(size_t budget, string pagesFileName, string slotFileName, bool prefetch);
+    ~AccountCache();
+
+    AccountCache(const AccountCache&) = delete;
+    AccountCache& operator=(const AccountCache&) = delete;
+
+    // Forget every account and empty the page file (before a load)
+    bool clear();
+    void addCold(SlotDigest digest);                  // Next account is in its slot, not read yet
+    BankAccount* add(const BankAccount& account);     // Next account is new and resident
+    void remove(size_t position);                     // Last account moves into position
+
+    // Lookup. get() reads a cold account in, evicting others to make room
+    // (nullptr if it could not be read); resident() never reads.
+    BankAccount* get(size_t position, int slot);
+    const BankAccount* resident(size_t position) const;
+    const SlotDigest& getDigest(size_t position) const;   // Copy on disk (current for a cold account)
+    void resize(size_t position);                     // A resident account grew or shrank
+    void prefetch(size_t position, int slot);
+
+    // Copies of a cold account without caching it; without history only
+    // the slot record's fields (and held amount) are filled in
+    bool read(size_t position, int slot, bool withHistory, optional<BankAccount>& account) const;
+    bool readRecord(size_t position, int slot, AccountRecord& record) const;
+
+    void invalidate();                                // Slots were renumbered or the slot file replaced
+    void forEachResident(const function<void(const BankAccount&)>& visit) const;
+    AccountCacheStats getStats() const;
+    const string& getError() const;
+
+    // Slot records and the accounts built from them, shared with the
+    // shard's load so a cold account reads back as a loaded one would
+    static AccountRecord recordFor(const BankAccount& account);
+    static AccountRecord normalizedRecord(const AccountRecord& record);
+    static BankAccount accountFromRecord(const AccountRecord& record);
+    static SlotDigest digestOf(const BankAccount& account);
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include "AccountNumberAllocator.h"
+#include <iostream>
+#include <fstream>
+#include <climits>
+#include <unordered_set>
+
+using namespace std;
+
+// Constructor
+AccountNumberAllocator::AccountNumberAllocator(string retiredFile, int32_t firstNumber)
+    : next(firstNumber), highWater(firstNumber), persistPending(false), reserveChunk(64),
+      reuseRetired(false), quarantineDays(90), retiredCount(0), retiredFileName(retiredFile) {}
+
+// Apply settings
+void AccountNumberAllocator::configure(int32_t chunk, bool reuse, int quarantine) {
+    reserveChunk = chunk > 0 ? chunk : 1;
+    reuseRetired = reuse;
+    quarantineDays = quarantine >= 0 ? quarantine : 0;
+}
+
+// Move the high-water mark past a reserved range if needed
+void AccountNumberAllocator::extendHighWater(int64_t reservedEnd) {
+    int64_t mark = highWater.load();
+    while (reservedEnd > mark) {
+        int64_t wanted = reservedEnd + reserveChunk;
+        if (wanted > static_cast<int64_t>(INT32_MAX) + 1) {
+            wanted = static_cast<int64_t>(INT32_MAX) + 1;
+        }
+        if (highWater.compare_exchange_weak(mark, wanted)) {
+            persistPending = true;
+            return;
+        }
+    }
+}
+
+// Pop the oldest retired number if its quarantine has ended
+int32_t AccountNumberAllocator::takeRetired() {
+    lock_guard<mutex> lock(retiredMutex);
+    if (retired.empty()) {
+        return -1;
+    }
+    time_t releaseTime = retired.front().retiredAt + static_cast<time_t>(quarantineDays) * 86400;
+    if (releaseTime > time(0)) {
+        return -1;
+    }
+    int32_t number = retired.front().number;
+    retired.pop_front();
+    retiredCount = retired.size();
+    return number;
+}
+
+// Allocate one account number
+int32_t AccountNumberAllocator::allocate() {
+    // Fast path is a single atomic increment; the retired queue is only
+    // consulted when reuse is enabled and something is waiting in it
+    if (reuseRetired && retiredCount.load(memory_order_relaxed) > 0) {
+        int32_t reused = takeRetired();
+        if (reused != -1) {
+            saveRetired();
+            return reused;
+        }
+    }
+    
+    int64_t number = next.fetch_add(1);
+    if (number > INT32_MAX) {
+        next.store(static_cast<int64_t>(INT32_MAX) + 1);
+        return -1;
+    }
+    extendHighWater(number + 1);
+    return static_cast<int32_t>(number);
+}
+
+// Retire the number of a deleted account. The append happens under the
+// mutex too, so it cannot land after a saveRetired() rewrite that already
+// holds the number and list it twice.
+void AccountNumberAllocator::retire(int32_t number) {
+    RetiredNumber entry;
+    entry.number = number;
+    entry.retiredAt = time(0);
+    lock_guard<mutex> lock(retiredMutex);
+    retired.push_back(entry);
+    retiredCount = retired.size();
+    
+    // Appending keeps retirement O(1) on disk
+    ofstream outFile(retiredFileName, ios::app);
+    if (!outFile) {
+        cerr << "Error: Could not open retired numbers file for saving!" << endl;
+        return;
+    }
+    outFile << entry.number << " " << static_cast<long long>(entry.retiredAt) << endl;
+}
+
+size_t AccountNumberAllocator::getRetiredCount() const {
+    return retiredCount.load();
+}
+
+// Resume numbering from the value stored in the data file header
+void AccountNumberAllocator::restore(int32_t persistedMark) {
+    next = persistedMark;
+    highWater = persistedMark;
+    persistPending = false;
+}
+
+int32_t AccountNumberAllocator::getHighWater() const {
+    return static_cast<int32_t>(highWater.load() > INT32_MAX ? INT32_MAX : highWater.load());
+}
+
+int32_t AccountNumberAllocator::peekNext() const {
+    return static_cast<int32_t>(next.load() > INT32_MAX ? INT32_MAX : next.load());
+}
+
+bool AccountNumberAllocator::takePersistRequest() {
+    return persistPending.exchange(false);
+}
+
+// Pull the mark back to the next unused number
+void AccountNumberAllocator::trimHighWater() {
+    int64_t current = next.load();
+    if (highWater.exchange(current) != current) {
+        persistPending = true;
+    }
+}
+
+// Load retired numbers (a number listed twice is kept once)
+bool AccountNumberAllocator::loadRetired() {
+    ifstream inFile(retiredFileName);
+    if (!inFile) {
+        return false;
+    }
+    lock_guard<mutex> lock(retiredMutex);
+    retired.clear();
+    unordered_set<int32_t> seen;
+    RetiredNumber entry;
+    long long retiredAt;
+    while (inFile >> entry.number >> retiredAt) {
+        entry.retiredAt = static_cast<time_t>(retiredAt);
+        if (seen.insert(entry.number).second) {
+            retired.push_back(entry);
+        }
+    }
+    retiredCount = retired.size();
+    return true;
+}
+
+// Rewrite the retired numbers file (after a number was reissued)
+bool AccountNumberAllocator::saveRetired() {
+    lock_guard<mutex> lock(retiredMutex);
+    ofstream outFile(retiredFileName, ios::trunc);
+    if (!outFile) {
+        cerr << "Error: Could not open retired numbers file for saving!" << endl;
+        return false;
+    }
+    for (const auto& entry : retired) {
+        outFile << entry.number << " " << static_cast<long long>(entry.retiredAt) << endl;
+    }
+    return true;
+}
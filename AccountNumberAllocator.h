@@ -0,0 +1,64 @@
+#ifndef ACCOUNTNUMBERALLOCATOR_H
+#define ACCOUNTNUMBERALLOCATOR_H
+
+#include <string>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <ctime>
+
+using namespace std;
+
+// Hands out account numbers without locking. The persisted value is a
+// high-water mark kept one chunk ahead of the numbers in use, so the
+// data file header only needs rewriting once per chunk. After a crash
+// numbering resumes at the mark (skipping at most one chunk); a clean
+// shutdown trims the mark back so no numbers are skipped.
+class AccountNumberAllocator {
+private:
+    struct RetiredNumber {
+        int32_t number;
+        time_t retiredAt;
+    };
+
+    atomic<int64_t> next;           // 64-bit so overflow past INT32_MAX is detectable
+    atomic<int64_t> highWater;      // Everything below this is covered by the header
+    atomic<bool> persistPending;
+    int32_t reserveChunk;
+
+    // Retired numbers, oldest first (only touched on delete and when reuse is on)
+    bool reuseRetired;
+    int quarantineDays;
+    atomic<size_t> retiredCount;
+    deque<RetiredNumber> retired;
+    mutex retiredMutex;
+    string retiredFileName;
+
+    int32_t takeRetired();
+    void extendHighWater(int64_t reservedEnd);
+
+public:
+    // Constructor
+    AccountNumberAllocator(string retiredFile, int32_t firstNumber = 1001);
+
+    void configure(int32_t chunk, bool reuse, int quarantine);
+
+    // Allocation (returns -1 when the number space is exhausted)
+    int32_t allocate();
+
+    // Retirement of deleted numbers
+    void retire(int32_t number);
+    size_t getRetiredCount() const;
+
+    // Persistence
+    void restore(int32_t persistedMark);
+    int32_t getHighWater() const;
+    int32_t peekNext() const;
+    bool takePersistRequest();      // True once after the mark moves
+    void trimHighWater();           // Called on clean shutdown
+    bool loadRetired();
+    bool saveRetired();
+};
+
+#endif
@@ -0,0 +1,312 @@
+#include "AuditLog.h"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
+
+using namespace std;
+
+// Constructor
+AuditLog::AuditLog(string base)
+    : ring(new Cell[RING_SIZE]), enqueuePos(0), dequeuePos(0), droppedCount(0), writtenCount(0),
+      baseName(base), maxFileBytes(1024 * 1024), maxFiles(5), running(false) {
+    for (size_t i = 0; i < RING_SIZE; i++) {
+        ring[i].sequence.store(i, memory_order_relaxed);
+    }
+}
+
+// Destructor: write out everything still queued
+AuditLog::~AuditLog() {
+    stop();
+    delete[] ring;
+}
+
+void AuditLog::configure(size_t maxBytes, int files) {
+    maxFileBytes = maxBytes > 0 ? maxBytes : 1024 * 1024;
+    maxFiles = files > 0 ? files : 1;
+}
+
+// Start the background writer
+void AuditLog::start() {
+    if (running.exchange(true)) {
+        return;
+    }
+    writer = thread(&AuditLog::writerLoop, this);
+}
+
+// Stop the writer after a final drain
+void AuditLog::stop() {
+    if (!running.exchange(false)) {
+        return;
+    }
+    writer.join();
+    drain();
+}
+
+// Write out everything queued so far (used before queries)
+void AuditLog::flush() {
+    drain();
+}
+
+// Copy a string into a fixed field, truncating if needed
+static void copyField(char* field, size_t size, string_view value) {
+    size_t length = value.size() < size - 1 ? value.size() : size - 1;
+    memcpy(field, value.data(), length);
+    field[length] = '\0';
+}
+
+// Multi-producer enqueue (bounded MPMC queue by D. Vyukov)
+void AuditLog::log(string_view user, AuditAction action, int account, double amount,
+                   bool success, int targetAccount, string_view detail) {
+    size_t pos = enqueuePos.load(memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+        cell = &ring[pos & (RING_SIZE - 1)];
+        size_t sequence = cell->sequence.load(memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+        if (diff == 0) {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Ring is full: never block the caller, count the loss instead
+            droppedCount.fetch_add(1, memory_order_relaxed);
+            return;
+        } else {
+            pos = enqueuePos.load(memory_order_relaxed);
+        }
+    }
+    
+    AuditRecord& record = cell->record;
+    record.timestampMs = chrono::duration_cast<chrono::milliseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+    copyField(record.user, sizeof(record.user), user);
+    copyField(record.detail, sizeof(record.detail), detail);
+    record.action = action;
+    record.account = account;
+    record.targetAccount = targetAccount;
+    record.success = success ? 1 : 0;
+    record.amount = amount;
+    cell->sequence.store(pos + 1, memory_order_release);
+}
+
+// Single-consumer dequeue
+bool AuditLog::tryPop(AuditRecord& record) {
+    Cell* cell = &ring[dequeuePos & (RING_SIZE - 1)];
+    size_t sequence = cell->sequence.load(memory_order_acquire);
+    if (sequence != dequeuePos + 1) {
+        return false;
+    }
+    record = cell->record;
+    cell->sequence.store(dequeuePos + RING_SIZE, memory_order_release);
+    dequeuePos++;
+    return true;
+}
+
+string AuditLog::fileName(int index) const {
+    if (index == 0) {
+        return baseName + ".log";
+    }
+    return baseName + "." + to_string(index) + ".log";
+}
+
+// Shift audit.log -> audit.1.log -> ... (the oldest file is dropped)
+void AuditLog::rotate() {
+    remove(fileName(maxFiles - 1).c_str());
+    for (int i = maxFiles - 2; i >= 0; i--) {
+        rename(fileName(i).c_str(), fileName(i + 1).c_str());
+    }
+}
+
+// Escape a string for JSON output
+static string jsonEscape(const char* text) {
+    string escaped;
+    for (const char* c = text; *c; c++) {
+        if (static_cast<unsigned char>(*c) < 0x20) {
+            // Control characters (tab, newline, ...) are not allowed raw in a JSON string
+            char code[7];
+            snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned char>(*c));
+            escaped += code;
+            continue;
+        }
+        if (*c == '"' || *c == '\\') {
+            escaped += '\\';
+        }
+        escaped += *c;
+    }
+    return escaped;
+}
+
+// Move queued records to disk; returns the number written
+size_t AuditLog::drain() {
+    lock_guard<mutex> lock(drainMutex);
+    AuditRecord record;
+    if (!tryPop(record)) {
+        return 0;
+    }
+    
+    ofstream outFile(fileName(0), ios::app);
+    if (!outFile) {
+        cerr << "Error: Could not open audit log for writing!" << endl;
+        return 0;
+    }
+    outFile.seekp(0, ios::end);
+    
+    size_t written = 0;
+    time_t formattedSecond = -1;
+    char buffer[32] = "";
+    do {
+        // Format the wall-clock time once per second
+        time_t seconds = static_cast<time_t>(record.timestampMs / 1000);
+        if (seconds != formattedSecond) {
+            tm timeInfo;
+            localtime_s(&timeInfo, &seconds);
+            strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &timeInfo);
+            formattedSecond = seconds;
+        }
+        
+        outFile << "{\"ts_ms\":" << record.timestampMs
+                << ",\"time\":\"" << buffer << "\""
+                << ",\"user\":\"" << jsonEscape(record.user) << "\""
+                << ",\"action\":\"" << actionName(record.action) << "\""
+                << ",\"account\":" << record.account
+                << ",\"target\":" << record.targetAccount
+                << ",\"amount\":" << fixed << setprecision(2) << record.amount
+                << ",\"ok\":" << (record.success ? "true" : "false")
+                << ",\"detail\":\"" << jsonEscape(record.detail) << "\"}\n";
+        written++;
+        
+        if (static_cast<size_t>(outFile.tellp()) >= maxFileBytes) {
+            outFile.close();
+            rotate();
+            outFile.open(fileName(0), ios::app);
+            if (!outFile) {
+                cerr << "Error: Could not open audit log for writing!" << endl;
+                break;
+            }
+        }
+    } while (tryPop(record));
+    
+    writtenCount.fetch_add(written, memory_order_relaxed);
+    return written;
+}
+
+// Background writer: drain periodically until stopped
+void AuditLog::writerLoop() {
+    while (running.load()) {
+        if (drain() == 0) {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+    }
+}
+
+// Pull a field value out of one of our own JSON lines
+static string extractField(const string& line, const string& key) {
+    string pattern = "\"" + key + "\":";
+    size_t start = line.find(pattern);
+    if (start == string::npos) {
+        return "";
+    }
+    start += pattern.size();
+    if (start < line.size() && line[start] == '"') {
+        string value;
+        for (size_t i = start + 1; i < line.size(); i++) {
+            if (line[i] == '\\' && i + 1 < line.size()) {
+                value += line[++i];
+            } else if (line[i] == '"') {
+                break;
+            } else {
+                value += line[i];
+            }
+        }
+        return value;
+    }
+    size_t end = line.find_first_of(",}", start);
+    return line.substr(start, end - start);
+}
+
+// Display matching records, oldest first
+void AuditLog::query(int64_t fromTime, int64_t toTime, const string& user) const {
+    cout << "\n========================================" << endl;
+    cout << "            AUDIT LOG" << endl;
+    cout << "========================================" << endl;
+    cout << left << setw(21) << "Time" << setw(12) << "User" << setw(17) << "Action"
+         << setw(8) << "Account" << right << setw(12) << "Amount" << "  Result" << endl;
+    cout << "----------------------------------------" << endl;
+    
+    size_t matches = 0;
+    for (int index = maxFiles - 1; index >= 0; index--) {
+        ifstream inFile(fileName(index));
+        if (!inFile) {
+            continue;
+        }
+        string line;
+        while (getline(inFile, line)) {
+            int64_t seconds = atoll(extractField(line, "ts_ms").c_str()) / 1000;
+            if ((fromTime != 0 && seconds < fromTime) || (toTime != 0 && seconds > toTime)) {
+                continue;
+            }
+            string recordUser = extractField(line, "user");
+            if (!user.empty() && recordUser != user) {
+                continue;
+            }
+            cout << left << setw(21) << extractField(line, "time")
+                 << setw(12) << recordUser
+                 << setw(17) << extractField(line, "action")
+                 << setw(8) << extractField(line, "account")
+                 << right << setw(12) << extractField(line, "amount")
+                 << "  " << (extractField(line, "ok") == "true" ? "OK    " : "FAILED")
+                 << " " << extractField(line, "detail") << endl;
+            matches++;
+        }
+    }
+    
+    if (matches == 0) {
+        cout << "No matching audit records." << endl;
+    }
+    cout << "----------------------------------------" << endl;
+    cout << matches << " record(s); " << getDroppedCount() << " dropped (ring full)" << endl;
+    cout << "========================================\n" << endl;
+}
+
+uint64_t AuditLog::getDroppedCount() const {
+    return droppedCount.load();
+}
+
+uint64_t AuditLog::getWrittenCount() const {
+    return writtenCount.load();
+}
+
+const char* AuditLog::actionName(int action) {
+    switch (action) {
+        case AUDIT_LOGIN: return "login";
+        case AUDIT_LOGIN_FAILED: return "login_failed";
+        case AUDIT_LOGOUT: return "logout";
+        case AUDIT_USER_LOCKED: return "user_locked";
+        case AUDIT_USER_UNLOCKED: return "user_unlocked";
+        case AUDIT_REGISTER_USER: return "register_user";
+        case AUDIT_CREATE_ACCOUNT: return "create_account";
+        case AUDIT_DELETE_ACCOUNT: return "delete_account";
+        case AUDIT_DEPOSIT: return "deposit";
+        case AUDIT_WITHDRAW: return "withdraw";
+        case AUDIT_TRANSFER: return "transfer";
+        case AUDIT_INTEREST_POSTING: return "interest_posting";
+        case AUDIT_PERMISSION_DENIED: return "permission_denied";
+        case AUDIT_PLACE_HOLD: return "place_hold";
+        case AUDIT_SETTLE_HOLD: return "settle_hold";
+        case AUDIT_RELEASE_HOLD: return "release_hold";
+        case AUDIT_SET_LIMITS: return "set_limits";
+        case AUDIT_PROMOTE_STANDBY: return "promote_standby";
+        case AUDIT_STATEMENTS: return "statements";
+        case AUDIT_VERIFY_INTEGRITY: return "verify_integrity";
+        case AUDIT_RISK_FLAGGED: return "risk_flagged";
+        case AUDIT_RISK_HELD: return "risk_held";
+        case AUDIT_RISK_REVIEW: return "risk_review";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef AUDITLOG_H
+#define AUDITLOG_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <cstdint>
+
+using namespace std;
+
+// Audited operations
+enum AuditAction {
+    AUDIT_LOGIN,
+    AUDIT_LOGIN_FAILED,
+    AUDIT_LOGOUT,
+    AUDIT_USER_LOCKED,
+    AUDIT_USER_UNLOCKED,
+    AUDIT_REGISTER_USER,
+    AUDIT_CREATE_ACCOUNT,
+    AUDIT_DELETE_ACCOUNT,
+    AUDIT_DEPOSIT,
+    AUDIT_WITHDRAW,
+    AUDIT_TRANSFER,
+    AUDIT_INTEREST_POSTING,
+    AUDIT_PERMISSION_DENIED,
+    AUDIT_PLACE_HOLD,
+    AUDIT_SETTLE_HOLD,
+    AUDIT_RELEASE_HOLD,
+    AUDIT_SET_LIMITS,
+    AUDIT_PROMOTE_STANDBY,
+    AUDIT_STATEMENTS,
+    AUDIT_VERIFY_INTEGRITY,
+    AUDIT_RISK_FLAGGED,
+    AUDIT_RISK_HELD,
+    AUDIT_RISK_REVIEW,
+    AUDIT_ACTION_COUNT
+};
+
+// Fixed-size audit record (copied into the ring without allocating)
+struct AuditRecord {
+    int64_t timestampMs;
+    char user[32];           // Who performed the action
+    char detail[32];         // Subject of the action (e.g. the user unlocked)
+    int32_t action;
+    int32_t account;
+    int32_t targetAccount;
+    int32_t success;
+    double amount;
+};
+
+// Audit log: callers push records into a bounded lock-free ring buffer
+// and a background thread drains it to rotating JSON-lines files
+// (audit.log, audit.1.log, ... oldest has the highest number).
+class AuditLog {
+private:
+    static const size_t RING_SIZE = 16384;  // Must be a power of two
+
+    struct Cell {
+        atomic<size_t> sequence;
+        AuditRecord record;
+    };
+
+    Cell* ring;
+    atomic<size_t> enqueuePos;
+    size_t dequeuePos;                       // Only used by the writer thread
+    atomic<uint64_t> droppedCount;
+    atomic<uint64_t> writtenCount;
+
+    string baseName;
+    size_t maxFileBytes;
+    int maxFiles;
+
+    thread writer;
+    atomic<bool> running;
+    mutex drainMutex;                        // Serializes draining (writer vs. flush)
+
+    bool tryPop(AuditRecord& record);
+    size_t drain();
+    void writerLoop();
+    void rotate();
+    string fileName(int index) const;
+
+public:
+    // Constructor
+    AuditLog(string base);
+    ~AuditLog();
+
+    void configure(size_t maxBytes, int files);
+    void start();
+    void stop();
+    void flush();
+
+    // Hot path: copies the record into the ring (drops it if the ring is full)
+    void log(string_view user, AuditAction action, int account = 0, double amount = 0.0,
+             bool success = true, int targetAccount = 0, string_view detail = "");
+
+    // Admin query (times are Unix seconds, 0 = unbounded, empty user = all)
+    void query(int64_t fromTime, int64_t toTime, const string& user) const;
+
+    uint64_t getDroppedCount() const;
+    uint64_t getWrittenCount() const;
+    static const char* actionName(int action);
+};
+
+#endif
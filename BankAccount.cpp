@@ -1,12 +1,15 @@
 #include "BankAccount.h"
+#include "StringArena.h"
 #include <iostream>
 #include <iomanip>
 
 using namespace std;
 
 // Constructor
-BankAccount::BankAccount(int accNum, string name, double initialBalance)
-    : accountNumber(accNum), accountHolderName(name), balance(initialBalance) {
+BankAccount::BankAccount(int accNum, string_view name, double initialBalance, AccountType type,
+                         CurrencyCode currencyCode)
+    : accountNumber(accNum), accountType(type), currency(currencyCode), balance(initialBalance), closedAt(0),
+      accountHolderName(StringArena::shared().intern(name)) {
     if (initialBalance > 0) {
         addTransaction("Initial Deposit", initialBalance);
     }
@@ -17,7 +20,7 @@ int BankAccount::getAccountNumber() const {
     return accountNumber;
 }
 
-string BankAccount::getAccountHolderName() const {
+string_view BankAccount::getAccountHolderName() const {
     return accountHolderName;
 }
 
@@ -25,6 +28,47 @@ double BankAccount::getBalance() const {
     return balance;
 }
 
+AccountType BankAccount::getAccountType() const {
+    return accountType;
+}
+
+string BankAccount::getAccountTypeName() const {
+    switch (accountType) {
+        case CHECKING: return "Checking";
+        case SAVINGS: return "Savings";
+        default: return "Unknown";
+    }
+}
+
+CurrencyCode BankAccount::getCurrency() const {
+    return currency;
+}
+
+bool BankAccount::isClosed() const {
+    return closedAt != 0;
+}
+
+time_t BankAccount::getClosedAt() const {
+    return closedAt;
+}
+
+const SpendingControls& BankAccount::getControls() const {
+    return controls;
+}
+
+const TransactionHistory& BankAccount::getHistory() const {
+    return transactionHistory;
+}
+
+double BankAccount::getAvailableFunds() const {
+    return balance + controls.overdraftLimit - controls.heldAmount;
+}
+
+// Day number (days since 1970, UTC) used for the daily limit
+int32_t BankAccount::epochDay(time_t when) {
+    return static_cast<int32_t>(when / 86400);
+}
+
 // Deposit money into account
 bool BankAccount::deposit(double amount) {
     if (amount <= 0) {
@@ -34,28 +78,30 @@ bool BankAccount::deposit(double amount) {
     
     balance += amount;
     addTransaction("Deposit", amount);
-    cout << "Successfully deposited $" << fixed << setprecision(2) << amount << endl;
-    cout << "New balance: $" << balance << endl;
+    string unit = Currency::prefix(currency);
+    cout << "Successfully deposited " << unit << fixed << setprecision(2) << amount << endl;
+    cout << "New balance: " << unit << balance << endl;
     return true;
 }
 
-// Withdraw money from account
+// Withdraw money from account (within the overdraft line and daily limit)
 bool BankAccount::withdraw(double amount) {
     if (amount <= 0) {
         cout << "Error: Withdrawal amount must be positive!" << endl;
         return false;
     }
     
-    if (amount > balance) {
-        cout << "Error: Insufficient funds!" << endl;
-        cout << "Current balance: $" << fixed << setprecision(2) << balance << endl;
+    int32_t today = epochDay(time(0));
+    if (!canDebit(amount, today, true)) {
         return false;
     }
     
     balance -= amount;
+    countWithdrawal(amount, today);
     addTransaction("Withdrawal", amount);
-    cout << "Successfully withdrew $" << fixed << setprecision(2) << amount << endl;
-    cout << "New balance: $" << balance << endl;
+    string unit = Currency::prefix(currency);
+    cout << "Successfully withdrew " << unit << fixed << setprecision(2) << amount << endl;
+    cout << "New balance: " << unit << balance << endl;
     return true;
 }
 
@@ -66,29 +112,133 @@ void BankAccount::displayAccountInfo() const {
     cout << "========================================" << endl;
     cout << "Account Number: " << accountNumber << endl;
     cout << "Account Holder: " << accountHolderName << endl;
-    cout << "Current Balance: $" << fixed << setprecision(2) << balance << endl;
+    cout << "Account Type: " << getAccountTypeName() << endl;
+    cout << "Currency: " << Currency::name(currency) << endl;
+    string unit = Currency::prefix(currency);
+    cout << "Current Balance: " << unit << fixed << setprecision(2) << balance << endl;
+    if (controls.overdraftLimit > 0 || controls.heldAmount > 0) {
+        cout << "On Hold: " << unit << controls.heldAmount << endl;
+        cout << "Overdraft Line: " << unit << controls.overdraftLimit << endl;
+        cout << "Available Funds: " << unit << getAvailableFunds() << endl;
+    }
+    if (controls.dailyLimit > 0) {
+        double used = controls.withdrawalDay == epochDay(time(0)) ? controls.withdrawnToday : 0.0;
+        cout << "Daily Limit: " << unit << controls.dailyLimit << " (" << unit << controls.dailyLimit - used
+             << " left today)" << endl;
+    }
+    if (closedAt != 0) {
+        tm timeInfo;
+        localtime_s(&timeInfo, &closedAt);
+        char buffer[32];
+        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M", &timeInfo);
+        cout << "Status: CLOSED on " << buffer << endl;
+    }
     cout << "========================================\n" << endl;
 }
 
-// Display transaction history
-void BankAccount::displayTransactionHistory() const {
+// Display transaction history, optionally only the entries within a time
+// range; entries keep their numbers from the full history
+void BankAccount::displayTransactionHistory(time_t from, time_t to) const {
     cout << "\n========================================" << endl;
     cout << "       TRANSACTION HISTORY" << endl;
     cout << "========================================" << endl;
     
+    size_t shown = 0;
+    string unit = Currency::prefix(currency);
+    transactionHistory.forEach(from, to, [&shown, &unit](size_t position, const Transaction& trans) {
+        cout << (position + 1) << ". " << trans.type << ": " << unit
+             << fixed << setprecision(2) << trans.amount 
+             << " | Balance After: " << unit << trans.balanceAfter << endl;
+        shown++;
+    });
     if (transactionHistory.empty()) {
         cout << "No transactions yet." << endl;
-    } else {
-        for (size_t i = 0; i < transactionHistory.size(); i++) {
-            const Transaction& trans = transactionHistory[i];
-            cout << (i + 1) << ". " << trans.type << ": $" 
-                 << fixed << setprecision(2) << trans.amount 
-                 << " | Balance After: $" << trans.balanceAfter << endl;
-        }
+    } else if (shown == 0) {
+        cout << "No transactions in that period." << endl;
     }
     cout << "========================================\n" << endl;
 }
 
+// Apply a signed adjustment (interest, fee or transfer leg) and record it
+void BankAccount::postAdjustment(string type, double amount) {
+    balance += amount;
+    addTransaction(type, amount < 0 ? -amount : amount);
+}
+
+// Mark the account closed; its balance and history stay for audit
+void BankAccount::close(time_t when) {
+    closedAt = when;
+    addTransaction("Account Closed", 0.0);
+}
+
+// Check a debit against available funds and, if it counts, the daily
+// limit. The day's total is only reset when a later day is seen.
+bool BankAccount::canDebit(double amount, int32_t today, bool countsTowardLimit) const {
+    if (amount > getAvailableFunds()) {
+        cout << "Error: Insufficient funds!" << endl;
+        cout << "Available funds: " << Currency::prefix(currency) << fixed << setprecision(2)
+             << getAvailableFunds() << endl;
+        return false;
+    }
+    if (countsTowardLimit && controls.dailyLimit > 0) {
+        double used = controls.withdrawalDay == today ? controls.withdrawnToday : 0.0;
+        if (used + amount > controls.dailyLimit) {
+            cout << "Error: Daily withdrawal limit exceeded!" << endl;
+            cout << "Remaining today: " << Currency::prefix(currency) << fixed << setprecision(2)
+                 << controls.dailyLimit - used << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Add to the day's withdrawals, starting a new total on a new day
+void BankAccount::countWithdrawal(double amount, int32_t day) {
+    if (controls.withdrawalDay != day) {
+        if (day < controls.withdrawalDay) {
+            return;  // Replay of an earlier day that has already rolled over
+        }
+        controls.withdrawalDay = day;
+        controls.withdrawnToday = 0.0;
+    }
+    controls.withdrawnToday += amount;
+}
+
+// Set the overdraft line and daily limit (0 = none)
+void BankAccount::setLimits(double overdraftLimit, double dailyLimit) {
+    controls.overdraftLimit = overdraftLimit;
+    controls.dailyLimit = dailyLimit;
+}
+
+// Restore the day's withdrawals from a saved slot
+void BankAccount::restoreUsage(double withdrawnToday, int32_t day) {
+    controls.withdrawnToday = withdrawnToday;
+    controls.withdrawalDay = day;
+}
+
+// Continue the history digest from the one saved with this account's slot
+void BankAccount::rebaseHistory(uint64_t digest) {
+    transactionHistory.rebase(digest, balance);
+}
+
+// Put back the history saved with the account's page
+void BankAccount::restoreHistory(TransactionHistory history) {
+    transactionHistory = move(history);
+}
+
+// Reserve funds for a hold
+void BankAccount::addHold(double amount) {
+    controls.heldAmount += amount;
+}
+
+// Return a hold's funds (released, expired or settled)
+void BankAccount::releaseHold(double amount) {
+    controls.heldAmount -= amount;
+    if (controls.heldAmount < 0.005) {
+        controls.heldAmount = 0.0;  // Drop rounding residue once the last hold is gone
+    }
+}
+
 // Add transaction to history
 void BankAccount::addTransaction(string type, double amount) {
     Transaction trans;
@@ -96,5 +246,5 @@ void BankAccount::addTransaction(string type, double amount) {
     trans.amount = amount;
     trans.balanceAfter = balance;
     trans.timestamp = time(0);
-    transactionHistory.push_back(trans);
+    transactionHistory.add(trans);
 }
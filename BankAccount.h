@@ -1,41 +1,84 @@
 #ifndef BANKACCOUNT_H
 #define BANKACCOUNT_H
 
+#include "TransactionHistory.h"
+#include "Currency.h"
 #include <string>
+#include <string_view>
 #include <vector>
 #include <ctime>
+#include <cstdint>
 
 using namespace std;
 
-// Transaction structure to store transaction history
-struct Transaction {
-    string type = "";        // "Deposit", "Withdrawal", "Transfer"
-    double amount = 0.0;
-    double balanceAfter = 0.0;
-    time_t timestamp = 0;
+// Account product type (selects the interest/fee schedule); one byte so
+// the currency fits beside it
+enum AccountType : uint8_t {
+    CHECKING,
+    SAVINGS,
+    ACCOUNT_TYPE_COUNT
+};
+
+// Overdraft line, daily withdrawal limit and holds. Kept next to the
+// balance so a withdrawal, hold or settlement is decided from one cache
+// line without further lookups.
+struct SpendingControls {
+    double overdraftLimit = 0.0;    // How far below zero the balance may go
+    double dailyLimit = 0.0;        // Withdrawals and holds per day; 0 = no limit
+    double withdrawnToday = 0.0;    // Counted against dailyLimit
+    double heldAmount = 0.0;        // Sum of open holds
+    int32_t withdrawalDay = 0;      // Epoch day withdrawnToday belongs to; reset lazily
 };
 
 class BankAccount {
 private:
+    // Hot fields first: everything a debit decision reads
     int accountNumber;
-    string accountHolderName;
+    AccountType accountType;
+    CurrencyCode currency;  // Fixed when the account is opened; every amount on it is in this currency
     double balance;
-    vector<Transaction> transactionHistory;
+    SpendingControls controls;
+    time_t closedAt;        // 0 while open; a closed account is a tombstone kept for audit
+    string_view accountHolderName;   // Interned in StringArena::shared()
+    TransactionHistory transactionHistory;   // Recent entries hot, older ones compressed
 
 public:
     // Constructor
-    BankAccount(int accNum, string name, double initialBalance = 0.0);
+    BankAccount(int accNum, string_view name, double initialBalance = 0.0, AccountType type = CHECKING,
+                CurrencyCode currencyCode = Currency::USD);
     
     // Getters
     int getAccountNumber() const;
-    string getAccountHolderName() const;
+    string_view getAccountHolderName() const;   // Valid for the life of the program
     double getBalance() const;
+    AccountType getAccountType() const;
+    string getAccountTypeName() const;
+    CurrencyCode getCurrency() const;
+    bool isClosed() const;
+    time_t getClosedAt() const;
+    const SpendingControls& getControls() const;
+    const TransactionHistory& getHistory() const;
+    double getAvailableFunds() const;   // Balance plus overdraft line, less holds
     
     // Banking operations
     bool deposit(double amount);
     bool withdraw(double amount);
     void displayAccountInfo() const;
-    void displayTransactionHistory() const;
+    void displayTransactionHistory(time_t from = 0, time_t to = 0) const;  // 0 = unbounded
+    void postAdjustment(string type, double amount);  // Signed: credits (+) or debits (-)
+    void close(time_t when);
+    
+    // Spending controls. canDebit() reports why a debit is refused; holds
+    // and withdrawals count toward the daily limit, transfers do not.
+    bool canDebit(double amount, int32_t today, bool countsTowardLimit) const;
+    void countWithdrawal(double amount, int32_t day);
+    void setLimits(double overdraftLimit, double dailyLimit);
+    void restoreUsage(double withdrawnToday, int32_t day);
+    void rebaseHistory(uint64_t digest);   // Continue the history digest saved at the last checkpoint
+    void restoreHistory(TransactionHistory history);   // The history it had when it was paged out
+    void addHold(double amount);
+    void releaseHold(double amount);
+    static int32_t epochDay(time_t when);
     
     // Helper function to add transaction to history
     void addTransaction(string type, double amount);
@@ -1,216 +1,2166 @@
 #include "BankingSystem.h"
+#include "Metrics.h"
+#include "StringArena.h"
 #include <iostream>
 #include <iomanip>
 #include <limits>
 #include <fstream>
 #include <sstream>
 #include <ctime>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+#include <deque>
 
 using namespace std;
 
+// Milliseconds elapsed since a point in time
+static double msSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Test hook: stop the process at once, as a crash would, when the
+// BANK_CRASH_POINT environment variable names this point (tests/regression.sh)
+static void crashPoint(const char* point) {
+    static const char* wanted = getenv("BANK_CRASH_POINT");
+    if (wanted && strcmp(wanted, point) == 0) {
+        _Exit(70);
+    }
+}
+
+thread_local string BankingSystem::actingUser;
+thread_local vector<uint64_t> BankingSystem::unsyncedCommits;
+thread_local bool BankingSystem::applyingReview = false;
+
 // Constructor
-BankingSystem::BankingSystem() 
-    : nextAccountNumber(1001), dataFileName("bank_data.txt"), 
-      usersFileName("users.txt"), currentUser(nullptr) {
+BankingSystem::BankingSystem(const string& standbyOf)
+    : settings("settings.txt"), accountNumbers("retired_accounts.txt"), dataFileName("bank_data.dat"), 
+      legacyDataFileName("bank_data.txt"), usersFileName("users.txt"), 
+      currentUser(nullptr), loginSource("console"), storageSync(false), checkpointRecords(1000), transferLog("transfers.journal"),
+      compactorStopping(false), tombstoneRetentionDays(90), compactionIntervalSeconds(300), accountsPurged(0),
+      slotFileRewrites(0), holdsExpired(0), postingEngine("rates.txt", "posting_batch.dat"), lastPostingDay(0), fxRates("fx_rates.txt"), reviewQueue("review_queue.log"),
+      riskAction(RISK_FLAG), ledgerVersion(1),
+      auditLog("audit"), slotsChangedOnDisk(0), lastVerification("never"), replicationLog("replication.log", "replication.ack"), standbySource(standbyOf),
+      replicationEnabled(false), replicationHeartbeatMs(1000), replicationMaxBytes(0), trace("trace.log") {
+    auto startupBegin = chrono::steady_clock::now();
+    auto phaseStart = startupBegin;
+    settings.load();
+    accountNumbers.configure(settings.getInt("number_reserve_chunk", 64),
+                             settings.getBool("reuse_retired_numbers", false),
+                             settings.getInt("retired_quarantine_days", 90));
+    accountNumbers.loadRetired();
+    auditLog.configure(static_cast<size_t>(settings.getInt("audit_max_file_kb", 1024)) * 1024,
+                       settings.getInt("audit_max_files", 5));
+    auditLog.start();
+    int journalLimit = settings.getInt("journal_checkpoint_records", 1000);
+    checkpointRecords = journalLimit > 0 ? static_cast<size_t>(journalLimit) : 1;
+    lockoutPolicy.configure(settings.getInt("login_window_seconds", 900),
+                            settings.getInt("login_max_failures", 3),
+                            settings.getInt("lockout_base_seconds", 60),
+                            settings.getInt("lockout_max_seconds", 3600),
+                            settings.getInt("login_rate_per_minute", 10),
+                            settings.getInt("login_burst", 5));
+    sessionManager.configure(settings.getInt("session_idle_minutes", 15) * 60,
+                             settings.getInt("session_sweep_seconds", 60));
+    sessionManager.start();
+    tombstoneRetentionDays = max(settings.getInt("tombstone_retention_days", 90), 0);
+    compactionIntervalSeconds = max(settings.getInt("compaction_interval_seconds", 300), 1);
+    replicationEnabled = settings.getBool("replication_enabled", false);
+    replicationHeartbeatMs = max(settings.getInt("replication_heartbeat_ms", 1000), 10);
+    replicationMaxBytes = static_cast<uint64_t>(max(settings.getInt("replication_max_mb", 64), 1)) * 1024 * 1024;
+    storage = StorageBackend::create(settings.getString("storage_backend", "io_uring"),
+                                     static_cast<size_t>(max(settings.getInt("storage_threads", 4), 1)));
+    storageSync = settings.getBool("storage_fsync", false);
+    fxRates.load();
+    riskAction = settings.getString("risk_action", "flag") == "hold" ? RISK_HOLD : RISK_FLAG;
+    reviewQueue.configure(static_cast<size_t>(max(settings.getInt("review_max_open", 10000), 0)));
+    recordPhase("Settings and audit log", msSince(phaseStart));
+    
+    // A standby loads nothing until it is promoted; run() follows the primary
+    if (!standbySource.empty()) {
+        return;
+    }
+    if (settings.getBool("trace_capture", false) && !trace.open()) {
+        cerr << "Error: Could not open " << trace.getFileName() << " for tracing!" << endl;
+    }
+    
+    // Users and accounts live in separate files, so they load side by side
+    double usersMs = 0.0;
+    thread userLoader([this, &usersMs]() {
+        auto start = chrono::steady_clock::now();
+        loadUsers();
+        usersMs = msSince(start);
+    });
+    size_t accountsPhase = startupPhases.size();
+    recordPhase("Accounts", 0.0);  // Filled in below, after its sub-phases
+    phaseStart = chrono::steady_clock::now();
     loadFromFile();
-    loadUsers();
+    startupPhases[accountsPhase].second = msSince(phaseStart);
+    userLoader.join();
+    recordPhase("Users (concurrent with accounts)", usersMs);
+    
+    phaseStart = chrono::steady_clock::now();
+    postingEngine.loadRates();
+    recoverPostingBatch();
+    runInterestPosting(true);
+    recordPhase("Interest catch-up", msSince(phaseStart));
     if (users.empty()) {
         createDefaultUsers();
     }
+    
+    startServices();
+    
+    double totalMs = msSince(startupBegin);
+    recordPhase("Total", totalMs);
+    cout << "*** Ready in " << fixed << setprecision(1) << totalMs << " ms ("
+         << getAccountCount() << " account(s), " << users.size() << " user(s)) ***\n" << endl;
+}
+
+// Destructor: stop the background compactor before the shards go away
+BankingSystem::~BankingSystem() {
+    {
+        lock_guard<mutex> lock(compactorMutex);
+        compactorStopping = true;
+    }
+    compactorWake.notify_all();
+    if (compactor.joinable()) {
+        compactor.join();
+    }
+    replicationLog.stop();
+    for (auto& shard : shards) {
+        shard->setChangeFeed(nullptr);
+    }
+    changeFeed.close();
+    storage->drain();
+}
+
+// Remember how long a startup phase took
+void BankingSystem::recordPhase(const string& name, double milliseconds) {
+    startupPhases.push_back(make_pair(name, milliseconds));
+}
+
+// Show the startup phase timings
+void BankingSystem::displayStartupPhases() const {
+    cout << "\n========================================" << endl;
+    cout << "         STARTUP PHASES" << endl;
+    cout << "========================================" << endl;
+    for (const auto& phase : startupPhases) {
+        cout << left << setw(36) << phase.first
+             << right << setw(10) << fixed << setprecision(2) << phase.second << " ms" << endl;
+    }
+    cout << "Worker threads: " << workerPool.size() << ", shards: " << shards.size() << endl;
+    cout << "========================================\n" << endl;
+}
+
+// Name recorded in the audit log for the current actor
+string_view BankingSystem::actorName() const {
+    if (!actingUser.empty()) {
+        return actingUser;
+    }
+    return currentUser ? currentUser->getUsername() : string_view("system");
+}
+
+// Name of a per-shard file, e.g. bank_data.2.dat
+static string shardFileName(const string& dataFile, int index, const string& extension) {
+    string base = dataFile.substr(0, dataFile.rfind('.'));
+    return base + "." + to_string(index) + extension;
+}
+
+// Shard that owns an account number. Numbers are handed out in sequence,
+// so taking them modulo the shard count spreads new accounts evenly.
+LedgerShard& BankingSystem::shardFor(int accountNumber) {
+    size_t index = static_cast<size_t>(accountNumber < 0 ? -accountNumber : accountNumber) % shards.size();
+    return *shards[index];
+}
+
+// Lock every shard in index order (the only order used, so no deadlock)
+vector<unique_lock<mutex>> BankingSystem::lockAllShards() {
+    vector<unique_lock<mutex>> locks;
+    locks.reserve(shards.size());
+    for (auto& shard : shards) {
+        locks.emplace_back(shard->getMutex());
+    }
+    return locks;
+}
+
+// Ledger-wide values written into shard headers
+LedgerMeta BankingSystem::currentMeta() const {
+    LedgerMeta meta;
+    meta.nextAccountNumber = accountNumbers.getHighWater();
+    meta.lastPostingDay = lastPostingDay;
+    return meta;
+}
+
+// Journal a balance change and checkpoint the shard when its journal is long
+// (caller holds the shard lock). A transfer leg never checkpoints: until the
+// transfer's END is logged, recovery finds its applied legs in the journal,
+// so the transfer checkpoints its shards itself after END.
+void BankingSystem::commitChange(LedgerShard& shard, const BankAccount& account, const string& type, double amount,
+                                 uint64_t transferId, const RequestOutcome* request) {
+    if (!shard.recordChange(account, type, amount, transferId, request)) {
+        cerr << "Error: Shard " << shard.getIndex() << " " << shard.getError() << "!" << endl;
+    }
+    finishChange(shard, transferId == 0);
+}
+
+// Publish a journaled change and checkpoint the shard when its journal is
+// long (caller holds the shard lock)
+void BankingSystem::finishChange(LedgerShard& shard, bool mayCheckpoint) {
+    ledgerVersion++;
+    if (unsyncedCommits.size() < shards.size()) {
+        unsyncedCommits.resize(shards.size(), 0);
+    }
+    unsyncedCommits[static_cast<size_t>(shard.getIndex())] = shard.lastJournalSequence();
+    if (mayCheckpoint) {
+        checkpointIfFull(shard);
+    }
+}
+
+// Checkpoint the shard if its journal is long (caller holds the shard lock)
+void BankingSystem::checkpointIfFull(LedgerShard& shard) {
+    if (shard.pendingJournalRecords() >= checkpointRecords) {
+        BANK_TIMED(OP_SAVE_ACCOUNTS);
+        if (!shard.checkpoint(currentMeta())) {
+            cerr << "Error: Shard " << shard.getIndex() << " " << shard.getError() << "!" << endl;
+        }
+    }
+}
+
+// Wait until both legs of a transfer are in their shard journals on disk.
+// A queued storage backend may not have written them yet, and END must
+// not reach the transfer log first: recovery would then drop the legs.
+bool BankingSystem::waitForLegs(LedgerShard& source, LedgerShard& destination) {
+    bool ok = source.waitDurable(source.lastJournalSequence());
+    if (&destination != &source) {
+        ok = destination.waitDurable(destination.lastJournalSequence()) && ok;
+    }
+    return ok;
+}
+
+// Wait until the journal records of this thread's changes are on disk
+// (called with no shard lock held, once per command)
+void BankingSystem::waitForCommits() {
+    for (size_t i = 0; i < unsyncedCommits.size() && i < shards.size(); i++) {
+        if (unsyncedCommits[i] != 0 && !shards[i]->waitDurable(unsyncedCommits[i])) {
+            cerr << "Error: " << shardFileName(dataFileName, static_cast<int>(i), ".journal")
+                 << " could not be written!" << endl;
+        }
+        unsyncedCommits[i] = 0;
+    }
+}
+
+// Checkpoint every shard in parallel (caller holds all shard locks)
+bool BankingSystem::checkpointShards() {
+    LedgerMeta meta = currentMeta();
+    replicationLog.shipMeta(meta.nextAccountNumber, meta.lastPostingDay);
+    vector<char> results(shards.size(), 0);
+    vector<thread> workers;
+    for (size_t i = 0; i < shards.size(); i++) {
+        workers.emplace_back([this, &results, &meta, i]() {
+            results[i] = shards[i]->checkpoint(meta) ? 1 : 0;
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    
+    bool ok = true;
+    for (size_t i = 0; i < shards.size(); i++) {
+        if (!results[i]) {
+            cerr << "Error: " << shardFileName(dataFileName, static_cast<int>(i), ".dat") << " "
+                 << shards[i]->getError() << "!" << endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Write the ledger-wide values after the account number mark moved.
+// Shard 0's header is enough; loading takes the highest value of all shards.
+bool BankingSystem::persistMeta() {
+    lock_guard<mutex> lock(shards[0]->getMutex());
+    LedgerMeta meta = currentMeta();
+    replicationLog.shipMeta(meta.nextAccountNumber, meta.lastPostingDay);
+    if (!shards[0]->checkpoint(meta)) {
+        cerr << "Error: " << shardFileName(dataFileName, 0, ".dat") << " " << shards[0]->getError() << "!" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Copy attempts one shard at a time before a snapshot holds every shard lock
+static const int SNAPSHOT_COPY_ATTEMPTS = 4;
+
+// Append a view of each open account in a shard (caller holds the shard lock)
+static void copyAccountViews(const LedgerShard& shard, vector<AccountView>& accounts) {
+    accounts.reserve(accounts.size() + shard.size());
+    shard.forEachAccount([&accounts](const BankAccount& account) {
+        if (account.isClosed()) {
+            return;
+        }
+        AccountView view;
+        view.accountNumber = account.getAccountNumber();
+        view.accountType = account.getAccountType();
+        view.balance = account.getBalance();
+        view.currency = account.getCurrency();
+        view.holderName = account.getAccountHolderName();
+        accounts.push_back(view);
+    });
 }
 
-// Find account index in vector
-int BankingSystem::findAccountIndex(int accountNumber) {
-    for (size_t i = 0; i < accounts.size(); i++) {
-        if (accounts[i].getAccountNumber() == accountNumber) {
-            return static_cast<int>(i);
+// Return a snapshot no older than the last committed change. Each shard is
+// copied under its own lock only, so the other shards keep taking changes;
+// callers format and write from the snapshot without blocking anyone.
+// A change bumps the ledger version before it releases its shard locks, so
+// a version that did not move during the copy means no transfer landed
+// between two shards' copies. If writes keep moving it, the last attempt
+// copies under every shard lock.
+SnapshotManager::ReadGuard BankingSystem::readSnapshot() {
+    if (snapshots.currentVersion() != ledgerVersion.load()) {
+        LedgerSnapshot* snapshot = new LedgerSnapshot();
+        for (int attempt = 1; ; attempt++) {
+            snapshot->accounts.clear();
+            if (attempt == SNAPSHOT_COPY_ATTEMPTS) {
+                vector<unique_lock<mutex>> locks = lockAllShards();
+                snapshot->version = ledgerVersion.load();
+                snapshot->nextAccountNumber = accountNumbers.peekNext();
+                for (const auto& shard : shards) {
+                    copyAccountViews(*shard, snapshot->accounts);
+                }
+                break;
+            }
+            snapshot->version = ledgerVersion.load();
+            snapshot->nextAccountNumber = accountNumbers.peekNext();
+            for (const auto& shard : shards) {
+                lock_guard<mutex> lock(shard->getMutex());
+                copyAccountViews(*shard, snapshot->accounts);
+            }
+            if (ledgerVersion.load() == snapshot->version) {
+                break;
+            }
+        }
+        snapshot->takenAt = time(0);
+        sort(snapshot->accounts.begin(), snapshot->accounts.end(),
+             [](const AccountView& a, const AccountView& b) { return a.accountNumber < b.accountNumber; });
+        for (const auto& view : snapshot->accounts) {
+            double value = 0.0;
+            if (fxRates.convert(view.balance, view.currency, fxRates.getBase(), value)) {
+                snapshot->totalBalance += value;
+            }
         }
+        snapshots.publish(snapshot);
+    }
+    return snapshots.read();
+}
+
+// Total accounts across all shards
+size_t BankingSystem::getAccountCount() const {
+    size_t count = 0;
+    for (const auto& shard : shards) {
+        count += shard->size();
+    }
+    return count;
+}
+
+// True if a holder name fits its slot and journal record whole; a longer
+// name is refused rather than cut, possibly inside a UTF-8 sequence
+static bool holderNameFits(const string& name) {
+    static_assert(sizeof(JournalRecord::text) > MAX_HOLDER_NAME_BYTES, "journal text must hold a whole holder name");
+    if (name.size() > MAX_HOLDER_NAME_BYTES) {
+        cout << "Error: Account holder name is " << name.size() << " bytes; the limit is " << MAX_HOLDER_NAME_BYTES
+             << "!" << endl;
+        return false;
     }
-    return -1;
+    return true;
 }
 
 // Create a new account
-void BankingSystem::createAccount(string name, double initialDeposit) {
+void BankingSystem::createAccount(string name, double initialDeposit, AccountType type, CurrencyCode currency) {
+    if (!holderNameFits(name)) {
+        return;
+    }
     if (initialDeposit < 0) {
         cout << "Error: Initial deposit cannot be negative!" << endl;
         return;
     }
+    if (!fxRates.hasRate(currency)) {
+        cout << "Error: No exchange rate for " << Currency::name(currency) << "; add it to fx_rates.txt!" << endl;
+        return;
+    }
+    
+    int accountNumber = accountNumbers.allocate();
+    if (accountNumber == -1) {
+        cout << "Error: No account numbers left to assign!" << endl;
+        return;
+    }
     
-    BankAccount newAccount(nextAccountNumber, name, initialDeposit);
-    accounts.push_back(newAccount);
+    BankAccount newAccount(accountNumber, name, initialDeposit, type, currency);
+    {
+        LedgerShard& shard = shardFor(accountNumber);
+        lock_guard<mutex> lock(shard.getMutex());
+        if (!shard.addAccount(newAccount)) {
+            cerr << "Error: Shard " << shard.getIndex() << " " << shard.getError() << "!" << endl;
+            return;
+        }
+        ledgerVersion++;
+    }
     
     cout << "*** Account Created Successfully! ***" << endl;
-    cout << "Account Number:" << nextAccountNumber << endl;
+    cout << "Account Number:" << accountNumber << endl;
     cout << "Account Holder:" << name << endl;
-    cout << "Initial Balance: $" << fixed << setprecision(2) << initialDeposit << endl;
+    cout << "Account Type:" << newAccount.getAccountTypeName() << endl;
+    cout << "Currency:" << Currency::name(currency) << endl;
+    cout << "Initial Balance: " << Currency::prefix(currency) << fixed << setprecision(2) << initialDeposit << endl;
     
-    nextAccountNumber++;
-    saveToFile();
+    // The headers only change when the reserved range runs out
+    if (accountNumbers.takePersistRequest()) {
+        persistMeta();
+    }
+    auditLog.log(actorName(), AUDIT_CREATE_ACCOUNT, accountNumber, initialDeposit, true, 0, name);
 }
 
 // Find and return pointer to account
 BankAccount* BankingSystem::findAccount(int accountNumber) {
-    int index = findAccountIndex(accountNumber);
-    if (index != -1) {
-        return &accounts[index];
-    }
-    return nullptr;
+    BANK_TIMED(OP_FIND_ACCOUNT);
+    return shardFor(accountNumber).find(accountNumber);
 }
 
-// Delete an account
+// Close an account. It stays behind as a tombstone (balance and history
+// kept for audit) until compaction purges it after the retention period.
 void BankingSystem::deleteAccount(int accountNumber) {
-    int index = findAccountIndex(accountNumber);
-    if (index == -1) {
+    LedgerShard& shard = shardFor(accountNumber);
+    lock_guard<mutex> lock(shard.getMutex());
+    BankAccount* account = shard.find(accountNumber);
+    if (!account) {
         cout << "Error: Account not found!" << endl;
         return;
     }
+    if (account->isClosed()) {
+        cout << "Error: Account is already closed!" << endl;
+        return;
+    }
+    
+    string_view holderName = account->getAccountHolderName();
+    double balance = account->getBalance();
+    cout << "Deleting account for: " << holderName << endl;
+    if (!shard.closeAccount(accountNumber, time(0))) {
+        cerr << "Error: Shard " << shard.getIndex() << " " << shard.getError() << "!" << endl;
+        return;
+    }
+    auditLog.log(actorName(), AUDIT_DELETE_ACCOUNT, accountNumber, balance, true, 0, holderName);
+    ledgerVersion++;
+    cout << "Account deleted successfully!" << endl;
+    cout << "Its history is kept for " << tombstoneRetentionDays << " day(s) before compaction removes it." << endl;
+}
+
+// Close a list of accounts. The list is split by shard and each shard is
+// locked once and journals its closures in a single write.
+size_t BankingSystem::closeAccounts(const vector<int>& accountNumbers) {
+    vector<vector<int>> byShard(shards.size());
+    for (int accountNumber : accountNumbers) {
+        byShard[shardFor(accountNumber).getIndex()].push_back(accountNumber);
+    }
+    
+    time_t now = time(0);
+    size_t closedCount = 0;
+    for (size_t i = 0; i < shards.size(); i++) {
+        if (byShard[i].empty()) {
+            continue;
+        }
+        vector<int> closed;
+        vector<double> balances;
+        {
+            lock_guard<mutex> lock(shards[i]->getMutex());
+            if (!shards[i]->closeAccounts(byShard[i], now, closed)) {
+                cerr << "Error: Shard " << i << " " << shards[i]->getError() << "!" << endl;
+            }
+            for (int accountNumber : closed) {
+                balances.push_back(shards[i]->find(accountNumber)->getBalance());
+            }
+            // Bumped before the lock is released, as readSnapshot() relies on
+            if (!closed.empty()) {
+                ledgerVersion++;
+            }
+        }
+        for (size_t j = 0; j < closed.size(); j++) {
+            auditLog.log(actorName(), AUDIT_DELETE_ACCOUNT, closed[j], balances[j], true, 0, "bulk closure");
+        }
+        closedCount += closed.size();
+    }
+    return closedCount;
+}
+
+// Purge expired tombstones and rewrite sparse slot files, one shard at a
+// time so the other shards stay available. Purged numbers are retired.
+size_t BankingSystem::compactLedger() {
+    time_t cutoff = time(0) - static_cast<time_t>(tombstoneRetentionDays) * 86400;
+    size_t purgedCount = 0;
+    for (auto& shard : shards) {
+        vector<int> purged;
+        {
+            lock_guard<mutex> lock(shard->getMutex());
+            shard->purgeTombstones(cutoff, purged);
+            if (shard->needsRewrite()) {
+                if (shard->rewriteSnapshot(currentMeta())) {
+                    slotFileRewrites++;
+                } else {
+                    cerr << "Error: Shard " << shard->getIndex() << " " << shard->getError() << "!" << endl;
+                }
+            }
+        }
+        for (int accountNumber : purged) {
+            accountNumbers.retire(accountNumber);
+        }
+        purgedCount += purged.size();
+    }
+    accountsPurged += purgedCount;
+    return purgedCount;
+}
+
+// Background compactor: wakes every compaction interval until shutdown
+void BankingSystem::compactionLoop() {
+    unique_lock<mutex> lock(compactorMutex);
+    while (!compactorStopping) {
+        compactorWake.wait_for(lock, chrono::seconds(compactionIntervalSeconds), [this]() { return compactorStopping; });
+        if (compactorStopping) {
+            break;
+        }
+        lock.unlock();
+        expireHolds();
+        compactLedger();
+        rotateReplicationLog();
+        lock.lock();
+    }
+}
+
+// Start the background work of a primary: replication and the compactor
+void BankingSystem::startServices() {
+    reviewQueue.load();
+    startChangeFeed();
+    startReplication();
+    compactor = thread(&BankingSystem::compactionLoop, this);
+}
+
+// Start a new replication log from the current ledger and ship every
+// journal append from then on (only when replication_enabled is set)
+void BankingSystem::startReplication() {
+    if (!replicationEnabled) {
+        return;
+    }
+    vector<unique_lock<mutex>> locks = lockAllShards();
+    vector<vector<JournalRecord>> snapshot(shards.size());
+    for (size_t i = 0; i < shards.size(); i++) {
+        shards[i]->snapshotRecords(snapshot[i], time(0));
+    }
+    LedgerMeta meta = currentMeta();
+    if (!replicationLog.begin(snapshot, meta.nextAccountNumber, meta.lastPostingDay)) {
+        cerr << "Error: Could not write replication.log!" << endl;
+        return;
+    }
+    for (auto& shard : shards) {
+        shard->setShipper(&replicationLog);
+    }
+    replicationLog.startHeartbeat(replicationHeartbeatMs);
+}
+
+// Publish every journal append to the shared-memory change feed from now
+// on (only when change_feed is set)
+void BankingSystem::startChangeFeed() {
+    if (!settings.getBool("change_feed", false)) {
+        return;
+    }
+    vector<unique_lock<mutex>> locks = lockAllShards();
+    if (!changeFeed.open(settings.getString("change_feed_name", "/banking_changes"), static_cast<int>(shards.size()),
+                         static_cast<size_t>(max(settings.getInt("change_feed_events", 65536), 1)))) {
+        return;
+    }
+    for (auto& shard : shards) {
+        shard->setChangeFeed(&changeFeed);
+    }
+}
+
+// Start a new generation once the log has outgrown replication_max_mb, or
+// if it could not be written; standbys rebuild from the new snapshot
+void BankingSystem::rotateReplicationLog() {
+    if (!replicationEnabled || (replicationLog.isActive() && replicationLog.getSize() < replicationMaxBytes)) {
+        return;
+    }
+    startReplication();
+}
+
+// Apply the entries the primary has added to its log since the last
+// call. Returns true if there were any.
+bool BankingSystem::followPrimary(ReplicationTail& tail, StandbyProgress& progress) {
+    vector<ReplicationEntry> entries;
+    bool restarted = false;
+    if (!tail.poll(entries, restarted)) {
+        return false;
+    }
+    if (restarted) {
+        // A new generation begins with a full snapshot of the primary
+        createShards(tail.getShardCount());
+        progress.highestAccount = 0;
+        progress.generations++;
+    }
+    
+    int64_t appliedAt = ReplicationLog::nowMs();
+    for (const auto& entry : entries) {
+        if (entry.kind == REPLICATE_RECORD && entry.shardIndex >= 0 &&
+            entry.shardIndex < static_cast<int32_t>(shards.size())) {
+            LedgerShard& shard = *shards[entry.shardIndex];
+            lock_guard<mutex> lock(shard.getMutex());
+            shard.applyReplicated(entry.record);
+            ledgerVersion++;
+            progress.highestAccount = max(progress.highestAccount, entry.record.accountNumber);
+        } else if (entry.kind == REPLICATE_META) {
+            progress.nextAccountNumber = entry.record.accountNumber;
+            lastPostingDay = entry.record.accountType;
+        } else if (entry.kind == REPLICATE_HEARTBEAT) {
+            progress.lastHeartbeatMs = entry.shippedAtMs;
+        }
+        
+        // Lag is apply time minus ship time; the average and maximum only
+        // count entries shipped after the standby first caught up
+        int64_t lag = max<int64_t>(appliedAt - entry.shippedAtMs, 0);
+        progress.lastLagMs = lag;
+        progress.lastShippedMs = entry.shippedAtMs;
+        progress.entriesApplied++;
+        if (progress.caughtUp) {
+            progress.maxLagMs = max(progress.maxLagMs, lag);
+            progress.totalLagMs += static_cast<double>(lag);
+            progress.lagSamples++;
+        }
+    }
+    if (tail.getBytesBehind() < sizeof(ReplicationEntry)) {
+        progress.caughtUp = true;
+    }
+    return !entries.empty();
+}
+
+// Show how far the standby is behind its primary
+void BankingSystem::displayStandbyStatus(const ReplicationTail& tail, const StandbyProgress& progress) {
+    int64_t now = ReplicationLog::nowMs();
+    int64_t lastContact = max(progress.lastShippedMs, progress.lastHeartbeatMs);
+    
+    cout << "\n========================================" << endl;
+    cout << "         STANDBY STATUS" << endl;
+    cout << "========================================" << endl;
+    cout << "Following: " << standbySource << "/replication.log" << endl;
+    if (tail.getGeneration() == 0) {
+        cout << "Waiting for the primary's log..." << endl;
+        cout << "========================================\n" << endl;
+        return;
+    }
+    cout << "Generation: " << tail.getGeneration() << " (logs followed: " << progress.generations << ")" << endl;
+    cout << "Accounts: " << getAccountCount() << " in " << shards.size() << " shard(s)" << endl;
+    cout << "Entries Applied: " << progress.entriesApplied << endl;
+    cout << "Bytes Behind: " << tail.getBytesBehind() << " (" << tail.getBytesBehind() / sizeof(ReplicationEntry)
+         << " entries)" << endl;
+    cout << "Replication Lag: " << progress.lastLagMs << " ms (newest entry), max " << progress.maxLagMs << " ms";
+    if (progress.lagSamples > 0) {
+        cout << ", average " << fixed << setprecision(1)
+             << progress.totalLagMs / static_cast<double>(progress.lagSamples) << " ms";
+    }
+    cout << endl;
+    cout << "Last Heard From Primary: " << (lastContact > 0 ? now - lastContact : 0) << " ms ago" << endl;
+    cout << "========================================\n" << endl;
+}
+
+// Take over as primary: apply the rest of the log, copy the files the log
+// does not carry, write the ledger to this directory and start serving
+void BankingSystem::promoteStandby(ReplicationTail& tail, StandbyProgress& progress) {
+    auto start = chrono::steady_clock::now();
+    while (followPrimary(tail, progress)) {
+    }
+    if (shards.empty()) {
+        createShards(max(settings.getInt("shard_count", 4), 1));
+    }
+    
+    // Users, retired numbers, rates and transfer decisions live outside the shard journals
+    vector<string> copied = { usersFileName, "retired_accounts.txt", "rates.txt", "transfers.journal",
+                              "posting_batch.dat" };
+    for (const auto& name : copied) {
+        ifstream source(standbySource + "/" + name, ios::binary);
+        if (!source || source.peek() == ifstream::traits_type::eof()) {
+            remove(name.c_str());
+            continue;
+        }
+        ofstream target(name, ios::binary | ios::trunc);
+        target << source.rdbuf();
+        if (!target) {
+            cerr << "Error: Could not copy " << name << " from the primary!" << endl;
+        }
+    }
+    loadUsers();
+    accountNumbers.loadRetired();
+    accountNumbers.restore(max(max(progress.nextAccountNumber, progress.highestAccount + 1),
+                               accountNumbers.getHighWater()));
+    
+    // Empty files first, so interrupted transfers can be journaled, then
+    // the whole ledger written out
+    {
+        vector<unique_lock<mutex>> locks = lockAllShards();
+        LedgerMeta meta = currentMeta();
+        for (auto& shard : shards) {
+            if (!shard->create(meta)) {
+                cerr << "Error: Shard " << shard->getIndex() << " " << shard->getError() << "!" << endl;
+            }
+        }
+    }
+    recoverTransfers();
+    {
+        vector<unique_lock<mutex>> locks = lockAllShards();
+        LedgerMeta meta = currentMeta();
+        for (auto& shard : shards) {
+            if (!shard->rewriteSnapshot(meta)) {
+                cerr << "Error: Shard " << shard->getIndex() << " " << shard->getError() << "!" << endl;
+            }
+        }
+    }
+    transferLog.truncate();
+    postingEngine.loadRates();
+    recoverPostingBatch();
+    if (users.empty()) {
+        createDefaultUsers();
+    }
+    
+    string formerPrimary = standbySource;
+    standbySource.clear();
+    ledgerVersion++;
+    startServices();
+    auditLog.log("system", AUDIT_PROMOTE_STANDBY, 0, 0.0, true, 0, formerPrimary);
+    cout << "\n*** Promoted to primary in " << fixed << setprecision(1) << msSince(start) << " ms ("
+         << getAccountCount() << " account(s), " << users.size() << " user(s)) ***\n" << endl;
+}
+
+// Follow the primary until promoted or told to quit. Commands are read on
+// a helper thread so that following never waits for input. Returns true
+// if the menus should run next (promoted with input still open).
+bool BankingSystem::runStandby() {
+    ReplicationTail tail(standbySource + "/replication.log", standbySource + "/replication.ack");
+    StandbyProgress progress;
+    int pollMs = max(settings.getInt("standby_poll_ms", 50), 1);
+    int64_t promoteAfterMs = static_cast<int64_t>(max(settings.getInt("standby_promote_after_seconds", 0), 0)) * 1000;
+    
+    cout << "\n======================================" << endl;
+    cout << "   STANDBY MODE" << endl;
+    cout << "======================================" << endl;
+    cout << "Following: " << standbySource << "/replication.log" << endl;
+    cout << "Commands: status, promote, quit" << endl;
+    if (promoteAfterMs > 0) {
+        cout << "Promotes itself after " << promoteAfterMs / 1000 << " s without word from the primary." << endl;
+    }
+    cout << "Note: this directory's ledger files are replaced when promoted." << endl;
+    cout << "======================================\n" << endl;
+    
+    mutex inputMutex;
+    vector<string> commands;
+    bool inputClosed = false;
+    bool inputReleased = false;               // Promoted: hand the console back after one more line
+    thread reader([&]() {
+        string line;
+        while (getline(cin, line)) {
+            line.erase(0, line.find_first_not_of(" \t\r"));
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            lock_guard<mutex> lock(inputMutex);
+            if (inputReleased) {
+                return;
+            }
+            commands.push_back(line);
+            if (line == "promote" || line == "quit") {
+                return;
+            }
+        }
+        lock_guard<mutex> lock(inputMutex);
+        inputClosed = true;
+    });
+    
+    bool promote = false;
+    bool quit = false;
+    bool selfPromoted = false;
+    int64_t followingSince = ReplicationLog::nowMs();
+    int64_t lastAckMs = 0;
+    while (!promote && !quit) {
+        bool applied = followPrimary(tail, progress);
+        int64_t now = ReplicationLog::nowMs();
+        if (tail.getGeneration() != 0 && now - lastAckMs >= 1000) {
+            ReplicationAck ack;
+            ack.generation = tail.getGeneration();
+            ack.offset = tail.getOffset();
+            ack.entriesApplied = progress.entriesApplied;
+            ack.lastLagMs = progress.lastLagMs;
+            ack.maxLagMs = progress.maxLagMs;
+            ack.ackedAtMs = now;
+            tail.writeAck(ack);
+            lastAckMs = now;
+        }
+        
+        vector<string> pending;
+        {
+            lock_guard<mutex> lock(inputMutex);
+            pending.swap(commands);
+        }
+        for (const auto& command : pending) {
+            if (command == "status") {
+                displayStandbyStatus(tail, progress);
+            } else if (command == "promote") {
+                promote = true;
+            } else if (command == "quit") {
+                quit = true;
+            } else if (!command.empty()) {
+                cout << "Error: Unknown command '" << command << "'! (status, promote, quit)" << endl;
+            }
+        }
+        
+        int64_t lastContact = max(max(progress.lastShippedMs, progress.lastHeartbeatMs), followingSince);
+        if (!promote && !quit && promoteAfterMs > 0 && now - lastContact > promoteAfterMs) {
+            cout << "No word from the primary for " << (now - lastContact) / 1000 << " s; promoting." << endl;
+            promote = true;
+            selfPromoted = true;
+        }
+        if (!applied && !promote && !quit) {
+            this_thread::sleep_for(chrono::milliseconds(pollMs));
+        }
+    }
     
-    cout << "Deleting account for: " << accounts[index].getAccountHolderName() << endl;
-    accounts.erase(accounts.begin() + index);
-    cout << "Account deleted successfully!" << endl;    saveToFile();}
+    if (quit) {
+        reader.join();
+        cout << "\n*** Standby stopped ***" << endl;
+        return false;
+    }
+    promoteStandby(tail, progress);
+    {
+        lock_guard<mutex> lock(inputMutex);
+        inputReleased = true;
+        if (selfPromoted && !inputClosed) {
+            // The reader still owns the console until it gets a line
+            cout << "Press Enter to continue..." << endl;
+        }
+    }
+    reader.join();
+    if (inputClosed) {
+        // Nothing can reach the menus; shut down as Exit would
+        accountNumbers.trimHighWater();
+        accountNumbers.takePersistRequest();
+        saveToFile();
+        cout << "*** Input closed; ledger saved ***" << endl;
+        return false;
+    }
+    return true;
+}
 
 // List all accounts
-void BankingSystem::listAllAccounts() const {
+void BankingSystem::listAllAccounts() {
+    SnapshotManager::ReadGuard snapshot = readSnapshot();
+    
+    cout << "\n========================================" << endl;
+    cout << "         ALL BANK ACCOUNTS" << endl;
+    cout << "========================================" << endl;
+    
+    if (snapshot->accounts.empty()) {
+        cout << "No accounts in the system." << endl;
+    } else {
+        cout << left << setw(15) << "Account #" 
+             << setw(25) << "Account Holder" 
+             << right << setw(15) << "Balance" << "  Currency" << endl;
+        cout << "----------------------------------------" << endl;
+        
+        for (const auto& account : snapshot->accounts) {
+            cout << left << setw(15) << account.accountNumber
+                 << setw(25) << account.holderName
+                 << right << setw(15) << fixed << setprecision(2) 
+                 << account.balance << "  " << Currency::name(account.currency) << endl;
+        }
+    }
+    cout << "========================================\n" << endl;
+}
+
+// Check a request's idempotency key before applying it (caller holds the
+// shard lock). Returns true if the key was seen before; result is then the
+// answer to give without applying the request again.
+bool BankingSystem::checkRequest(LedgerShard& shard, uint64_t keyHash, uint32_t fingerprint, bool& result) {
+    const RequestOutcome* previous = shard.findRequest(keyHash, time(0));
+    if (!previous) {
+        return false;
+    }
+    if (previous->fingerprint != fingerprint) {
+        cout << "Error: Request key already used for a different request!" << endl;
+        result = false;
+        return true;
+    }
+    const BankAccount* account = shard.find(previous->accountNumber);
+    cout << "Duplicate request: already applied to account " << previous->accountNumber << " (balance after: "
+         << Currency::prefix(account ? account->getCurrency() : Currency::USD) << fixed << setprecision(2)
+         << previous->balanceAfter << ")" << endl;
+    result = true;
+    return true;
+}
+
+// Outcome to remember for a request applied to an account
+RequestOutcome BankingSystem::makeRequestOutcome(const LedgerShard& shard, uint64_t keyHash, uint32_t fingerprint,
+                                                 const BankAccount& account) const {
+    RequestOutcome outcome;
+    outcome.keyHash = keyHash;
+    outcome.expiresAt = static_cast<int64_t>(time(0)) + shard.getRequestTtl();
+    outcome.balanceAfter = account.getBalance();
+    outcome.fingerprint = fingerprint;
+    outcome.accountNumber = account.getAccountNumber();
+    return outcome;
+}
+
+// Deposit into an account and journal it. A request key makes a retried
+// deposit return the first outcome instead of depositing twice.
+bool BankingSystem::deposit(int accountNumber, double amount, const string& requestKey) {
+    BANK_TIMED(OP_DEPOSIT);
+    LedgerShard& shard = shardFor(accountNumber);
+    lock_guard<mutex> lock(shard.getMutex());
+    uint64_t keyHash = requestKey.empty() ? 0 : IdempotencyTable::hashKey(requestKey);
+    uint32_t fingerprint = IdempotencyTable::fingerprint(CMD_DEPOSIT, accountNumber, 0, amount);
+    bool repeated = false;
+    if (keyHash != 0 && checkRequest(shard, keyHash, fingerprint, repeated)) {
+        return repeated;
+    }
+    BankAccount* account = findAccount(accountNumber);
+    if (!account || account->isClosed()) {
+        cout << (account ? "Error: Account is closed!" : "Account not found!") << endl;
+        auditLog.log(actorName(), AUDIT_DEPOSIT, accountNumber, amount, false);
+        return false;
+    }
+    uint32_t reasons = 0;
+    if (!screenTransaction(shard, CMD_DEPOSIT, accountNumber, 0, amount, reasons)) {
+        return false;
+    }
+    if (!account->deposit(amount)) {
+        auditLog.log(actorName(), AUDIT_DEPOSIT, accountNumber, amount, false);
+        return false;
+    }
+    if (keyHash != 0) {
+        RequestOutcome outcome = makeRequestOutcome(shard, keyHash, fingerprint, *account);
+        commitChange(shard, *account, "Deposit", amount, 0, &outcome);
+    } else {
+        commitChange(shard, *account, "Deposit", amount);
+    }
+    recordScreened(shard, CMD_DEPOSIT, accountNumber, 0, amount, reasons);
+    auditLog.log(actorName(), AUDIT_DEPOSIT, accountNumber, amount, true);
+    return true;
+}
+
+// Withdraw from an account and journal it (a request key works as for deposits)
+bool BankingSystem::withdraw(int accountNumber, double amount, const string& requestKey) {
+    BANK_TIMED(OP_WITHDRAW);
+    LedgerShard& shard = shardFor(accountNumber);
+    lock_guard<mutex> lock(shard.getMutex());
+    uint64_t keyHash = requestKey.empty() ? 0 : IdempotencyTable::hashKey(requestKey);
+    uint32_t fingerprint = IdempotencyTable::fingerprint(CMD_WITHDRAW, accountNumber, 0, amount);
+    bool repeated = false;
+    if (keyHash != 0 && checkRequest(shard, keyHash, fingerprint, repeated)) {
+        return repeated;
+    }
+    holdsExpired += shard.expireHolds(time(0));  // Expired holds no longer reserve funds
+    BankAccount* account = findAccount(accountNumber);
+    if (!account || account->isClosed()) {
+        cout << (account ? "Error: Account is closed!" : "Account not found!") << endl;
+        auditLog.log(actorName(), AUDIT_WITHDRAW, accountNumber, amount, false);
+        return false;
+    }
+    uint32_t reasons = 0;
+    if (!screenTransaction(shard, CMD_WITHDRAW, accountNumber, 0, amount, reasons)) {
+        return false;
+    }
+    if (!account->withdraw(amount)) {
+        auditLog.log(actorName(), AUDIT_WITHDRAW, accountNumber, amount, false);
+        return false;
+    }
+    if (keyHash != 0) {
+        RequestOutcome outcome = makeRequestOutcome(shard, keyHash, fingerprint, *account);
+        commitChange(shard, *account, "Withdrawal", -amount, 0, &outcome);
+    } else {
+        commitChange(shard, *account, "Withdrawal", -amount);
+    }
+    recordScreened(shard, CMD_WITHDRAW, accountNumber, 0, amount, reasons);
+    auditLog.log(actorName(), AUDIT_WITHDRAW, accountNumber, amount, true);
+    return true;
+}
+
+// Reserve funds on an account until the hold is settled, released or
+// expires. Holds count toward the daily withdrawal limit.
+uint64_t BankingSystem::placeHold(int accountNumber, double amount) {
+    if (amount <= 0) {
+        cout << "Error: Hold amount must be positive!" << endl;
+        return 0;
+    }
+    LedgerShard& shard = shardFor(accountNumber);
+    lock_guard<mutex> lock(shard.getMutex());
+    time_t now = time(0);
+    holdsExpired += shard.expireHolds(now);
+    BankAccount* account = findAccount(accountNumber);
+    if (!account || account->isClosed()) {
+        cout << (account ? "Error: Account is closed!" : "Account not found!") << endl;
+        auditLog.log(actorName(), AUDIT_PLACE_HOLD, accountNumber, amount, false);
+        return 0;
+    }
+    if (!account->canDebit(amount, BankAccount::epochDay(now), true)) {
+        auditLog.log(actorName(), AUDIT_PLACE_HOLD, accountNumber, amount, false);
+        return 0;
+    }
+    uint64_t holdId = shard.placeHold(*account, amount, now);
+    if (holdId == 0) {
+        cerr << "Error: Shard " << shard.getIndex() << " " << shard.getError() << "!" << endl;
+        return 0;
+    }
+    finishChange(shard);
+    auditLog.log(actorName(), AUDIT_PLACE_HOLD, accountNumber, amount, true, 0, to_string(holdId));
+    string unit = Currency::prefix(account->getCurrency());
+    cout << "Hold " << holdId << " placed for " << unit << fixed << setprecision(2) << amount << endl;
+    cout << "Available funds: " << unit << account->getAvailableFunds() << endl;
+    return holdId;
+}
+
+// Shard that issued a hold id
+LedgerShard* BankingSystem::shardForHold(uint64_t holdId) {
+    return shards[static_cast<size_t>(holdId % shards.size())].get();
+}
+
+// Debit up to the held amount and release the hold
+bool BankingSystem::settleHold(uint64_t holdId, double amount) {
+    LedgerShard& shard = *shardForHold(holdId);
+    lock_guard<mutex> lock(shard.getMutex());
+    holdsExpired += shard.expireHolds(time(0));
+    const AccountHold* hold = shard.findHold(holdId);
+    if (!hold) {
+        cout << "Error: No open hold " << holdId << " (settled, released or expired)!" << endl;
+        auditLog.log(actorName(), AUDIT_SETTLE_HOLD, 0, amount, false, 0, to_string(holdId));
+        return false;
+    }
+    int accountNumber = hold->accountNumber;
+    BankAccount* account = shard.find(accountNumber);
+    if (!account || account->isClosed()) {
+        cout << (account ? "Error: Account is closed!" : "Account not found!") << endl;
+        auditLog.log(actorName(), AUDIT_SETTLE_HOLD, accountNumber, amount, false, 0, to_string(holdId));
+        return false;
+    }
+    string unit = Currency::prefix(account->getCurrency());
+    if (amount <= 0 || amount > hold->amount) {
+        cout << "Error: Settlement must be positive and at most the held " << unit << fixed << setprecision(2)
+             << hold->amount << "!" << endl;
+        auditLog.log(actorName(), AUDIT_SETTLE_HOLD, accountNumber, amount, false, 0, to_string(holdId));
+        return false;
+    }
+    if (!shard.settleHold(holdId, amount)) {
+        cerr << "Error: Shard " << shard.getIndex() << " " << shard.getError() << "!" << endl;
+        return false;
+    }
+    finishChange(shard);
+    auditLog.log(actorName(), AUDIT_SETTLE_HOLD, accountNumber, amount, true, 0, to_string(holdId));
+    cout << "Hold " << holdId << " settled for " << unit << fixed << setprecision(2) << amount << endl;
+    account = shard.find(accountNumber);
+    if (account) {
+        cout << "New balance: " << unit << account->getBalance() << endl;
+    }
+    return true;
+}
+
+// Release a hold without debiting the account
+bool BankingSystem::releaseHold(uint64_t holdId) {
+    LedgerShard& shard = *shardForHold(holdId);
+    lock_guard<mutex> lock(shard.getMutex());
+    const AccountHold* hold = shard.findHold(holdId);
+    if (!hold) {
+        cout << "Error: No open hold " << holdId << " (settled, released or expired)!" << endl;
+        auditLog.log(actorName(), AUDIT_RELEASE_HOLD, 0, 0.0, false, 0, to_string(holdId));
+        return false;
+    }
+    int accountNumber = hold->accountNumber;
+    double amount = hold->amount;
+    if (!shard.releaseHold(holdId)) {
+        cerr << "Error: Shard " << shard.getIndex() << " " << shard.getError() << "!" << endl;
+        return false;
+    }
+    finishChange(shard);
+    auditLog.log(actorName(), AUDIT_RELEASE_HOLD, accountNumber, amount, true, 0, to_string(holdId));
+    // A hold left over from before its account was closed and purged has no account to show
+    BankAccount* account = shard.find(accountNumber);
+    cout << "Hold " << holdId << " released; " << (account ? Currency::prefix(account->getCurrency()) : "")
+         << fixed << setprecision(2) << amount << " available again." << endl;
+    return true;
+}
+
+// Set an account's overdraft line and daily withdrawal limit (0 = none)
+bool BankingSystem::setAccountLimits(int accountNumber, double overdraftLimit, double dailyLimit) {
+    if (overdraftLimit < 0 || dailyLimit < 0) {
+        cout << "Error: Limits cannot be negative!" << endl;
+        return false;
+    }
+    LedgerShard& shard = shardFor(accountNumber);
+    lock_guard<mutex> lock(shard.getMutex());
+    BankAccount* account = findAccount(accountNumber);
+    if (!account || account->isClosed()) {
+        cout << (account ? "Error: Account is closed!" : "Account not found!") << endl;
+        auditLog.log(actorName(), AUDIT_SET_LIMITS, accountNumber, overdraftLimit, false);
+        return false;
+    }
+    if (!shard.setLimits(*account, overdraftLimit, dailyLimit)) {
+        cerr << "Error: Shard " << shard.getIndex() << " " << shard.getError() << "!" << endl;
+        return false;
+    }
+    finishChange(shard);
+    auditLog.log(actorName(), AUDIT_SET_LIMITS, accountNumber, overdraftLimit, true);
+    cout << "Limits updated for account " << accountNumber << endl;
+    string unit = Currency::prefix(account->getCurrency());
+    cout << "Overdraft line: " << unit << fixed << setprecision(2) << overdraftLimit << endl;
+    if (dailyLimit > 0) {
+        cout << "Daily limit: " << unit << dailyLimit << endl;
+    } else {
+        cout << "Daily limit: none" << endl;
+    }
+    return true;
+}
+
+// Release expired holds on every shard (run by the background thread; each
+// debit also expires its own shard's holds first)
+size_t BankingSystem::expireHolds() {
+    size_t expired = 0;
+    for (auto& shard : shards) {
+        lock_guard<mutex> lock(shard->getMutex());
+        size_t count = shard->expireHolds(time(0));
+        if (count > 0) {
+            finishChange(*shard);
+        }
+        expired += count;
+    }
+    holdsExpired += expired;
+    return expired;
+}
+
+// Score a deposit, withdrawal or transfer on its (source) account's shard,
+// under that shard's lock. Returns false if it is held for review instead
+// of applied; otherwise reasons says whether to flag it once applied.
+// Items being approved are not scored again.
+bool BankingSystem::screenTransaction(LedgerShard& shard, CommandId operation, int accountNumber, int toAccount,
+                                      double amount, uint32_t& reasons) {
+    reasons = 0;
+    if (applyingReview || amount <= 0) {
+        return true;
+    }
+    reasons = shard.getRiskStage().score(accountNumber, amount, static_cast<int64_t>(time(0)));
+    if (reasons == 0 || riskAction != RISK_HOLD) {
+        return true;
+    }
+    ReviewItem item;
+    item.createdAt = static_cast<int64_t>(time(0));
+    item.operation = operation;
+    item.accountNumber = accountNumber;
+    item.toAccount = toAccount;
+    item.amount = amount;
+    item.reasons = reasons;
+    item.held = true;
+    item.user = string(actorName());
+    int32_t itemId = reviewQueue.add(item);
+    auditLog.log(actorName(), AUDIT_RISK_HELD, accountNumber, amount, itemId != 0, toAccount,
+                 RiskStage::describe(reasons));
+    if (itemId == 0) {
+        cout << "Error: Transaction needs review but could not be queued!" << endl;
+        return false;
+    }
+    cout << "Transaction held for review (" << RiskStage::describe(reasons) << "): item " << itemId
+         << "; it is applied if a reviewer approves it." << endl;
+    return false;
+}
+
+// Add an applied amount to the account's statistics and queue it for
+// review if it was flagged
+void BankingSystem::recordScreened(LedgerShard& shard, CommandId operation, int accountNumber, int toAccount,
+                                   double amount, uint32_t reasons) {
+    shard.getRiskStage().observe(accountNumber, amount, static_cast<int64_t>(time(0)));
+    if (reasons == 0) {
+        return;
+    }
+    ReviewItem item;
+    item.createdAt = static_cast<int64_t>(time(0));
+    item.operation = operation;
+    item.accountNumber = accountNumber;
+    item.toAccount = toAccount;
+    item.amount = amount;
+    item.reasons = reasons;
+    item.user = string(actorName());
+    int32_t itemId = reviewQueue.add(item);
+    auditLog.log(actorName(), AUDIT_RISK_FLAGGED, accountNumber, amount, true, toAccount,
+                 RiskStage::describe(reasons));
+    if (itemId != 0) {
+        cout << "Flagged for review (" << RiskStage::describe(reasons) << "): item " << itemId << endl;
+    }
+}
+
+// Move money between two accounts as one change. Both shards are locked
+// in index order, then the transfer runs two phases through the transfer
+// log: each shard checks it can take its leg (prepare), the decision is
+// logged (commit), and only then are the legs applied and journaled. A
+// request key is kept by the source account's shard. The amount is in the
+// source account's currency; a destination in another currency is credited
+// the amount converted at the loaded rates, and the commit record keeps it.
+bool BankingSystem::transfer(int fromAccount, int toAccount, double amount, const string& requestKey) {
+    if (amount <= 0) {
+        cout << "Error: Transfer amount must be positive!" << endl;
+        return false;
+    }
+    if (fromAccount == toAccount) {
+        cout << "Error: Cannot transfer to the same account!" << endl;
+        return false;
+    }
+    
+    LedgerShard& sourceShard = shardFor(fromAccount);
+    LedgerShard& destinationShard = shardFor(toAccount);
+    LedgerShard* first = sourceShard.getIndex() < destinationShard.getIndex() ? &sourceShard : &destinationShard;
+    LedgerShard* second = first == &sourceShard ? &destinationShard : &sourceShard;
+    unique_lock<mutex> firstLock(first->getMutex());
+    unique_lock<mutex> secondLock;
+    if (second != first) {
+        secondLock = unique_lock<mutex>(second->getMutex());
+    }
+    uint64_t keyHash = requestKey.empty() ? 0 : IdempotencyTable::hashKey(requestKey);
+    uint32_t fingerprint = IdempotencyTable::fingerprint(CMD_TRANSFER, fromAccount, toAccount, amount);
+    bool repeated = false;
+    if (keyHash != 0 && checkRequest(sourceShard, keyHash, fingerprint, repeated)) {
+        return repeated;
+    }
+    
+    uint64_t transferId = transferLog.begin(fromAccount, toAccount, amount);
+    if (transferId == 0) {
+        cerr << "Error: Could not write transfer log!" << endl;
+        return false;
+    }
+    
+    // Phase 1: prepare (holds expire first, so no lookup comes between
+    // finding the two accounts and using them)
+    holdsExpired += sourceShard.expireHolds(time(0));
+    BankAccount* source = sourceShard.find(fromAccount);
+    BankAccount* destination = destinationShard.find(toAccount);
+    if (!source || !destination) {
+        transferLog.abort(transferId);
+        cout << "Error: Account not found!" << endl;
+        auditLog.log(actorName(), AUDIT_TRANSFER, fromAccount, amount, false, toAccount);
+        return false;
+    }
+    if (source->isClosed() || destination->isClosed()) {
+        transferLog.abort(transferId);
+        cout << "Error: Account is closed!" << endl;
+        auditLog.log(actorName(), AUDIT_TRANSFER, fromAccount, amount, false, toAccount);
+        return false;
+    }
+    double creditAmount = amount;
+    if (!fxRates.convert(amount, source->getCurrency(), destination->getCurrency(), creditAmount)) {
+        transferLog.abort(transferId);
+        cout << "Error: No exchange rate between " << Currency::name(source->getCurrency()) << " and "
+             << Currency::name(destination->getCurrency()) << "!" << endl;
+        auditLog.log(actorName(), AUDIT_TRANSFER, fromAccount, amount, false, toAccount);
+        return false;
+    }
+    if (!source->canDebit(amount, BankAccount::epochDay(time(0)), false)) {
+        transferLog.abort(transferId);
+        auditLog.log(actorName(), AUDIT_TRANSFER, fromAccount, amount, false, toAccount);
+        return false;
+    }
+    uint32_t reasons = 0;
+    if (!screenTransaction(sourceShard, CMD_TRANSFER, fromAccount, toAccount, amount, reasons)) {
+        transferLog.abort(transferId);
+        return false;
+    }
+    
+    // Phase 2: commit, then apply both legs
+    if (!transferLog.commit(transferId, creditAmount)) {
+        transferLog.abort(transferId);
+        cerr << "Error: Could not write transfer log!" << endl;
+        return false;
+    }
+    source->postAdjustment("Transfer Out", -amount);
+    if (keyHash != 0) {
+        RequestOutcome outcome = makeRequestOutcome(sourceShard, keyHash, fingerprint, *source);
+        commitChange(sourceShard, *source, "Transfer Out", -amount, transferId, &outcome);
+    } else {
+        commitChange(sourceShard, *source, "Transfer Out", -amount, transferId);
+    }
+    destination->postAdjustment("Transfer In", creditAmount);
+    commitChange(destinationShard, *destination, "Transfer In", creditAmount, transferId);
+    crashPoint("transfer-before-end");
+    if (waitForLegs(sourceShard, destinationShard)) {
+        transferLog.end(transferId);
+    } else {
+        cerr << "Error: Transfer " << transferId << " could not be written to its shard journals;"
+             << " it will be completed at the next start!" << endl;
+    }
+    crashPoint("transfer-after-end");
+    checkpointIfFull(sourceShard);
+    if (&destinationShard != &sourceShard) {
+        checkpointIfFull(destinationShard);
+    }
+    recordScreened(sourceShard, CMD_TRANSFER, fromAccount, toAccount, amount, reasons);
+    auditLog.log(actorName(), AUDIT_TRANSFER, fromAccount, amount, true, toAccount);
+    
+    string unit = Currency::prefix(source->getCurrency());
+    cout << "Successfully transferred " << unit << fixed << setprecision(2) << amount
+         << " from " << fromAccount << " to " << toAccount << endl;
+    if (source->getCurrency() != destination->getCurrency()) {
+        cout << "Credited " << Currency::prefix(destination->getCurrency()) << creditAmount << " at "
+             << setprecision(6) << amount / creditAmount << " " << Currency::name(source->getCurrency()) << " per "
+             << Currency::name(destination->getCurrency()) << setprecision(2) << endl;
+    }
+    cout << "New balance: " << unit << source->getBalance() << endl;
+    return true;
+}
+
+// Finish transfers that committed but were interrupted before both legs
+// reached their shard journals (called after the shards are loaded; the
+// caller checkpoints every shard afterwards, and none may checkpoint before,
+// since that would forget the legs replayed from the journals)
+void BankingSystem::recoverTransfers() {
+    vector<TransferLog::PendingTransfer> pending = transferLog.recover();
+    for (const auto& transfer : pending) {
+        BankAccount* source = findAccount(transfer.fromAccount);
+        if (source && !shardFor(transfer.fromAccount).hasReplayedLeg(transfer.transferId, transfer.fromAccount)) {
+            source->postAdjustment("Transfer Out (recovered)", -transfer.amount);
+            commitChange(shardFor(transfer.fromAccount), *source, "Transfer Out (recovered)", -transfer.amount,
+                         transfer.transferId);
+        }
+        BankAccount* destination = findAccount(transfer.toAccount);
+        if (destination && !shardFor(transfer.toAccount).hasReplayedLeg(transfer.transferId, transfer.toAccount)) {
+            destination->postAdjustment("Transfer In (recovered)", transfer.creditAmount);
+            commitChange(shardFor(transfer.toAccount), *destination, "Transfer In (recovered)", transfer.creditAmount,
+                         transfer.transferId);
+        }
+        if (waitForLegs(shardFor(transfer.fromAccount), shardFor(transfer.toAccount))) {
+            transferLog.end(transfer.transferId);
+        }
+    }
+    if (!pending.empty()) {
+        cout << "\n*** Completed " << pending.size() << " interrupted transfer(s) ***\n" << endl;
+    }
+}
+
+// Checkpoint all shards: changed slots are written and the journals emptied.
+// Only slots touched since the last checkpoint are rewritten, so the cost is
+// proportional to the number of changes rather than the number of accounts.
+bool BankingSystem::saveToFile() {
+    BANK_TIMED(OP_SAVE_ACCOUNTS);
+    vector<unique_lock<mutex>> locks = lockAllShards();
+    return checkpointShards();
+}
+
+// Replace the shards with empty ones (nothing is read or written yet)
+void BankingSystem::createShards(int shardCount) {
+    int requestKeysPerShard = settings.getInt("idempotency_keys_per_shard", 4096);
+    int requestTtlHours = max(settings.getInt("idempotency_ttl_hours", 24), 1);
+    int holdExpiryHours = max(settings.getInt("hold_expiry_hours", 168), 1);
+    string riskStageKind = settings.getString("risk_stage", "rolling");
+    RiskConfig riskConfig;
+    riskConfig.windowSeconds = max(settings.getInt("risk_window_seconds", 60), 1);
+    riskConfig.maxPerWindow = max(settings.getInt("risk_max_per_window", 30), 1);
+    riskConfig.outlierFactor = max(settings.getInt("risk_outlier_factor", 8), 1);
+    riskConfig.minSamples = max(settings.getInt("risk_min_samples", 8), 1);
+    riskConfig.minAmount = max(settings.getInt("risk_min_amount", 1000), 0);
+    riskConfig.dormantSeconds = static_cast<int64_t>(max(settings.getInt("risk_dormant_days", 180), 1)) * 86400;
+    riskConfig.accountsPerShard = static_cast<size_t>(max(settings.getInt("risk_accounts_per_shard", 16384), 16));
+    size_t cacheBytes = static_cast<size_t>(max(settings.getInt("account_cache_mb", 0), 0)) * 1024 * 1024;
+    bool prefetchCold = settings.getBool("account_cache_prefetch", true);
+    for (auto& shard : shards) {
+        shard->setStorage(nullptr, false);    // Finishes and closes its queued writes
+    }
+    shards.clear();
+    for (int i = 0; i < shardCount; i++) {
+        shards.push_back(unique_ptr<LedgerShard>(new LedgerShard(i, shardCount, shardFileName(dataFileName, i, ".dat"),
+                                                                 shardFileName(dataFileName, i, ".journal"),
+                                                                 shardFileName(dataFileName, i, ".keys"),
+                                                                 shardFileName(dataFileName, i, ".holds"),
+                                                                 shardFileName(dataFileName, i, ".merkle"),
+                                                                 shardFileName(dataFileName, i, ".verified"))));
+        shards.back()->configureRequests(static_cast<size_t>(max(requestKeysPerShard, 1)), requestTtlHours * 3600);
+        shards.back()->configureHolds(holdExpiryHours * 3600);
+        shards.back()->setRiskStage(RiskStage::create(riskStageKind, riskConfig));
+        shards.back()->setStorage(storage.get(), storageSync);
+        if (cacheBytes > 0) {
+            shards.back()->configureCache(cacheBytes / static_cast<size_t>(shardCount),
+                                          shardFileName(dataFileName, i, ".pages"), prefetchCold);
+        }
+    }
+}
+
+// Load all shards in parallel, migrating older data files on first start
+bool BankingSystem::loadFromFile() {
+    BANK_TIMED(OP_LOAD_ACCOUNTS);
+    
+    // An existing ledger keeps the shard count it was created with
+    int shardCount = settings.getInt("shard_count", 4);
+    LedgerShard::finishRewrite(shardFileName(dataFileName, 0, ".dat"));
+    LedgerFile firstShard(shardFileName(dataFileName, 0, ".dat"));
+    bool existing = firstShard.exists();
+    if (existing) {
+        LedgerHeader header;
+        if (!firstShard.readHeader(header)) {
+            cerr << "Error: " << shardFileName(dataFileName, 0, ".dat") << " is corrupt or has an unsupported format!" << endl;
+            return false;
+        }
+        if (header.shardCount != shardCount) {
+            cout << "Note: Ledger has " << header.shardCount << " shard(s); shard_count applies to new ledgers only." << endl;
+        }
+        shardCount = header.shardCount;
+    }
+    firstShard.close();
+    if (shardCount < 1) {
+        shardCount = 1;
+    }
+    
+    createShards(shardCount);
+    
+    if (!existing) {
+        // First run with shards: migrate the single-file or text ledger if present
+        vector<BankAccount> loaded;
+        bool migrated = loadSingleFileLedger(loaded) || loadLegacyFile(loaded);
+        LedgerMeta meta = currentMeta();
+        for (auto& shard : shards) {
+            if (!shard->create(meta)) {
+                cerr << "Error: Could not create data file!" << endl;
+                return false;
+            }
+        }
+        for (const auto& account : loaded) {
+            shardFor(account.getAccountNumber()).loadAccount(account);
+        }
+        saveToFile();
+        transferLog.truncate();
+        return migrated;
+    }
+    
+    // Each shard reads its own files, so they load side by side; within a
+    // shard the slots are parsed in chunks on the shared worker pool
+    vector<LedgerMeta> metas(shards.size());
+    vector<char> results(shards.size(), 0);
+    vector<thread> workers;
+    for (size_t i = 0; i < shards.size(); i++) {
+        workers.emplace_back([this, &metas, &results, i]() {
+            results[i] = shards[i]->load(metas[i], workerPool) ? 1 : 0;
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    
+    int32_t nextAccountNumber = 0;
+    for (size_t i = 0; i < shards.size(); i++) {
+        if (!results[i]) {
+            cerr << "Error: " << shardFileName(dataFileName, static_cast<int>(i), ".dat") << " "
+                 << shards[i]->getError() << "!" << endl;
+            return false;
+        }
+        nextAccountNumber = max(nextAccountNumber, metas[i].nextAccountNumber);
+        lastPostingDay = max(lastPostingDay, metas[i].lastPostingDay);
+    }
+    accountNumbers.restore(nextAccountNumber);
+    
+    // Slots whose record no longer matches the hash saved with it were
+    // changed on disk outside the ledger
+    slotsChangedOnDisk = 0;
+    for (size_t i = 0; i < shards.size(); i++) {
+        for (int slot : shards[i]->getIntegrityMismatches()) {
+            int owner = shards[i]->getSlotOwner(slot);
+            if (slotsChangedOnDisk++ < 10) {
+                cout << "Warning: " << shardFileName(dataFileName, static_cast<int>(i), ".dat") << " slot " << slot;
+                if (owner != 0) {
+                    cout << " (account " << owner << ")";
+                }
+                cout << " was changed on disk since it was saved!" << endl;
+            }
+            auditLog.log("system", AUDIT_VERIFY_INTEGRITY, owner, 0.0, false, 0, "changed on disk");
+        }
+    }
+    if (slotsChangedOnDisk > 10) {
+        cout << "Warning: ... and " << slotsChangedOnDisk - 10 << " more slot(s) changed on disk!" << endl;
+    }
+    
+    // Shards run in parallel, so each phase took as long as its slowest shard
+    ShardLoadStats slowest;
+    for (const auto& shard : shards) {
+        const ShardLoadStats& stats = shard->getLoadStats();
+        slowest.readMs = max(slowest.readMs, stats.readMs);
+        slowest.parseMs = max(slowest.parseMs, stats.parseMs);
+        slowest.indexMs = max(slowest.indexMs, stats.indexMs);
+        slowest.replayMs = max(slowest.replayMs, stats.replayMs);
+        slowest.replayedRecords += stats.replayedRecords;
+    }
+    recordPhase("  Shard files read", slowest.readMs);
+    recordPhase("  Slots parsed (thread pool)", slowest.parseMs);
+    recordPhase("  Store and index built", slowest.indexMs);
+    recordPhase("  Journals replayed (" + to_string(slowest.replayedRecords) + ")", slowest.replayMs);
+    
+    // Settle interrupted transfers, then fold the replayed journals into the slots
+    auto phaseStart = chrono::steady_clock::now();
+    recoverTransfers();
+    saveToFile();
+    transferLog.truncate();
+    ledgerVersion++;
+    recordPhase("  Recovery and checkpoint", msSince(phaseStart));
+    
+    size_t count = getAccountCount();
+    if (count > 0) {
+        cout << "\n*** Loaded " << count << " account(s) from " << shards.size() << " shard(s) ***\n" << endl;
+    }
+    
+    return true;
+}
+
+// Load accounts from the single bank_data.dat file used before sharding
+bool BankingSystem::loadSingleFileLedger(vector<BankAccount>& loaded) {
+    LedgerFile singleFile(dataFileName);
+    if (!singleFile.exists()) {
+        return false;
+    }
+    
+    LedgerHeader header;
+    if (!singleFile.readHeader(header)) {
+        cerr << "Error: " << dataFileName << " is corrupt or has an unsupported format!" << endl;
+        return false;
+    }
+    vector<AccountRecord> records(header.slotCount);
+    if (!singleFile.readSlots(0, header.slotCount, records.data())) {
+        cerr << "Error: " << dataFileName << " is truncated!" << endl;
+        return false;
+    }
+    accountNumbers.restore(header.nextAccountNumber);
+    lastPostingDay = header.lastPostingDay;
+    
+    for (auto& record : records) {
+        if (record.accountNumber == 0) {
+            continue;
+        }
+        record.holderName[sizeof(record.holderName) - 1] = '\0';
+        AccountType type = CHECKING;
+        if (record.accountType >= 0 && record.accountType < ACCOUNT_TYPE_COUNT) {
+            type = static_cast<AccountType>(record.accountType);
+        }
+        loaded.push_back(BankAccount(record.accountNumber, record.holderName, record.balance, type));
+    }
+    
+    cout << "\n*** Migrated " << loaded.size() << " account(s) from " << dataFileName << " ***\n" << endl;
+    return true;
+}
+
+// Load accounts from the old bank_data.txt text format
+bool BankingSystem::loadLegacyFile(vector<BankAccount>& loaded) {
+    ifstream inFile(legacyDataFileName);
+    if (!inFile) {
+        // File doesn't exist yet, not an error
+        return false;
+    }
+    
+    // Load next account number
+    int nextAccountNumber = 1001;
+    inFile >> nextAccountNumber;
+    accountNumbers.restore(nextAccountNumber);
+    
+    // Load number of accounts
+    int numAccounts;
+    inFile >> numAccounts;
+    inFile.ignore(); // Clear newline
+    
+    // Load each account
+    for (int i = 0; i < numAccounts; i++) {
+        int accNum;
+        string name;
+        double balance;
+        
+        inFile >> accNum;
+        inFile.ignore(); // Clear newline
+        getline(inFile, name);
+        inFile >> balance;
+        inFile.ignore(); // Clear newline
+        
+        loaded.push_back(BankAccount(accNum, name, balance));
+    }
+    
+    inFile.close();
+    
+    if (numAccounts > 0) {
+        cout << "\n*** Migrated " << numAccounts << " account(s) from " << legacyDataFileName << " ***\n" << endl;
+    }
+    
+    return true;
+}
+
+// Apply computed postings to the in-memory accounts, totalling them in the
+// base currency (caller holds all shard locks; the batch file covers a
+// crash until the checkpoint)
+void BankingSystem::applyPostings(const vector<Posting>& postings, double& totalInterest, double& totalFees) {
+    for (const auto& posting : postings) {
+        LedgerShard& shard = shardFor(posting.accountNumber);
+        BankAccount* account = shard.find(posting.accountNumber);
+        if (!account) {
+            continue;
+        }
+        double interest = 0.0;
+        double fees = 0.0;
+        if (fxRates.convert(posting.interestCents / 100.0, account->getCurrency(), fxRates.getBase(), interest) &&
+            fxRates.convert(posting.feeCents / 100.0, account->getCurrency(), fxRates.getBase(), fees)) {
+            totalInterest += interest;
+            totalFees += fees;
+        }
+        if (posting.interestCents != 0) {
+            account->postAdjustment("Interest", posting.interestCents / 100.0);
+        }
+        if (posting.feeCents != 0) {
+            account->postAdjustment("Maintenance Fee", -posting.feeCents / 100.0);
+        }
+        shard.markDirty(posting.accountNumber);
+        shard.shipChange(*account, "Interest", (posting.interestCents - posting.feeCents) / 100.0);
+    }
+    ledgerVersion++;
+}
+
+// Finish a posting batch that was interrupted before it was saved
+void BankingSystem::recoverPostingBatch() {
+    int32_t batchDay = 0;
+    vector<Posting> postings;
+    if (!postingEngine.readBatch(batchDay, postings)) {
+        return;
+    }
+    
+    if (batchDay > lastPostingDay) {
+        // The batch stores final balances, so re-applying it is safe even
+        // for accounts whose slots were already written before the crash
+        for (const auto& posting : postings) {
+            LedgerShard& shard = shardFor(posting.accountNumber);
+            BankAccount* account = shard.find(posting.accountNumber);
+            if (!account) {
+                continue;
+            }
+            int64_t delta = posting.newBalanceCents - PostingEngine::toCents(account->getBalance());
+            if (delta != 0) {
+                account->postAdjustment("Interest Posting (recovered)", delta / 100.0);
+                shard.markDirty(posting.accountNumber);
+            }
+        }
+        lastPostingDay = batchDay;
+        ledgerVersion++;
+        if (!saveToFile()) {
+            return;
+        }
+        cout << "\n*** Recovered interrupted interest posting (" << postings.size() << " account(s)) ***\n" << endl;
+    }
+    postingEngine.clearBatch();
+}
+
+// Post interest and maintenance fees for every day since the last run.
+// The run is keyed by day number, so running it again on the same day
+// posts nothing. When scheduled, it stays quiet unless a batch was posted.
+void BankingSystem::runInterestPosting(bool scheduled) {
+    int32_t today = PostingEngine::today();
+    
+    if (lastPostingDay == 0) {
+        // First run: start the schedule today without back-dating interest
+        lastPostingDay = today;
+        saveToFile();
+        if (!scheduled) {
+            cout << "Interest schedule started. Interest accrues from today." << endl;
+        }
+        return;
+    }
+    
+    if (today <= lastPostingDay) {
+        if (!scheduled) {
+            cout << "Interest and fees are already posted for today. Nothing to do." << endl;
+        }
+        return;
+    }
+    
+    int days = today - lastPostingDay;
+    int monthsCrossed = PostingEngine::monthsBetween(lastPostingDay, today);
+    auto start = chrono::steady_clock::now();
+    
+    vector<unique_lock<mutex>> locks = lockAllShards();
+    vector<Posting> postings;
+    size_t accountCount = 0;
+    for (auto& shard : shards) {
+        if (shard->isBounded()) {
+            // Cold accounts are read from disk one at a time, not cached
+            shard->forEachAccount([this, days, monthsCrossed, &postings](const BankAccount& account) {
+                postingEngine.computeAccount(account, days, monthsCrossed, postings);
+            });
+        } else {
+            vector<Posting> shardPostings = postingEngine.computePostings(shard->getAccounts(), days, monthsCrossed);
+            postings.insert(postings.end(), shardPostings.begin(), shardPostings.end());
+        }
+        accountCount += shard->size();
+    }
+    
+    // Commit: intent file first, then accounts, then the headers with the new day
+    if (!postingEngine.writeBatch(today, postings)) {
+        return;
+    }
+    // Postings are in each account's currency; the totals are in the base
+    double totalInterest = 0.0;
+    double totalFees = 0.0;
+    applyPostings(postings, totalInterest, totalFees);
+    lastPostingDay = today;
+    if (!checkpointShards()) {
+        return;
+    }
+    postingEngine.clearBatch();
+    locks.clear();
+    double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    auditLog.log(actorName(), AUDIT_INTEREST_POSTING, 0, totalInterest - totalFees, true, 0,
+                 to_string(postings.size()) + " accounts");
+    
+    cout << "\n*** Interest Posting Complete ***" << endl;
+    cout << "Days accrued: " << days << ", month-end fees: " << monthsCrossed << endl;
+    cout << "Accounts posted: " << postings.size() << " of " << accountCount << endl;
+    string unit = Currency::prefix(fxRates.getBase());
+    cout << "Total interest: " << unit << fixed << setprecision(2) << totalInterest << endl;
+    cout << "Total fees: " << unit << totalFees << endl;
+    cout << "Elapsed: " << elapsedMs << " ms\n" << endl;
+}
+
+// Export accounts to JSON format (from a snapshot, so totals are consistent)
+void BankingSystem::exportToJSON(string filename) {
+    SnapshotManager::ReadGuard snapshot = readSnapshot();
+    
+    ostringstream outFile;
+    const vector<AccountView>& views = snapshot->accounts;
+    outFile << "{\n";
+    outFile << "  \"bankingSystem\": {\n";
+    outFile << "    \"nextAccountNumber\": " << snapshot->nextAccountNumber << ",\n";
+    outFile << "    \"snapshotVersion\": " << snapshot->version << ",\n";
+    outFile << "    \"baseCurrency\": \"" << Currency::name(fxRates.getBase()) << "\",\n";
+    outFile << "    \"totalBalance\": " << fixed << setprecision(2) << snapshot->totalBalance << ",\n";
+    outFile << "    \"accounts\": [\n";
+    
+    for (size_t i = 0; i < views.size(); i++) {
+        outFile << "      {\n";
+        outFile << "        \"accountNumber\": " << views[i].accountNumber << ",\n";
+        outFile << "        \"accountHolder\": \"" << views[i].holderName << "\",\n";
+        outFile << "        \"currency\": \"" << Currency::name(views[i].currency) << "\",\n";
+        outFile << "        \"balance\": " << fixed << setprecision(2) << views[i].balance << "\n";
+        outFile << "      }";
+        if (i < views.size() - 1) {
+            outFile << ",";
+        }
+        outFile << "\n";
+    }
+    
+    outFile << "    ]\n";
+    outFile << "  }\n";
+    outFile << "}\n";
+    
+    if (!storage->replaceAndWait(filename, outFile.str(), storageSync)) {
+        cout << "Error: Could not create JSON file!" << endl;
+        return;
+    }
+    cout << "\n*** Data exported to " << filename << " ***\n" << endl;
+}
+
+// Write the month's statement for every account that had a balance or
+// activity in it. Chunks of account numbers are spread over the worker
+// pool; each copies its accounts' entries under the shard lock, then
+// formats them with the lock released into a buffer the thread reuses.
+// Finished chunks are recorded, so an interrupted run picks up where it
+// stopped when the same month is run again.
+bool BankingSystem::generateStatements(const string& month) {
+    StatementRun run;
+    if (!run.setPeriod(month)) {
+        cout << "Error: Month must be YYYY-MM and not in the future!" << endl;
+        return false;
+    }
+    auto start = chrono::steady_clock::now();
+    if (!run.open(accountNumbers.getHighWater(), static_cast<int>(shards.size()))) {
+        return false;
+    }
+    if (run.isResumed()) {
+        cout << "Resuming the interrupted run for " << run.getPeriod() << " (" << run.getStatementsResumed()
+             << " statements already written)." << endl;
+    }
+
+    time_t periodStart = run.getPeriodStart();
+    time_t periodEnd = run.getPeriodEnd();
+    size_t chunkCount = run.getChunkCount();
+    int shardCount = static_cast<int>(shards.size());
+    atomic<bool> failed(false);
+    workerPool.parallelFor(chunkCount * shards.size(), [&](size_t task) {
+        int shardIndex = static_cast<int>(task % shards.size());
+        size_t chunk = task / shards.size();
+        if (failed.load() || run.isDone(shardIndex, chunk)) {
+            return;
+        }
+        // Reused by every chunk this worker formats
+        static thread_local vector<StatementInput> inputs;
+        static thread_local string text;
+        
+        pair<int32_t, int32_t> range = run.chunkRange(chunk);
+        int32_t first = range.first + (shardIndex - range.first % shardCount + shardCount) % shardCount;
+        size_t used = 0;
+        {
+            LedgerShard& shard = *shards[static_cast<size_t>(shardIndex)];
+            lock_guard<mutex> lock(shard.getMutex());
+            optional<BankAccount> copy;     // A cold account, read without caching it
+            for (int32_t number = first; number < range.second; number += shardCount) {
+                const BankAccount* account = shard.peek(number, copy);
+                if (!account || (account->isClosed() && account->getClosedAt() < periodStart)) {
+                    continue;
+                }
+                if (used == inputs.size()) {
+                    inputs.emplace_back();
+                }
+                StatementInput& input = inputs[used];
+                input.entries.clear();
+                bool seen = false;
+                double opening = 0.0;
+                account->getHistory().forEach(0, periodStart - 1, [&](size_t, const Transaction& entry) {
+                    opening = entry.balanceAfter;
+                    seen = true;
+                });
+                account->getHistory().forEach(periodStart, periodEnd, [&](size_t, const Transaction& entry) {
+                    input.entries.push_back(entry);
+                });
+                if (!seen && input.entries.empty()) {
+                    continue;           // Opened after the month, or never used
+                }
+                input.accountNumber = account->getAccountNumber();
+                input.accountType = account->getAccountType();
+                input.currency = account->getCurrency();
+                input.holderName = account->getAccountHolderName();
+                input.openingBalance = opening;
+                used++;
+            }
+        }
+        StatementRun::Chunk output(run, shardIndex, chunk, text);
+        for (size_t i = 0; i < used; i++) {
+            output.add(inputs[i]);
+        }
+        if (!output.commit()) {
+            failed = true;
+        }
+    });
+    bool finished = !failed.load() && run.finish();
+    if (!finished) {
+        cout << "Error: Could not write the statements for " << run.getPeriod()
+             << "; run the month again to resume!" << endl;
+        return false;
+    }
+    
+    double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    uint64_t total = run.getStatementsResumed() + run.getStatementsWritten();
+    auditLog.log(actorName(), AUDIT_STATEMENTS, 0, 0.0, true, 0, run.getPeriod());
+    
+    cout << "\n*** Statements for " << run.getPeriod() << " Complete ***" << endl;
+    cout << "Statements: " << total;
+    if (run.isResumed()) {
+        cout << " (" << run.getStatementsWritten() << " written now)";
+    }
+    cout << endl;
+    cout << "Files: " << run.outputFileName(0) << " .. " << run.outputFileName(shardCount - 1) << " ("
+         << run.getBytesWritten() / 1024 << " KB)" << endl;
+    cout << "Elapsed: " << fixed << setprecision(2) << elapsedMs << " ms";
+    if (elapsedMs > 0) {
+        cout << " (" << static_cast<uint64_t>(run.getStatementsWritten() * 1000.0 / elapsedMs) << " statements/s)";
+    }
+    cout << "\n" << endl;
+    return true;
+}
+
+// Slots audited per worker task during verification
+static const size_t VERIFY_CHUNK_SLOTS = 16384;
+
+// Audit the ledger against its Merkle trees with every shard locked.
+// Each slot's leaf is recomputed from its account (its history audited
+// against its balance on the way) and compared with the leaf the shard
+// kept up to date as it changed. A full check covers every slot and
+// compares each shard's rebuilt root with its live one; a quick check
+// diffs each live tree against the tree saved at the last verification
+// that passed and audits only the slots under differing subtrees. Slots
+// found changed on disk at startup also fail verification.
+bool BankingSystem::verifyIntegrity(bool full) {
+    auto start = chrono::steady_clock::now();
+    vector<unique_lock<mutex>> locks = lockAllShards();
+    
+    // Slots to audit in each shard
+    vector<vector<int>> changedSlots(shards.size());
+    vector<char> wholeShard(shards.size(), 0);
+    size_t totalSlots = 0;
+    size_t nodesCompared = 0;
+    for (size_t i = 0; i < shards.size(); i++) {
+        const LedgerShard& shard = *shards[i];
+        totalSlots += shard.getSlotCount();
+        if (full || !shard.hasVerifiedTree()) {
+            wholeShard[i] = 1;
+            continue;
+        }
+        vector<size_t> changed;
+        nodesCompared += shard.getIntegrityTree().diff(shard.getVerifiedTree(), changed);
+        for (size_t slot : changed) {
+            if (slot < shard.getSlotCount()) {
+                changedSlots[i].push_back(static_cast<int>(slot));
+            }
+        }
+    }
+    
+    // Tasks of up to VERIFY_CHUNK_SLOTS slots: (shard, first position)
+    vector<pair<size_t, size_t>> tasks;
+    vector<vector<uint64_t>> rebuiltLeaves(shards.size());
+    size_t slotsChecked = 0;
+    for (size_t i = 0; i < shards.size(); i++) {
+        size_t count = wholeShard[i] ? shards[i]->getSlotCount() : changedSlots[i].size();
+        if (full) {
+            rebuiltLeaves[i].resize(count);
+        }
+        for (size_t first = 0; first < count; first += VERIFY_CHUNK_SLOTS) {
+            tasks.push_back(make_pair(i, first));
+        }
+        slotsChecked += count;
+    }
+    
+    mutex problemsMutex;
+    vector<string> problems;
+    auto report = [&problems, &problemsMutex](const string& problem) {
+        lock_guard<mutex> lock(problemsMutex);
+        problems.push_back(problem);
+    };
+    workerPool.parallelFor(tasks.size(), [&](size_t task) {
+        size_t shardIndex = tasks[task].first;
+        const LedgerShard& shard = *shards[shardIndex];
+        const MerkleTree& tree = shard.getIntegrityTree();
+        size_t count = wholeShard[shardIndex] ? shard.getSlotCount() : changedSlots[shardIndex].size();
+        size_t end = min(tasks[task].second + VERIFY_CHUNK_SLOTS, count);
+        for (size_t position = tasks[task].second; position < end; position++) {
+            int slot = wholeShard[shardIndex] ? static_cast<int>(position) : changedSlots[shardIndex][position];
+            uint64_t leaf = 0;
+            string problem;
+            bool ok = shard.auditSlot(slot, leaf, problem);
+            if (ok && leaf != tree.getLeaf(static_cast<size_t>(slot))) {
+                ok = false;
+                problem = "slot hash is out of date in the ledger's tree";
+            }
+            if (full) {
+                rebuiltLeaves[shardIndex][position] = leaf;
+            }
+            if (!ok) {
+                int owner = shard.getSlotOwner(slot);
+                report("Shard " + to_string(shardIndex) + " slot " + to_string(slot) +
+                       (owner != 0 ? " (account " + to_string(owner) + ")" : "") + ": " + problem);
+            }
+        }
+    });
+    
+    // A full check also rebuilds each shard's tree and compares roots
+    if (full) {
+        workerPool.parallelFor(shards.size(), [&](size_t i) {
+            MerkleTree rebuilt;
+            rebuilt.assign(rebuiltLeaves[i]);
+            if (rebuilt.root() != shards[i]->getIntegrityTree().root()) {
+                report("Shard " + to_string(i) + ": rebuilt root does not match the ledger's root");
+            }
+        });
+    }
+    for (size_t i = 0; i < shards.size(); i++) {
+        for (int slot : shards[i]->getIntegrityMismatches()) {
+            int owner = shards[i]->getSlotOwner(slot);
+            report("Shard " + to_string(i) + " slot " + to_string(slot) +
+                   (owner != 0 ? " (account " + to_string(owner) + ")" : "") + ": changed on disk before startup");
+        }
+    }
+    
+    // A pass becomes the tree the next quick check is measured against
+    bool passed = problems.empty();
+    if (passed) {
+        for (auto& shard : shards) {
+            if (!shard->saveVerifiedTree()) {
+                cout << "Error: Could not save the verified tree of shard " << shard->getIndex() << "!" << endl;
+            }
+        }
+    }
+    locks.clear();
+    
+    double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    sort(problems.begin(), problems.end());
+    time_t now = time(0);
+    tm timeInfo;
+    localtime_s(&timeInfo, &now);
+    char when[32];
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &timeInfo);
+    lastVerification = string(full ? "full" : "quick") + (passed ? " passed" : " FAILED") + " at " + when;
+    auditLog.log(actorName(), AUDIT_VERIFY_INTEGRITY, 0, 0.0, passed, 0,
+                 string(full ? "full, " : "quick, ") + to_string(problems.size()) + " problem(s)");
+    
+    cout << "\n*** Integrity Verification (" << (full ? "full" : "quick") << ") ***" << endl;
+    cout << "Slots audited: " << slotsChecked << " of " << totalSlots << " in " << shards.size() << " shard(s)";
+    if (!full) {
+        cout << " (" << nodesCompared << " tree nodes compared)";
+    }
+    cout << endl;
+    for (size_t i = 0; i < problems.size() && i < 20; i++) {
+        cout << "  " << problems[i] << endl;
+    }
+    if (problems.size() > 20) {
+        cout << "  ... and " << problems.size() - 20 << " more" << endl;
+    }
+    cout << "Result: " << (passed ? "PASSED" : "FAILED (" + to_string(problems.size()) + " problem(s))") << endl;
+    cout << "Elapsed: " << fixed << setprecision(2) << elapsedMs << " ms\n" << endl;
+    return passed;
+}
+
+// Show the oldest open review items and the screening counts
+void BankingSystem::displayReviewQueue() {
+    vector<ReviewItem> items = reviewQueue.list(20);
     cout << "\n========================================" << endl;
-    cout << "         ALL BANK ACCOUNTS" << endl;
+    cout << "         RISK REVIEW QUEUE" << endl;
     cout << "========================================" << endl;
-    
-    if (accounts.empty()) {
-        cout << "No accounts in the system." << endl;
-    } else {
-        cout << left << setw(15) << "Account #" 
-             << setw(25) << "Account Holder" 
-             << right << setw(15) << "Balance" << endl;
+    cout << "Stage: " << (shards.empty() ? "none" : shards[0]->getRiskStage().name()) << ", action: "
+         << (riskAction == RISK_HOLD ? "hold" : "flag") << endl;
+    cout << "Flagged since start: " << reviewQueue.getFlaggedCount() << " (" << reviewQueue.getDroppedCount()
+         << " not queued, queue full), held: " << reviewQueue.getHeldCount() << endl;
+    cout << "Open items: " << reviewQueue.size() << endl;
+    if (!items.empty()) {
         cout << "----------------------------------------" << endl;
-        
-        for (const auto& account : accounts) {
-            cout << left << setw(15) << account.getAccountNumber()
-                 << setw(25) << account.getAccountHolderName()
-                 << right << setw(15) << fixed << setprecision(2) 
-                 << "$" << account.getBalance() << endl;
-        }
+        cout << left << setw(7) << "Item" << setw(10) << "Status" << setw(10) << "Type" << setw(10) << "Account"
+             << setw(10) << "To" << right << setw(14) << "Amount" << "  " << left << setw(19) << "Reasons"
+             << "By" << endl;
+    }
+    for (const auto& item : items) {
+        const char* type = item.operation == CMD_WITHDRAW ? "withdraw" :
+                           item.operation == CMD_TRANSFER ? "transfer" : "deposit";
+        cout << left << setw(7) << item.id << setw(10) << (item.held ? "HELD" : "applied") << setw(10) << type
+             << setw(10) << item.accountNumber << setw(10) << (item.toAccount != 0 ? to_string(item.toAccount) : "-")
+             << right << setw(14) << fixed << setprecision(2) << item.amount << "  " << left << setw(19)
+             << RiskStage::describe(item.reasons) << item.user << endl;
+    }
+    if (reviewQueue.size() > items.size()) {
+        cout << "... and " << reviewQueue.size() - items.size() << " more" << endl;
     }
     cout << "========================================\n" << endl;
 }
 
-// Save all accounts to file
-bool BankingSystem::saveToFile() {
-    ofstream outFile(dataFileName);
-    if (!outFile) {
-        cerr << "Error: Could not open file for saving!" << endl;
+// Close a review item. Approving a held item runs it now, without screening
+// it again; if it fails (e.g. the funds are gone) the item stays queued.
+// Flagged items were applied already, so either decision only closes them.
+bool BankingSystem::resolveReview(int itemId, bool approve) {
+    ReviewItem item;
+    if (!reviewQueue.take(itemId, item)) {
+        cout << "Error: No open review item " << itemId << "!" << endl;
         return false;
     }
-    
-    // Save next account number
-    outFile << nextAccountNumber << endl;
-    
-    // Save number of accounts
-    outFile << accounts.size() << endl;
-    
-    // Save each account
-    for (const auto& account : accounts) {
-        outFile << account.getAccountNumber() << endl;
-        outFile << account.getAccountHolderName() << endl;
-        outFile << fixed << setprecision(2) << account.getBalance() << endl;
+    if (approve && item.held) {
+        applyingReview = true;
+        bool applied = false;
+        if (item.operation == CMD_DEPOSIT) {
+            applied = deposit(item.accountNumber, item.amount);
+        } else if (item.operation == CMD_WITHDRAW) {
+            applied = withdraw(item.accountNumber, item.amount);
+        } else if (item.operation == CMD_TRANSFER) {
+            applied = transfer(item.accountNumber, item.toAccount, item.amount);
+        }
+        applyingReview = false;
+        if (!applied) {
+            reviewQueue.putBack(item);
+            cout << "Approval failed; item " << itemId << " stays in the queue." << endl;
+            auditLog.log(actorName(), AUDIT_RISK_REVIEW, item.accountNumber, item.amount, false, item.toAccount,
+                         "approve " + to_string(itemId));
+            return false;
+        }
     }
-    
-    outFile.close();
+    reviewQueue.close(item, approve);
+    auditLog.log(actorName(), AUDIT_RISK_REVIEW, item.accountNumber, item.amount, true, item.toAccount,
+                 (approve ? "approve " : "reject ") + to_string(itemId));
+    cout << "Item " << itemId << (approve ? " approved" : " rejected")
+         << (item.held ? (approve ? " and applied." : "; it was not applied.") : ".") << endl;
     return true;
 }
 
-// Load all accounts from file
-bool BankingSystem::loadFromFile() {
-    ifstream inFile(dataFileName);
-    if (!inFile) {
-        // File doesn't exist yet, not an error
+// Accounts revalued by one worker task
+static const size_t REVALUE_CHUNK_ACCOUNTS = 1 << 18;
+
+// Value every open balance in one currency at the loaded rates. Each shard
+// keeps its balances and currencies as two columns, so the pass reads them
+// in runs of REVALUE_CHUNK_ACCOUNTS on the worker pool, one set of totals
+// per run; the runs are added up in order, so the figures are the same
+// whatever the thread count.
+bool BankingSystem::revalueLedger(CurrencyCode reportCurrency) {
+    vector<double> table;
+    if (!fxRates.ratesInto(reportCurrency, table)) {
+        cout << "Error: No exchange rate for " << Currency::name(reportCurrency) << "!" << endl;
         return false;
     }
+    auto start = chrono::steady_clock::now();
+    vector<unique_lock<mutex>> locks = lockAllShards();
     
-    accounts.clear();
-    
-    // Load next account number
-    inFile >> nextAccountNumber;
-    
-    // Load number of accounts
-    int numAccounts;
-    inFile >> numAccounts;
-    inFile.ignore(); // Clear newline
-    
-    // Load each account
-    for (int i = 0; i < numAccounts; i++) {
-        int accNum;
-        string name;
-        double balance;
-        
-        inFile >> accNum;
-        inFile.ignore(); // Clear newline
-        getline(inFile, name);
-        inFile >> balance;
-        inFile.ignore(); // Clear newline
-        
-        BankAccount account(accNum, name, balance);
-        accounts.push_back(account);
-    }
-    
-    inFile.close();
-    
-    if (numAccounts > 0) {
-        cout << "\n*** Loaded " << numAccounts << " account(s) from file ***\n" << endl;
+    // Tasks: (shard, first position)
+    vector<pair<size_t, size_t>> tasks;
+    size_t accountCount = 0;
+    for (size_t i = 0; i < shards.size(); i++) {
+        size_t count = shards[i]->getBalanceColumn().size();
+        for (size_t first = 0; first < count; first += REVALUE_CHUNK_ACCOUNTS) {
+            tasks.push_back(make_pair(i, first));
+        }
+        accountCount += count;
     }
+    vector<RevaluationTotals> partial(tasks.size());
+    workerPool.parallelFor(tasks.size(), [&](size_t task) {
+        const LedgerShard& shard = *shards[tasks[task].first];
+        size_t first = tasks[task].second;
+        size_t count = min(REVALUE_CHUNK_ACCOUNTS, shard.getBalanceColumn().size() - first);
+        FxRateTable::revalue(shard.getBalanceColumn().data() + first, shard.getCurrencyColumn().data() + first,
+                             count, table.data(), partial[task]);
+    });
+    locks.clear();
     
-    return true;
-}
-
-// Export accounts to JSON format
-void BankingSystem::exportToJSON(string filename) {
-    ofstream outFile(filename);
-    if (!outFile) {
-        cout << "Error: Could not create JSON file!" << endl;
-        return;
+    RevaluationTotals totals;
+    for (const auto& part : partial) {
+        totals.merge(part);
     }
+    double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
     
-    outFile << "{\n";
-    outFile << "  \"bankingSystem\": {\n";
-    outFile << "    \"nextAccountNumber\": " << nextAccountNumber << ",\n";
-    outFile << "    \"accounts\": [\n";
-    
-    for (size_t i = 0; i < accounts.size(); i++) {
-        outFile << "      {\n";
-        outFile << "        \"accountNumber\": " << accounts[i].getAccountNumber() << ",\n";
-        outFile << "        \"accountHolder\": \"" << accounts[i].getAccountHolderName() << "\",\n";
-        outFile << "        \"balance\": " << fixed << setprecision(2) << accounts[i].getBalance() << "\n";
-        outFile << "      }";
-        if (i < accounts.size() - 1) {
-            outFile << ",";
+    string unit = Currency::prefix(reportCurrency);
+    cout << "\n========================================" << endl;
+    cout << "   FX REVALUATION (" << Currency::name(reportCurrency) << ")" << endl;
+    cout << "========================================" << endl;
+    cout << left << setw(10) << "Currency" << right << setw(10) << "Accounts" << setw(18) << "Native Total"
+         << setw(12) << "Rate" << setw(18) << "Value" << endl;
+    cout << "----------------------------------------" << endl;
+    for (CurrencyCode code : fxRates.getCurrencies()) {
+        if (totals.accountCounts.empty() || totals.accountCounts[code] == 0) {
+            continue;
         }
-        outFile << "\n";
+        cout << left << setw(10) << Currency::name(code) << right << setw(10) << totals.accountCounts[code]
+             << setw(18) << fixed << setprecision(2) << totals.nativeTotals[code]
+             << setw(12) << setprecision(6) << table[code]
+             << setw(18) << setprecision(2) << totals.nativeTotals[code] * table[code] << endl;
     }
-    
-    outFile << "    ]\n";
-    outFile << "  }\n";
-    outFile << "}\n";
-    
-    outFile.close();
-    cout << "\n*** Data exported to " << filename << " ***\n" << endl;
+    cout << "----------------------------------------" << endl;
+    cout << "Credit balances: " << unit << totals.credit << endl;
+    cout << "Overdrawn balances: " << unit << totals.debit << endl;
+    cout << "Net position: " << unit << totals.credit + totals.debit << endl;
+    cout << "Accounts scanned: " << accountCount << " in " << tasks.size() << " task(s), kernel: "
+         << FxRateTable::kernelName() << endl;
+    cout << "Elapsed: " << elapsedMs << " ms" << endl;
+    cout << "========================================\n" << endl;
+    return true;
 }
 
-// Save users to file
+// Save users to file. The text is handed to the storage backend, which
+// replaces the file in the background; a failure is reported when it ends.
 bool BankingSystem::saveUsers() {
-    ofstream outFile(usersFileName);
-    if (!outFile) {
-        cerr << "Error: Could not open users file for saving!" << endl;
-        return false;
-    }
-    
-    outFile << users.size() << endl;
+    BANK_TIMED(OP_SAVE_USERS);
+    ostringstream outFile;
+    time_t now = time(0);
+    outFile << users.size() << "\n";
     for (const auto& user : users) {
-        outFile << user.getUsername() << endl;
-        outFile << user.getPasswordHash() << endl;
-        outFile << static_cast<int>(user.getRole()) << endl;
-        outFile << (user.getLocked() ? 1 : 0) << endl;
+        outFile << user.getUsername() << "\n";
+        outFile << user.getPasswordHash() << "\n";
+        outFile << static_cast<int>(user.getRole()) << "\n";
+        outFile << lockoutPolicy.serialize(user.getUsername(), now) << "\n";
     }
     
-    outFile.close();
+    storage->replace(usersFileName, outFile.str(), storageSync, [](bool ok) {
+        if (!ok) {
+            cerr << "Error: Could not save users file!" << endl;
+        }
+    });
     return true;
 }
 
@@ -225,17 +2175,19 @@ bool BankingSystem::loadUsers() {
     inFile >> numUsers;
     inFile.ignore();
     
+    time_t now = time(0);
     for (int i = 0; i < numUsers; i++) {
-        string username, passwordHash;
-        int roleInt, lockedInt;
+        string username, passwordHash, lockoutFields;
+        int roleInt;
         
         getline(inFile, username);
         getline(inFile, passwordHash);
         inFile >> roleInt;
-        inFile >> lockedInt;
         inFile.ignore();
+        getline(inFile, lockoutFields);  // Locked flag, then lockout state if present
         
-        users.push_back(User(username, passwordHash, static_cast<UserRole>(roleInt), lockedInt == 1));
+        users.push_back(User(username, passwordHash, static_cast<UserRole>(roleInt)));
+        lockoutPolicy.restore(username, lockoutFields, now);
     }
     
     inFile.close();
@@ -244,9 +2196,9 @@ bool BankingSystem::loadUsers() {
 
 // Create default users
 void BankingSystem::createDefaultUsers() {
-    users.push_back(User("admin", User::hashPassword("admin123"), ADMIN, false));
-    users.push_back(User("user1", User::hashPassword("pass123"), USER, false));
-    users.push_back(User("guest", User::hashPassword("guest123"), GUEST, false));
+    users.push_back(User("admin", User::hashPassword("admin123"), ADMIN));
+    users.push_back(User("user1", User::hashPassword("pass123"), USER));
+    users.push_back(User("guest", User::hashPassword("guest123"), GUEST));
     saveUsers();
     cout << "\n*** Default users created ***" << endl;
     cout << "Admin: username='admin', password='admin123'" << endl;
@@ -263,7 +2215,21 @@ User* BankingSystem::login() {
         cout << "           LOGIN SYSTEM" << endl;
         cout << "======================================" << endl;
         cout << "Username: ";
-        cin >> username;
+        // Input closed or unreadable: back to the main menu, which exits on end of input
+        if (!(cin >> username)) {
+            return nullptr;
+        }
+        
+        // Rate limit before any lookup or hashing; sit out the wait, then go
+        // back to the main menu rather than asking again at once
+        double waitSeconds = lockoutPolicy.acquireToken(loginSource);
+        if (waitSeconds > 0) {
+            auditLog.log(username, AUDIT_LOGIN_FAILED, 0, 0.0, false, 0, "rate limited");
+            cout << "\n*** TOO MANY LOGIN ATTEMPTS ***" << endl;
+            cout << "Please wait " << static_cast<int>(waitSeconds + 0.999) << " second(s) before trying again.\n" << endl;
+            this_thread::sleep_for(chrono::duration<double>(waitSeconds));
+            return nullptr;
+        }
         
         // Find user
         User* user = nullptr;
@@ -275,40 +2241,59 @@ User* BankingSystem::login() {
         }
         
         if (!user) {
+            auditLog.log(username, AUDIT_LOGIN_FAILED, 0, 0.0, false, 0, "unknown user");
             cout << "Error: Username not found!" << endl;
             cout << "Please try again.\n" << endl;
             continue;
         }
         
-        // Check if account is locked
-        if (user->getLocked()) {
+        // Check if account is locked (locks expire on their own)
+        int lockedSeconds = lockoutPolicy.lockedFor(username, time(0));
+        if (lockedSeconds > 0) {
+            auditLog.log(username, AUDIT_LOGIN_FAILED, 0, 0.0, false, 0, "account locked");
             cout << "\n*** ACCOUNT LOCKED ***" << endl;
-            cout << "This account has been locked due to too many failed login attempts." << endl;
-            cout << "Please contact an administrator or try a different account.\n" << endl;
+            cout << "This account is locked after too many failed login attempts." << endl;
+            cout << "Try again in " << lockedSeconds << " second(s) or contact an administrator.\n" << endl;
             continue;
         }
         
         cout << "Password: ";
-        cin >> password;
+        if (!(cin >> password)) {
+            return nullptr;
+        }
+        
+        // Time the credential check itself, not the time spent typing
+        bool authenticated;
+        {
+            BANK_TIMED(OP_LOGIN);
+            authenticated = user->authenticate(password);
+        }
         
-        if (user->authenticate(password)) {
-            user->resetFailedAttempts();
+        if (authenticated) {
+            lockoutPolicy.recordSuccess(username);
             saveUsers();
+            auditLog.log(username, AUDIT_LOGIN, 0, 0.0, true, 0, user->getRoleName());
             cout << "\n*** Login Successful! ***" << endl;
             cout << "Welcome, " << username << " (" << user->getRoleName() << ")" << endl;
             return user;
         } else {
-            user->incrementFailedAttempts();
+            time_t now = time(0);
+            int lockSeconds = lockoutPolicy.recordFailure(username, now);
             saveUsers();
+            auditLog.log(username, AUDIT_LOGIN_FAILED, 0, 0.0, false, 0, "bad password");
+            trace.record("", chrono::steady_clock::now(), "login-failed", username);
             
-            if (user->getLocked()) {
+            if (lockSeconds > 0) {
+                auditLog.log(username, AUDIT_USER_LOCKED, 0, 0.0, true, 0, "locked " + to_string(lockSeconds) + "s");
                 cout << "\n*** ACCOUNT LOCKED ***" << endl;
-                cout << "Too many failed attempts. Your account has been locked." << endl;
-                cout << "Please contact an administrator or try a different account.\n" << endl;
+                cout << "Too many failed attempts. Your account is locked for " << lockSeconds << " second(s)." << endl;
+                cout << "Each further lockout doubles the wait. An administrator can unlock it sooner.\n" << endl;
             } else {
+                int maxFailures = lockoutPolicy.getMaxFailures();
                 cout << "\nInvalid password!" << endl;
-                cout << "Failed attempts: " << user->getFailedAttempts() << "/3" << endl;
-                cout << "Warning: Account will be locked after 3 failed attempts." << endl;
+                cout << "Failed attempts: " << lockoutPolicy.recentFailures(username, now) << "/" << maxFailures
+                     << " in the last " << lockoutPolicy.getWindowSeconds() / 60 << " minute(s)" << endl;
+                cout << "Warning: Account will be locked after " << maxFailures << " failed attempts." << endl;
                 cout << "Please try again.\n" << endl;
             }
         }
@@ -316,13 +2301,14 @@ User* BankingSystem::login() {
 }
 
 // Register new user (Admin only)
-void BankingSystem::registerUser() {
+void BankingSystem::registerUser(CommandInput& input) {
     string username, password;
     int roleChoice;
     
     cout << "\n--- Register New User ---" << endl;
-    cout << "Enter username: ";
-    cin >> username;
+    if (!input.readWord("Enter username: ", username)) {
+        return;
+    }
     
     // Check if username exists
     for (const auto& user : users) {
@@ -332,18 +2318,22 @@ void BankingSystem::registerUser() {
         }
     }
     
-    cout << "Enter password: ";
-    cin >> password;
+    if (!input.readSecret("Enter password: ", password)) {
+        return;
+    }
     
     // Hash the password
     string hashedPassword = User::hashPassword(password);
     
-    cout << "Select role:" << endl;
-    cout << "1. Admin" << endl;
-    cout << "2. User" << endl;
-    cout << "3. Guest" << endl;
-    cout << "Choice: ";
-    cin >> roleChoice;
+    if (input.isInteractive()) {
+        cout << "Select role:" << endl;
+        cout << "1. Admin" << endl;
+        cout << "2. User" << endl;
+        cout << "3. Guest" << endl;
+    }
+    if (!input.readInt("Choice: ", roleChoice)) {
+        return;
+    }
     
     UserRole role;
     switch (roleChoice) {
@@ -355,19 +2345,14 @@ void BankingSystem::registerUser() {
             role = USER;
     }
     
-    users.push_back(User(username, hashedPassword, role, false));
+    users.push_back(User(username, hashedPassword, role));
     saveUsers();
+    auditLog.log(actorName(), AUDIT_REGISTER_USER, 0, 0.0, true, 0, username);
     
     cout << "\n*** User registered successfully! ***" << endl;
     cout << "Username: " << username << endl;
     cout << "Password Hash: " << hashedPassword << endl;
-    cout << "Role: ";
-    switch (role) {
-        case ADMIN: cout << "Admin"; break;
-        case USER: cout << "User"; break;
-        case GUEST: cout << "Guest"; break;
-    }
-    cout << endl;
+    cout << "Role: " << ROLE_NAMES[role] << endl;
 }
 
 // Public registration (available before login)
@@ -412,16 +2397,27 @@ void BankingSystem::registerNewUser() {
     }
     
     // Create and save user
-    users.push_back(User(username, hashedPassword, role, false));
+    users.push_back(User(username, hashedPassword, role));
     saveUsers();  // Persistence: Save immediately
+    auditLog.log(username, AUDIT_REGISTER_USER, 0, 0.0, true, 0, "self-registration");
+    trace.record("", chrono::steady_clock::now(), "signup", username + " " + to_string(role));
     
     cout << "\n*** Registration Successful! ***" << endl;
     cout << "Username: " << username << endl;
     cout << "Password Hash: " << hashedPassword << endl;
-    cout << "Role: " << (role == GUEST ? "Guest" : "User") << endl;
+    cout << "Role: " << ROLE_NAMES[role] << endl;
     cout << "You can now login with your credentials.\n" << endl;
 }
 
+// Lock status shown in user lists
+string BankingSystem::lockStatus(const User& user) const {
+    int seconds = lockoutPolicy.lockedFor(user.getUsername(), time(0));
+    if (seconds == 0) {
+        return "Active";
+    }
+    return "LOCKED (" + to_string((seconds + 59) / 60) + "m)";
+}
+
 // Manage users (Admin only)
 void BankingSystem::manageUsers() {
     cout << "\n========================================" << endl;
@@ -433,13 +2429,13 @@ void BankingSystem::manageUsers() {
     for (const auto& user : users) {
         cout << left << setw(20) << user.getUsername() 
              << setw(15) << user.getRoleName()
-             << setw(10) << (user.getLocked() ? "LOCKED" : "Active") << endl;
+             << setw(10) << lockStatus(user) << endl;
     }
     cout << "========================================\n" << endl;
 }
 
 // Unlock user account (Admin only)
-void BankingSystem::unlockAccount() {
+void BankingSystem::unlockAccount(CommandInput& input) {
     string username;
     
     cout << "\n--- Unlock User Account ---" << endl;
@@ -454,12 +2450,13 @@ void BankingSystem::unlockAccount() {
     for (const auto& user : users) {
         cout << left << setw(20) << user.getUsername() 
              << setw(15) << user.getRoleName()
-             << setw(10) << (user.getLocked() ? "LOCKED" : "Active") << endl;
+             << setw(10) << lockStatus(user) << endl;
     }
     cout << "========================================\n" << endl;
     
-    cout << "Enter username to unlock: ";
-    cin >> username;
+    if (!input.readWord("Enter username to unlock: ", username)) {
+        return;
+    }
     
     // Find user
     User* user = nullptr;
@@ -475,21 +2472,35 @@ void BankingSystem::unlockAccount() {
         return;
     }
     
-    if (!user->getLocked()) {
+    if (lockoutPolicy.lockedFor(username, time(0)) == 0) {
         cout << "Account '" << username << "' is not locked." << endl;
         return;
     }
     
-    user->setLocked(false);
-    user->resetFailedAttempts();
+    lockoutPolicy.unlock(username);
     saveUsers();
+    auditLog.log(actorName(), AUDIT_USER_UNLOCKED, 0, 0.0, true, 0, username);
     
     cout << "\n*** Account Unlocked Successfully! ***" << endl;
     cout << "User '" << username << "' can now log in." << endl;
 }
 
+// Convert YYYY-MM-DD (local time) to Unix seconds; 0 for "-" or bad input
+static int64_t parseDate(const string& text) {
+    int year, month, day;
+    if (text == "-" || sscanf(text.c_str(), "%d-%d-%d", &year, &month, &day) != 3) {
+        return 0;
+    }
+    tm timeInfo = {};
+    timeInfo.tm_year = year - 1900;
+    timeInfo.tm_mon = month - 1;
+    timeInfo.tm_mday = day;
+    timeInfo.tm_isdst = -1;
+    return static_cast<int64_t>(mktime(&timeInfo));
+}
+
 // View system logs (Admin only)
-void BankingSystem::viewSystemLogs() {
+void BankingSystem::viewSystemLogs(CommandInput& input) {
     cout << "\n========================================" << endl;
     cout << "          SYSTEM LOGS" << endl;
     cout << "========================================" << endl;
@@ -500,17 +2511,108 @@ void BankingSystem::viewSystemLogs() {
     char buffer[80];
     strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &timeInfo);
     
+    SnapshotManager::ReadGuard snapshot = readSnapshot();
+    
     cout << "Current Time: " << buffer << endl;
-    cout << "Total Accounts: " << accounts.size() << endl;
+    cout << "Total Accounts: " << snapshot->accounts.size() << endl;
     cout << "Total Users: " << users.size() << endl;
-    cout << "Next Account Number: " << nextAccountNumber << endl;
-    
-    double totalBalance = 0;
-    for (const auto& account : accounts) {
-        totalBalance += account.getBalance();
+    cout << "Next Account Number: " << snapshot->nextAccountNumber << endl;
+    cout << "Retired Account Numbers: " << accountNumbers.getRetiredCount() << endl;
+    cout << "Total Bank Balance: " << Currency::prefix(fxRates.getBase()) << fixed << setprecision(2)
+         << snapshot->totalBalance << endl;
+    cout << "Snapshot Version: " << snapshot->version << endl;
+    cout << "Audit Records Written: " << auditLog.getWrittenCount() << endl;
+    cout << "Active Sessions: " << sessionManager.getActiveCount() << endl;
+    size_t tombstones = 0;
+    size_t openHolds = 0;
+    size_t historyEntries = 0;
+    size_t historyArchived = 0;
+    size_t historyBytes = 0;
+    for (const auto& shard : shards) {
+        lock_guard<mutex> lock(shard->getMutex());
+        tombstones += shard->getTombstoneCount();
+        openHolds += shard->getHoldCount();
+        shard->forEachResident([&](const BankAccount& account) {
+            const TransactionHistory& history = account.getHistory();
+            historyEntries += history.size();
+            historyArchived += history.getArchivedCount();
+            historyBytes += history.memoryBytes();
+        });
+    }
+    bool bounded = shards.front()->isBounded();
+    cout << "Closed Accounts Held: " << tombstones << " (purged so far: " << accountsPurged.load()
+         << ", slot file rewrites: " << slotFileRewrites.load() << ")" << endl;
+    cout << "Open Holds: " << openHolds << " (expired so far: " << holdsExpired.load() << ")" << endl;
+    cout << "Transaction History: " << historyEntries << " entries (" << historyArchived << " compressed), "
+         << historyBytes / 1024 << " KB (" << historyEntries * sizeof(Transaction) / 1024 << " KB uncompressed)"
+         << (bounded ? " in accounts in memory" : "") << endl;
+    if (bounded) {
+        AccountCacheStats cache = cacheTotals();
+        uint64_t lookups = cache.hits + cache.misses;
+        cout << "Account Cache: " << cache.residentAccounts << " accounts in memory, "
+             << cache.residentBytes / 1024 << " of " << cache.budgetBytes / 1024 << " KB; hit rate "
+             << fixed << setprecision(1) << (lookups > 0 ? 100.0 * cache.hits / lookups : 100.0) << setprecision(2)
+             << "% of " << lookups << " lookups (" << cache.prefetchHits << " misses prefetched), "
+             << cache.evictions << " evictions, " << cache.writeBacks << " written back" << endl;
+        cout << "Account Pages: " << cache.pageFileBytes / 1024 << " KB on disk ("
+             << cache.livePageBytes / 1024 << " KB live, " << cache.compactions << " compactions), "
+             << cache.readFailures << " read and " << cache.writeFailures << " write failure(s)" << endl;
+    }
+    cout << "Integrity: " << slotsChangedOnDisk << " slot(s) changed on disk at startup; last verification "
+         << lastVerification << endl;
+    cout << "Interned Names and Hashes: " << StringArena::shared().size() << " ("
+         << StringArena::shared().bytesUsed() / 1024 << " KB)" << endl;
+    if (changeFeed.isActive()) {
+        cout << "Change Feed: " << changeFeed.getPublishedCount() << " events published to " << changeFeed.getName()
+             << " (" << changeFeed.getCapacity() << " per shard ring)" << endl;
+    }
+    if (replicationLog.isActive()) {
+        uint64_t logSize = replicationLog.getSize();
+        cout << "Replication: " << replicationLog.getShippedCount() << " entries shipped, log "
+             << logSize / 1024 << " KB" << endl;
+        ReplicationAck ack;
+        if (replicationLog.readAck(ack) && ack.generation == replicationLog.getGeneration()) {
+            uint64_t behind = logSize > ack.offset ? (logSize - ack.offset) / sizeof(ReplicationEntry) : 0;
+            cout << "Standby: " << behind << " entries behind, lag " << ack.lastLagMs << " ms (max "
+                 << ack.maxLagMs << " ms), reported " << ReplicationLog::nowMs() - ack.ackedAtMs << " ms ago" << endl;
+        } else {
+            cout << "Standby: none reporting" << endl;
+        }
     }
-    cout << "Total Bank Balance: $" << fixed << setprecision(2) << totalBalance << endl;
     cout << "========================================\n" << endl;
+    
+    string answer;
+    if (!input.readWord("Search audit log? (y/n): ", answer) || (answer != "y" && answer != "Y")) {
+        return;
+    }
+    
+    string fromDate, toDate, username;
+    if (!input.readWord("From date (YYYY-MM-DD, - for any): ", fromDate) ||
+        !input.readWord("To date (YYYY-MM-DD, - for any): ", toDate) ||
+        !input.readWord("Username (- for all): ", username)) {
+        return;
+    }
+    
+    int64_t fromTime = parseDate(fromDate);
+    int64_t toTime = parseDate(toDate);
+    if (toTime != 0) {
+        toTime += 86399;  // Include the whole end day
+    }
+    auditLog.flush();
+    auditLog.query(fromTime, toTime, username == "-" ? "" : username);
+}
+
+// View performance statistics and dump them for scraping (Admin only)
+void BankingSystem::viewPerformanceStats() {
+    displayStartupPhases();
+    Metrics::display();
+    StorageStats io = storage->getStats();
+    cout << "Storage backend: " << storage->name() << (storageSync ? " (fdatasync per batch)" : "") << endl;
+    cout << "Write requests: " << io.requests << " in " << io.batches << " batch(es), " << io.syscalls
+         << " I/O system call(s), " << io.syncs << " sync(s), " << io.bytes << " byte(s)\n" << endl;
+    if (Metrics::dumpPrometheus("bank_stats.prom")) {
+        cout << "Statistics written to bank_stats.prom (Prometheus text format)\n" << endl;
+    }
 }
 
 // Main menu (before login)
@@ -525,370 +2627,623 @@ void BankingSystem::displayMainMenu() {
     cout << "Enter your choice: ";
 }
 
-// Admin menu
-void BankingSystem::displayAdminMenu() {
-    cout << "\n======================================" << endl;
-    cout << "      ADMIN - BANKING SYSTEM" << endl;
-    cout << "======================================" << endl;
-    cout << "1. Create New Account" << endl;
-    cout << "2. Deposit Money" << endl;
-    cout << "3. Withdraw Money" << endl;
-    cout << "4. Check Balance" << endl;
-    cout << "5. View Transaction History" << endl;
-    cout << "6. List All Accounts" << endl;
-    cout << "7. Delete Account" << endl;
-    cout << "8. Export to JSON" << endl;
-    cout << "9. View System Logs" << endl;
-    cout << "10. User Management" << endl;
-    cout << "11. Register New User" << endl;
-    cout << "12. Unlock User Account" << endl;
-    cout << "13. Logout" << endl;
-    cout << "======================================" << endl;
-    cout << "Enter your choice: ";
-}
+// Menu heading for each role, indexed by UserRole
+static const char* const ROLE_MENU_TITLES[] = {
+    "      ADMIN - BANKING SYSTEM",
+    "      USER - BANKING SYSTEM",
+    "     GUEST - BANKING SYSTEM\n     (View-Only Access)"
+};
 
-// User menu
-void BankingSystem::displayUserMenu() {
-    cout << "\n======================================" << endl;
-    cout << "      USER - BANKING SYSTEM" << endl;
-    cout << "======================================" << endl;
-    cout << "1. Create New Account" << endl;
-    cout << "2. Deposit Money" << endl;
-    cout << "3. Withdraw Money" << endl;
-    cout << "4. Check Balance" << endl;
-    cout << "5. View Transaction History" << endl;
-    cout << "6. List All Accounts" << endl;
-    cout << "7. Export to JSON" << endl;
-    cout << "8. Logout" << endl;
-    cout << "======================================" << endl;
-    cout << "Enter your choice: ";
-}
+// Every command: its batch name, menu label, required permissions and handler.
+// Entries are in CommandId order so dispatch is a direct index.
+constexpr BankingSystem::CommandSpec BankingSystem::commandTable[COMMAND_COUNT] = {
+    {CMD_CREATE_ACCOUNT, "create", "Create New Account", PERM_OPEN_ACCOUNT, &BankingSystem::cmdCreateAccount},
+    {CMD_DEPOSIT, "deposit", "Deposit Money", PERM_TRANSACT, &BankingSystem::cmdDeposit},
+    {CMD_WITHDRAW, "withdraw", "Withdraw Money", PERM_TRANSACT, &BankingSystem::cmdWithdraw},
+    {CMD_CHECK_BALANCE, "balance", "Check Balance", PERM_VIEW_ACCOUNTS, &BankingSystem::cmdCheckBalance},
+    {CMD_TRANSACTION_HISTORY, "history", "View Transaction History", PERM_VIEW_ACCOUNTS,
+     &BankingSystem::cmdTransactionHistory},
+    {CMD_LIST_ACCOUNTS, "list", "List All Accounts", PERM_VIEW_ACCOUNTS, &BankingSystem::cmdListAccounts},
+    {CMD_DELETE_ACCOUNT, "delete", "Delete Account", PERM_CLOSE_ACCOUNT, &BankingSystem::cmdDeleteAccount},
+    {CMD_EXPORT_JSON, "export", "Export to JSON", PERM_EXPORT, &BankingSystem::cmdExportJSON},
+    {CMD_SYSTEM_LOGS, "logs", "View System Logs", PERM_VIEW_SYSTEM, &BankingSystem::cmdSystemLogs},
+    {CMD_MANAGE_USERS, "users", "User Management", PERM_MANAGE_USERS, &BankingSystem::cmdManageUsers},
+    {CMD_REGISTER_USER, "register", "Register New User", PERM_MANAGE_USERS, &BankingSystem::cmdRegisterUser},
+    {CMD_UNLOCK_USER, "unlock", "Unlock User Account", PERM_MANAGE_USERS, &BankingSystem::cmdUnlockUser},
+    {CMD_INTEREST_POSTING, "post-interest", "Run Interest Posting", PERM_RUN_POSTING,
+     &BankingSystem::cmdInterestPosting},
+    {CMD_RATE_TABLE, "rates", "View Rate Table", PERM_RUN_POSTING, &BankingSystem::cmdRateTable},
+    {CMD_TRANSFER, "transfer", "Transfer Money", PERM_TRANSACT, &BankingSystem::cmdTransfer},
+    {CMD_PERFORMANCE_STATS, "stats", "Performance Statistics", PERM_VIEW_SYSTEM,
+     &BankingSystem::cmdPerformanceStats},
+    {CMD_CLOSE_ACCOUNTS, "close-accounts", "Bulk Close Accounts", PERM_CLOSE_ACCOUNT,
+     &BankingSystem::cmdCloseAccounts},
+    {CMD_COMPACT_LEDGER, "compact", "Compact Ledger Now", PERM_CLOSE_ACCOUNT, &BankingSystem::cmdCompactLedger},
+    {CMD_RUN_BATCH, "batch", "Run Batch File", PERM_RUN_BATCH, &BankingSystem::cmdRunBatch},
+    {CMD_PLACE_HOLD, "hold", "Place Hold", PERM_TRANSACT, &BankingSystem::cmdPlaceHold},
+    {CMD_SETTLE_HOLD, "settle", "Settle Hold", PERM_TRANSACT, &BankingSystem::cmdSettleHold},
+    {CMD_RELEASE_HOLD, "release", "Release Hold", PERM_TRANSACT, &BankingSystem::cmdReleaseHold},
+    {CMD_SET_LIMITS, "limits", "Set Overdraft and Daily Limits", PERM_SET_LIMITS, &BankingSystem::cmdSetLimits},
+    {CMD_MONTHLY_STATEMENTS, "statements", "Generate Monthly Statements", PERM_RUN_POSTING,
+     &BankingSystem::cmdMonthlyStatements},
+    {CMD_VERIFY_INTEGRITY, "verify", "Verify Ledger Integrity", PERM_VIEW_SYSTEM,
+     &BankingSystem::cmdVerifyIntegrity},
+    {CMD_REVALUE, "revalue", "FX Revaluation Report", PERM_VIEW_SYSTEM, &BankingSystem::cmdRevalue},
+    {CMD_REVIEW_QUEUE, "review", "Risk Review Queue", PERM_REVIEW_RISK, &BankingSystem::cmdReviewQueue}
+};
 
-// Guest menu (view-only)
-void BankingSystem::displayGuestMenu() {
-    cout << "\n======================================" << endl;
-    cout << "     GUEST - BANKING SYSTEM" << endl;
-    cout << "     (View-Only Access)" << endl;
-    cout << "======================================" << endl;
-    cout << "1. Check Balance" << endl;
-    cout << "2. View Transaction History" << endl;
-    cout << "3. List All Accounts" << endl;
-    cout << "4. Logout" << endl;
-    cout << "======================================" << endl;
-    cout << "Enter your choice: ";
+// Entry i must describe command i (checked at compile time in executeCommand)
+constexpr bool BankingSystem::commandTableInOrder() {
+    for (int i = 0; i < COMMAND_COUNT; i++) {
+        if (commandTable[i].id != i) {
+            return false;
+        }
+    }
+    return true;
 }
 
-// Admin session
-void BankingSystem::runAdminSession() {
-    int choice;
-    int accountNumber;
-    double amount;
-    string name;
+// Run a command for the session that holds token. The session's role is
+// checked against the command's permission bits with one mask test.
+CommandResult BankingSystem::executeCommand(const string& token, CommandId id, CommandInput& input) {
+    static_assert(commandTableInOrder(), "commandTable must list commands in CommandId order");
     
-    while (true) {
-        displayAdminMenu();
-        cin >> choice;
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-        
-        if (choice == 13) {
-            cout << "\n*** Logged out ***" << endl;
-            return;
-        }
-        
-        switch (choice) {
-            case 1: case 2: case 3: case 4: case 5: case 6: case 7: case 8:
-                // Reuse existing functionality by calling the old menu handler
-                // We'll handle these inline
-                break;
-            case 9:
-                viewSystemLogs();
-                break;
-            case 10:
-                manageUsers();
-                break;
-            case 11:
-                registerUser();
-                break;
-            case 12:
-                unlockAccount();
-                break;
-            default:
-                cout << "Invalid choice!" << endl;
-        }
-        
-        // Handle standard banking operations
-        if (choice >= 1 && choice <= 8) {
-            switch (choice) {
-                case 1: {
-                    cout << "\n--- Create New Account ---" << endl;
-                    cout << "Enter account holder name: ";
-                    getline(cin, name);
-                    cout << "Enter initial deposit (0 for none): $";
-                    cin >> amount;
-                    createAccount(name, amount);
-                    break;
-                }
-                case 2: {
-                    cout << "\n--- Deposit Money ---" << endl;
-                    if (accounts.empty()) {
-                        cout << "No accounts exist!" << endl;
-                        break;
-                    }
-                    cout << "Enter account number: ";
-                    cin >> accountNumber;
-                    BankAccount* account = findAccount(accountNumber);
-                    if (account) {
-                        cout << "Enter amount: $";
-                        cin >> amount;
-                        account->deposit(amount);
-                        saveToFile();
-                    } else {
-                        cout << "Account not found!" << endl;
-                    }
-                    break;
-                }
-                case 3: {
-                    cout << "\n--- Withdraw Money ---" << endl;
-                    if (accounts.empty()) {
-                        cout << "No accounts exist!" << endl;
-                        break;
-                    }
-                    cout << "Enter account number: ";
-                    cin >> accountNumber;
-                    BankAccount* account = findAccount(accountNumber);
-                    if (account) {
-                        cout << "Enter amount: $";
-                        cin >> amount;
-                        account->withdraw(amount);
-                        saveToFile();
-                    } else {
-                        cout << "Account not found!" << endl;
-                    }
-                    break;
-                }
-                case 4: {
-                    cout << "\n--- Check Balance ---" << endl;
-                    if (accounts.empty()) {
-                        cout << "No accounts exist!" << endl;
-                        break;
-                    }
-                    cout << "Enter account number: ";
-                    cin >> accountNumber;
-                    BankAccount* account = findAccount(accountNumber);
-                    if (account) {
-                        account->displayAccountInfo();
-                    } else {
-                        cout << "Account not found!" << endl;
-                    }
-                    break;
-                }
-                case 5: {
-                    cout << "\n--- Transaction History ---" << endl;
-                    if (accounts.empty()) {
-                        cout << "No accounts exist!" << endl;
-                        break;
-                    }
-                    cout << "Enter account number: ";
-                    cin >> accountNumber;
-                    BankAccount* account = findAccount(accountNumber);
-                    if (account) {
-                        account->displayTransactionHistory();
-                    } else {
-                        cout << "Account not found!" << endl;
-                    }
-                    break;
-                }
-                case 6:
-                    listAllAccounts();
-                    break;
-                case 7: {
-                    cout << "\n--- Delete Account ---" << endl;
-                    cout << "Enter account number: ";
-                    cin >> accountNumber;
-                    deleteAccount(accountNumber);
-                    break;
-                }
-                case 8: {
-                    exportToJSON("bank_export.json");
-                    break;
-                }
-            }
-        }
+    Session session;
+    if (!sessionManager.validate(token, session)) {
+        return COMMAND_EXPIRED;
+    }
+    if (id < 0 || id >= COMMAND_COUNT) {
+        return COMMAND_UNKNOWN;
     }
+    
+    const CommandSpec& command = commandTable[id];
+    if (!roleHasPermissions(session.role, command.permissions)) {
+        auditLog.log(session.username, AUDIT_PERMISSION_DENIED, 0, 0.0, false, 0, command.name);
+        return COMMAND_DENIED;
+    }
+    
+    string outerActor = actingUser;         // Set when run from a batch file
+    actingUser = session.username;
+    if (id != CMD_RUN_BATCH && trace.isOpen()) {
+        // The batch command itself is left out; each of its lines is traced
+        string fields;
+        input.setTranscript(&fields);
+        auto started = chrono::steady_clock::now();
+        (this->*command.handler)(input);
+        input.setTranscript(nullptr);
+        trace.record(token, started, command.name, fields);
+    } else {
+        (this->*command.handler)(input);
+    }
+    actingUser = outerActor;
+    if (outerActor.empty()) {
+        // The lines of a batch file are waited for together when it ends
+        waitForCommits();
+    }
+    return COMMAND_OK;
 }
 
-// User session
-void BankingSystem::runUserSession() {
-    int choice;
-    int accountNumber;
-    double amount;
-    string name;
-    
-    while (true) {
-        displayUserMenu();
-        cin >> choice;
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-        
-        if (choice == 8) {
-            cout << "\n*** Logged out ***" << endl;
-            return;
+// Run a command by its batch name (e.g. "deposit")
+CommandResult BankingSystem::executeCommand(const string& token, const string& name, CommandInput& input) {
+    for (const auto& command : commandTable) {
+        if (name == command.name) {
+            return executeCommand(token, command.id, input);
         }
-        
-        switch (choice) {
-            case 1: {
-                cout << "\n--- Create New Account ---" << endl;
-                cout << "Enter account holder name: ";
-                getline(cin, name);
-                cout << "Enter initial deposit (0 for none): $";
-                cin >> amount;
-                createAccount(name, amount);
-                break;
-            }
-            case 2: {
-                cout << "\n--- Deposit Money ---" << endl;
-                if (accounts.empty()) {
-                    cout << "No accounts exist!" << endl;
-                    break;
-                }
-                cout << "Enter account number: ";
-                cin >> accountNumber;
-                BankAccount* account = findAccount(accountNumber);
-                if (account) {
-                    cout << "Enter amount: $";
-                    cin >> amount;
-                    account->deposit(amount);
-                    saveToFile();
-                } else {
-                    cout << "Account not found!" << endl;
-                }
-                break;
-            }
-            case 3: {
-                cout << "\n--- Withdraw Money ---" << endl;
-                if (accounts.empty()) {
-                    cout << "No accounts exist!" << endl;
-                    break;
-                }
-                cout << "Enter account number: ";
-                cin >> accountNumber;
-                BankAccount* account = findAccount(accountNumber);
-                if (account) {
-                    cout << "Enter amount: $";
-                    cin >> amount;
-                    account->withdraw(amount);
-                    saveToFile();
-                } else {
-                    cout << "Account not found!" << endl;
-                }
-                break;
-            }
-            case 4: {
-                cout << "\n--- Check Balance ---" << endl;
-                if (accounts.empty()) {
-                    cout << "No accounts exist!" << endl;
-                    break;
-                }
-                cout << "Enter account number: ";
-                cin >> accountNumber;
-                BankAccount* account = findAccount(accountNumber);
-                if (account) {
-                    account->displayAccountInfo();
-                } else {
-                    cout << "Account not found!" << endl;
-                }
-                break;
-            }
-            case 5: {
-                cout << "\n--- Transaction History ---" << endl;
-                if (accounts.empty()) {
-                    cout << "No accounts exist!" << endl;
-                    break;
-                }
-                cout << "Enter account number: ";
-                cin >> accountNumber;
-                BankAccount* account = findAccount(accountNumber);
-                if (account) {
-                    account->displayTransactionHistory();
-                } else {
-                    cout << "Account not found!" << endl;
-                }
-                break;
-            }
-            case 6:
-                listAllAccounts();
-                break;
-            case 7:
-                exportToJSON("bank_export.json");
-                break;
-            default:
-                cout << "Invalid choice!" << endl;
+    }
+    return COMMAND_UNKNOWN;
+}
+
+// Show the commands a role may run; returns them in menu order
+vector<CommandId> BankingSystem::displaySessionMenu(UserRole role) {
+    vector<CommandId> entries;
+    cout << "\n======================================" << endl;
+    cout << ROLE_MENU_TITLES[role] << endl;
+    cout << "======================================" << endl;
+    for (const auto& command : commandTable) {
+        if (roleHasPermissions(role, command.permissions)) {
+            entries.push_back(command.id);
+            cout << entries.size() << ". " << command.label << endl;
         }
     }
+    cout << entries.size() + 1 << ". Logout" << endl;
+    cout << "======================================" << endl;
+    cout << "Enter your choice: ";
+    return entries;
 }
 
-// Guest session (view-only)
-void BankingSystem::runGuestSession() {
-    int choice;
-    int accountNumber;
+// Menu loop for the logged-in user; every choice goes through executeCommand
+void BankingSystem::runSession() {
+    CommandInput console(cin, true);
     
     while (true) {
-        displayGuestMenu();
+        vector<CommandId> entries = displaySessionMenu(currentUser->getRole());
+        int choice;
         cin >> choice;
         
+        // End of input logs the session out; the main menu then exits
+        if (!cin && cin.eof()) {
+            cout << "\n*** Logged out ***" << endl;
+            return;
+        }
         if (!cin) {
             cin.clear();
             cin.ignore(numeric_limits<streamsize>::max(), '\n');
             cout << "Invalid input! Please enter a number." << endl;
             continue;
         }
-        
         cin.ignore(numeric_limits<streamsize>::max(), '\n');
         
-        if (choice == 4) {
+        if (choice == static_cast<int>(entries.size()) + 1) {
             cout << "\n*** Logged out ***" << endl;
             return;
         }
         
-        switch (choice) {
-            case 1: {
-                cout << "\n--- Check Balance ---" << endl;
-                if (accounts.empty()) {
-                    cout << "No accounts exist!" << endl;
-                    break;
-                }
-                cout << "Enter account number: ";
-                cin >> accountNumber;
-                BankAccount* account = findAccount(accountNumber);
-                if (account) {
-                    account->displayAccountInfo();
-                } else {
-                    cout << "Account not found!" << endl;
-                }
+        CommandId id = COMMAND_COUNT;
+        if (choice >= 1 && choice <= static_cast<int>(entries.size())) {
+            id = entries[choice - 1];
+        }
+        
+        switch (executeCommand(sessionToken, id, console)) {
+            case COMMAND_OK:
                 break;
-            }
-            case 2: {
-                cout << "\n--- Transaction History ---" << endl;
-                if (accounts.empty()) {
-                    cout << "No accounts exist!" << endl;
-                    break;
-                }
-                cout << "Enter account number: ";
-                cin >> accountNumber;
-                BankAccount* account = findAccount(accountNumber);
-                if (account) {
-                    account->displayTransactionHistory();
-                } else {
-                    cout << "Account not found!" << endl;
-                }
+            case COMMAND_EXPIRED:
+                cout << "\n*** Session expired. Please log in again. ***\n" << endl;
+                return;
+            case COMMAND_DENIED:
+                cout << "Error: Permission denied!" << endl;
+                break;
+            case COMMAND_UNKNOWN:
+                cout << "Invalid choice!" << endl;
                 break;
+        }
+    }
+}
+
+// Ask for the number of an existing account (reports a missing account);
+// currency, if given, is set to the account's so amount prompts can show it
+bool BankingSystem::promptForAccount(CommandInput& input, int& accountNumber, CurrencyCode* currency) {
+    if (getAccountCount() == 0) {
+        cout << "No accounts exist!" << endl;
+        return false;
+    }
+    if (!input.readInt("Enter account number: ", accountNumber)) {
+        return false;
+    }
+    bool found;
+    {
+        lock_guard<mutex> lock(shardFor(accountNumber).getMutex());
+        BankAccount* account = findAccount(accountNumber);
+        found = account != nullptr;
+        if (found && currency) {
+            *currency = account->getCurrency();
+        }
+    }
+    if (!found) {
+        cout << "Account not found!" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Command: open an account
+void BankingSystem::cmdCreateAccount(CommandInput& input) {
+    string name;
+    double amount;
+    int typeChoice;
+    string currencyName;
+    cout << "\n--- Create New Account ---" << endl;
+    // Check the name before asking for the rest
+    if (!input.readText("Enter account holder name: ", name) || !holderNameFits(name)) {
+        return;
+    }
+    if (!input.readAmount("Enter initial deposit (0 for none): ", amount) ||
+        !input.readInt("Account type (1 = Checking, 2 = Savings): ", typeChoice)) {
+        return;
+    }
+    // Batches and traces written before currencies end here: the base currency
+    if (input.isInteractive()) {
+        if (!input.readWord("Currency (e.g. USD, EUR): ", currencyName)) {
+            return;
+        }
+    } else {
+        input.readOptionalWord(currencyName);
+    }
+    CurrencyCode currency = currencyName.empty() ? fxRates.getBase() : Currency::parse(currencyName);
+    if (currency == Currency::NONE) {
+        cout << "Error: Currency must be a three-letter code!" << endl;
+        return;
+    }
+    createAccount(name, amount, typeChoice == 2 ? SAVINGS : CHECKING, currency);
+}
+
+// Command: deposit
+void BankingSystem::cmdDeposit(CommandInput& input) {
+    cout << "\n--- Deposit Money ---" << endl;
+    int accountNumber;
+    double amount;
+    string requestKey;
+    CurrencyCode currency = Currency::USD;
+    if (promptForAccount(input, accountNumber, &currency) &&
+        input.readAmount("Enter amount: " + Currency::prefix(currency), amount)) {
+        input.readOptionalWord(requestKey);
+        deposit(accountNumber, amount, requestKey);
+    }
+}
+
+// Command: withdraw
+void BankingSystem::cmdWithdraw(CommandInput& input) {
+    cout << "\n--- Withdraw Money ---" << endl;
+    int accountNumber;
+    double amount;
+    string requestKey;
+    CurrencyCode currency = Currency::USD;
+    if (promptForAccount(input, accountNumber, &currency) &&
+        input.readAmount("Enter amount: " + Currency::prefix(currency), amount)) {
+        input.readOptionalWord(requestKey);
+        withdraw(accountNumber, amount, requestKey);
+    }
+}
+
+// Command: show one account
+void BankingSystem::cmdCheckBalance(CommandInput& input) {
+    cout << "\n--- Check Balance ---" << endl;
+    int accountNumber;
+    if (promptForAccount(input, accountNumber)) {
+        // Compaction may move accounts, so read under the shard lock
+        lock_guard<mutex> lock(shardFor(accountNumber).getMutex());
+        BankAccount* account = findAccount(accountNumber);
+        if (account) {
+            account->displayAccountInfo();
+        }
+    }
+}
+
+// Command: show an account's transactions, optionally within a date range
+// (asked for on the console; two optional trailing YYYY-MM-DD fields in a batch)
+void BankingSystem::cmdTransactionHistory(CommandInput& input) {
+    cout << "\n--- Transaction History ---" << endl;
+    int accountNumber;
+    if (!promptForAccount(input, accountNumber)) {
+        return;
+    }
+    string fromDate, toDate;
+    if (input.isInteractive()) {
+        if (!input.readWord("From date (YYYY-MM-DD, - for any): ", fromDate) ||
+            !input.readWord("To date (YYYY-MM-DD, - for any): ", toDate)) {
+            return;
+        }
+    } else {
+        input.readOptionalWord(fromDate);
+        input.readOptionalWord(toDate);
+    }
+    int64_t fromTime = parseDate(fromDate);
+    int64_t toTime = parseDate(toDate);
+    if (toTime != 0) {
+        toTime += 86399;  // Include the whole end day
+    }
+
+    lock_guard<mutex> lock(shardFor(accountNumber).getMutex());
+    BankAccount* account = findAccount(accountNumber);
+    if (account) {
+        account->displayTransactionHistory(static_cast<time_t>(fromTime), static_cast<time_t>(toTime));
+    }
+}
+
+// Command: list every account
+void BankingSystem::cmdListAccounts(CommandInput&) {
+    listAllAccounts();
+}
+
+// Command: close an account
+void BankingSystem::cmdDeleteAccount(CommandInput& input) {
+    int accountNumber;
+    cout << "\n--- Delete Account ---" << endl;
+    if (input.readInt("Enter account number: ", accountNumber)) {
+        deleteAccount(accountNumber);
+    }
+}
+
+// Command: export the ledger
+void BankingSystem::cmdExportJSON(CommandInput&) {
+    exportToJSON("bank_export.json");
+}
+
+// Command: system statistics and audit search
+void BankingSystem::cmdSystemLogs(CommandInput& input) {
+    viewSystemLogs(input);
+}
+
+// Command: list users
+void BankingSystem::cmdManageUsers(CommandInput&) {
+    manageUsers();
+}
+
+// Command: add a user
+void BankingSystem::cmdRegisterUser(CommandInput& input) {
+    registerUser(input);
+}
+
+// Command: lift a lockout
+void BankingSystem::cmdUnlockUser(CommandInput& input) {
+    unlockAccount(input);
+}
+
+// Command: post interest and fees now
+void BankingSystem::cmdInterestPosting(CommandInput&) {
+    runInterestPosting(false);
+}
+
+// Command: show the rate table
+void BankingSystem::cmdRateTable(CommandInput&) {
+    postingEngine.displayRates();
+}
+
+// Command: move money between accounts
+void BankingSystem::cmdTransfer(CommandInput& input) {
+    int accountNumber;
+    int toAccountNumber;
+    double amount;
+    cout << "\n--- Transfer Money ---" << endl;
+    if (input.readInt("Enter source account number: ", accountNumber) &&
+        input.readInt("Enter destination account number: ", toAccountNumber) &&
+        input.readAmount("Enter amount (in the source account's currency): ", amount)) {
+        string requestKey;
+        input.readOptionalWord(requestKey);
+        transfer(accountNumber, toAccountNumber, amount, requestKey);
+    }
+}
+
+// Command: latency and startup statistics
+void BankingSystem::cmdPerformanceStats(CommandInput&) {
+    viewPerformanceStats();
+}
+
+// Command: close every account in a list
+void BankingSystem::cmdCloseAccounts(CommandInput& input) {
+    string line;
+    cout << "\n--- Bulk Close Accounts ---" << endl;
+    if (!input.readText("Enter account numbers separated by spaces: ", line)) {
+        return;
+    }
+    vector<int> requested;
+    istringstream numbers(line);
+    int accountNumber;
+    while (numbers >> accountNumber) {
+        requested.push_back(accountNumber);
+    }
+    if (requested.empty()) {
+        cout << "No account numbers entered." << endl;
+        return;
+    }
+    size_t closed = closeAccounts(requested);
+    cout << "Closed " << closed << " of " << requested.size() << " account(s)." << endl;
+    if (closed < requested.size()) {
+        cout << "The rest were not found or already closed." << endl;
+    }
+}
+
+// Command: run compaction now instead of waiting for the background pass
+void BankingSystem::cmdCompactLedger(CommandInput&) {
+    uint64_t rewritesBefore = slotFileRewrites.load();
+    size_t purged = compactLedger();
+    cout << "Purged " << purged << " closed account(s) older than " << tombstoneRetentionDays << " day(s)." << endl;
+    cout << "Slot files rewritten: " << slotFileRewrites.load() - rewritesBefore << endl;
+}
+
+// Commands whose first fields are account numbers, and how many, so a
+// batch or replay can read those accounts ahead in bounded mode
+static const struct {
+    const char* name;
+    int accountFields;
+} ACCOUNT_COMMANDS[] = {
+    {"deposit", 1},
+    {"withdraw", 1},
+    {"transfer", 2},
+    {"balance", 1},
+    {"history", 1},
+    {"hold", 1},
+    {"limits", 1}
+};
+
+// Commands a batch or replay looks ahead by
+static const size_t PREFETCH_AHEAD = 32;
+
+// Account cache counters summed over the shards (bounded mode)
+AccountCacheStats BankingSystem::cacheTotals() const {
+    AccountCacheStats totals;
+    for (const auto& shard : shards) {
+        lock_guard<mutex> lock(shard->getMutex());
+        AccountCacheStats stats = shard->getCacheStats();
+        totals.hits += stats.hits;
+        totals.misses += stats.misses;
+        totals.prefetchHits += stats.prefetchHits;
+        totals.evictions += stats.evictions;
+        totals.writeBacks += stats.writeBacks;
+        totals.readFailures += stats.readFailures;
+        totals.writeFailures += stats.writeFailures;
+        totals.compactions += stats.compactions;
+        totals.residentAccounts += stats.residentAccounts;
+        totals.residentBytes += stats.residentBytes;
+        totals.budgetBytes += stats.budgetBytes;
+        totals.pageFileBytes += stats.pageFileBytes;
+        totals.livePageBytes += stats.livePageBytes;
+    }
+    return totals;
+}
+
+// Start reading the accounts a coming command names, if they are cold.
+// A shard in use by another thread is skipped: read-ahead is only a hint.
+void BankingSystem::prefetchAccounts(const string& op, istream& fields) {
+    for (const auto& command : ACCOUNT_COMMANDS) {
+        if (op != command.name) {
+            continue;
+        }
+        int accountNumber;
+        for (int i = 0; i < command.accountFields && fields >> accountNumber; i++) {
+            LedgerShard& shard = shardFor(accountNumber);
+            unique_lock<mutex> lock(shard.getMutex(), try_to_lock);
+            if (lock.owns_lock()) {
+                shard.prefetch(accountNumber);
+            }
+        }
+        return;
+    }
+}
+
+// Command: run the commands in a file, one per line ("deposit 1001 50 key-7").
+// A trailing request key on deposit, withdraw and transfer lines makes a
+// rerun of the same file skip the lines that were already applied.
+void BankingSystem::cmdRunBatch(CommandInput& input) {
+    string fileName;
+    cout << "\n--- Run Batch File ---" << endl;
+    if (!input.readText("Enter batch file name: ", fileName)) {
+        return;
+    }
+    ifstream batchFile(fileName);
+    if (!batchFile) {
+        cout << "Error: Could not open " << fileName << "!" << endl;
+        return;
+    }
+    
+    int lineNumber = 0;
+    int executed = 0;
+    int rejected = 0;
+    deque<string> upcoming;     // Lines read ahead, so their accounts can be prefetched
+    bool readAhead = shards.front()->isBounded();
+    string line;
+    while (true) {
+        while (upcoming.size() < PREFETCH_AHEAD && getline(batchFile, line)) {
+            if (readAhead) {
+                istringstream ahead(line);
+                string op;
+                ahead >> op;
+                prefetchAccounts(op, ahead);
             }
-            case 3:
-                listAllAccounts();
+            upcoming.push_back(line);
+        }
+        if (upcoming.empty()) {
+            break;
+        }
+        line = move(upcoming.front());
+        upcoming.pop_front();
+        lineNumber++;
+        istringstream fields(line);
+        string name;
+        if (!(fields >> name) || name[0] == '#') {
+            continue;
+        }
+        cout << "[" << lineNumber << "] " << line << endl;
+        if (name == commandTable[CMD_RUN_BATCH].name) {
+            cout << "Error: Batch files cannot run other batch files!" << endl;
+            rejected++;
+            continue;
+        }
+        CommandInput lineInput(fields, false);
+        switch (executeCommand(sessionToken, name, lineInput)) {
+            case COMMAND_OK:
+                executed++;
                 break;
-            default:
-                cout << "Invalid choice! Please try again." << endl;
+            case COMMAND_UNKNOWN:
+                cout << "Error: Unknown command '" << name << "'!" << endl;
+                rejected++;
                 break;
+            case COMMAND_DENIED:
+                cout << "Error: Permission denied for '" << name << "'!" << endl;
+                rejected++;
+                break;
+            case COMMAND_EXPIRED:
+                cout << "Error: Session expired; batch stopped at line " << lineNumber << "!" << endl;
+                return;
+        }
+    }
+    cout << "Batch complete: " << executed << " command(s) run, " << rejected << " rejected." << endl;
+}
+
+// Command: reserve funds on an account
+void BankingSystem::cmdPlaceHold(CommandInput& input) {
+    cout << "\n--- Place Hold ---" << endl;
+    int accountNumber;
+    double amount;
+    CurrencyCode currency = Currency::USD;
+    if (promptForAccount(input, accountNumber, &currency) &&
+        input.readAmount("Enter amount to hold: " + Currency::prefix(currency), amount)) {
+        placeHold(accountNumber, amount);
+    }
+}
+
+// Command: settle a hold for its final amount
+void BankingSystem::cmdSettleHold(CommandInput& input) {
+    cout << "\n--- Settle Hold ---" << endl;
+    uint64_t holdId;
+    double amount;
+    if (input.readId("Enter hold id: ", holdId) && input.readAmount("Enter amount to settle: ", amount)) {
+        settleHold(holdId, amount);
+    }
+}
+
+// Command: release a hold without debiting
+void BankingSystem::cmdReleaseHold(CommandInput& input) {
+    cout << "\n--- Release Hold ---" << endl;
+    uint64_t holdId;
+    if (input.readId("Enter hold id: ", holdId)) {
+        releaseHold(holdId);
+    }
+}
+
+// Command: set an account's overdraft line and daily withdrawal limit
+void BankingSystem::cmdSetLimits(CommandInput& input) {
+    cout << "\n--- Set Overdraft and Daily Limits ---" << endl;
+    int accountNumber;
+    double overdraftLimit;
+    double dailyLimit;
+    CurrencyCode currency = Currency::USD;
+    if (promptForAccount(input, accountNumber, &currency) &&
+        input.readAmount("Overdraft line (0 for none): " + Currency::prefix(currency), overdraftLimit) &&
+        input.readAmount("Daily withdrawal limit (0 for none): " + Currency::prefix(currency), dailyLimit)) {
+        setAccountLimits(accountNumber, overdraftLimit, dailyLimit);
+    }
+}
+
+// Command: write every account's statement for a month
+void BankingSystem::cmdMonthlyStatements(CommandInput& input) {
+    cout << "\n--- Generate Monthly Statements ---" << endl;
+    string month;
+    if (input.readWord("Month (YYYY-MM): ", month)) {
+        generateStatements(month);
+    }
+}
+
+// Command: verify the ledger's integrity trees and histories
+void BankingSystem::cmdVerifyIntegrity(CommandInput& input) {
+    cout << "\n--- Verify Ledger Integrity ---" << endl;
+    string answer;
+    if (input.readWord("Full audit of every slot? (y/n): ", answer)) {
+        verifyIntegrity(answer == "y" || answer == "Y");
+    }
+}
+
+// Command: value every open balance in one currency
+void BankingSystem::cmdRevalue(CommandInput& input) {
+    cout << "\n--- FX Revaluation Report ---" << endl;
+    string currencyName;
+    if (input.readWord("Report currency (e.g. USD): ", currencyName)) {
+        revalueLedger(Currency::parse(currencyName));
+    }
+}
+
+// Command: show the risk review queue and resolve one item
+void BankingSystem::cmdReviewQueue(CommandInput& input) {
+    displayReviewQueue();
+    int itemId;
+    string decision;
+    if (!input.readInt("Item to resolve (0 to return): ", itemId) || itemId == 0) {
+        return;
+    }
+    if (input.readWord("Approve or reject (a/r): ", decision)) {
+        if (decision != "a" && decision != "r") {
+            cout << "Error: Enter a to approve or r to reject!" << endl;
+            return;
         }
+        resolveReview(itemId, decision == "a");
     }
 }
 
@@ -912,15 +3267,26 @@ void BankingSystem::displayMenu() {
 
 // Run the banking system
 void BankingSystem::run() {
+    if (!standbySource.empty() && !runStandby()) {
+        return;
+    }
     cout << "\n*** Welcome to Automated Banking System ***\n" << endl;
     
     User* loggedInUser = nullptr;
     
     while (true) {
+        // Catch up the nightly interest batch if the date has rolled over
+        runInterestPosting(true);
         displayMainMenu();
         int choice;
         cin >> choice;
         
+        // End of input: shut down as Exit would instead of reading forever
+        if (!cin && cin.eof()) {
+            saveOnExit();
+            cout << "\nInput closed. Goodbye!" << endl;
+            return;
+        }
         if (!cin) {
             cin.clear();
             cin.ignore(numeric_limits<streamsize>::max(), '\n');
@@ -935,18 +3301,18 @@ void BankingSystem::run() {
                 // Login
                 currentUser = login();
                 if (currentUser) {
-                    // Route to appropriate session based on role
-                    switch (currentUser->getRole()) {
-                        case ADMIN:
-                            runAdminSession();
-                            break;
-                        case USER:
-                            runUserSession();
-                            break;
-                        case GUEST:
-                            runGuestSession();
-                            break;
-                    }
+                    sessionToken = sessionManager.create(*currentUser);
+                    trace.record(sessionToken, chrono::steady_clock::now(), "login",
+                                 string(currentUser->getUsername()) + " " + to_string(currentUser->getRole()));
+                    cout << "Session token: " << sessionToken << " (expires after "
+                         << sessionManager.getIdleTimeoutSeconds() / 60 << " idle minute(s))" << endl;
+                    
+                    // The menu shows only the commands the user's role permits
+                    runSession();
+                    trace.record(sessionToken, chrono::steady_clock::now(), "logout", "");
+                    auditLog.log(actorName(), AUDIT_LOGOUT);
+                    sessionManager.revoke(sessionToken);
+                    sessionToken.clear();
                     currentUser = nullptr;
                 }
                 break;
@@ -959,8 +3325,7 @@ void BankingSystem::run() {
             }
             
             case 3: {
-                // Exit
-                saveToFile();
+                saveOnExit();
                 cout << "\n*** Thank you for using Automated Banking System! ***" << endl;
                 cout << "Goodbye!" << endl;
                 return;
@@ -972,3 +3337,262 @@ void BankingSystem::run() {
         }
     }
 }
+
+// Save everything on a clean shutdown, recording the exact next account number
+void BankingSystem::saveOnExit() {
+    accountNumbers.trimHighWater();
+    accountNumbers.takePersistRequest();
+    saveToFile();
+}
+
+// Output sink for a replay, so the terminal is not what gets measured
+class DiscardBuffer : public streambuf {
+protected:
+    int overflow(int c) override {
+        return traits_type::not_eof(c);
+    }
+};
+
+// Commands whose last field is a request key, and the fields before it
+static const struct {
+    const char* name;
+    int fieldsBeforeKey;
+} KEYED_COMMANDS[] = {
+    {"deposit", 2},
+    {"withdraw", 2},
+    {"transfer", 3}
+};
+
+// Commands that read or change the user list; replay threads take usersMutex for them
+static const CommandId USER_COMMANDS[] = { CMD_SYSTEM_LOGS, CMD_MANAGE_USERS, CMD_REGISTER_USER, CMD_UNLOCK_USER };
+
+// An event's fields for a copy of the trace. Copies after the first get
+// their own request keys, so they are not taken for retries of the first.
+static string fieldsForCopy(const TraceEvent& event, int copy) {
+    if (copy == 0) {
+        return event.fields;
+    }
+    for (const auto& keyed : KEYED_COMMANDS) {
+        if (event.op == keyed.name) {
+            istringstream fields(event.fields);
+            string field;
+            int count = 0;
+            while (fields >> field) {
+                count++;
+            }
+            if (count > keyed.fieldsBeforeKey) {
+                return event.fields + "~" + to_string(copy);
+            }
+            break;
+        }
+    }
+    return event.fields;
+}
+
+// Replay one copy of a trace on this thread. Each traced stream gets its
+// own session; with a speed set, each operation waits for its offset.
+void BankingSystem::replayCopy(const vector<TraceEvent>& events, int copy, double speed, ReplayResult& result) {
+    unordered_map<int, string> tokens;      // Stream -> session token
+    bool readAhead = shards.front()->isBounded();
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < events.size(); i++) {
+        const TraceEvent& event = events[i];
+        // Read ahead: the accounts PREFETCH_AHEAD events on (and at the
+        // start, every event up to there)
+        for (size_t ahead = i == 0 ? 0 : i + PREFETCH_AHEAD;
+             readAhead && ahead <= i + PREFETCH_AHEAD && ahead < events.size(); ahead++) {
+            istringstream fields(events[ahead].fields);
+            prefetchAccounts(events[ahead].op, fields);
+        }
+        if (event.op == commandTable[CMD_RUN_BATCH].name) {
+            result.skipped++;
+            continue;
+        }
+        if (speed > 0.0) {
+            this_thread::sleep_until(start + chrono::microseconds(static_cast<int64_t>(event.offsetMs * 1000.0 / speed)));
+        }
+        auto began = chrono::steady_clock::now();
+        if (event.op == "login" || event.op == "signup") {
+            istringstream fields(event.fields);
+            string username;
+            int role = USER;
+            fields >> username >> role;
+            lock_guard<mutex> lock(usersMutex);
+            User* user = nullptr;
+            for (auto& u : users) {
+                if (u.getUsername() == username) {
+                    user = &u;
+                    break;
+                }
+            }
+            if (!user) {
+                // A user the fresh ledger lacks is added with the traced role
+                UserRole traced = role >= ADMIN && role <= GUEST ? static_cast<UserRole>(role) : USER;
+                users.push_back(User(username, User::hashPassword("*"), traced));
+                user = &users.back();
+            }
+            if (event.op == "login") {
+                lockoutPolicy.recordSuccess(username);
+                tokens[event.stream] = sessionManager.create(*user);
+            }
+        } else if (event.op == "login-failed") {
+            lock_guard<mutex> lock(usersMutex);
+            for (const auto& user : users) {
+                if (user.getUsername() == event.fields) {
+                    user.authenticate("");
+                    lockoutPolicy.recordFailure(event.fields, time(0));
+                    break;
+                }
+            }
+        } else if (event.op == "logout") {
+            auto it = tokens.find(event.stream);
+            if (it != tokens.end()) {
+                sessionManager.revoke(it->second);
+                tokens.erase(it);
+            }
+        } else {
+            auto it = tokens.find(event.stream);
+            istringstream fields(fieldsForCopy(event, copy));
+            CommandInput input(fields, false);
+            CommandResult outcome = COMMAND_EXPIRED;
+            if (it != tokens.end()) {
+                bool touchesUsers = false;
+                for (CommandId id : USER_COMMANDS) {
+                    touchesUsers = touchesUsers || event.op == commandTable[id].name;
+                }
+                if (touchesUsers) {
+                    lock_guard<mutex> lock(usersMutex);
+                    outcome = executeCommand(it->second, event.op, input);
+                } else {
+                    outcome = executeCommand(it->second, event.op, input);
+                }
+            }
+            if (outcome != COMMAND_OK) {
+                result.refused++;
+            }
+        }
+        result.latencies[event.op].push_back(
+            chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - began).count());
+    }
+    for (const auto& token : tokens) {
+        sessionManager.revoke(token.second);
+    }
+}
+
+// Value at a percentile of sorted samples
+static int64_t percentileOf(const vector<int64_t>& sorted, double percent) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(percent / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[index < sorted.size() ? index : sorted.size() - 1];
+}
+
+// Throughput and latency percentiles of a replay, overall and per operation
+void BankingSystem::displayReplayResults(const vector<TraceEvent>& events, const ReplayOptions& options,
+                                         const vector<ReplayResult>& results, double seconds) {
+    map<string, vector<int64_t>> byOperation;
+    vector<int64_t> all;
+    uint64_t refused = 0;
+    uint64_t skipped = 0;
+    for (const auto& result : results) {
+        for (const auto& entry : result.latencies) {
+            vector<int64_t>& samples = byOperation[entry.first];
+            samples.insert(samples.end(), entry.second.begin(), entry.second.end());
+            all.insert(all.end(), entry.second.begin(), entry.second.end());
+        }
+        refused += result.refused;
+        skipped += result.skipped;
+    }
+    sort(all.begin(), all.end());
+    map<string, vector<int64_t>> traced;    // Latencies recorded in the trace, in microseconds
+    for (const auto& event : events) {
+        if (event.latencyUs > 0) {
+            traced[event.op].push_back(event.latencyUs);
+        }
+    }
+    
+    cout << "\n========================================" << endl;
+    cout << "           REPLAY RESULTS" << endl;
+    cout << "========================================" << endl;
+    cout << "Trace: " << options.traceFile << " (" << events.size() << " operations), copies: " << results.size()
+         << ", pace: ";
+    if (options.speed > 0.0) {
+        cout << options.speed << "x original" << endl;
+    } else {
+        cout << "as fast as possible" << endl;
+    }
+    cout << "Operations run: " << all.size() << " in " << fixed << setprecision(2) << seconds << " s ("
+         << setprecision(0) << (seconds > 0.0 ? all.size() / seconds : 0.0) << " ops/s)" << endl;
+    cout << "Refused: " << refused << ", skipped: " << skipped << endl;
+    StorageStats io = storage->getStats();
+    cout << "Storage (" << storage->name() << "): " << io.requests << " write request(s) in " << io.batches
+         << " batch(es), " << io.syscalls << " I/O system call(s), " << io.syncs << " sync(s)" << endl;
+    if (shards.front()->isBounded()) {
+        AccountCacheStats cache = cacheTotals();
+        uint64_t lookups = cache.hits + cache.misses;
+        cout << setprecision(1) << "Account cache: hit rate "
+             << (lookups > 0 ? 100.0 * cache.hits / lookups : 100.0) << "% of " << lookups << " lookups ("
+             << cache.prefetchHits << " misses prefetched), " << cache.evictions << " evictions, "
+             << cache.writeBacks << " written back" << endl;
+    }
+    cout << setprecision(1) << "Latency (us): p50 " << percentileOf(all, 50) / 1000.0
+         << " | p90 " << percentileOf(all, 90) / 1000.0 << " | p99 " << percentileOf(all, 99) / 1000.0
+         << " | p99.9 " << percentileOf(all, 99.9) / 1000.0 << " | max " << percentileOf(all, 100) / 1000.0 << endl;
+    cout << "----------------------------------------" << endl;
+    cout << left << setw(16) << "Operation" << right << setw(9) << "Count" << setw(10) << "p50 us"
+         << setw(10) << "p99 us" << setw(11) << "max us" << setw(14) << "traced p50" << endl;
+    for (auto& entry : byOperation) {
+        vector<int64_t>& samples = entry.second;
+        sort(samples.begin(), samples.end());
+        cout << left << setw(16) << entry.first << right << setw(9) << samples.size()
+             << setw(10) << percentileOf(samples, 50) / 1000.0 << setw(10) << percentileOf(samples, 99) / 1000.0
+             << setw(11) << percentileOf(samples, 100) / 1000.0;
+        auto tracedSamples = traced.find(entry.first);
+        if (tracedSamples != traced.end()) {
+            sort(tracedSamples->second.begin(), tracedSamples->second.end());
+            cout << setw(14) << static_cast<double>(percentileOf(tracedSamples->second, 50));
+        } else {
+            cout << setw(14) << "-";
+        }
+        cout << endl;
+    }
+    cout << left << "========================================\n" << endl;
+}
+
+// Run a trace against this ledger, which must be empty: its account
+// numbers then match the ones the trace refers to. Each thread replays
+// its own copy; console output is discarded while the copies run.
+bool BankingSystem::replayTrace(const ReplayOptions& options) {
+    vector<TraceEvent> events;
+    if (!TraceFile::load(options.traceFile, events)) {
+        return false;
+    }
+    if (getAccountCount() != 0) {
+        cout << "Error: Replay needs a fresh ledger; run it in an empty directory!" << endl;
+        return false;
+    }
+    trace.close();  // A replay is not itself traced
+    int threads = max(options.threads, 1);
+    cout << "Replaying " << events.size() << " operation(s) from " << options.traceFile << " on " << threads
+         << " thread(s)..." << endl;
+    
+    vector<ReplayResult> results(threads);
+    DiscardBuffer discard;
+    streambuf* console = cout.rdbuf(&discard);
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int copy = 0; copy < threads; copy++) {
+        workers.emplace_back(&BankingSystem::replayCopy, this, cref(events), copy, options.speed, ref(results[copy]));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    double seconds = msSince(start) / 1000.0;
+    cout.rdbuf(console);
+    
+    displayReplayResults(events, options, results, seconds);
+    saveUsers();
+    saveOnExit();
+    return true;
+}
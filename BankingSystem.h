@@ -3,61 +3,303 @@
 
 #include "BankAccount.h"
 #include "User.h"
+#include "LedgerFile.h"
+#include "LedgerShard.h"
+#include "Journal.h"
+#include "PostingEngine.h"
+#include "AccountNumberAllocator.h"
+#include "Settings.h"
+#include "LedgerSnapshot.h"
+#include "AuditLog.h"
+#include "ThreadPool.h"
+#include "LockoutPolicy.h"
+#include "SessionManager.h"
+#include "Command.h"
+#include "Replication.h"
+#include "ChangeFeed.h"
+#include "Trace.h"
+#include "StatementRun.h"
+#include "Storage.h"
+#include "Currency.h"
+#include "RiskStage.h"
 #include <vector>
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <utility>
 
 using namespace std;
 
 class BankingSystem {
 private:
-    vector<BankAccount> accounts;
     vector<User> users;
-    int nextAccountNumber;
+    Settings settings;
+    AccountNumberAllocator accountNumbers;
     string dataFileName;
+    string legacyDataFileName;
     string usersFileName;
     User* currentUser;
     
-    // Helper function to find account index
-    int findAccountIndex(int accountNumber);
+    // Login throttling and lockouts (state persisted with users.txt)
+    LockoutPolicy lockoutPolicy;
+    string loginSource;                       // Rate-limit key for this terminal
+    
+    // Authenticated sessions: requests present sessionToken, not credentials
+    SessionManager sessionManager;
+    string sessionToken;
+    static thread_local string actingUser;    // Session user while a command runs on this thread
+    
+    // Command registry: every operation is one handler with the permission
+    // bits it needs, dispatched through a constexpr table indexed by CommandId
+    struct CommandSpec {
+        CommandId id;
+        const char* name;                     // Name used by batch and network front ends
+        const char* label;                    // Menu text
+        uint32_t permissions;                 // Bits the caller's role must hold
+        void (BankingSystem::*handler)(CommandInput&);
+    };
+    static const CommandSpec commandTable[COMMAND_COUNT];
+    static constexpr bool commandTableInOrder();
+    
+    // Persistence writes (journals, checkpoints, users.txt, exports) go
+    // through this backend. Commands return once their journal records are
+    // on disk, waiting for them after the shard lock is released, so one
+    // batch of writes carries the commits of every thread waiting on it.
+    unique_ptr<StorageBackend> storage;       // Declared before shards: outlives their callbacks
+    bool storageSync;                         // fdatasync each batch (storage_fsync)
+    static thread_local vector<uint64_t> unsyncedCommits;  // Per shard: this thread's newest journal sequence
+    
+    // Ledger partitioned by account number; each shard has its own lock,
+    // snapshot file (bank_data.N.dat) and journal (bank_data.N.journal)
+    vector<unique_ptr<LedgerShard>> shards;
+    size_t checkpointRecords;                 // Journal length that triggers a shard checkpoint
+    TransferLog transferLog;                  // Two-phase log for transfers between shards
+    ThreadPool workerPool;                    // Shared by bulk jobs such as startup parsing
+    vector<pair<string, double>> startupPhases;  // Phase name -> milliseconds
+    
+    // Background compaction: purges tombstones past their retention and
+    // rewrites slot files that have become sparse
+    thread compactor;
+    mutex compactorMutex;
+    condition_variable compactorWake;
+    bool compactorStopping;
+    int tombstoneRetentionDays;
+    int compactionIntervalSeconds;
+    atomic<uint64_t> accountsPurged;
+    atomic<uint64_t> slotFileRewrites;
+    atomic<uint64_t> holdsExpired;
+    
+    // Interest and fee batch posting
+    PostingEngine postingEngine;
+    int32_t lastPostingDay;
+    
+    // Exchange rates (fx_rates.txt), read once at startup: cross-currency
+    // transfers and the revaluation report use them
+    FxRateTable fxRates;
+    
+    // Risk screening: each shard's stage scores deposits, withdrawals and
+    // transfers before they are applied; screened-out ones are queued for
+    // review, and held ones only run when a reviewer approves them
+    ReviewQueue reviewQueue;
+    RiskAction riskAction;
+    static thread_local bool applyingReview;  // Set while an approved item runs: it is not screened again
+    
+    // Concurrency: writers hold one shard lock only while mutating; reports
+    // read immutable snapshots and never hold a lock while formatting output
+    atomic<uint64_t> ledgerVersion;       // Bumped on every committed change
+    SnapshotManager snapshots;
+    
+    // Audit trail of logins and mutations
+    AuditLog auditLog;
+    
+    // Integrity: slots found changed on disk at startup, and the outcome
+    // of the last verification
+    size_t slotsChangedOnDisk;
+    string lastVerification;
+    
+    // Hot standby: a primary ships every journal append to replication.log;
+    // a standby (started with --standby DIR) applies another directory's
+    // log to its in-memory shards until it is promoted
+    ReplicationLog replicationLog;
+    string standbySource;                     // Primary's directory; empty unless a standby
+    bool replicationEnabled;
+    int replicationHeartbeatMs;
+    uint64_t replicationMaxBytes;             // A longer log starts a new generation
+    
+    // Change data capture: with change_feed set, every journal append is
+    // also published to a shared-memory ring per shard for local subscribers
+    ChangeFeed changeFeed;
+    
+    // Load testing: trace_capture writes every command and login to
+    // trace.log; --replay runs a trace against a fresh ledger
+    TraceWriter trace;
+    mutex usersMutex;                         // Guards users while replay threads run
+    
+    struct ReplayResult {
+        unordered_map<string, vector<int64_t>> latencies;  // Operation -> nanoseconds per run
+        uint64_t refused = 0;                 // Unknown command, permission denied or no session
+        uint64_t skipped = 0;                 // Operations a replay does not run (batch)
+    };
+    
+    struct StandbyProgress {
+        uint64_t entriesApplied = 0;
+        int64_t lastShippedMs = 0;            // Ship time of the newest entry applied
+        int64_t lastHeartbeatMs = 0;
+        int64_t lastLagMs = 0;                // Apply time minus ship time, newest entry
+        int64_t maxLagMs = 0;
+        double totalLagMs = 0.0;
+        uint64_t lagSamples = 0;
+        int32_t highestAccount = 0;
+        int32_t nextAccountNumber = 0;        // From the primary's meta entries
+        uint32_t generations = 0;             // Logs followed (1 + primary restarts and rotations)
+        bool caughtUp = false;                // Reached the end of the log at least once
+    };
+    
+    // Shard routing and persistence helpers
+    LedgerShard& shardFor(int accountNumber);
+    vector<unique_lock<mutex>> lockAllShards();
+    LedgerMeta currentMeta() const;
+    void commitChange(LedgerShard& shard, const BankAccount& account, const string& type, double amount,
+                      uint64_t transferId = 0, const RequestOutcome* request = nullptr);
+    void finishChange(LedgerShard& shard, bool mayCheckpoint = true);
+    void checkpointIfFull(LedgerShard& shard);
+    bool waitForLegs(LedgerShard& source, LedgerShard& destination);
+    void waitForCommits();
+    LedgerShard* shardForHold(uint64_t holdId);
+    bool checkRequest(LedgerShard& shard, uint64_t keyHash, uint32_t fingerprint, bool& result);
+    RequestOutcome makeRequestOutcome(const LedgerShard& shard, uint64_t keyHash, uint32_t fingerprint,
+                                      const BankAccount& account) const;
+    bool checkpointShards();
+    bool persistMeta();
+    void recoverTransfers();
+    void createShards(int shardCount);
+    void startServices();
+    void startReplication();
+    void startChangeFeed();
+    void rotateReplicationLog();
+    bool followPrimary(ReplicationTail& tail, StandbyProgress& progress);
+    void displayStandbyStatus(const ReplicationTail& tail, const StandbyProgress& progress);
+    void promoteStandby(ReplicationTail& tail, StandbyProgress& progress);
+    bool runStandby();
+    void replayCopy(const vector<TraceEvent>& events, int copy, double speed, ReplayResult& result);
+    void prefetchAccounts(const string& op, istream& fields);
+    AccountCacheStats cacheTotals() const;
+    void displayReplayResults(const vector<TraceEvent>& events, const ReplayOptions& options,
+                              const vector<ReplayResult>& results, double seconds);
+    void saveOnExit();
+    bool loadSingleFileLedger(vector<BankAccount>& loaded);
+    bool loadLegacyFile(vector<BankAccount>& loaded);
+    void recordPhase(const string& name, double milliseconds);
+    void displayStartupPhases() const;
+    void compactionLoop();
+    string lockStatus(const User& user) const;
+    bool promptForAccount(CommandInput& input, int& accountNumber, CurrencyCode* currency = nullptr);
+    bool screenTransaction(LedgerShard& shard, CommandId operation, int accountNumber, int toAccount, double amount,
+                           uint32_t& reasons);
+    void recordScreened(LedgerShard& shard, CommandId operation, int accountNumber, int toAccount, double amount,
+                        uint32_t reasons);
+    vector<CommandId> displaySessionMenu(UserRole role);
+    
+    // Command handlers (see commandTable)
+    void cmdCreateAccount(CommandInput& input);
+    void cmdDeposit(CommandInput& input);
+    void cmdWithdraw(CommandInput& input);
+    void cmdCheckBalance(CommandInput& input);
+    void cmdTransactionHistory(CommandInput& input);
+    void cmdListAccounts(CommandInput& input);
+    void cmdDeleteAccount(CommandInput& input);
+    void cmdExportJSON(CommandInput& input);
+    void cmdSystemLogs(CommandInput& input);
+    void cmdManageUsers(CommandInput& input);
+    void cmdRegisterUser(CommandInput& input);
+    void cmdUnlockUser(CommandInput& input);
+    void cmdInterestPosting(CommandInput& input);
+    void cmdRateTable(CommandInput& input);
+    void cmdTransfer(CommandInput& input);
+    void cmdPerformanceStats(CommandInput& input);
+    void cmdCloseAccounts(CommandInput& input);
+    void cmdCompactLedger(CommandInput& input);
+    void cmdRunBatch(CommandInput& input);
+    void cmdPlaceHold(CommandInput& input);
+    void cmdSettleHold(CommandInput& input);
+    void cmdReleaseHold(CommandInput& input);
+    void cmdSetLimits(CommandInput& input);
+    void cmdMonthlyStatements(CommandInput& input);
+    void cmdVerifyIntegrity(CommandInput& input);
+    void cmdRevalue(CommandInput& input);
+    void cmdReviewQueue(CommandInput& input);
+    void applyPostings(const vector<Posting>& postings, double& totalInterest, double& totalFees);
+    void recoverPostingBatch();
+    SnapshotManager::ReadGuard readSnapshot();
+    string_view actorName() const;
 
 public:
-    // Constructor
-    BankingSystem();
+    // Constructor; a non-empty standbyOf starts a standby of that directory's primary
+    BankingSystem(const string& standbyOf = "");
+    ~BankingSystem();
     
     // System operations
-    void createAccount(string name, double initialDeposit = 0.0);
+    void createAccount(string name, double initialDeposit = 0.0, AccountType type = CHECKING,
+                       CurrencyCode currency = Currency::USD);
     BankAccount* findAccount(int accountNumber);
-    void deleteAccount(int accountNumber);
-    void listAllAccounts() const;
+    void deleteAccount(int accountNumber);             // Closes it; the tombstone keeps its history
+    size_t closeAccounts(const vector<int>& accountNumbers);  // Bulk closure, one pass per shard
+    size_t compactLedger();
+    void listAllAccounts();
+    // A non-empty request key makes a retry return the first outcome instead of applying twice
+    bool deposit(int accountNumber, double amount, const string& requestKey = "");
+    bool withdraw(int accountNumber, double amount, const string& requestKey = "");
+    bool transfer(int fromAccount, int toAccount, double amount, const string& requestKey = "");
+    uint64_t placeHold(int accountNumber, double amount);   // Returns the hold id, 0 if refused
+    bool settleHold(uint64_t holdId, double amount);
+    bool releaseHold(uint64_t holdId);
+    bool setAccountLimits(int accountNumber, double overdraftLimit, double dailyLimit);
+    size_t expireHolds();
+    size_t getAccountCount() const;
+    void runInterestPosting(bool scheduled);
     
     // File operations
     bool saveToFile();
     bool loadFromFile();
     void exportToJSON(string filename);
+    bool generateStatements(const string& month);   // YYYY-MM; resumes an interrupted run
+    bool verifyIntegrity(bool full);   // Full: every slot; otherwise slots changed since the last pass
+    bool revalueLedger(CurrencyCode reportCurrency);   // Every open balance valued in one currency
+    void displayReviewQueue();
+    bool resolveReview(int itemId, bool approve);     // Approving a held item applies it
     bool saveUsers();
     bool loadUsers();
     
     // User management
     void createDefaultUsers();
     User* login();
-    void registerUser();  // Admin only
+    void registerUser(CommandInput& input);  // Admin only
     void registerNewUser();  // Public registration
     void manageUsers();
-    void unlockAccount();
-    void viewSystemLogs();
+    void unlockAccount(CommandInput& input);
+    void viewSystemLogs(CommandInput& input);
+    void viewPerformanceStats();
     
-    // Role-based menus
+    // Command dispatch shared by the console and other front ends
+    CommandResult executeCommand(const string& token, CommandId id, CommandInput& input);
+    CommandResult executeCommand(const string& token, const string& name, CommandInput& input);
+    
+    // Menus
     void displayMainMenu();
-    void displayAdminMenu();
-    void displayUserMenu();
-    void displayGuestMenu();
-    void runAdminSession();
-    void runUserSession();
-    void runGuestSession();
+    void runSession();
     
     // Main menu
     void displayMenu();
     void run();
+    
+    // Load testing: run a trace against this (fresh) ledger and report
+    // throughput and latency percentiles
+    bool replayTrace(const ReplayOptions& options);
 };
 
 #endif
@@ -0,0 +1,587 @@
+#include "ChangeFeed.h"
+#include "Settings.h"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <cerrno>
+
+#if BANK_CHANGE_FEED
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+static const char FEED_MAGIC[8] = {'B', 'A', 'N', 'K', 'C', 'D', 'C', '1'};
+
+// Bytes of a segment with this many shards and slots per shard
+static size_t segmentSize(uint32_t shards, uint64_t capacity) {
+    return sizeof(ChangeFeedHeader) + shards * sizeof(FeedRing) + shards * capacity * sizeof(FeedSlot);
+}
+
+// Milliseconds since the Unix epoch
+static int64_t nowMs() {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// A double's bits as a word, and back
+static uint64_t doubleBits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double bitsDouble(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Constructor
+ChangeFeed::ChangeFeed()
+    : mapping(nullptr), mappingSize(0), header(nullptr), rings(nullptr), slots(nullptr), shardCount(0),
+      capacityMask(0) {}
+
+ChangeFeed::~ChangeFeed() {
+    close();
+}
+
+#if BANK_CHANGE_FEED
+// Make a fresh segment. A segment left under the name (by a producer that
+// crashed, or one still running elsewhere) is marked retired first, so
+// its readers move to the new one.
+bool ChangeFeed::open(const string& name, int shards, size_t capacity) {
+    close();
+    uint64_t slotsPerShard = 1024;
+    while (slotsPerShard < capacity) {
+        slotsPerShard *= 2;
+    }
+    int oldFd = shm_open(name.c_str(), O_RDWR, 0);
+    if (oldFd >= 0) {
+        struct stat info;
+        if (fstat(oldFd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(ChangeFeedHeader)) {
+            void* old = mmap(nullptr, sizeof(ChangeFeedHeader), PROT_READ | PROT_WRITE, MAP_SHARED, oldFd, 0);
+            if (old != MAP_FAILED) {
+                static_cast<ChangeFeedHeader*>(old)->state.store(FEED_RETIRED, memory_order_release);
+                munmap(old, sizeof(ChangeFeedHeader));
+            }
+        }
+        ::close(oldFd);
+        shm_unlink(name.c_str());
+    }
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        cerr << "Error: Could not create shared memory " << name << ": " << strerror(errno) << "!" << endl;
+        return false;
+    }
+    size_t size = segmentSize(static_cast<uint32_t>(shards), slotsPerShard);
+    void* memory = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        cerr << "Error: Could not map shared memory " << name << ": " << strerror(errno) << "!" << endl;
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    // The new pages are zero, which is an empty ring and an unwritten slot
+    segmentName = name;
+    mapping = memory;
+    mappingSize = size;
+    header = static_cast<ChangeFeedHeader*>(memory);
+    rings = reinterpret_cast<FeedRing*>(header + 1);
+    slots = reinterpret_cast<FeedSlot*>(rings + shards);
+    shardCount = static_cast<uint32_t>(shards);
+    capacityMask = slotsPerShard - 1;
+    memcpy(header->magic, FEED_MAGIC, sizeof(FEED_MAGIC));
+    header->generation = nowMs();
+    header->shardCount = shardCount;
+    header->capacity = static_cast<uint32_t>(slotsPerShard);
+    header->state.store(FEED_LIVE, memory_order_release);
+    return true;
+}
+
+// Tell readers the segment is finished and remove its name
+void ChangeFeed::close() {
+    if (!header) {
+        return;
+    }
+    header->state.store(FEED_RETIRED, memory_order_release);
+    munmap(mapping, mappingSize);
+    shm_unlink(segmentName.c_str());
+    mapping = nullptr;
+    header = nullptr;
+    rings = nullptr;
+    slots = nullptr;
+}
+#else
+bool ChangeFeed::open(const string& name, int, size_t) {
+    cerr << "Warning: The change feed is not in this build; " << name << " was not created" << endl;
+    return false;
+}
+
+void ChangeFeed::close() {}
+#endif
+
+// Write each record into the next slot of the shard's ring, then move the
+// head past them all. Only the shard's lock holder gets here, so the head
+// is read without synchronization.
+void ChangeFeed::publish(int shardIndex, const JournalRecord* records, size_t count, bool journaled) {
+    if (!header || static_cast<uint32_t>(shardIndex) >= shardCount) {
+        return;
+    }
+    FeedRing& ring = rings[shardIndex];
+    FeedSlot* ringSlots = slots + static_cast<size_t>(shardIndex) * (capacityMask + 1);
+    uint64_t sequence = ring.head.load(memory_order_relaxed);
+    for (size_t i = 0; i < count; i++) {
+        const JournalRecord& record = records[i];
+        FeedSlot& slot = ringSlots[++sequence & capacityMask];
+        slot.sequence.store(0, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        slot.words[0].store(journaled ? record.sequence : 0, memory_order_relaxed);
+        slot.words[1].store(static_cast<uint64_t>(record.timestampMs), memory_order_relaxed);
+        slot.words[2].store(record.transferId, memory_order_relaxed);
+        slot.words[3].store(static_cast<uint32_t>(record.accountNumber) |
+                            static_cast<uint64_t>(static_cast<uint32_t>(record.op)) << 32, memory_order_relaxed);
+        slot.words[4].store(doubleBits(record.amount), memory_order_relaxed);
+        slot.words[5].store(doubleBits(record.balanceAfter), memory_order_relaxed);
+        slot.words[6].store(static_cast<uint32_t>(record.accountType), memory_order_relaxed);
+        slot.sequence.store(sequence, memory_order_release);
+    }
+    ring.head.store(sequence, memory_order_release);
+}
+
+bool ChangeFeed::isActive() const {
+    return header != nullptr;
+}
+
+// Sum of the ring heads
+uint64_t ChangeFeed::getPublishedCount() const {
+    uint64_t total = 0;
+    for (uint32_t i = 0; header && i < shardCount; i++) {
+        total += rings[i].head.load(memory_order_relaxed);
+    }
+    return total;
+}
+
+size_t ChangeFeed::getCapacity() const {
+    return header ? static_cast<size_t>(capacityMask + 1) : 0;
+}
+
+const string& ChangeFeed::getName() const {
+    return segmentName;
+}
+
+// Constructor
+ChangeFeedReader::ChangeFeedReader()
+    : mapping(nullptr), mappingSize(0), header(nullptr), rings(nullptr), slots(nullptr), shardCount(0),
+      capacityMask(0) {}
+
+ChangeFeedReader::~ChangeFeedReader() {
+    detach();
+}
+
+#if BANK_CHANGE_FEED
+// Map a live segment read-only
+bool ChangeFeedReader::attach(const string& name) {
+    detach();
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    void* memory = MAP_FAILED;
+    size_t size = 0;
+    if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(ChangeFeedHeader)) {
+        size = static_cast<size_t>(info.st_size);
+        memory = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        return false;
+    }
+    const ChangeFeedHeader* candidate = static_cast<const ChangeFeedHeader*>(memory);
+    if (candidate->state.load(memory_order_acquire) != FEED_LIVE ||
+        memcmp(candidate->magic, FEED_MAGIC, sizeof(FEED_MAGIC)) != 0 || candidate->capacity == 0 ||
+        (candidate->capacity & (candidate->capacity - 1)) != 0 ||
+        segmentSize(candidate->shardCount, candidate->capacity) != size) {
+        munmap(memory, size);
+        return false;
+    }
+    mapping = memory;
+    mappingSize = size;
+    header = candidate;
+    shardCount = header->shardCount;
+    capacityMask = header->capacity - 1;
+    rings = reinterpret_cast<const FeedRing*>(header + 1);
+    slots = reinterpret_cast<const FeedSlot*>(rings + shardCount);
+    return true;
+}
+
+void ChangeFeedReader::detach() {
+    if (!header) {
+        return;
+    }
+    munmap(mapping, mappingSize);
+    mapping = nullptr;
+    header = nullptr;
+    rings = nullptr;
+    slots = nullptr;
+}
+#else
+bool ChangeFeedReader::attach(const string&) {
+    return false;
+}
+
+void ChangeFeedReader::detach() {}
+#endif
+
+// True once the producer has stopped or made a new segment (also when
+// not attached)
+bool ChangeFeedReader::isRetired() const {
+    return !header || header->state.load(memory_order_acquire) != FEED_LIVE;
+}
+
+int ChangeFeedReader::getShardCount() const {
+    return static_cast<int>(shardCount);
+}
+
+int64_t ChangeFeedReader::getGeneration() const {
+    return header ? header->generation : 0;
+}
+
+uint64_t ChangeFeedReader::getHead(int shardIndex) const {
+    return rings[shardIndex].head.load(memory_order_acquire);
+}
+
+// Copy events out of a ring. Each slot is checked before and after its
+// words are copied: if the producer reused it in between (it has lapped
+// this reader), the event is lost and reading moves to the oldest one
+// still in the ring.
+size_t ChangeFeedReader::read(int shardIndex, uint64_t& next, ChangeEvent* events, size_t max, uint64_t& lost) const {
+    uint64_t capacity = capacityMask + 1;
+    const FeedSlot* ringSlots = slots + static_cast<size_t>(shardIndex) * capacity;
+    uint64_t head = rings[shardIndex].head.load(memory_order_acquire);
+    size_t count = 0;
+    while (count < max && next <= head) {
+        if (head - next >= capacity) {
+            lost += head - capacity + 1 - next;
+            next = head - capacity + 1;
+        }
+        const FeedSlot& slot = ringSlots[next & capacityMask];
+        uint64_t before = slot.sequence.load(memory_order_acquire);
+        uint64_t words[7];
+        for (int i = 0; i < 7; i++) {
+            words[i] = slot.words[i].load(memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        uint64_t after = slot.sequence.load(memory_order_relaxed);
+        if (before != next || after != next) {
+            head = rings[shardIndex].head.load(memory_order_acquire);
+            lost++;
+            next++;
+            continue;
+        }
+        ChangeEvent& event = events[count++];
+        event.sequence = next;
+        event.journalSequence = words[0];
+        event.timestampMs = static_cast<int64_t>(words[1]);
+        event.transferId = words[2];
+        event.shardIndex = shardIndex;
+        event.accountNumber = static_cast<int32_t>(static_cast<uint32_t>(words[3]));
+        event.op = static_cast<int32_t>(words[3] >> 32);
+        event.amount = bitsDouble(words[4]);
+        event.balanceAfter = bitsDouble(words[5]);
+        event.accountType = static_cast<int32_t>(static_cast<uint32_t>(words[6]));
+        next++;
+    }
+    return count;
+}
+
+// Constructor
+ChangeConsumer::ChangeConsumer(string ledgerDirectory, bool quietOutput)
+    : directory(ledgerDirectory), quiet(quietOutput), delivered(0), lost(0), fromJournal(0), unrecoverable(0) {}
+
+// Journal op as a word
+const char* ChangeConsumer::opName(int op) {
+    switch (op) {
+        case JOURNAL_CREATE: return "create";
+        case JOURNAL_BALANCE: return "balance";
+        case JOURNAL_DELETE: return "purge";
+        case JOURNAL_CLOSE: return "close";
+        case JOURNAL_REQUEST: return "request";
+        case JOURNAL_HOLD: return "hold";
+        case JOURNAL_HOLD_RELEASE: return "release";
+        case JOURNAL_LIMITS: return "limits";
+        default: return "other";
+    }
+}
+
+// Segment name the ledger in a directory publishes to
+string ChangeConsumer::configuredName(const string& ledgerDirectory) {
+    string fileName = ledgerDirectory + "/settings.txt";
+    Settings settings(fileName);
+    if (!ifstream(fileName) || !settings.load()) {
+        return "/banking_changes";
+    }
+    return settings.getString("change_feed_name", "/banking_changes");
+}
+
+// Pass on an event from the ring, filling any hole in the shard's journal
+// sequence from the journal first. Events already read back from the
+// journal are skipped.
+void ChangeConsumer::deliver(const ChangeEvent& event) {
+    ShardCursor& cursor = cursors[event.shardIndex];
+    if (event.journalSequence != 0 && cursor.lastJournal != 0) {
+        if (event.journalSequence <= cursor.lastJournal) {
+            return;
+        }
+        if (event.journalSequence > cursor.lastJournal + 1) {
+            resumeFromJournal(event.shardIndex, event.journalSequence - 1);
+        }
+        if (event.journalSequence > cursor.lastJournal + 1) {
+            unrecoverable += event.journalSequence - cursor.lastJournal - 1;
+            cerr << "Warning: Shard " << event.shardIndex << " journal records " << cursor.lastJournal + 1 << " to "
+                 << event.journalSequence - 1 << " are no longer in the journal; resync from the slot file" << endl;
+        }
+    }
+    if (event.journalSequence != 0) {
+        cursor.lastJournal = event.journalSequence;
+    }
+    emit(event);
+}
+
+// Hand one event on (here: print it)
+void ChangeConsumer::emit(const ChangeEvent& event) {
+    delivered++;
+    if (quiet) {
+        return;
+    }
+    cout << "shard " << event.shardIndex << " #";
+    if (event.sequence != 0) {
+        cout << event.sequence;
+    } else {
+        cout << "-";
+    }
+    cout << " journal " << event.journalSequence << " " << left << setw(8) << opName(event.op) << right
+         << " account " << event.accountNumber << " amount " << fixed << setprecision(2) << event.amount
+         << " balance " << event.balanceAfter << endl;
+}
+
+// Deliver the shard's journal records after the last one delivered, up to
+// upTo. Records already checkpointed out of the journal cannot be read
+// back; the consumer is told to resync from the slot file instead.
+void ChangeConsumer::resumeFromJournal(int shardIndex, uint64_t upTo) {
+    ShardCursor& cursor = cursors[shardIndex];
+    if (cursor.lastJournal == 0) {
+        return;   // Nothing delivered on this shard yet, so there is no position to resume from
+    }
+    ShardJournal journal(directory + "/bank_data." + to_string(shardIndex) + ".journal");
+    vector<JournalRecord> records;
+    journal.readAll(records);
+    for (const JournalRecord& record : records) {
+        if (record.sequence <= cursor.lastJournal || record.sequence > upTo) {
+            continue;
+        }
+        if (record.sequence > cursor.lastJournal + 1) {
+            uint64_t missing = record.sequence - cursor.lastJournal - 1;
+            unrecoverable += missing;
+            cerr << "Warning: Shard " << shardIndex << " journal records " << cursor.lastJournal + 1 << " to "
+                 << record.sequence - 1 << " are no longer in the journal; resync from the slot file" << endl;
+        }
+        ChangeEvent event;
+        event.sequence = 0;
+        event.journalSequence = record.sequence;
+        event.timestampMs = record.timestampMs;
+        event.transferId = record.transferId;
+        event.shardIndex = shardIndex;
+        event.op = record.op;
+        event.accountNumber = record.accountNumber;
+        event.accountType = record.accountType;
+        event.amount = record.amount;
+        event.balanceAfter = record.balanceAfter;
+        cursor.lastJournal = record.sequence;
+        fromJournal++;
+        emit(event);
+    }
+}
+
+// Attach (waiting for the producer if needed) and read every shard's ring
+// in turn. A retired segment means the producer restarted: the new
+// segment's rings start again from 1, and the journal fills the gap.
+bool ChangeConsumer::follow(const string& name, int seconds) {
+#if BANK_CHANGE_FEED
+    ChangeFeedReader reader;
+    auto started = chrono::steady_clock::now();
+    auto lastReport = started;
+    uint64_t reportedDelivered = 0;
+    bool attached = false;
+    bool waiting = false;
+    vector<ChangeEvent> batch(4096);
+    while (seconds == 0 || chrono::steady_clock::now() - started < chrono::seconds(seconds)) {
+        if (!attached || reader.isRetired()) {
+            if (!reader.attach(name)) {
+                if (!waiting) {
+                    cout << "Waiting for the change feed " << name << " ..." << endl;
+                    waiting = true;
+                }
+                attached = false;
+                this_thread::sleep_for(chrono::milliseconds(200));
+                continue;
+            }
+            bool restarted = attached || !cursors.empty();
+            cursors.resize(reader.getShardCount());
+            for (int i = 0; i < reader.getShardCount(); i++) {
+                cursors[i].next = restarted ? 1 : reader.getHead(i) + 1;
+            }
+            cout << "Following " << name << " (" << reader.getShardCount() << " shard(s), generation "
+                 << reader.getGeneration() << ")" << endl;
+            attached = true;
+            waiting = false;
+        }
+
+        size_t readCount = 0;
+        for (int i = 0; i < reader.getShardCount(); i++) {
+            uint64_t missed = 0;
+            size_t count = reader.read(i, cursors[i].next, batch.data(), batch.size(), missed);
+            if (missed != 0) {
+                lost += missed;
+                if (!quiet) {
+                    cerr << "Warning: Shard " << i << " ring overran; " << missed << " event(s) missed" << endl;
+                }
+                resumeFromJournal(i, UINT64_MAX);
+            }
+            for (size_t j = 0; j < count; j++) {
+                deliver(batch[j]);
+            }
+            readCount += count;
+        }
+        if (readCount == 0) {
+            this_thread::sleep_for(chrono::microseconds(200));
+        }
+
+        auto now = chrono::steady_clock::now();
+        if (quiet && now - lastReport >= chrono::seconds(1)) {
+            double elapsed = chrono::duration<double>(now - lastReport).count();
+            cout << fixed << setprecision(0) << (delivered - reportedDelivered) / elapsed << " events/s, "
+                 << delivered << " delivered, " << lost << " missed in the ring, " << fromJournal
+                 << " read back from the journal, " << unrecoverable << " unrecoverable" << endl;
+            lastReport = now;
+            reportedDelivered = delivered;
+        }
+    }
+    cout << delivered << " event(s) delivered, " << lost << " missed in the ring, " << fromJournal
+         << " read back from the journal, " << unrecoverable << " unrecoverable" << endl;
+    return true;
+#else
+    cout << "Error: The change feed is not in this build; cannot follow " << name << "!" << endl;
+    return false;
+#endif
+}
+
+// Publish events into a private segment while reader threads, each with
+// its own mapping, follow it. Unlike the ledger, the benchmark's producer
+// yields whenever it is half a ring ahead of the slowest reader, so every
+// reader sees every event and the rates are end to end.
+bool ChangeConsumer::benchmark(uint64_t events, int consumers, size_t capacity) {
+#if BANK_CHANGE_FEED
+    string name = "/banking_changes_bench." + to_string(getpid());
+    ChangeFeed feed;
+    if (!feed.open(name, 1, capacity)) {
+        return false;
+    }
+    struct ReaderResult {
+        atomic<uint64_t> position{0};   // Events read so far, for the producer to watch
+        uint64_t received = 0;
+        uint64_t lost = 0;
+        double seconds = 0.0;
+        double checksum = 0.0;
+    };
+    vector<ReaderResult> results(max(consumers, 1));
+    atomic<int> ready(0);
+    atomic<bool> producing(true);
+    vector<thread> readers;
+    for (size_t r = 0; r < results.size(); r++) {
+        readers.push_back(thread([&, r]() {
+            ChangeFeedReader reader;
+            if (!reader.attach(name)) {
+                ready++;
+                return;
+            }
+            vector<ChangeEvent> batch(1024);
+            uint64_t next = 1;
+            ReaderResult& result = results[r];
+            ready++;
+            auto started = chrono::steady_clock::now();
+            while (true) {
+                bool finished = !producing.load(memory_order_acquire);
+                size_t count = reader.read(0, next, batch.data(), batch.size(), result.lost);
+                for (size_t i = 0; i < count; i++) {
+                    result.checksum += batch[i].amount;
+                }
+                result.received += count;
+                result.position.store(next - 1, memory_order_release);
+                if (count == 0 && finished && next > reader.getHead(0)) {
+                    break;
+                }
+                if (count == 0) {
+                    this_thread::yield();
+                }
+            }
+            result.seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        }));
+    }
+    while (ready.load() < static_cast<int>(results.size())) {
+        this_thread::yield();
+    }
+
+    JournalRecord record = ShardJournal::makeRecord(JOURNAL_BALANCE, 1001, 0, 0.0, 0.0, "Deposit");
+    uint64_t slack = feed.getCapacity() / 2;
+    uint64_t checkMask = min<uint64_t>(slack / 2, 1024) - 1;
+    auto started = chrono::steady_clock::now();
+    for (uint64_t i = 1; i <= events; i++) {
+        if ((i & checkMask) == 0) {
+            for (const auto& result : results) {
+                while (i - result.position.load(memory_order_acquire) > slack) {
+                    this_thread::yield();
+                }
+            }
+        }
+        record.sequence = i;
+        record.amount = 1.0;
+        record.balanceAfter = static_cast<double>(i);
+        feed.publish(0, &record, 1, true);
+    }
+    producing.store(false, memory_order_release);
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+    cout << "Ring: " << feed.getCapacity() << " slots of " << sizeof(FeedSlot) << " bytes" << endl;
+    cout << events << " events to " << results.size() << " consumer(s) in " << fixed << setprecision(3) << seconds
+         << " s (" << setprecision(1) << events / seconds / 1e6 << " M events/s through the ring, "
+         << thread::hardware_concurrency() << " hardware thread(s))" << endl;
+    for (size_t r = 0; r < results.size(); r++) {
+        const ReaderResult& result = results[r];
+        cout << "Consumer " << r + 1 << ": " << result.received << " received, " << result.lost << " missed, "
+             << setprecision(1) << (result.seconds > 0 ? result.received / result.seconds / 1e6 : 0.0)
+             << " M events/s" << (result.received + result.lost == events ? "" : " (incomplete)") << endl;
+    }
+    return true;
+#else
+    (void)events;
+    (void)consumers;
+    (void)capacity;
+    cout << "Error: The change feed is not in this build!" << endl;
+    return false;
+#endif
+}
@@ -0,0 +1,173 @@
+#ifndef CHANGEFEED_H
+#define CHANGEFEED_H
+
+#include "Journal.h"
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+// Set BANK_CHANGE_FEED to 0 (e.g. -DBANK_CHANGE_FEED=0) to leave the
+// change feed out. It needs POSIX shared memory (shm_open), so it is not
+// built on Windows.
+#ifndef BANK_CHANGE_FEED
+#ifdef _WIN32
+#define BANK_CHANGE_FEED 0
+#else
+#define BANK_CHANGE_FEED 1
+#endif
+#endif
+
+using namespace std;
+
+static_assert(atomic<uint64_t>::is_always_lock_free, "the change feed needs lock-free 64-bit atomics");
+
+// One committed change as a subscriber reads it
+struct ChangeEvent {
+    uint64_t sequence;          // Position in its shard's ring: from 1, no gaps (0 = read from the journal)
+    uint64_t journalSequence;   // Sequence of the journal record (0 = posting change, not journaled)
+    int64_t timestampMs;
+    uint64_t transferId;        // Transfer id, hold id or request key hash, as in the journal record
+    int32_t shardIndex;
+    int32_t op;                 // JournalOp value
+    int32_t accountNumber;
+    int32_t accountType;        // As in the journal record (create: type | stored currency << 16)
+    double amount;
+    double balanceAfter;
+};
+
+// Lifecycle of a shared segment
+enum ChangeFeedState : uint32_t {
+    FEED_STARTING = 0,
+    FEED_LIVE = 1,
+    FEED_RETIRED = 2            // The producer stopped or was replaced: attach again by name
+};
+
+// Start of the shared segment. Then come one FeedRing per shard and then
+// each shard's slots, capacity of them per shard.
+struct ChangeFeedHeader {
+    char magic[8];              // "BANKCDC1"
+    int64_t generation;         // Producer's clock in ms when it made the segment
+    uint32_t shardCount;
+    uint32_t capacity;          // Slots per shard (a power of two)
+    atomic<uint32_t> state;     // ChangeFeedState
+    char reserved[36];
+};
+
+// Where a shard's ring has got to, alone on its cache line
+struct alignas(64) FeedRing {
+    atomic<uint64_t> head;      // Sequence of the newest published event (0 = none yet)
+    char reserved[56];
+};
+
+// One event in a ring, written like a seqlock: the sequence is zeroed,
+// the words are stored, then the sequence is set. A reader that sees the
+// same sequence before and after copying the words has a whole event.
+struct alignas(64) FeedSlot {
+    atomic<uint64_t> sequence;
+    atomic<uint64_t> words[7];
+};
+
+// Producer side: a shared-memory segment with one single-producer,
+// many-consumer ring per shard. Each journal append is written straight
+// into its shard's ring from inside the shard lock, so every ring has one
+// writer and keeps the shard's order. The producer never waits for
+// readers: a reader that falls a whole ring behind loses the oldest
+// events and sees the gap in the ring sequence.
+class ChangeFeed {
+private:
+    string segmentName;
+    void* mapping;
+    size_t mappingSize;
+    ChangeFeedHeader* header;
+    FeedRing* rings;
+    FeedSlot* slots;
+    uint32_t shardCount;
+    uint64_t capacityMask;
+
+public:
+    // Constructor
+    ChangeFeed();
+    ~ChangeFeed();
+
+    // Make a fresh segment (retiring any left by an earlier producer)
+    bool open(const string& name, int shards, size_t capacity);
+    void close();                         // Retires and removes the segment
+
+    // Called under the shard's lock. journaled is false for changes that
+    // reach disk through a checkpoint (posting), which have no sequence.
+    void publish(int shardIndex, const JournalRecord* records, size_t count, bool journaled);
+
+    bool isActive() const;
+    uint64_t getPublishedCount() const;   // Since the segment was made
+    size_t getCapacity() const;
+    const string& getName() const;
+};
+
+// Consumer side: maps a producer's segment read-only and copies events
+// out of one ring at a time
+class ChangeFeedReader {
+private:
+    void* mapping;
+    size_t mappingSize;
+    const ChangeFeedHeader* header;
+    const FeedRing* rings;
+    const FeedSlot* slots;
+    uint32_t shardCount;
+    uint64_t capacityMask;
+
+public:
+    // Constructor
+    ChangeFeedReader();
+    ~ChangeFeedReader();
+
+    bool attach(const string& name);      // False if there is no live segment by that name
+    void detach();
+
+    bool isRetired() const;
+    int getShardCount() const;
+    int64_t getGeneration() const;
+    uint64_t getHead(int shardIndex) const;
+
+    // Copy up to max events, starting at sequence next, and move next past
+    // them. Events overwritten before they could be read are skipped and
+    // added to lost.
+    size_t read(int shardIndex, uint64_t& next, ChangeEvent* events, size_t max, uint64_t& lost) const;
+};
+
+// Sample subscriber (banking --changes DIR) and the ring benchmark
+// (banking --changes-bench)
+class ChangeConsumer {
+private:
+    struct ShardCursor {
+        uint64_t next = 0;              // Ring sequence to read next
+        uint64_t lastJournal = 0;       // Journal sequence of the newest event delivered (0 = none yet)
+    };
+
+    string directory;
+    bool quiet;
+    vector<ShardCursor> cursors;
+    uint64_t delivered;
+    uint64_t lost;
+    uint64_t fromJournal;
+    uint64_t unrecoverable;
+
+    void deliver(const ChangeEvent& event);
+    void emit(const ChangeEvent& event);
+    void resumeFromJournal(int shardIndex, uint64_t upTo);
+
+public:
+    // Constructor
+    ChangeConsumer(string ledgerDirectory, bool quietOutput);
+
+    // Segment name from the ledger's settings.txt (change_feed_name)
+    static string configuredName(const string& ledgerDirectory);
+
+    // Follow the feed until seconds have passed (0 = until interrupted)
+    bool follow(const string& name, int seconds);
+
+    static bool benchmark(uint64_t events, int consumers, size_t capacity);
+    static const char* opName(int op);
+};
+
+#endif
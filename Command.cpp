@@ -0,0 +1,137 @@
+#include "Command.h"
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+using namespace std;
+
+// Constructor
+CommandInput::CommandInput(istream& source, bool prompts)
+    : in(source), interactive(prompts), transcript(nullptr) {}
+
+// True when reading from the console (prompts are shown)
+bool CommandInput::isInteractive() const {
+    return interactive;
+}
+
+// Report a bad value; on the console the rest of the line is discarded
+bool CommandInput::rejectInput() {
+    if (interactive && !in.eof()) {
+        in.clear();
+        in.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+    cout << "Invalid input!" << endl;
+    return false;
+}
+
+// Append a value to the transcript, if one is being kept
+void CommandInput::note(const string& field) {
+    if (transcript) {
+        if (!transcript->empty()) {
+            *transcript += ' ';
+        }
+        *transcript += field;
+    }
+}
+
+// Start or stop recording the values read
+void CommandInput::setTranscript(string* fields) {
+    transcript = fields;
+}
+
+// Read a whole number
+bool CommandInput::readInt(const string& prompt, int& value) {
+    if (interactive) {
+        cout << prompt;
+    }
+    if (!(in >> value)) {
+        return rejectInput();
+    }
+    note(to_string(value));
+    return true;
+}
+
+// Read a positive 64-bit id
+bool CommandInput::readId(const string& prompt, uint64_t& value) {
+    if (interactive) {
+        cout << prompt;
+    }
+    long long number;
+    if (!(in >> number) || number <= 0) {
+        return rejectInput();
+    }
+    value = static_cast<uint64_t>(number);
+    note(to_string(value));
+    return true;
+}
+
+// Read a money amount
+bool CommandInput::readAmount(const string& prompt, double& value) {
+    if (interactive) {
+        cout << prompt;
+    }
+    if (!(in >> value)) {
+        return rejectInput();
+    }
+    if (transcript) {
+        ostringstream field;
+        field << setprecision(15) << value;
+        note(field.str());
+    }
+    return true;
+}
+
+// Read a single word
+bool CommandInput::readWord(const string& prompt, string& value) {
+    if (interactive) {
+        cout << prompt;
+    }
+    if (!(in >> value)) {
+        return rejectInput();
+    }
+    note(value);
+    return true;
+}
+
+// Read a password or similar; the transcript gets "*" in its place
+bool CommandInput::readSecret(const string& prompt, string& value) {
+    if (interactive) {
+        cout << prompt;
+    }
+    if (!(in >> value)) {
+        return rejectInput();
+    }
+    note("*");
+    return true;
+}
+
+// Read free text: the rest of the line on the console, a (quoted) field otherwise
+bool CommandInput::readText(const string& prompt, string& value) {
+    if (interactive) {
+        cout << prompt;
+        if (!getline(in, value)) {
+            return rejectInput();
+        }
+    } else if (!(in >> quoted(value))) {
+        return rejectInput();
+    }
+    if (transcript) {
+        ostringstream field;
+        field << quoted(value);
+        note(field.str());
+    }
+    return true;
+}
+
+// Read a trailing field such as an idempotency key; empty on the console or if absent
+void CommandInput::readOptionalWord(string& value) {
+    value.clear();
+    if (interactive) {
+        return;
+    }
+    in >> value;
+    if (!value.empty()) {
+        note(value);
+    }
+}
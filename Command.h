@@ -0,0 +1,84 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <string>
+#include <istream>
+#include <cstdint>
+
+using namespace std;
+
+// Operations available after login. The order is the menu order; a role's
+// menu lists the commands it is permitted to run.
+enum CommandId {
+    CMD_CREATE_ACCOUNT,
+    CMD_DEPOSIT,
+    CMD_WITHDRAW,
+    CMD_CHECK_BALANCE,
+    CMD_TRANSACTION_HISTORY,
+    CMD_LIST_ACCOUNTS,
+    CMD_DELETE_ACCOUNT,
+    CMD_EXPORT_JSON,
+    CMD_SYSTEM_LOGS,
+    CMD_MANAGE_USERS,
+    CMD_REGISTER_USER,
+    CMD_UNLOCK_USER,
+    CMD_INTEREST_POSTING,
+    CMD_RATE_TABLE,
+    CMD_TRANSFER,
+    CMD_PERFORMANCE_STATS,
+    CMD_CLOSE_ACCOUNTS,
+    CMD_COMPACT_LEDGER,
+    CMD_RUN_BATCH,
+    CMD_PLACE_HOLD,
+    CMD_SETTLE_HOLD,
+    CMD_RELEASE_HOLD,
+    CMD_SET_LIMITS,
+    CMD_MONTHLY_STATEMENTS,
+    CMD_VERIFY_INTEGRITY,
+    CMD_REVALUE,
+    CMD_REVIEW_QUEUE,
+    COMMAND_COUNT
+};
+
+// Outcome of dispatching a command
+enum CommandResult {
+    COMMAND_OK,
+    COMMAND_UNKNOWN,
+    COMMAND_DENIED,
+    COMMAND_EXPIRED     // Session token unknown or timed out
+};
+
+// Where a command reads its arguments. The console prompts for each value
+// on cin; batch and network front ends pass the values as one stream of
+// whitespace-separated fields (quote names that contain spaces) and no
+// prompts are printed. With a transcript set, every value read is also
+// appended to it in batch syntax, so a console command can be traced and
+// run again from a file.
+class CommandInput {
+private:
+    istream& in;
+    bool interactive;
+    string* transcript;
+
+    bool rejectInput();
+    void note(const string& field);
+
+public:
+    // Constructor
+    CommandInput(istream& source, bool prompts);
+
+    bool isInteractive() const;
+
+    // Each returns false (after reporting it) if the value is missing or malformed
+    bool readInt(const string& prompt, int& value);
+    bool readId(const string& prompt, uint64_t& value);  // Positive 64-bit id (e.g. a hold)
+    bool readAmount(const string& prompt, double& value);
+    bool readWord(const string& prompt, string& value);
+    bool readText(const string& prompt, string& value);  // Rest of the line when interactive
+    bool readSecret(const string& prompt, string& value);  // A word kept out of the transcript
+    void readOptionalWord(string& value);                // Trailing field if present; never prompts
+
+    void setTranscript(string* fields);                  // nullptr stops recording
+};
+
+#endif
@@ -0,0 +1,284 @@
+#include "Currency.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+
+#if BANK_FX_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Rates written to a new fx_rates.txt (units of USD per unit)
+static const struct {
+    const char* code;
+    double rate;
+} DEFAULT_RATES[] = {
+    { "USD", 1.0 },
+    { "EUR", 1.08 },
+    { "GBP", 1.27 },
+    { "CHF", 1.12 },
+    { "CAD", 0.73 },
+    { "AUD", 0.66 },
+    { "JPY", 0.0067 }
+};
+
+// Parse a three-letter code (either case)
+CurrencyCode Currency::parse(string_view text) {
+    if (text.size() != 3) {
+        return NONE;
+    }
+    CurrencyCode code = 0;
+    for (char letter : text) {
+        char upper = letter >= 'a' && letter <= 'z' ? static_cast<char>(letter - 'a' + 'A') : letter;
+        if (upper < 'A' || upper > 'Z') {
+            return NONE;
+        }
+        code = static_cast<CurrencyCode>((code << 5) | (upper - '@'));
+    }
+    return code;
+}
+
+// The three letters of a code
+string Currency::name(CurrencyCode code) {
+    if (code == NONE || code >= CODE_LIMIT) {
+        return "---";
+    }
+    string text(3, ' ');
+    for (int i = 2; i >= 0; i--) {
+        text[i] = static_cast<char>('@' + (code & 31));
+        code = static_cast<CurrencyCode>(code >> 5);
+    }
+    return text;
+}
+
+// Written before an amount; USD keeps the dollar sign shown before currencies
+string Currency::prefix(CurrencyCode code) {
+    return code == USD ? "$" : name(code) + " ";
+}
+
+// Code as kept in a slot or journal record
+int32_t Currency::toStored(CurrencyCode code) {
+    return code == USD ? 0 : code;
+}
+
+// Code from a slot or journal record
+CurrencyCode Currency::fromStored(int32_t stored) {
+    if (stored <= 0 || stored >= static_cast<int32_t>(CODE_LIMIT)) {
+        return USD;
+    }
+    return static_cast<CurrencyCode>(stored);
+}
+
+// Add another pass's totals (from the same report currency)
+void RevaluationTotals::merge(const RevaluationTotals& other) {
+    credit += other.credit;
+    debit += other.debit;
+    if (nativeTotals.empty()) {
+        nativeTotals.assign(Currency::CODE_LIMIT, 0.0);
+        accountCounts.assign(Currency::CODE_LIMIT, 0);
+    }
+    for (size_t code = 0; code < other.accountCounts.size(); code++) {
+        if (other.accountCounts[code] != 0) {
+            nativeTotals[code] += other.nativeTotals[code];
+            accountCounts[code] += other.accountCounts[code];
+        }
+    }
+}
+
+// Constructor
+FxRateTable::FxRateTable(string file) : fileName(file), baseCurrency(Currency::USD), rates(Currency::CODE_LIMIT, 0.0) {
+    for (const auto& entry : DEFAULT_RATES) {
+        setRate(Currency::parse(entry.code), entry.rate);
+    }
+}
+
+// Set a currency's rate, listing it if it had none
+void FxRateTable::setRate(CurrencyCode code, double rate) {
+    if (rates[code] == 0.0) {
+        listed.push_back(code);
+    }
+    rates[code] = rate;
+}
+
+// Load the rates, writing the defaults if the file doesn't exist. Rates
+// are rescaled if needed so that the base currency's rate is exactly 1.
+bool FxRateTable::load() {
+    ifstream inFile(fileName);
+    if (!inFile) {
+        return save();
+    }
+
+    CurrencyCode base = Currency::USD;
+    vector<pair<CurrencyCode, double>> entries;
+    string line;
+    while (getline(inFile, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        istringstream fields(line);
+        string first;
+        string second;
+        fields >> first >> second;
+        if (first == "base" && Currency::parse(second) != Currency::NONE) {
+            base = Currency::parse(second);
+            continue;
+        }
+        CurrencyCode code = Currency::parse(first);
+        double rate = 0.0;
+        istringstream value(second);
+        if (code == Currency::NONE || !(value >> rate) || !(rate > 0.0) || !isfinite(rate)) {
+            cerr << "Warning: Skipping malformed exchange rate line: " << line << endl;
+            continue;
+        }
+        entries.push_back(make_pair(code, rate));
+    }
+    inFile.close();
+
+    double baseRate = 1.0;
+    for (const auto& entry : entries) {
+        if (entry.first == base) {
+            baseRate = entry.second;
+        }
+    }
+    rates.assign(Currency::CODE_LIMIT, 0.0);
+    listed.clear();
+    baseCurrency = base;
+    setRate(base, 1.0);
+    for (const auto& entry : entries) {
+        if (entry.first != base) {
+            setRate(entry.first, entry.second / baseRate);
+        }
+    }
+    return true;
+}
+
+// Save the rate table
+bool FxRateTable::save() const {
+    ofstream outFile(fileName);
+    if (!outFile) {
+        cerr << "Error: Could not open exchange rate file for saving!" << endl;
+        return false;
+    }
+    outFile << "# Units of the base currency per one unit of each currency" << endl;
+    outFile << "base " << Currency::name(baseCurrency) << endl;
+    outFile.precision(10);
+    for (CurrencyCode code : listed) {
+        outFile << Currency::name(code) << " " << rates[code] << endl;
+    }
+    outFile.close();
+    return true;
+}
+
+CurrencyCode FxRateTable::getBase() const {
+    return baseCurrency;
+}
+
+bool FxRateTable::hasRate(CurrencyCode code) const {
+    return code != Currency::NONE && rates[code] > 0.0;
+}
+
+// Units of the base currency per unit of code (0 = no rate)
+double FxRateTable::getRate(CurrencyCode code) const {
+    return rates[code];
+}
+
+// Currencies with a rate, the base first
+const vector<CurrencyCode>& FxRateTable::getCurrencies() const {
+    return listed;
+}
+
+// Convert an amount between currencies, rounded to the cent
+bool FxRateTable::convert(double amount, CurrencyCode from, CurrencyCode to, double& result) const {
+    if (!hasRate(from) || !hasRate(to)) {
+        return false;
+    }
+    result = from == to ? amount : llround(amount * rates[from] / rates[to] * 100.0) / 100.0;
+    return true;
+}
+
+// Flat rate table into the report currency
+bool FxRateTable::ratesInto(CurrencyCode reportCurrency, vector<double>& table) const {
+    if (!hasRate(reportCurrency)) {
+        return false;
+    }
+    table.assign(Currency::CODE_LIMIT, 0.0);
+    for (CurrencyCode code : listed) {
+        table[code] = code == reportCurrency ? 1.0 : rates[code] / rates[reportCurrency];
+    }
+    return true;
+}
+
+#if BANK_FX_AVX2
+// Whether the processor can run the AVX2 kernel (checked once)
+static bool hasAvx2() {
+    static const bool supported = __builtin_cpu_supports("avx2") != 0;
+    return supported;
+}
+
+// Gather four rates at a time by currency code, multiply them with four
+// balances and keep positive and negative values in separate lane sums.
+// Returns how many balances it covered (a multiple of four).
+__attribute__((target("avx2")))
+static size_t revalueAvx2(const double* balances, const CurrencyCode* currencies, size_t count, const double* table,
+                          double* credit, double* debit) {
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d everyLane = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    __m256d creditLanes = zero;
+    __m256d debitLanes = zero;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i codes = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(currencies + i)));
+        __m256d rate = _mm256_mask_i32gather_pd(zero, table, codes, everyLane, 8);
+        __m256d value = _mm256_mul_pd(_mm256_loadu_pd(balances + i), rate);
+        creditLanes = _mm256_add_pd(creditLanes, _mm256_max_pd(value, zero));
+        debitLanes = _mm256_add_pd(debitLanes, _mm256_min_pd(value, zero));
+    }
+    _mm256_storeu_pd(credit, creditLanes);
+    _mm256_storeu_pd(debit, debitLanes);
+    return i;
+}
+#endif
+
+// Revalue a run of balances. The gather and multiply go four at a time;
+// the per-currency totals are a second, scalar pass over the same columns.
+void FxRateTable::revalue(const double* balances, const CurrencyCode* currencies, size_t count, const double* table,
+                          RevaluationTotals& totals) {
+    double credit[4] = { 0.0, 0.0, 0.0, 0.0 };
+    double debit[4] = { 0.0, 0.0, 0.0, 0.0 };
+    size_t i = 0;
+#if BANK_FX_AVX2
+    if (hasAvx2()) {
+        i = revalueAvx2(balances, currencies, count, table, credit, debit);
+    }
+#endif
+    for (; i < count; i++) {
+        double value = balances[i] * table[currencies[i]];
+        credit[i & 3] += value > 0.0 ? value : 0.0;
+        debit[i & 3] += value < 0.0 ? value : 0.0;
+    }
+    totals.credit += (credit[0] + credit[1]) + (credit[2] + credit[3]);
+    totals.debit += (debit[0] + debit[1]) + (debit[2] + debit[3]);
+
+    if (totals.nativeTotals.empty()) {
+        totals.nativeTotals.assign(Currency::CODE_LIMIT, 0.0);
+        totals.accountCounts.assign(Currency::CODE_LIMIT, 0);
+    }
+    double* native = totals.nativeTotals.data();
+    uint32_t* counts = totals.accountCounts.data();
+    for (size_t j = 0; j < count; j++) {
+        native[currencies[j]] += balances[j];
+        counts[currencies[j]]++;
+    }
+}
+
+// Kernel revalue() runs on this processor
+const char* FxRateTable::kernelName() {
+#if BANK_FX_AVX2
+    if (hasAvx2()) {
+        return "avx2 gather";
+    }
+#endif
+    return "portable";
+}
@@ -0,0 +1,95 @@
+#ifndef CURRENCY_H
+#define CURRENCY_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Set BANK_FX_AVX2 to 0 (e.g. -DBANK_FX_AVX2=0) to leave out the AVX2
+// revaluation kernel. With GCC or Clang on x86-64 it is compiled for AVX2
+// and used on processors that have it; elsewhere the portable loop runs.
+#ifndef BANK_FX_AVX2
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define BANK_FX_AVX2 1
+#else
+#define BANK_FX_AVX2 0
+#endif
+#endif
+
+using namespace std;
+
+// ISO 4217 code packed five bits per letter ("EUR" = 5, 21, 18), so every
+// code is below Currency::CODE_LIMIT and can index a flat table
+typedef uint16_t CurrencyCode;
+
+// Currency codes and how they are written
+class Currency {
+public:
+    static constexpr CurrencyCode NONE = 0;
+    static constexpr CurrencyCode USD = (('U' - '@') << 10) | (('S' - '@') << 5) | ('D' - '@');
+    static constexpr size_t CODE_LIMIT = 1 << 15;
+
+    static CurrencyCode parse(string_view text);    // NONE unless three letters
+    static string name(CurrencyCode code);          // "EUR"; "---" for NONE
+    static string prefix(CurrencyCode code);        // Shown before amounts: "$" for USD, "EUR " otherwise
+
+    // Slot files and journals written before currencies hold 0, which
+    // means USD; USD is still stored as 0 so those files hash the same
+    static int32_t toStored(CurrencyCode code);
+    static CurrencyCode fromStored(int32_t stored);
+};
+
+// Result of revaluing balances into one currency. Credit and debit are in
+// the report currency; the per-currency figures are in each currency.
+struct RevaluationTotals {
+    double credit = 0.0;                // Sum of positive balances
+    double debit = 0.0;                 // Sum of overdrawn (negative) balances
+    vector<double> nativeTotals;        // Indexed by currency code
+    vector<uint32_t> accountCounts;     // Indexed by currency code
+
+    void merge(const RevaluationTotals& other);
+};
+
+// Exchange rates from fx_rates.txt: units of the base currency per unit of
+// each listed currency. Loaded once at startup, so conversions made while
+// the program runs all use the same rates.
+class FxRateTable {
+private:
+    string fileName;
+    CurrencyCode baseCurrency;
+    vector<double> rates;               // Indexed by currency code; 0 = no rate
+    vector<CurrencyCode> listed;        // Currencies with a rate, in file order
+
+    void setRate(CurrencyCode code, double rate);
+
+public:
+    // Constructor
+    FxRateTable(string file);
+
+    bool load();                        // Writes the defaults if the file doesn't exist
+    bool save() const;
+
+    CurrencyCode getBase() const;
+    bool hasRate(CurrencyCode code) const;
+    double getRate(CurrencyCode code) const;
+    const vector<CurrencyCode>& getCurrencies() const;
+
+    // amount in from, in to, rounded to the cent; false if either has no rate
+    bool convert(double amount, CurrencyCode from, CurrencyCode to, double& result) const;
+
+    // Flat table of Currency::CODE_LIMIT rates into reportCurrency (0 where
+    // there is no rate), for revalue()
+    bool ratesInto(CurrencyCode reportCurrency, vector<double>& table) const;
+
+    // Revalue count balances: gather each one's rate by its currency code,
+    // multiply and sum. Four lanes each take every fourth balance, on AVX2
+    // or in the portable loop alike, so the totals do not depend on which
+    // ran. Tombstones (currency NONE, balance 0) add nothing.
+    static void revalue(const double* balances, const CurrencyCode* currencies, size_t count, const double* table,
+                        RevaluationTotals& totals);
+    static const char* kernelName();    // "avx2 gather" or "portable"
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include "IdempotencyTable.h"
+#include <cmath>
+
+using namespace std;
+
+// Constructor
+IdempotencyTable::IdempotencyTable(size_t capacity) : indexMask(0), head(0), count(0) {
+    configure(capacity);
+}
+
+// Size the ring and index; both are allocated once here
+void IdempotencyTable::configure(size_t capacity) {
+    size_t size = 16;
+    while (size < capacity) {
+        size *= 2;
+    }
+    ring.assign(size, RequestOutcome());
+    index.assign(size * 2, -1);
+    indexMask = index.size() - 1;
+    head = 0;
+    count = 0;
+}
+
+// Forget every key
+void IdempotencyTable::clear() {
+    index.assign(index.size(), -1);
+    head = 0;
+    count = 0;
+}
+
+// First bucket probed for a key (the hash is already well mixed)
+size_t IdempotencyTable::homeBucket(uint64_t keyHash) const {
+    return static_cast<size_t>(keyHash ^ (keyHash >> 32)) & indexMask;
+}
+
+// Linear probe for a key's bucket
+size_t IdempotencyTable::findBucket(uint64_t keyHash) const {
+    for (size_t bucket = homeBucket(keyHash);; bucket = (bucket + 1) & indexMask) {
+        int32_t position = index[bucket];
+        if (position < 0) {
+            return index.size();
+        }
+        if (ring[position].keyHash == keyHash) {
+            return bucket;
+        }
+    }
+}
+
+// Empty a bucket and shift later entries of the probe run back into the
+// gap, so lookups never need tombstones
+void IdempotencyTable::eraseBucket(size_t bucket) {
+    size_t gap = bucket;
+    for (size_t next = (gap + 1) & indexMask; index[next] >= 0; next = (next + 1) & indexMask) {
+        size_t home = homeBucket(ring[index[next]].keyHash);
+        // Move the entry unless its home lies cyclically in (gap, next]
+        bool homeBetween = gap <= next ? (home > gap && home <= next) : (home > gap || home <= next);
+        if (!homeBetween) {
+            index[gap] = index[next];
+            gap = next;
+        }
+    }
+    index[gap] = -1;
+}
+
+// Look up a key
+const RequestOutcome* IdempotencyTable::find(uint64_t keyHash, int64_t now) const {
+    size_t bucket = findBucket(keyHash);
+    if (bucket == index.size()) {
+        return nullptr;
+    }
+    const RequestOutcome& outcome = ring[index[bucket]];
+    return outcome.expiresAt > now ? &outcome : nullptr;
+}
+
+// Remember an outcome, evicting the oldest one if the ring is full
+void IdempotencyTable::insert(const RequestOutcome& outcome) {
+    // A key seen again after it expired replaces its old entry
+    size_t existing = findBucket(outcome.keyHash);
+    if (existing != index.size()) {
+        eraseBucket(existing);
+    }
+    if (count == ring.size()) {
+        // The oldest entry may already have left the index (expired and replaced)
+        size_t oldest = findBucket(ring[head].keyHash);
+        if (oldest != index.size() && static_cast<size_t>(index[oldest]) == head) {
+            eraseBucket(oldest);
+        }
+    } else {
+        count++;
+    }
+    ring[head] = outcome;
+    size_t bucket = homeBucket(outcome.keyHash);
+    while (index[bucket] >= 0) {
+        bucket = (bucket + 1) & indexMask;
+    }
+    index[bucket] = static_cast<int32_t>(head);
+    head = (head + 1) % ring.size();
+}
+
+// Ring entries in use (some may have expired)
+size_t IdempotencyTable::size() const {
+    return count;
+}
+
+// Keys held before the oldest is evicted
+size_t IdempotencyTable::capacity() const {
+    return ring.size();
+}
+
+// Unexpired outcomes still reachable through the index, oldest first
+vector<RequestOutcome> IdempotencyTable::live(int64_t now) const {
+    vector<RequestOutcome> outcomes;
+    outcomes.reserve(count);
+    size_t start = (head + ring.size() - count) % ring.size();
+    for (size_t i = 0; i < count; i++) {
+        size_t position = (start + i) % ring.size();
+        const RequestOutcome& outcome = ring[position];
+        if (outcome.expiresAt <= now) {
+            continue;
+        }
+        size_t bucket = findBucket(outcome.keyHash);
+        if (bucket != index.size() && static_cast<size_t>(index[bucket]) == position) {
+            outcomes.push_back(outcome);
+        }
+    }
+    return outcomes;
+}
+
+// 64-bit FNV-1a of the caller's key, finished with a mixing step; never 0
+uint64_t IdempotencyTable::hashKey(const string& key) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash != 0 ? hash : 1;
+}
+
+// Identify what a request asked for, so a key reused for a different request is caught
+uint32_t IdempotencyTable::fingerprint(int operation, int accountNumber, int otherAccount, double amount) {
+    int64_t cents = static_cast<int64_t>(llround(amount * 100.0));
+    uint32_t hash = 2166136261u;
+    int64_t fields[4] = { operation, accountNumber, otherAccount, cents };
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(fields);
+    for (size_t i = 0; i < sizeof(fields); i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
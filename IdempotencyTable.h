@@ -0,0 +1,56 @@
+#ifndef IDEMPOTENCYTABLE_H
+#define IDEMPOTENCYTABLE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// Outcome of a request that carried an idempotency key
+struct RequestOutcome {
+    uint64_t keyHash;           // Hash of the caller's key (never 0)
+    int64_t expiresAt;          // Unix seconds; the key is forgotten after this
+    double balanceAfter;        // Balance of the account when the request was applied
+    uint32_t fingerprint;       // Operation, accounts and amount, to catch a reused key
+    int32_t accountNumber;
+};
+
+// Bounded dedup table for idempotency keys. Outcomes live in a ring in
+// insertion order, so when the table is full the oldest key is evicted;
+// an open-addressed index twice the ring's size maps key hashes to ring
+// positions, so a lookup is normally a single probe. Expired entries are
+// ignored by lookups and overwritten as the ring comes round. Not
+// thread-safe: each shard owns one and guards it with the shard lock.
+class IdempotencyTable {
+private:
+    vector<RequestOutcome> ring;
+    vector<int32_t> index;      // Ring position, or -1 for an empty bucket
+    size_t indexMask;
+    size_t head;                // Next ring position to write
+    size_t count;
+
+    size_t homeBucket(uint64_t keyHash) const;
+    size_t findBucket(uint64_t keyHash) const;  // Bucket holding the key, or index.size()
+    void eraseBucket(size_t bucket);
+
+public:
+    // Constructor
+    IdempotencyTable(size_t capacity = 4096);
+
+    void configure(size_t capacity);    // Rounded up to a power of two; clears the table
+    void clear();
+
+    // Returns nullptr if the key is unknown or has expired
+    const RequestOutcome* find(uint64_t keyHash, int64_t now) const;
+    void insert(const RequestOutcome& outcome);
+
+    size_t size() const;
+    size_t capacity() const;
+    vector<RequestOutcome> live(int64_t now) const;  // Unexpired outcomes, oldest first
+
+    static uint64_t hashKey(const string& key);
+    static uint32_t fingerprint(int operation, int accountNumber, int otherAccount, double amount);
+};
+
+#endif
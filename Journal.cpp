@@ -0,0 +1,372 @@
+#include "Journal.h"
+#include "Replication.h"
+#include "ChangeFeed.h"
+#include "Storage.h"
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <map>
+#include <algorithm>
+
+using namespace std;
+
+// Milliseconds since the epoch for journal timestamps
+static int64_t nowMs() {
+    return chrono::duration_cast<chrono::milliseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Constructor
+ShardJournal::ShardJournal(string name)
+    : fileName(name), nextSequence(1), recordCount(0), shipper(nullptr), shipperShard(0), feed(nullptr), feedShard(0),
+      storage(nullptr), storageHandle(-1), syncWrites(false), durableSequence(0), writeFailed(false) {}
+
+// FNV-1a over the record with the checksum field zeroed
+uint32_t ShardJournal::computeChecksum(const JournalRecord& record) {
+    JournalRecord copy = record;
+    copy.checksum = 0;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&copy);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(copy); i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Add records to the end of the file: queued on the storage backend when
+// there is one, otherwise written and flushed here
+bool ShardJournal::write(const JournalRecord* records, size_t count) {
+    const char* bytes = reinterpret_cast<const char*>(records);
+    size_t size = count * sizeof(JournalRecord);
+    if (storage) {
+        if (storageHandle < 0) {
+            storageHandle = storage->open(fileName, true);
+            if (storageHandle < 0) {
+                return false;
+            }
+        }
+        uint64_t last = records[count - 1].sequence;
+        storage->write(storageHandle, StorageBackend::APPEND, string(bytes, size), syncWrites,
+                       [this, last](bool ok) { markDurable(last, ok); });
+        return true;
+    }
+    if (!out.is_open()) {
+        out.open(fileName, ios::binary | ios::app);
+        if (!out) {
+            return false;
+        }
+    }
+    out.write(bytes, static_cast<streamsize>(size));
+    out.flush();
+    return out.good();
+}
+
+// Append one record and push it to disk
+bool ShardJournal::append(JournalRecord& record) {
+    record.sequence = nextSequence;
+    record.checksum = computeChecksum(record);
+    if (!write(&record, 1)) {
+        return false;
+    }
+    nextSequence++;
+    recordCount++;
+    if (shipper) {
+        shipper->ship(shipperShard, &record, 1);
+    }
+    if (feed) {
+        feed->publish(feedShard, &record, 1, true);
+    }
+    return true;
+}
+
+// Append several records with a single flush
+bool ShardJournal::append(vector<JournalRecord>& records) {
+    if (records.empty()) {
+        return true;
+    }
+    for (size_t i = 0; i < records.size(); i++) {
+        records[i].sequence = nextSequence + i;
+        records[i].checksum = computeChecksum(records[i]);
+    }
+    if (!write(records.data(), records.size())) {
+        return false;
+    }
+    nextSequence += records.size();
+    recordCount += records.size();
+    if (shipper) {
+        shipper->ship(shipperShard, records.data(), records.size());
+    }
+    if (feed) {
+        feed->publish(feedShard, records.data(), records.size(), true);
+    }
+    return true;
+}
+
+// Read every intact record
+bool ShardJournal::readAll(vector<JournalRecord>& records) const {
+    records.clear();
+    ifstream inFile(fileName, ios::binary);
+    if (!inFile) {
+        // No journal yet, not an error
+        return true;
+    }
+    JournalRecord record;
+    while (inFile.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+        if (record.checksum != computeChecksum(record)) {
+            break;
+        }
+        record.text[sizeof(record.text) - 1] = '\0';
+        records.push_back(record);
+    }
+    return true;
+}
+
+// Empty the journal after its records reached the slot file
+bool ShardJournal::truncate() {
+    close();
+    ofstream outFile(fileName, ios::binary | ios::trunc);
+    recordCount = 0;
+    lock_guard<mutex> lock(durableMutex);
+    writeFailed = false;            // The slot file now holds what those writes carried
+    return outFile.good();
+}
+
+// Close the append handle, once queued appends are written
+void ShardJournal::close() {
+    if (storageHandle >= 0) {
+        storage->close(storageHandle);
+        storageHandle = -1;
+    }
+    if (out.is_open()) {
+        out.close();
+    }
+}
+
+// Queue appends on a storage backend from now on (null: write them here)
+void ShardJournal::setStorage(StorageBackend* backend, bool sync) {
+    close();
+    storage = backend;
+    syncWrites = sync;
+}
+
+// Called by the backend once the records up to sequence are written
+void ShardJournal::markDurable(uint64_t sequence, bool ok) {
+    {
+        lock_guard<mutex> lock(durableMutex);
+        durableSequence = max(durableSequence, sequence);
+        writeFailed = writeFailed || !ok;
+    }
+    durableChanged.notify_all();
+}
+
+// Block until the record with this sequence is on disk (at once without
+// a backend, where append() already wrote it)
+bool ShardJournal::waitDurable(uint64_t sequence) {
+    if (!storage) {
+        return true;
+    }
+    storage->runPending();
+    unique_lock<mutex> lock(durableMutex);
+    durableChanged.wait(lock, [this, sequence]() { return durableSequence >= sequence; });
+    return !writeFailed;
+}
+
+// Continue numbering after records already on disk
+void ShardJournal::setNextSequence(uint64_t sequence) {
+    nextSequence = sequence;
+    lock_guard<mutex> lock(durableMutex);
+    if (sequence > 0) {
+        durableSequence = max(durableSequence, sequence - 1);
+    }
+}
+
+// Sequence the next appended record will get
+uint64_t ShardJournal::getNextSequence() const {
+    return nextSequence;
+}
+
+// Records appended since the last truncate
+size_t ShardJournal::getRecordCount() const {
+    return recordCount;
+}
+
+// Copy every record appended from now on to a replication log
+void ShardJournal::setShipper(ReplicationLog* log, int shardIndex) {
+    shipper = log;
+    shipperShard = shardIndex;
+}
+
+// Publish every record appended from now on to a change feed
+void ShardJournal::setChangeFeed(ChangeFeed* changeFeed, int shardIndex) {
+    feed = changeFeed;
+    feedShard = shardIndex;
+}
+
+// Send a record to the replication log and the change feed only, for a
+// change that reaches disk through a checkpoint rather than the journal
+void ShardJournal::ship(JournalRecord& record) {
+    if (!shipper && !feed) {
+        return;
+    }
+    record.sequence = nextSequence - 1;
+    record.checksum = computeChecksum(record);
+    if (shipper) {
+        shipper->ship(shipperShard, &record, 1);
+    }
+    if (feed) {
+        feed->publish(feedShard, &record, 1, false);
+    }
+}
+
+// Build a journal record
+JournalRecord ShardJournal::makeRecord(JournalOp op, int accountNumber, int accountType, double amount,
+                                       double balanceAfter, string_view text, uint64_t transferId) {
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.timestampMs = nowMs();
+    record.transferId = transferId;
+    record.op = op;
+    record.accountNumber = accountNumber;
+    record.accountType = accountType;
+    record.amount = amount;
+    record.balanceAfter = balanceAfter;
+    size_t length = text.size() < sizeof(record.text) - 1 ? text.size() : sizeof(record.text) - 1;
+    memcpy(record.text, text.data(), length);
+    return record;
+}
+
+// Constructor
+TransferLog::TransferLog(string name) : fileName(name), lastTransferId(0), openTransfers(0), lineCount(0) {}
+
+// Append one line and push it to disk (caller holds logMutex)
+bool TransferLog::writeLine(const string& line) {
+    if (!out.is_open()) {
+        out.open(fileName, ios::app);
+        if (!out) {
+            return false;
+        }
+    }
+    out << line << "\n";
+    out.flush();
+    lineCount++;
+    return out.good();
+}
+
+// Start a transfer and return its id (0 if the log could not be written)
+uint64_t TransferLog::begin(int fromAccount, int toAccount, double amount) {
+    lock_guard<mutex> lock(logMutex);
+    // Ids are time based so they stay unique after the log is truncated
+    uint64_t id = static_cast<uint64_t>(nowMs()) * 1000;
+    if (id <= lastTransferId) {
+        id = lastTransferId + 1;
+    }
+    lastTransferId = id;
+
+    ostringstream line;
+    line.precision(17);
+    line << "BEGIN " << id << " " << fromAccount << " " << toAccount << " " << amount;
+    if (!writeLine(line.str())) {
+        return 0;
+    }
+    openTransfers++;
+    return id;
+}
+
+// Both shards accepted the transfer; from here on it must complete
+bool TransferLog::commit(uint64_t transferId, double creditAmount) {
+    lock_guard<mutex> lock(logMutex);
+    ostringstream line;
+    line.precision(17);
+    line << "COMMIT " << transferId << " " << creditAmount;
+    return writeLine(line.str());
+}
+
+// Both legs are in their shard journals
+bool TransferLog::end(uint64_t transferId) {
+    return finish("END", transferId);
+}
+
+// A shard refused the transfer; nothing was applied
+bool TransferLog::abort(uint64_t transferId) {
+    return finish("ABORT", transferId);
+}
+
+// Close out a transfer, emptying the log if nothing else is in flight
+bool TransferLog::finish(const string& kind, uint64_t transferId) {
+    lock_guard<mutex> lock(logMutex);
+    bool ok = writeLine(kind + " " + to_string(transferId));
+    if (openTransfers > 0) {
+        openTransfers--;
+    }
+    if (ok && openTransfers == 0 && lineCount >= COMPACT_LINES) {
+        return truncateLocked();
+    }
+    return ok;
+}
+
+// Scan the log for transfers that committed but never finished
+vector<TransferLog::PendingTransfer> TransferLog::recover() {
+    lock_guard<mutex> lock(logMutex);
+    vector<PendingTransfer> pending;
+    ifstream inFile(fileName);
+    if (!inFile) {
+        return pending;
+    }
+
+    map<uint64_t, PendingTransfer> begun;
+    map<uint64_t, double> committed;    // Id -> credited amount
+    string line;
+    while (getline(inFile, line)) {
+        istringstream fields(line);
+        string kind;
+        uint64_t id = 0;
+        if (!(fields >> kind >> id)) {
+            continue;  // Torn last line
+        }
+        if (id > lastTransferId) {
+            lastTransferId = id;
+        }
+        if (kind == "BEGIN") {
+            PendingTransfer transfer;
+            transfer.transferId = id;
+            if (fields >> transfer.fromAccount >> transfer.toAccount >> transfer.amount) {
+                transfer.creditAmount = transfer.amount;
+                begun[id] = transfer;
+            }
+        } else if (kind == "COMMIT") {
+            double creditAmount = 0.0;
+            committed[id] = fields >> creditAmount ? creditAmount : -1.0;  // Logs from before currencies have none
+        } else if (kind == "END" || kind == "ABORT") {
+            begun.erase(id);
+            committed.erase(id);
+        }
+    }
+
+    for (auto& entry : begun) {
+        auto decision = committed.find(entry.first);
+        if (decision != committed.end()) {
+            if (decision->second >= 0.0) {
+                entry.second.creditAmount = decision->second;
+            }
+            pending.push_back(entry.second);
+        }
+    }
+    return pending;
+}
+
+// Empty the log once no transfer is in flight
+bool TransferLog::truncate() {
+    lock_guard<mutex> lock(logMutex);
+    return truncateLocked();
+}
+
+// Empty the log (caller holds logMutex)
+bool TransferLog::truncateLocked() {
+    lineCount = 0;
+    if (out.is_open()) {
+        out.close();
+    }
+    ofstream outFile(fileName, ios::trunc);
+    return outFile.good();
+}
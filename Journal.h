@@ -0,0 +1,153 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+using namespace std;
+
+// Kinds of change recorded in a shard journal
+enum JournalOp {
+    JOURNAL_CREATE = 1,     // New account (text = holder name, accountType = type | stored currency << 16)
+    JOURNAL_BALANCE = 2,    // Balance change (text = transaction type)
+    JOURNAL_DELETE = 3,     // Tombstone purged by compaction (the account is gone)
+    JOURNAL_CLOSE = 4,      // Account closed; kept as a tombstone
+    JOURNAL_REQUEST = 5,    // Idempotency key (transferId = key hash, accountType = fingerprint)
+    JOURNAL_HOLD = 6,       // Hold placed (transferId = hold id, amount = amount held)
+    JOURNAL_HOLD_RELEASE = 7,  // Hold released, expired or settled (text says which)
+    JOURNAL_LIMITS = 8,     // Limits set (amount = overdraft line, balanceAfter = daily limit)
+    JOURNAL_USAGE = 9       // Day's withdrawals, in replication snapshots only (accountType = day)
+};
+
+class ReplicationLog;
+class ChangeFeed;
+class StorageBackend;
+
+// One fixed-size journal entry. Records carry the balance after the
+// change, so replay can be checked against the account it applies to.
+struct JournalRecord {
+    uint64_t sequence;          // Per shard, keeps rising across checkpoints
+    int64_t timestampMs;
+    uint64_t transferId;        // Non-zero for one leg of a transfer
+    int32_t op;                 // JournalOp value
+    int32_t accountNumber;
+    int32_t accountType;
+    uint32_t checksum;          // Detects a record torn by a crash mid-write
+    double amount;              // Signed change applied to the balance
+    double balanceAfter;
+    char text[72];              // Null-terminated, truncated if longer (holder names always fit)
+};
+
+// Append-only change log for one shard. Every mutation is one small
+// sequential write; the shard's slot file is only rewritten at
+// checkpoints, after which the journal is emptied.
+//
+// With a storage backend, append() only queues the records and returns;
+// the backend writes them (together with whatever else is queued) while
+// the shard carries on, and waitDurable() blocks until a sequence is on
+// disk. Without one, append() writes and flushes before returning.
+class ShardJournal {
+private:
+    string fileName;
+    ofstream out;
+    uint64_t nextSequence;
+    size_t recordCount;         // Records appended since the last truncate
+    ReplicationLog* shipper;    // Receives each record once written (null when not replicating)
+    int shipperShard;
+    ChangeFeed* feed;           // Also receives each record once written (null when there is no change feed)
+    int feedShard;
+
+    StorageBackend* storage;    // Null: written on the caller's thread
+    int storageHandle;          // -1 until the first queued append
+    bool syncWrites;            // Ask the backend to force each batch to the device
+    mutex durableMutex;
+    condition_variable durableChanged;
+    uint64_t durableSequence;   // Highest sequence known to be on disk (under durableMutex)
+    bool writeFailed;           // A queued write failed since the last truncate
+
+    bool write(const JournalRecord* records, size_t count);
+    void markDurable(uint64_t sequence, bool ok);
+
+public:
+    // Constructor
+    ShardJournal(string name);
+
+    // Assigns the sequence number and checksum, then writes and flushes
+    bool append(JournalRecord& record);
+    bool append(vector<JournalRecord>& records);  // One write and flush for the batch
+
+    // Reads intact records in order, stopping at the first torn one
+    bool readAll(vector<JournalRecord>& records) const;
+
+    bool truncate();            // Waits for queued appends first
+    void close();
+
+    void setStorage(StorageBackend* backend, bool sync);
+    bool waitDurable(uint64_t sequence);   // False if a queued write failed
+
+    void setNextSequence(uint64_t sequence);
+    uint64_t getNextSequence() const;
+    size_t getRecordCount() const;
+    void setShipper(ReplicationLog* log, int shardIndex);
+    void setChangeFeed(ChangeFeed* changeFeed, int shardIndex);
+    void ship(JournalRecord& record);     // Replicate and publish without journaling (a checkpoint follows)
+
+    static uint32_t computeChecksum(const JournalRecord& record);
+
+    static JournalRecord makeRecord(JournalOp op, int accountNumber, int accountType, double amount,
+                                    double balanceAfter, string_view text, uint64_t transferId = 0);
+};
+
+// Coordinator log for transfers between shards. A transfer is BEGIN,
+// then COMMIT once both shards have accepted it (with the amount the
+// destination is credited, which differs when the two accounts hold
+// different currencies), then END once both
+// legs are in their shard journals. On restart a transfer that reached
+// COMMIT but not END has its missing legs re-applied; one that never
+// reached COMMIT is abandoned. Transfers on different shard pairs run
+// at the same time, so the log has its own lock; it empties itself
+// whenever it has grown long and no transfer is in flight.
+class TransferLog {
+private:
+    static const size_t COMPACT_LINES = 3000;
+
+    string fileName;
+    ofstream out;
+    uint64_t lastTransferId;
+    size_t openTransfers;
+    size_t lineCount;
+    mutex logMutex;
+
+    bool writeLine(const string& line);
+    bool finish(const string& kind, uint64_t transferId);
+    bool truncateLocked();
+
+public:
+    // A transfer that committed but did not finish before a restart
+    struct PendingTransfer {
+        uint64_t transferId;
+        int fromAccount;
+        int toAccount;
+        double amount;
+        double creditAmount;        // Destination leg, in the destination's currency
+    };
+
+    // Constructor
+    TransferLog(string name);
+
+    uint64_t begin(int fromAccount, int toAccount, double amount);
+    bool commit(uint64_t transferId, double creditAmount);
+    bool end(uint64_t transferId);
+    bool abort(uint64_t transferId);
+
+    // Committed-but-unfinished transfers found in the log
+    vector<PendingTransfer> recover();
+    bool truncate();
+};
+
+#endif
@@ -0,0 +1,236 @@
+#include "LedgerFile.h"
+#include "Storage.h"
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+static const char LEDGER_MAGIC[8] = { 'B', 'A', 'N', 'K', 'L', 'D', 'G', '1' };
+
+// Constructor
+LedgerFile::LedgerFile(string name)
+    : fileName(name), headerSize(sizeof(LedgerHeader)), fileVersion(CURRENT_VERSION), storage(nullptr),
+      storageHandle(-1), syncWrites(false), writeFailed(false) {}
+
+// Bytes per slot in this file's version
+streamoff LedgerFile::slotSize() const {
+    return fileVersion >= 4 ? static_cast<streamoff>(sizeof(AccountRecord)) : V3_SLOT_SIZE;
+}
+
+// Byte offset of a slot within the file
+streamoff LedgerFile::slotOffset(int slot) const {
+    return headerSize + static_cast<streamoff>(slot) * slotSize();
+}
+
+// Check whether the data file is present on disk
+bool LedgerFile::exists() const {
+    ifstream probe(fileName, ios::binary);
+    return probe.good();
+}
+
+// Open the file for positioned reads and writes
+bool LedgerFile::ensureOpen() {
+    if (file.is_open()) {
+        return true;
+    }
+    file.open(fileName, ios::in | ios::out | ios::binary);
+    return file.is_open();
+}
+
+// Create an empty data file containing only a header
+bool LedgerFile::create(const LedgerHeader& header) {
+    close();
+    ofstream outFile(fileName, ios::binary | ios::trunc);
+    if (!outFile) {
+        return false;
+    }
+    headerSize = sizeof(LedgerHeader);
+    fileVersion = header.version;
+    outFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    outFile.close();
+    return ensureOpen();
+}
+
+// Close the underlying file handle (after queued writes complete)
+void LedgerFile::close() {
+    if (storageHandle >= 0) {
+        storage->close(storageHandle);
+        storageHandle = -1;
+    }
+    if (file.is_open()) {
+        file.close();
+    }
+}
+
+// Queue writes on a storage backend from now on (null: write them here)
+void LedgerFile::setStorage(StorageBackend* backend, bool sync) {
+    close();
+    storage = backend;
+    syncWrites = sync;
+}
+
+// Queue a positioned write; a failure is reported by the next flush()
+bool LedgerFile::queueWrite(streamoff offset, const void* data, size_t size) {
+    if (storageHandle < 0) {
+        storageHandle = storage->open(fileName, false);
+        if (storageHandle < 0) {
+            return false;
+        }
+    }
+    storage->write(storageHandle, static_cast<int64_t>(offset), string(static_cast<const char*>(data), size), false,
+                   [this](bool ok) { writeFailed = writeFailed || !ok; });
+    return true;
+}
+
+// Path of the data file
+const string& LedgerFile::getFileName() const {
+    return fileName;
+}
+
+// Read and validate the header
+bool LedgerFile::readHeader(LedgerHeader& header) {
+    if (!ensureOpen()) {
+        return false;
+    }
+    file.clear();
+    file.seekg(0);
+    memset(&header, 0, sizeof(header));
+    file.read(reinterpret_cast<char*>(&header), V1_HEADER_SIZE);
+    if (!file || memcmp(header.magic, LEDGER_MAGIC, sizeof(LEDGER_MAGIC)) != 0) {
+        return false;
+    }
+    fileVersion = header.version;
+    if (header.version == 1) {
+        // Single-file ledger from before sharding
+        headerSize = V1_HEADER_SIZE;
+        header.shardCount = 1;
+        return header.slotCount >= 0;
+    }
+    file.read(reinterpret_cast<char*>(&header) + V1_HEADER_SIZE, sizeof(header) - V1_HEADER_SIZE);
+    if (!file) {
+        return false;
+    }
+    headerSize = sizeof(LedgerHeader);
+    // Version 2 and 3 slots are shorter; they are converted as they are read
+    return header.version >= 2 && header.version <= CURRENT_VERSION && header.slotCount >= 0 &&
+           header.shardCount > 0;
+}
+
+// Overwrite the header in place (only files in the current format)
+bool LedgerFile::writeHeader(const LedgerHeader& header) {
+    if (!ensureOpen() || headerSize != static_cast<streamoff>(sizeof(LedgerHeader))) {
+        return false;
+    }
+    if (storage) {
+        fileVersion = header.version;
+        return queueWrite(0, &header, sizeof(header));
+    }
+    file.clear();
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    fileVersion = header.version;
+    return file.good();
+}
+
+// Read a run of slots in one sequential pass
+bool LedgerFile::readSlots(int32_t firstSlot, int32_t slotCount, AccountRecord* records) {
+    if (!ensureOpen()) {
+        return false;
+    }
+    if (slotCount == 0) {
+        return true;
+    }
+    file.clear();
+    file.seekg(slotOffset(firstSlot));
+    if (fileVersion >= 4) {
+        file.read(reinterpret_cast<char*>(records), static_cast<streamsize>(slotCount) * sizeof(AccountRecord));
+        return file.good();
+    }
+    
+    // Older slots are a prefix of the current layout; the new fields start at zero
+    vector<char> raw(static_cast<size_t>(slotCount) * V3_SLOT_SIZE);
+    file.read(raw.data(), static_cast<streamsize>(raw.size()));
+    if (!file.good()) {
+        return false;
+    }
+    for (int32_t i = 0; i < slotCount; i++) {
+        records[i] = emptyRecord();
+        memcpy(&records[i], raw.data() + static_cast<size_t>(i) * V3_SLOT_SIZE, V3_SLOT_SIZE);
+    }
+    if (fileVersion < 3) {
+        // The last 8 bytes held the end of an 80-byte name, not a close time
+        for (int32_t i = 0; i < slotCount; i++) {
+            records[i].holderName[sizeof(records[i].holderName) - 1] = '\0';
+            records[i].closedAt = 0;
+        }
+    }
+    return true;
+}
+
+// Overwrite a single slot in place
+bool LedgerFile::writeSlot(int slot, const AccountRecord& record) {
+    if (!ensureOpen() || fileVersion != CURRENT_VERSION) {
+        return false;
+    }
+    if (storage) {
+        return queueWrite(slotOffset(slot), &record, sizeof(record));
+    }
+    file.clear();
+    file.seekp(slotOffset(slot));
+    file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    return file.good();
+}
+
+// Push buffered writes to disk
+bool LedgerFile::flush() {
+    if (storage && storageHandle >= 0) {
+        if (syncWrites) {
+            storage->write(storageHandle, StorageBackend::APPEND, string(), true, nullptr);
+        }
+        storage->drain();
+        bool ok = !writeFailed;
+        writeFailed = false;
+        return ok;
+    }
+    if (!file.is_open()) {
+        return true;
+    }
+    file.flush();
+    return file.good();
+}
+
+// Build a slot record for an account
+AccountRecord LedgerFile::makeRecord(int accountNumber, string_view name, double balance, int32_t accountType,
+                                     int64_t closedAt) {
+    AccountRecord record = emptyRecord();
+    record.accountNumber = accountNumber;
+    record.accountType = accountType;
+    record.balance = balance;
+    record.closedAt = closedAt;
+    size_t length = name.size() < sizeof(record.holderName) - 1 ? name.size() : sizeof(record.holderName) - 1;
+    memcpy(record.holderName, name.data(), length);
+    return record;
+}
+
+// Build a record marking a free slot
+AccountRecord LedgerFile::emptyRecord() {
+    AccountRecord record;
+    memset(&record, 0, sizeof(record));
+    return record;
+}
+
+// Build a header
+LedgerHeader LedgerFile::makeHeader(int32_t nextAccountNumber, int32_t slotCount, int32_t lastPostingDay,
+                                    int32_t shardIndex, int32_t shardCount, int64_t checkpointSequence) {
+    LedgerHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LEDGER_MAGIC, sizeof(LEDGER_MAGIC));
+    header.version = CURRENT_VERSION;
+    header.nextAccountNumber = nextAccountNumber;
+    header.slotCount = slotCount;
+    header.lastPostingDay = lastPostingDay;
+    header.shardIndex = shardIndex;
+    header.shardCount = shardCount;
+    header.checkpointSequence = checkpointSequence;
+    return header;
+}
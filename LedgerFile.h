@@ -0,0 +1,94 @@
+#ifndef LEDGERFILE_H
+#define LEDGERFILE_H
+
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <cstdint>
+
+using namespace std;
+
+class StorageBackend;
+
+// Header stored at the start of the binary data file
+struct LedgerHeader {
+    char magic[8];              // "BANKLDG1"
+    int32_t version;
+    int32_t nextAccountNumber;
+    int32_t slotCount;          // Number of slots following the header
+    int32_t lastPostingDay;     // Day number of the last interest/fee batch (0 = never)
+    // Version 2 and later
+    int32_t shardIndex;         // Which shard this file holds
+    int32_t shardCount;         // Total shards the ledger was split into
+    int64_t checkpointSequence; // First journal sequence not yet in the slots
+};
+
+// One fixed-size account slot (accountNumber == 0 means the slot is free)
+struct AccountRecord {
+    int32_t accountNumber;
+    int32_t accountType;        // AccountType value
+    double balance;
+    char holderName[72];        // Null-terminated (80 bytes before version 3; longer old names are cut)
+    int64_t closedAt;           // Version 3: Unix seconds the account was closed, 0 = open
+    // Version 4 (slots before version 4 end here, at 96 bytes)
+    double overdraftLimit;
+    double dailyLimit;          // 0 = no limit
+    double withdrawnToday;
+    int32_t withdrawalDay;      // Epoch day withdrawnToday belongs to
+    int32_t currency;           // Currency::toStored() code; 0 = USD (always 0 before currencies)
+};
+
+// Longest holder name, in bytes, that a slot stores whole; longer names are refused
+constexpr size_t MAX_HOLDER_NAME_BYTES = sizeof(AccountRecord::holderName) - 1;
+
+// Fixed-slot binary store: every account lives at a known offset, so a
+// single changed account is saved with one positioned write instead of
+// rewriting the whole file. With a storage backend, slot and header
+// writes are queued and flush() waits for them, so a checkpoint's writes
+// reach the disk as one batch.
+class LedgerFile {
+private:
+    string fileName;
+    fstream file;
+    streamoff headerSize;       // Version 1 files have the shorter header
+    int32_t fileVersion;        // Version of the header last read or written
+    StorageBackend* storage;    // Null: written through file
+    int storageHandle;          // -1 until the first queued write
+    bool syncWrites;
+    bool writeFailed;           // Set by the backend; read after it drains
+
+    bool ensureOpen();
+    bool queueWrite(streamoff offset, const void* data, size_t size);
+    streamoff slotSize() const;
+    streamoff slotOffset(int slot) const;
+
+public:
+    static const int32_t CURRENT_VERSION = 4;
+    static const streamoff V1_HEADER_SIZE = 24;
+    static const streamoff V3_SLOT_SIZE = 96;
+
+    // Constructor
+    LedgerFile(string name);
+
+    bool exists() const;
+    bool create(const LedgerHeader& header);
+    void close();
+    const string& getFileName() const;
+
+    // Header and slot access (version 1 headers are accepted for migration)
+    bool readHeader(LedgerHeader& header);
+    bool writeHeader(const LedgerHeader& header);
+    bool readSlots(int32_t firstSlot, int32_t slotCount, AccountRecord* records);  // Older slots are read as open accounts
+    bool writeSlot(int slot, const AccountRecord& record);      // Current format only
+    bool flush();                                               // Waits for queued writes
+    void setStorage(StorageBackend* backend, bool sync);
+
+    // Record helpers
+    static AccountRecord makeRecord(int accountNumber, string_view name, double balance, int32_t accountType,
+                                    int64_t closedAt = 0);
+    static AccountRecord emptyRecord();
+    static LedgerHeader makeHeader(int32_t nextAccountNumber, int32_t slotCount, int32_t lastPostingDay,
+                                   int32_t shardIndex = 0, int32_t shardCount = 1, int64_t checkpointSequence = 0);
+};
+
+#endif
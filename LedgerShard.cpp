@@ -0,0 +1,1440 @@
+#include "LedgerShard.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+static const char REQUESTS_MAGIC[8] = { 'B', 'A', 'N', 'K', 'K', 'E', 'Y', '1' };
+static const char HOLDS_MAGIC[8] = { 'B', 'A', 'N', 'K', 'H', 'L', 'D', '1' };
+
+// Slots parsed per thread pool task during load
+static const size_t LOAD_CHUNK_SLOTS = 65536;
+
+// Slots read from disk at a time during load (128 MB of records)
+static const size_t LOAD_WINDOW_SLOTS = 16 * LOAD_CHUNK_SLOTS;
+
+// The slot file is rewritten once this many slots, and a quarter of the file, are free
+static const size_t REWRITE_MIN_FREE_SLOTS = 64;
+
+// Accounts parsed from one chunk of slots
+struct ParsedChunk {
+    vector<BankAccount> accounts;
+    vector<SlotDigest> digests; // Bounded mode: hashes of each account's slot, in place of accounts
+    vector<int> slots;          // Slot of each parsed account
+    vector<int> freeSlots;
+    size_t closedCount = 0;
+};
+
+// Milliseconds elapsed since a phase started
+static double elapsedMs(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// accountType field of an account's JOURNAL_CREATE record
+static int32_t createTypeField(const BankAccount& account) {
+    return static_cast<int32_t>(account.getAccountType()) | (Currency::toStored(account.getCurrency()) << 16);
+}
+
+// Hash of a slot record as written to the slot file
+static uint64_t recordHash(const AccountRecord& record) {
+    return MerkleTree::hashBytes(&record, sizeof(record));
+}
+
+// Leaf of a slot holding an account
+static uint64_t accountLeaf(const BankAccount& account) {
+    return MerkleTree::combine(recordHash(AccountCache::recordFor(account)), account.getHistory().getDigest());
+}
+
+// Leaf of a free slot
+static uint64_t freeLeaf() {
+    static const uint64_t leaf = MerkleTree::combine(recordHash(LedgerFile::emptyRecord()), 0);
+    return leaf;
+}
+
+// Read a file of fixed-size records saved at a checkpoint. A missing file
+// means none; if a save stopped between removing the old file and renaming
+// the new one, the new one is used.
+template <typename T>
+static bool readRecordFile(const string& fileName, const char (&magic)[8], vector<T>& records) {
+    records.clear();
+    string tempName = fileName + ".tmp";
+    ifstream probe(fileName, ios::binary);
+    if (!probe.good()) {
+        probe.close();
+        rename(tempName.c_str(), fileName.c_str());
+    }
+    probe.close();
+    
+    ifstream inFile(fileName, ios::binary);
+    if (!inFile) {
+        return true;
+    }
+    char fileMagic[8];
+    int32_t counts[2] = { 0, 0 };
+    inFile.read(fileMagic, sizeof(fileMagic));
+    inFile.read(reinterpret_cast<char*>(counts), sizeof(counts));
+    if (!inFile || memcmp(fileMagic, magic, sizeof(fileMagic)) != 0 || counts[0] < 0) {
+        return false;
+    }
+    T record;
+    for (int32_t i = 0; i < counts[0] && inFile.read(reinterpret_cast<char*>(&record), sizeof(record)); i++) {
+        records.push_back(record);
+    }
+    return true;
+}
+
+// Write records to a new file and rename it over the old one (removed if empty)
+template <typename T>
+static bool writeRecordFile(const string& fileName, const char (&magic)[8], const vector<T>& records) {
+    string tempName = fileName + ".tmp";
+    if (records.empty()) {
+        remove(tempName.c_str());
+        remove(fileName.c_str());
+        return true;
+    }
+    ofstream outFile(tempName, ios::binary | ios::trunc);
+    int32_t counts[2] = { static_cast<int32_t>(records.size()), 0 };
+    outFile.write(magic, sizeof(magic));
+    outFile.write(reinterpret_cast<const char*>(counts), sizeof(counts));
+    outFile.write(reinterpret_cast<const char*>(records.data()), static_cast<streamsize>(records.size() * sizeof(T)));
+    outFile.close();
+    if (!outFile) {
+        return false;
+    }
+    remove(fileName.c_str());
+    return rename(tempName.c_str(), fileName.c_str()) == 0;
+}
+
+// Constructor
+LedgerShard::LedgerShard(int index, int count, string snapshotName, string journalName, string requestsName,
+                         string holdsName, string integrityName, string verifiedName)
+    : shardIndex(index), shardCount(count), tombstoneCount(0), openCount(0), snapshotFile(snapshotName),
+      journal(journalName), requestTtlSeconds(86400), requestsFileName(requestsName),
+      riskStage(new NoRiskStage()), holdTtlSeconds(7 * 86400),
+      holdsFileName(holdsName), upgradePending(false), integrityFile(integrityName), integrityRewrite(true),
+      verifiedFileName(verifiedName), verifiedKnown(false) {}
+
+// Mutex guarding this shard
+mutex& LedgerShard::getMutex() {
+    return shardMutex;
+}
+
+// Position of this shard in the ledger
+int LedgerShard::getIndex() const {
+    return shardIndex;
+}
+
+// Number of open accounts in this shard
+size_t LedgerShard::size() const {
+    return openCount.load();
+}
+
+// Closed accounts still held for audit
+size_t LedgerShard::getTombstoneCount() const {
+    return tombstoneCount;
+}
+
+// Slots in the file not holding an account
+size_t LedgerShard::getFreeSlotCount() const {
+    return freeSlots.size();
+}
+
+// Find an account in this shard
+BankAccount* LedgerShard::find(int accountNumber) {
+    auto it = accountIndex.find(accountNumber);
+    if (it != accountIndex.end()) {
+        return accountAt(it->second);
+    }
+    return nullptr;
+}
+
+// All accounts in this shard (resident mode)
+vector<BankAccount>& LedgerShard::getAccounts() {
+    return accounts;
+}
+
+// Account at a position, read into the cache first if it is cold
+// (nullptr if it could not be read)
+BankAccount* LedgerShard::accountAt(size_t position) {
+    if (!cache) {
+        return &accounts[position];
+    }
+    BankAccount* account = cache->get(position, accountSlotOf[position]);
+    if (!account) {
+        fail(cache->getError());
+    }
+    return account;
+}
+
+// Account at a position if it is in memory, without reading it
+const BankAccount* LedgerShard::residentAt(size_t position) const {
+    return cache ? cache->resident(position) : &accounts[position];
+}
+
+// Slot record of the account at a position, as a checkpoint writes it
+bool LedgerShard::recordAt(size_t position, AccountRecord& record) const {
+    const BankAccount* account = residentAt(position);
+    if (account) {
+        record = AccountCache::recordFor(*account);
+        return true;
+    }
+    return cache->readRecord(position, accountSlotOf[position], record);
+}
+
+// Page accounts through a cache of budgetBytes instead of holding them
+// all (before load). Each shard gets its own page file.
+void LedgerShard::configureCache(size_t budgetBytes, const string& pagesName, bool prefetchCold) {
+    cache.reset(new AccountCache(budgetBytes, pagesName, snapshotFile.getFileName(), prefetchCold));
+}
+
+// Whether accounts are paged through a cache
+bool LedgerShard::isBounded() const {
+    return cache != nullptr;
+}
+
+// Visit every account in order. Cold accounts are read as copies without
+// their history and are not cached; one that cannot be read is skipped.
+void LedgerShard::forEachAccount(const function<void(const BankAccount&)>& visit) const {
+    optional<BankAccount> copy;
+    for (size_t position = 0; position < accountSlotOf.size(); position++) {
+        const BankAccount* account = residentAt(position);
+        if (account) {
+            visit(*account);
+        } else if (cache->read(position, accountSlotOf[position], false, copy)) {
+            visit(*copy);
+        }
+    }
+}
+
+// Visit the accounts in memory (all of them in resident mode)
+void LedgerShard::forEachResident(const function<void(const BankAccount&)>& visit) const {
+    if (cache) {
+        cache->forEachResident(visit);
+        return;
+    }
+    for (const auto& account : accounts) {
+        visit(account);
+    }
+}
+
+// An account with its history, read into copy if it is cold (not cached)
+const BankAccount* LedgerShard::peek(int accountNumber, optional<BankAccount>& copy) const {
+    auto it = accountIndex.find(accountNumber);
+    if (it == accountIndex.end()) {
+        return nullptr;
+    }
+    const BankAccount* account = residentAt(it->second);
+    if (account) {
+        return account;
+    }
+    return cache->read(it->second, accountSlotOf[it->second], true, copy) ? &*copy : nullptr;
+}
+
+// Start reading a cold account in the background
+void LedgerShard::prefetch(int accountNumber) {
+    if (!cache) {
+        return;
+    }
+    auto it = accountIndex.find(accountNumber);
+    if (it != accountIndex.end()) {
+        cache->prefetch(it->second, accountSlotOf[it->second]);
+    }
+}
+
+// Cache counters (all zero in resident mode)
+AccountCacheStats LedgerShard::getCacheStats() const {
+    return cache ? cache->getStats() : AccountCacheStats();
+}
+
+// Record the failure reason and report failure
+bool LedgerShard::fail(const string& message) {
+    lastError = message;
+    return false;
+}
+
+// Reason for the last failed load or checkpoint
+const string& LedgerShard::getError() const {
+    return lastError;
+}
+
+// Assign a snapshot slot to an account, reusing freed slots first
+int LedgerShard::allocateSlot(int accountNumber) {
+    int slot;
+    if (!freeSlots.empty()) {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+        slotOwners[slot] = accountNumber;
+    } else {
+        slot = static_cast<int>(slotOwners.size());
+        slotOwners.push_back(accountNumber);
+    }
+    dirtySlots.insert(slot);
+    refreshLeaf(slot);
+    return slot;
+}
+
+// Return a slot to the free list
+void LedgerShard::releaseSlot(int slot) {
+    slotOwners[slot] = 0;
+    freeSlots.push_back(slot);
+    dirtySlots.insert(slot);
+    refreshLeaf(slot);
+}
+
+// Record and history hashes of a slot as it stands
+SlotDigest LedgerShard::slotDigest(int slot) const {
+    SlotDigest digest = { recordHash(LedgerFile::emptyRecord()), 0 };
+    int owner = slotOwners[static_cast<size_t>(slot)];
+    if (owner != 0) {
+        size_t position = accountIndex.at(owner);
+        const BankAccount* account = residentAt(position);
+        digest = account ? AccountCache::digestOf(*account) : cache->getDigest(position);
+    }
+    return digest;
+}
+
+// Rehash a slot's leaf after its account changed
+void LedgerShard::refreshLeaf(int slot) {
+    SlotDigest digest = slotDigest(slot);
+    integrityTree.setLeaf(static_cast<size_t>(slot), MerkleTree::combine(digest.recordHash, digest.historyDigest));
+}
+
+// Copy an account's balance and currency into the revaluation columns;
+// a tombstone holds no funds and belongs to no currency
+void LedgerShard::refreshColumns(size_t position, const BankAccount& account) {
+    balanceColumn[position] = account.isClosed() ? 0.0 : account.getBalance();
+    currencyColumn[position] = account.isClosed() ? Currency::NONE : account.getCurrency();
+}
+
+// Add an account to memory and give it a slot
+void LedgerShard::insertAccount(const BankAccount& account) {
+    accountIndex[account.getAccountNumber()] = accountSlotOf.size();
+    if (cache) {
+        cache->add(account);
+    } else {
+        accounts.push_back(account);
+    }
+    accountSlotOf.push_back(allocateSlot(account.getAccountNumber()));
+    balanceColumn.push_back(0.0);
+    currencyColumn.push_back(Currency::NONE);
+    refreshColumns(accountSlotOf.size() - 1, account);
+    if (!account.isClosed()) {
+        openCount++;
+    }
+}
+
+// Remove an account by moving the last account into its place
+void LedgerShard::eraseAccount(int accountNumber) {
+    auto it = accountIndex.find(accountNumber);
+    if (it == accountIndex.end()) {
+        return;
+    }
+    size_t position = it->second;
+    size_t last = accountSlotOf.size() - 1;
+    int slot = accountSlotOf[position];
+    if (currencyColumn[position] == Currency::NONE) {
+        tombstoneCount--;
+    } else {
+        openCount--;
+    }
+    accountIndex.erase(it);
+    if (cache) {
+        cache->remove(position);
+    }
+    if (position != last) {
+        if (!cache) {
+            accounts[position] = move(accounts.back());
+        }
+        accountSlotOf[position] = accountSlotOf.back();
+        balanceColumn[position] = balanceColumn.back();
+        currencyColumn[position] = currencyColumn.back();
+        accountIndex[slotOwners[static_cast<size_t>(accountSlotOf[position])]] = position;
+    }
+    if (!cache) {
+        accounts.pop_back();
+    }
+    accountSlotOf.pop_back();
+    balanceColumn.pop_back();
+    currencyColumn.pop_back();
+    releaseSlot(slot);
+}
+
+// Journal and add a new account (fails if the number is already in use)
+bool LedgerShard::addAccount(const BankAccount& account) {
+    if (accountIndex.count(account.getAccountNumber())) {
+        return fail("already has account " + to_string(account.getAccountNumber()));
+    }
+    JournalRecord record = ShardJournal::makeRecord(JOURNAL_CREATE, account.getAccountNumber(),
+                                                    createTypeField(account), account.getBalance(),
+                                                    account.getBalance(), account.getAccountHolderName());
+    if (!journal.append(record)) {
+        return fail("could not write journal");
+    }
+    insertAccount(account);
+    return true;
+}
+
+// Turn an account into a tombstone
+void LedgerShard::markClosed(BankAccount& account, time_t when) {
+    account.close(when);
+    tombstoneCount++;
+    openCount--;
+    markDirty(account.getAccountNumber());
+}
+
+// Release records for the open holds on the given accounts, journaled
+// ahead of their closure so a hold never outlives its account
+void LedgerShard::collectHoldReleases(const set<int>& accountNumbers, vector<JournalRecord>& records,
+                                      vector<AccountHold>& released) const {
+    for (const auto& entry : holds) {
+        const AccountHold& hold = entry.second;
+        if (accountNumbers.count(hold.accountNumber)) {
+            records.push_back(ShardJournal::makeRecord(JOURNAL_HOLD_RELEASE, hold.accountNumber, 0, hold.amount, 0.0,
+                                                       "Hold Released", hold.holdId));
+            released.push_back(hold);
+        }
+    }
+}
+
+// Journal and close one account, releasing its open holds in the same write
+bool LedgerShard::closeAccount(int accountNumber, time_t when) {
+    BankAccount* account = find(accountNumber);
+    if (!account || account->isClosed()) {
+        return fail("has no open account " + to_string(accountNumber));
+    }
+    vector<JournalRecord> records;
+    vector<AccountHold> released;
+    collectHoldReleases({accountNumber}, records, released);
+    JournalRecord record = ShardJournal::makeRecord(JOURNAL_CLOSE, accountNumber, account->getAccountType(), 0.0,
+                                                    account->getBalance(), "Account Closed");
+    record.timestampMs = static_cast<int64_t>(when) * 1000;
+    records.push_back(record);
+    if (!journal.append(records)) {
+        return fail("could not write journal");
+    }
+    for (const auto& hold : released) {
+        applyRelease(hold, "Hold Released");
+    }
+    account = find(accountNumber);    // The releases may have evicted it in bounded mode
+    markClosed(*account, when);
+    return true;
+}
+
+// Close many accounts with one journal write; numbers that are missing or
+// already closed are skipped. The numbers closed are added to closed, and
+// their open holds are released in the same write.
+bool LedgerShard::closeAccounts(const vector<int>& accountNumbers, time_t when, vector<int>& closed) {
+    vector<JournalRecord> records;
+    vector<int> targets;    // Numbers, not pointers: in bounded mode accounts may be evicted meanwhile
+    set<int> listed;  // A number listed twice is closed once
+    records.reserve(accountNumbers.size());
+    targets.reserve(accountNumbers.size());
+    for (int accountNumber : accountNumbers) {
+        BankAccount* account = find(accountNumber);
+        if (!account || account->isClosed() || !listed.insert(accountNumber).second) {
+            continue;
+        }
+        JournalRecord record = ShardJournal::makeRecord(JOURNAL_CLOSE, accountNumber, account->getAccountType(), 0.0,
+                                                        account->getBalance(), "Account Closed");
+        record.timestampMs = static_cast<int64_t>(when) * 1000;
+        records.push_back(record);
+        targets.push_back(accountNumber);
+    }
+    // Releases go first so a replay frees each hold before its account closes
+    vector<JournalRecord> releases;
+    vector<AccountHold> released;
+    collectHoldReleases(set<int>(targets.begin(), targets.end()), releases, released);
+    records.insert(records.begin(), releases.begin(), releases.end());
+    if (!journal.append(records)) {
+        return fail("could not write journal");
+    }
+    for (const auto& hold : released) {
+        applyRelease(hold, "Hold Released");
+    }
+    for (int accountNumber : targets) {
+        BankAccount* account = find(accountNumber);
+        if (account) {
+            markClosed(*account, when);
+            closed.push_back(accountNumber);
+        }
+    }
+    return true;
+}
+
+// Journal a balance change already applied to the account. A request
+// carrying an idempotency key is journaled in the same write.
+bool LedgerShard::recordChange(const BankAccount& account, const string& type, double amount, uint64_t transferId,
+                               const RequestOutcome* request) {
+    JournalRecord record = ShardJournal::makeRecord(JOURNAL_BALANCE, account.getAccountNumber(),
+                                                    account.getAccountType(), amount, account.getBalance(),
+                                                    type, transferId);
+    markDirty(account.getAccountNumber());
+    if (!request) {
+        if (!journal.append(record)) {
+            return fail("could not write journal");
+        }
+        return true;
+    }
+    
+    vector<JournalRecord> records;
+    records.push_back(ShardJournal::makeRecord(JOURNAL_REQUEST, request->accountNumber,
+                                               static_cast<int32_t>(request->fingerprint), 0.0,
+                                               request->balanceAfter, "Request Key", request->keyHash));
+    records.push_back(record);
+    if (!journal.append(records)) {
+        return fail("could not write journal");
+    }
+    requests.insert(*request);
+    return true;
+}
+
+// Size the key table and set how long keys are remembered (before load)
+void LedgerShard::configureRequests(size_t capacity, int ttlSeconds) {
+    requests.configure(capacity);
+    requestTtlSeconds = ttlSeconds > 0 ? ttlSeconds : 1;
+}
+
+// Outcome of an earlier request with this key, if it is still remembered
+const RequestOutcome* LedgerShard::findRequest(uint64_t keyHash, time_t now) const {
+    return requests.find(keyHash, static_cast<int64_t>(now));
+}
+
+// Seconds a key is remembered
+int64_t LedgerShard::getRequestTtl() const {
+    return requestTtlSeconds;
+}
+
+// Read the keys saved at the last checkpoint
+bool LedgerShard::loadRequests(int64_t now) {
+    requests.clear();
+    vector<RequestOutcome> outcomes;
+    if (!readRecordFile(requestsFileName, REQUESTS_MAGIC, outcomes)) {
+        return fail("has a corrupt idempotency key file");
+    }
+    for (const auto& outcome : outcomes) {
+        if (outcome.expiresAt > now) {
+            requests.insert(outcome);
+        }
+    }
+    return true;
+}
+
+// Write the unexpired keys beside the slot file
+bool LedgerShard::saveRequests(int64_t now) {
+    return writeRecordFile(requestsFileName, REQUESTS_MAGIC, requests.live(now));
+}
+
+// Set how long a hold lasts before it expires (before load)
+void LedgerShard::configureHolds(int ttlSeconds) {
+    holdTtlSeconds = ttlSeconds > 0 ? ttlSeconds : 1;
+}
+
+// Replace the risk screening stage (before load)
+void LedgerShard::setRiskStage(unique_ptr<RiskStage> stage) {
+    riskStage = move(stage);
+}
+
+// Risk screening stage (use under the shard lock)
+RiskStage& LedgerShard::getRiskStage() {
+    return *riskStage;
+}
+
+// Read the holds open at the last checkpoint and re-reserve their funds.
+// Holds past their expiry are kept; the first expiry pass releases them.
+bool LedgerShard::loadHolds(int64_t now) {
+    holds.clear();
+    holdTimers.reset(now);
+    vector<AccountHold> saved;
+    if (!readRecordFile(holdsFileName, HOLDS_MAGIC, saved)) {
+        return fail("has a corrupt holds file");
+    }
+    for (const auto& hold : saved) {
+        BankAccount* account = find(hold.accountNumber);
+        if (account) {
+            account->addHold(hold.amount);
+            holds[hold.holdId] = hold;
+            holdTimers.schedule(hold.holdId, hold.expiresAt);
+        }
+    }
+    return true;
+}
+
+// Write the open holds beside the slot file
+bool LedgerShard::saveHolds() {
+    vector<AccountHold> open;
+    open.reserve(holds.size());
+    for (const auto& entry : holds) {
+        open.push_back(entry.second);
+    }
+    return writeRecordFile(holdsFileName, HOLDS_MAGIC, open);
+}
+
+// Journal a hold and reserve its funds. The id is built from the journal
+// sequence, so it is unique and names this shard.
+uint64_t LedgerShard::placeHold(BankAccount& account, double amount, time_t now) {
+    AccountHold hold;
+    hold.holdId = journal.getNextSequence() * static_cast<uint64_t>(shardCount) + static_cast<uint64_t>(shardIndex);
+    hold.expiresAt = static_cast<int64_t>(now) + holdTtlSeconds;
+    hold.amount = amount;
+    hold.accountNumber = account.getAccountNumber();
+    hold.reserved = 0;
+    JournalRecord record = ShardJournal::makeRecord(JOURNAL_HOLD, hold.accountNumber, account.getAccountType(), amount,
+                                                    account.getBalance(), "Hold Placed", hold.holdId);
+    record.timestampMs = static_cast<int64_t>(now) * 1000;
+    if (!journal.append(record)) {
+        fail("could not write journal");
+        return 0;
+    }
+    account.addHold(amount);
+    account.countWithdrawal(amount, BankAccount::epochDay(now));
+    account.addTransaction("Hold Placed", amount);
+    markDirty(hold.accountNumber);
+    holds[hold.holdId] = hold;
+    holdTimers.schedule(hold.holdId, hold.expiresAt);
+    return hold.holdId;
+}
+
+// An open hold, or nullptr
+const AccountHold* LedgerShard::findHold(uint64_t holdId) const {
+    auto it = holds.find(holdId);
+    return it != holds.end() ? &it->second : nullptr;
+}
+
+// Return a hold's funds and drop it ("Hold Settled" adds no history; the
+// settlement's balance change does)
+void LedgerShard::applyRelease(const AccountHold& hold, const string& type) {
+    BankAccount* account = find(hold.accountNumber);
+    if (account) {
+        account->releaseHold(hold.amount);
+        if (type != "Hold Settled") {
+            account->addTransaction(type, hold.amount);
+        }
+    }
+    holds.erase(hold.holdId);
+}
+
+// Settle a hold for up to its amount: the hold is released and the amount
+// debited, journaled in one write
+bool LedgerShard::settleHold(uint64_t holdId, double amount) {
+    auto it = holds.find(holdId);
+    BankAccount* account = it != holds.end() ? find(it->second.accountNumber) : nullptr;
+    if (!account || account->isClosed()) {
+        return fail("has no open hold " + to_string(holdId));
+    }
+    AccountHold hold = it->second;
+    vector<JournalRecord> records;
+    records.push_back(ShardJournal::makeRecord(JOURNAL_HOLD_RELEASE, hold.accountNumber, account->getAccountType(),
+                                               hold.amount, account->getBalance(), "Hold Settled", holdId));
+    records.push_back(ShardJournal::makeRecord(JOURNAL_BALANCE, hold.accountNumber, account->getAccountType(),
+                                               -amount, account->getBalance() - amount, "Hold Settled"));
+    if (!journal.append(records)) {
+        return fail("could not write journal");
+    }
+    applyRelease(hold, "Hold Settled");
+    account->postAdjustment("Hold Settled", -amount);
+    markDirty(hold.accountNumber);
+    return true;
+}
+
+// Release a hold without debiting anything
+bool LedgerShard::releaseHold(uint64_t holdId) {
+    auto it = holds.find(holdId);
+    if (it == holds.end()) {
+        return fail("has no open hold " + to_string(holdId));
+    }
+    AccountHold hold = it->second;
+    JournalRecord record = ShardJournal::makeRecord(JOURNAL_HOLD_RELEASE, hold.accountNumber, 0, hold.amount, 0.0,
+                                                    "Hold Released", holdId);
+    if (!journal.append(record)) {
+        return fail("could not write journal");
+    }
+    applyRelease(hold, "Hold Released");
+    markDirty(hold.accountNumber);
+    return true;
+}
+
+// Release the holds whose time has come, in one journal write. Timers of
+// holds already settled or released find nothing and are skipped.
+size_t LedgerShard::expireHolds(time_t now) {
+    vector<uint64_t> due;
+    holdTimers.advance(static_cast<int64_t>(now), due);
+    if (due.empty()) {
+        return 0;
+    }
+    vector<JournalRecord> records;
+    vector<AccountHold> expired;
+    for (uint64_t holdId : due) {
+        auto it = holds.find(holdId);
+        if (it == holds.end()) {
+            continue;
+        }
+        expired.push_back(it->second);
+        records.push_back(ShardJournal::makeRecord(JOURNAL_HOLD_RELEASE, it->second.accountNumber, 0,
+                                                   it->second.amount, 0.0, "Hold Expired", holdId));
+    }
+    if (!journal.append(records)) {
+        // Try again on the next pass
+        for (const auto& hold : expired) {
+            holdTimers.schedule(hold.holdId, hold.expiresAt);
+        }
+        fail("could not write journal");
+        return 0;
+    }
+    for (const auto& hold : expired) {
+        applyRelease(hold, "Hold Expired");
+        markDirty(hold.accountNumber);
+    }
+    return expired.size();
+}
+
+// Open holds on this shard
+size_t LedgerShard::getHoldCount() const {
+    return holds.size();
+}
+
+// Journal and set an account's overdraft line and daily limit
+bool LedgerShard::setLimits(BankAccount& account, double overdraftLimit, double dailyLimit) {
+    JournalRecord record = ShardJournal::makeRecord(JOURNAL_LIMITS, account.getAccountNumber(),
+                                                    account.getAccountType(), overdraftLimit, dailyLimit,
+                                                    "Limits Changed");
+    if (!journal.append(record)) {
+        return fail("could not write journal");
+    }
+    account.setLimits(overdraftLimit, dailyLimit);
+    markDirty(account.getAccountNumber());
+    return true;
+}
+
+// Ship this shard's journal appends to a replication log (null stops it)
+void LedgerShard::setShipper(ReplicationLog* log) {
+    journal.setShipper(log, shardIndex);
+}
+
+// Publish this shard's journal appends to a change feed (null stops it)
+void LedgerShard::setChangeFeed(ChangeFeed* feed) {
+    journal.setChangeFeed(feed, shardIndex);
+}
+
+// Records that rebuild this shard when replayed into an empty one: each
+// account with its limits and closure, then the open holds, then each
+// day's withdrawals (after the holds, which count toward them on replay),
+// then the unexpired request keys
+void LedgerShard::snapshotRecords(vector<JournalRecord>& records, time_t now) const {
+    uint64_t sequence = journal.getNextSequence() - 1;
+    size_t first = records.size();
+    vector<JournalRecord> usage;
+    forEachAccount([&records, &usage](const BankAccount& account) {
+        int accountNumber = account.getAccountNumber();
+        records.push_back(ShardJournal::makeRecord(JOURNAL_CREATE, accountNumber, createTypeField(account),
+                                                   account.getBalance(), account.getBalance(),
+                                                   account.getAccountHolderName()));
+        const SpendingControls& controls = account.getControls();
+        if (controls.overdraftLimit != 0.0 || controls.dailyLimit != 0.0) {
+            records.push_back(ShardJournal::makeRecord(JOURNAL_LIMITS, accountNumber, account.getAccountType(),
+                                                       controls.overdraftLimit, controls.dailyLimit,
+                                                       "Limits Changed"));
+        }
+        if (account.isClosed()) {
+            JournalRecord record = ShardJournal::makeRecord(JOURNAL_CLOSE, accountNumber, account.getAccountType(),
+                                                            0.0, account.getBalance(), "Account Closed");
+            record.timestampMs = static_cast<int64_t>(account.getClosedAt()) * 1000;
+            records.push_back(record);
+        }
+        if (controls.withdrawnToday != 0.0) {
+            usage.push_back(ShardJournal::makeRecord(JOURNAL_USAGE, accountNumber, controls.withdrawalDay,
+                                                     controls.withdrawnToday, 0.0, "Withdrawn Today"));
+        }
+    });
+    for (const auto& entry : holds) {
+        const AccountHold& hold = entry.second;
+        JournalRecord record = ShardJournal::makeRecord(JOURNAL_HOLD, hold.accountNumber, 0, hold.amount, 0.0,
+                                                        "Hold Placed", hold.holdId);
+        record.timestampMs = (hold.expiresAt - holdTtlSeconds) * 1000;
+        records.push_back(record);
+    }
+    records.insert(records.end(), usage.begin(), usage.end());
+    for (const auto& outcome : requests.live(static_cast<int64_t>(now))) {
+        JournalRecord record = ShardJournal::makeRecord(JOURNAL_REQUEST, outcome.accountNumber,
+                                                        static_cast<int32_t>(outcome.fingerprint), 0.0,
+                                                        outcome.balanceAfter, "Request Key", outcome.keyHash);
+        record.timestampMs = (outcome.expiresAt - requestTtlSeconds) * 1000;
+        records.push_back(record);
+    }
+    for (size_t i = first; i < records.size(); i++) {
+        records[i].sequence = sequence;
+    }
+}
+
+// Replicate a balance change that is not journaled (posting batches are
+// made durable by their intent file and a checkpoint)
+void LedgerShard::shipChange(const BankAccount& account, const string& type, double amount) {
+    JournalRecord record = ShardJournal::makeRecord(JOURNAL_BALANCE, account.getAccountNumber(),
+                                                    account.getAccountType(), amount, account.getBalance(), type);
+    journal.ship(record);
+}
+
+// Apply a record shipped from the primary. The journal's sequence is kept
+// past the primary's, so ids built from it after a promotion stay unique.
+void LedgerShard::applyReplicated(const JournalRecord& record) {
+    replay(record);
+    if (record.sequence >= journal.getNextSequence()) {
+        journal.setNextSequence(record.sequence + 1);
+    }
+}
+
+// Add an account read from an older data file
+void LedgerShard::loadAccount(const BankAccount& account) {
+    insertAccount(account);
+}
+
+// Queue an account's slot for the next checkpoint, rehash its leaf and
+// update its revaluation columns (a cold account has not changed since
+// it was evicted, so its columns are current)
+void LedgerShard::markDirty(int accountNumber) {
+    auto it = accountIndex.find(accountNumber);
+    if (it != accountIndex.end()) {
+        size_t position = it->second;
+        dirtySlots.insert(accountSlotOf[position]);
+        refreshLeaf(accountSlotOf[position]);
+        const BankAccount* account = residentAt(position);
+        if (account) {
+            refreshColumns(position, *account);
+        }
+        if (cache) {
+            cache->resize(position);
+        }
+    }
+}
+
+// Re-apply one journal record. Balance records carry the balance after
+// the change, so a record already contained in the slots is a no-op.
+void LedgerShard::replay(const JournalRecord& record) {
+    switch (record.op) {
+        case JOURNAL_CREATE: {
+            if (!find(record.accountNumber)) {
+                AccountType type = CHECKING;
+                int32_t typeField = record.accountType & 0xFFFF;
+                if (typeField < ACCOUNT_TYPE_COUNT) {
+                    type = static_cast<AccountType>(typeField);
+                }
+                insertAccount(BankAccount(record.accountNumber, record.text, record.balanceAfter, type,
+                                          Currency::fromStored(record.accountType >> 16)));
+            }
+            break;
+        }
+        case JOURNAL_BALANCE: {
+            BankAccount* account = find(record.accountNumber);
+            if (account) {
+                double delta = record.balanceAfter - account->getBalance();
+                if (delta != 0.0) {
+                    account->postAdjustment(record.text, delta);
+                    if (strcmp(record.text, "Withdrawal") == 0) {
+                        account->countWithdrawal(-record.amount,
+                                                 BankAccount::epochDay(static_cast<time_t>(record.timestampMs / 1000)));
+                    }
+                    markDirty(record.accountNumber);
+                }
+            }
+            if (record.transferId != 0) {
+                replayedLegs.insert(make_pair(record.transferId, record.accountNumber));
+            }
+            break;
+        }
+        case JOURNAL_DELETE:
+            eraseAccount(record.accountNumber);
+            break;
+        case JOURNAL_REQUEST: {
+            RequestOutcome outcome;
+            outcome.keyHash = record.transferId;
+            outcome.expiresAt = record.timestampMs / 1000 + requestTtlSeconds;
+            outcome.balanceAfter = record.balanceAfter;
+            outcome.fingerprint = static_cast<uint32_t>(record.accountType);
+            outcome.accountNumber = record.accountNumber;
+            requests.insert(outcome);
+            break;
+        }
+        case JOURNAL_HOLD: {
+            BankAccount* account = find(record.accountNumber);
+            if (account && holds.count(record.transferId) == 0) {
+                AccountHold hold;
+                hold.holdId = record.transferId;
+                hold.expiresAt = record.timestampMs / 1000 + holdTtlSeconds;
+                hold.amount = record.amount;
+                hold.accountNumber = record.accountNumber;
+                hold.reserved = 0;
+                account->addHold(hold.amount);
+                account->countWithdrawal(hold.amount,
+                                         BankAccount::epochDay(static_cast<time_t>(record.timestampMs / 1000)));
+                account->addTransaction(record.text, hold.amount);
+                markDirty(record.accountNumber);
+                holds[hold.holdId] = hold;
+                holdTimers.schedule(hold.holdId, hold.expiresAt);
+            }
+            break;
+        }
+        case JOURNAL_HOLD_RELEASE: {
+            auto it = holds.find(record.transferId);
+            if (it != holds.end()) {
+                AccountHold hold = it->second;
+                applyRelease(hold, record.text);
+                markDirty(hold.accountNumber);
+            }
+            break;
+        }
+        case JOURNAL_LIMITS: {
+            BankAccount* account = find(record.accountNumber);
+            if (account) {
+                account->setLimits(record.amount, record.balanceAfter);
+                markDirty(record.accountNumber);
+            }
+            break;
+        }
+        case JOURNAL_CLOSE: {
+            BankAccount* account = find(record.accountNumber);
+            if (account && !account->isClosed()) {
+                markClosed(*account, static_cast<time_t>(record.timestampMs / 1000));
+            }
+            break;
+        }
+        case JOURNAL_USAGE: {
+            BankAccount* account = find(record.accountNumber);
+            if (account) {
+                account->restoreUsage(record.amount, record.accountType);
+                markDirty(record.accountNumber);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Check whether the snapshot file is present on disk
+bool LedgerShard::exists() const {
+    return snapshotFile.exists();
+}
+
+// Start an empty shard
+bool LedgerShard::create(const LedgerMeta& meta) {
+    if (cache && !cache->clear()) {
+        return fail(cache->getError());
+    }
+    LedgerHeader header = LedgerFile::makeHeader(meta.nextAccountNumber, 0, meta.lastPostingDay,
+                                                 shardIndex, shardCount, static_cast<int64_t>(journal.getNextSequence()));
+    if (!snapshotFile.create(header)) {
+        return fail("could not be created");
+    }
+    integrityTree = MerkleTree();
+    integrityMismatches.clear();
+    if (!writeIntegrity(header.checkpointSequence, true)) {
+        return fail("could not be created");
+    }
+    verifiedKnown = false;
+    remove(verifiedFileName.c_str());
+    return journal.truncate();
+}
+
+// Load the snapshot file, then replay the journal on top of it. Slots are
+// read a window at a time and parsed in chunks on the thread pool, then
+// merged into a store and index sized up front so the merge never
+// reallocates. In bounded mode a chunk only hashes its records; the
+// accounts stay in their slots until they are first used.
+bool LedgerShard::load(LedgerMeta& meta, ThreadPool& pool) {
+    loadStats = ShardLoadStats();
+    auto phaseStart = chrono::steady_clock::now();
+    
+    finishRewrite(snapshotFile.getFileName());
+    LedgerHeader header;
+    if (!snapshotFile.readHeader(header)) {
+        return fail("is corrupt or has an unsupported format");
+    }
+    if (header.shardIndex != shardIndex || header.shardCount != shardCount) {
+        return fail("belongs to a different shard layout");
+    }
+
+    // Slot hashes saved at the last checkpoint; they only count if they
+    // were written with this slot file's checkpoint
+    IntegrityHeader savedIntegrity;
+    vector<SlotDigest> savedDigests;
+    bool integrityCurrent = header.version == LedgerFile::CURRENT_VERSION &&
+                            integrityFile.read(savedIntegrity, savedDigests) &&
+                            savedIntegrity.checkpointSequence == header.checkpointSequence &&
+                            savedIntegrity.slotCount == header.slotCount;
+    if (cache && !cache->clear()) {
+        return fail(cache->getError());
+    }
+    loadStats.readMs = elapsedMs(phaseStart);
+
+    size_t slotCount = static_cast<size_t>(header.slotCount);
+    slotOwners.assign(slotCount, 0);
+    vector<uint64_t> recordHashes(slotCount);
+    vector<uint64_t> leaves(slotCount, freeLeaf());
+    accounts.clear();
+    accountIndex.clear();
+    accountSlotOf.clear();
+    balanceColumn.clear();
+    currencyColumn.clear();
+    freeSlots.clear();
+    dirtySlots.clear();
+    replayedLegs.clear();
+    tombstoneCount = 0;
+    if (!cache) {
+        accounts.reserve(slotCount);
+    }
+    accountSlotOf.reserve(slotCount);
+    accountIndex.reserve(slotCount);
+    balanceColumn.reserve(slotCount);
+    currencyColumn.reserve(slotCount);
+
+    vector<AccountRecord> records;
+    for (size_t windowStart = 0; windowStart < slotCount; windowStart += LOAD_WINDOW_SLOTS) {
+        phaseStart = chrono::steady_clock::now();
+        size_t windowSize = min(LOAD_WINDOW_SLOTS, slotCount - windowStart);
+        records.resize(windowSize);
+        if (!snapshotFile.readSlots(static_cast<int32_t>(windowStart), static_cast<int32_t>(windowSize),
+                                    records.data())) {
+            return fail("is truncated");
+        }
+        loadStats.readMs += elapsedMs(phaseStart);
+
+        // Parse: each chunk turns its slots into accounts independently,
+        // hashing each record as read and each account's leaf as built
+        phaseStart = chrono::steady_clock::now();
+        size_t chunkCount = (windowSize + LOAD_CHUNK_SLOTS - 1) / LOAD_CHUNK_SLOTS;
+        vector<ParsedChunk> chunks(chunkCount);
+        pool.parallelFor(chunkCount, [this, &records, &recordHashes, &leaves, &savedDigests, integrityCurrent,
+                                      &chunks, windowStart, windowSize](size_t c) {
+            ParsedChunk& chunk = chunks[c];
+            size_t begin = c * LOAD_CHUNK_SLOTS;
+            size_t end = min(begin + LOAD_CHUNK_SLOTS, windowSize);
+            chunk.slots.reserve(end - begin);
+            for (size_t i = begin; i < end; i++) {
+                size_t slot = windowStart + i;
+                AccountRecord& record = records[i];
+                recordHashes[slot] = recordHash(record);  // As read, before anything is repaired
+                if (record.accountNumber == 0) {
+                    chunk.freeSlots.push_back(static_cast<int>(slot));
+                    continue;
+                }
+                record = AccountCache::normalizedRecord(record);
+                uint64_t historyDigest = integrityCurrent ? savedDigests[slot].historyDigest : 0;
+                if (cache) {
+                    SlotDigest digest = { recordHash(record), historyDigest };
+                    chunk.digests.push_back(digest);
+                    leaves[slot] = MerkleTree::combine(digest.recordHash, digest.historyDigest);
+                } else {
+                    chunk.accounts.push_back(AccountCache::accountFromRecord(record));
+                    if (integrityCurrent) {
+                        chunk.accounts.back().rebaseHistory(historyDigest);
+                    }
+                    leaves[slot] = accountLeaf(chunk.accounts.back());
+                }
+                if (record.closedAt != 0) {
+                    chunk.closedCount++;
+                }
+                chunk.slots.push_back(static_cast<int>(slot));
+                slotOwners[slot] = record.accountNumber;  // Chunks own disjoint slots
+            }
+        });
+        loadStats.parseMs += elapsedMs(phaseStart);
+
+        // Merge: move chunks into the pre-sized store and build the index
+        phaseStart = chrono::steady_clock::now();
+        for (auto& chunk : chunks) {
+            for (size_t i = 0; i < chunk.slots.size(); i++) {
+                const AccountRecord& record = records[static_cast<size_t>(chunk.slots[i]) - windowStart];
+                bool closed = record.closedAt != 0;
+                accountIndex.emplace(record.accountNumber, accountSlotOf.size());
+                accountSlotOf.push_back(chunk.slots[i]);
+                balanceColumn.push_back(closed ? 0.0 : record.balance);
+                currencyColumn.push_back(closed ? Currency::NONE : Currency::fromStored(record.currency));
+                if (cache) {
+                    cache->addCold(chunk.digests[i]);
+                } else {
+                    accounts.push_back(move(chunk.accounts[i]));
+                }
+            }
+            freeSlots.insert(freeSlots.end(), chunk.freeSlots.begin(), chunk.freeSlots.end());
+            tombstoneCount += chunk.closedCount;
+        }
+        loadStats.indexMs += elapsedMs(phaseStart);
+    }
+    vector<AccountRecord>().swap(records);
+
+    phaseStart = chrono::steady_clock::now();
+    openCount = accountSlotOf.size() - tombstoneCount;
+    // An older slot layout is rewritten as a whole file at the next checkpoint
+    upgradePending = header.version < LedgerFile::CURRENT_VERSION;
+    checkIntegrity(savedIntegrity, savedDigests, recordHashes, integrityCurrent);
+    integrityTree.assign(leaves);
+    verifiedKnown = verifiedTree.load(verifiedFileName);
+    loadStats.indexMs += elapsedMs(phaseStart);
+    if (!loadRequests(static_cast<int64_t>(time(0))) || !loadHolds(static_cast<int64_t>(time(0)))) {
+        return false;
+    }
+    meta.nextAccountNumber = header.nextAccountNumber;
+    meta.lastPostingDay = header.lastPostingDay;
+
+    // Replay changes made after the last checkpoint
+    phaseStart = chrono::steady_clock::now();
+    vector<JournalRecord> entries;
+    journal.readAll(entries);
+    uint64_t nextSequence = header.checkpointSequence > 0 ? static_cast<uint64_t>(header.checkpointSequence) : 1;
+    for (const auto& entry : entries) {
+        if (entry.sequence < static_cast<uint64_t>(header.checkpointSequence)) {
+            continue;  // Already in the slots; the journal was not emptied before a crash
+        }
+        replay(entry);
+        loadStats.replayedRecords++;
+        if (entry.sequence >= nextSequence) {
+            nextSequence = entry.sequence + 1;
+        }
+    }
+    journal.setNextSequence(nextSequence);
+    loadStats.replayMs = elapsedMs(phaseStart);
+    return true;
+}
+
+// Check the slots just read against the hashes saved at the last
+// checkpoint. Without current saved hashes nothing can be checked, and
+// the file is written whole at the next checkpoint.
+void LedgerShard::checkIntegrity(const IntegrityHeader& saved, const vector<SlotDigest>& digests,
+                                 const vector<uint64_t>& recordHashes, bool current) {
+    integrityMismatches.clear();
+    if (current) {
+        // The tree saved against the tree of what was read: matching roots
+        // settle it at once, and only differing subtrees are descended
+        vector<uint64_t> savedLeaves(digests.size());
+        vector<uint64_t> readLeaves(digests.size());
+        for (size_t slot = 0; slot < digests.size(); slot++) {
+            savedLeaves[slot] = MerkleTree::combine(digests[slot].recordHash, digests[slot].historyDigest);
+            readLeaves[slot] = MerkleTree::combine(recordHashes[slot], digests[slot].historyDigest);
+        }
+        MerkleTree savedTree;
+        MerkleTree readTree;
+        savedTree.assign(savedLeaves);
+        readTree.assign(readLeaves);
+        current = savedTree.root() == saved.root;   // Otherwise the integrity file itself is damaged
+        if (current && readTree.root() != savedTree.root()) {
+            vector<size_t> changed;
+            readTree.diff(savedTree, changed);
+            for (size_t slot : changed) {
+                integrityMismatches.push_back(static_cast<int>(slot));
+                dirtySlots.insert(static_cast<int>(slot));  // Saved again as read, so the file stays consistent
+            }
+        }
+    }
+    integrityRewrite = !current;
+}
+
+// Save every slot's hashes, or just the dirty slots', then the header with
+// the root. The header is first marked out of date, so a crash part way
+// leaves a file that is ignored (and rewritten) rather than one that
+// disagrees with the slot file.
+bool LedgerShard::writeIntegrity(int64_t checkpointSequence, bool wholeFile) {
+    int32_t slotCount = static_cast<int32_t>(slotOwners.size());
+    if (wholeFile ? !integrityFile.create() : !integrityFile.writeHeader(slotCount, -1, 0)) {
+        return false;
+    }
+    if (wholeFile) {
+        vector<SlotDigest> digests(slotOwners.size());
+        vector<uint64_t> leaves(slotOwners.size());
+        for (size_t slot = 0; slot < digests.size(); slot++) {
+            digests[slot] = slotDigest(static_cast<int>(slot));
+            leaves[slot] = MerkleTree::combine(digests[slot].recordHash, digests[slot].historyDigest);
+        }
+        integrityTree.assign(leaves);
+        if (!integrityFile.writeSlots(digests)) {
+            return false;
+        }
+    } else {
+        integrityTree.resize(slotOwners.size());
+        for (int slot : dirtySlots) {
+            SlotDigest digest = slotDigest(slot);
+            integrityTree.setLeaf(static_cast<size_t>(slot),
+                                  MerkleTree::combine(digest.recordHash, digest.historyDigest));
+            if (!integrityFile.writeSlot(slot, digest)) {
+                return false;
+            }
+        }
+    }
+    if (!integrityFile.flush() || !integrityFile.writeHeader(slotCount, checkpointSequence, integrityTree.root()) ||
+        !integrityFile.flush()) {
+        return false;
+    }
+    integrityRewrite = false;
+    return true;
+}
+
+// Write changed slots and their hashes, then the header, then empty the
+// journal. The header records the first journal sequence not covered by
+// the slots, so a crash between any two steps replays correctly.
+bool LedgerShard::checkpoint(const LedgerMeta& meta) {
+    if (upgradePending) {
+        return rewriteSnapshot(meta);
+    }
+    for (int slot : dirtySlots) {
+        AccountRecord record = LedgerFile::emptyRecord();
+        int owner = slotOwners[slot];
+        if (owner != 0 && !recordAt(accountIndex[owner], record)) {
+            return fail("could not read account " + to_string(owner) + " back from disk");
+        }
+        if (!snapshotFile.writeSlot(slot, record)) {
+            return fail("could not be written");
+        }
+    }
+    if (!snapshotFile.flush() || !saveRequests(static_cast<int64_t>(time(0))) || !saveHolds()) {
+        return fail("could not be written");
+    }
+
+    // Header goes last so it never counts slots that were not written yet
+    LedgerHeader header = LedgerFile::makeHeader(meta.nextAccountNumber, static_cast<int32_t>(slotOwners.size()),
+                                                 meta.lastPostingDay, shardIndex, shardCount,
+                                                 static_cast<int64_t>(journal.getNextSequence()));
+    if (!writeIntegrity(header.checkpointSequence, integrityRewrite)) {
+        return fail("integrity file could not be written");
+    }
+    dirtySlots.clear();
+    if (!snapshotFile.writeHeader(header) || !snapshotFile.flush()) {
+        return fail("could not be written");
+    }
+    replayedLegs.clear();
+    return journal.truncate();
+}
+
+// Remove tombstones closed at or before the cutoff. Each purge is journaled so
+// replay drops the account too; the numbers purged are returned so they
+// can be retired.
+size_t LedgerShard::purgeTombstones(time_t cutoff, vector<int>& purged) {
+    if (tombstoneCount == 0) {
+        return 0;
+    }
+    vector<JournalRecord> records;
+    vector<int> numbers;
+    for (size_t position = 0; position < accountSlotOf.size(); position++) {
+        AccountRecord record;
+        if (currencyColumn[position] == Currency::NONE && recordAt(position, record) && record.closedAt <= cutoff) {
+            numbers.push_back(record.accountNumber);
+            records.push_back(ShardJournal::makeRecord(JOURNAL_DELETE, record.accountNumber, 0, 0.0, 0.0, ""));
+        }
+    }
+    if (!journal.append(records)) {
+        fail("could not write journal");
+        return 0;
+    }
+    for (int accountNumber : numbers) {
+        eraseAccount(accountNumber);
+    }
+    if (accountSlotOf.capacity() > 2 * accountSlotOf.size() + LOAD_CHUNK_SLOTS) {
+        accounts.shrink_to_fit();
+        accountSlotOf.shrink_to_fit();
+    }
+    purged.insert(purged.end(), numbers.begin(), numbers.end());
+    return numbers.size();
+}
+
+// Whether enough of the slot file is free to be worth rewriting
+bool LedgerShard::needsRewrite() const {
+    return freeSlots.size() >= REWRITE_MIN_FREE_SLOTS && freeSlots.size() * 4 >= slotOwners.size();
+}
+
+// Write every account into consecutive slots of a new file, then swap it in
+// for the old one. The new header covers the whole journal, so the journal
+// is emptied as in a checkpoint.
+bool LedgerShard::rewriteSnapshot(const LedgerMeta& meta) {
+    const string& snapshotName = snapshotFile.getFileName();
+    string newName = snapshotName + ".compact";
+    string oldName = snapshotName + ".old";
+    
+    LedgerFile newFile(newName);
+    size_t accountCount = accountSlotOf.size();
+    LedgerHeader header = LedgerFile::makeHeader(meta.nextAccountNumber, static_cast<int32_t>(accountCount),
+                                                 meta.lastPostingDay, shardIndex, shardCount,
+                                                 static_cast<int64_t>(journal.getNextSequence()));
+    if (!newFile.create(header)) {
+        return fail("could not be rewritten");
+    }
+    vector<int> owners(accountCount);
+    for (size_t i = 0; i < accountCount; i++) {
+        AccountRecord record;
+        if (!recordAt(i, record) || !newFile.writeSlot(static_cast<int>(i), record)) {
+            newFile.close();
+            remove(newName.c_str());
+            return fail("could not be rewritten");
+        }
+        owners[i] = record.accountNumber;
+    }
+    if (!newFile.flush() || !saveRequests(static_cast<int64_t>(time(0))) || !saveHolds()) {
+        newFile.close();
+        remove(newName.c_str());
+        return fail("could not be rewritten");
+    }
+    newFile.close();
+    
+    // Old file aside, new file in place, old file removed; finishRewrite()
+    // completes these steps if the process stops between them. The
+    // integrity file is marked out of date first and rewritten after.
+    if (!integrityFile.writeHeader(static_cast<int32_t>(slotOwners.size()), -1, 0) || !integrityFile.flush()) {
+        remove(newName.c_str());
+        return fail("could not be rewritten");
+    }
+    snapshotFile.close();
+    if (rename(snapshotName.c_str(), oldName.c_str()) != 0 || rename(newName.c_str(), snapshotName.c_str()) != 0) {
+        finishRewrite(snapshotName);
+        return fail("could not be replaced");
+    }
+    remove(oldName.c_str());
+    LedgerHeader written;
+    snapshotFile.readHeader(written);  // Reopen in the format just written
+    upgradePending = false;
+    if (cache) {
+        cache->invalidate();
+    }
+    
+    slotOwners.swap(owners);
+    for (size_t i = 0; i < accountCount; i++) {
+        accountSlotOf[i] = static_cast<int>(i);
+    }
+    vector<int>().swap(freeSlots);
+    dirtySlots.clear();
+    replayedLegs.clear();
+    if (!writeIntegrity(header.checkpointSequence, true)) {
+        return fail("integrity file could not be written");
+    }
+    return journal.truncate();
+}
+
+// Settle a slot file rewrite that was interrupted. The new file is only
+// moved into place once complete, so whichever file holds the real name
+// is used and the leftovers are removed.
+void LedgerShard::finishRewrite(const string& snapshotName) {
+    string newName = snapshotName + ".compact";
+    string oldName = snapshotName + ".old";
+    ifstream current(snapshotName, ios::binary);
+    if (current.good()) {
+        current.close();
+        remove(newName.c_str());
+        remove(oldName.c_str());
+        return;
+    }
+    ifstream complete(newName, ios::binary);
+    if (complete.good()) {
+        complete.close();
+        rename(newName.c_str(), snapshotName.c_str());
+        remove(oldName.c_str());
+        return;
+    }
+    rename(oldName.c_str(), snapshotName.c_str());
+}
+
+// Send journal appends and slot writes through a storage backend
+void LedgerShard::setStorage(StorageBackend* backend, bool sync) {
+    journal.setStorage(backend, sync);
+    snapshotFile.setStorage(backend, sync);
+}
+
+// Sequence of the newest journal record
+uint64_t LedgerShard::lastJournalSequence() const {
+    return journal.getNextSequence() - 1;
+}
+
+// Wait until the journal record with this sequence is on disk
+bool LedgerShard::waitDurable(uint64_t sequence) {
+    return journal.waitDurable(sequence);
+}
+
+// Journal records written since the last checkpoint
+size_t LedgerShard::pendingJournalRecords() const {
+    return journal.getRecordCount();
+}
+
+// Phase timings of the last load
+const ShardLoadStats& LedgerShard::getLoadStats() const {
+    return loadStats;
+}
+
+// Whether replay saw the leg of a transfer for this account
+bool LedgerShard::hasReplayedLeg(uint64_t transferId, int accountNumber) const {
+    return replayedLegs.count(make_pair(transferId, accountNumber)) > 0;
+}
+
+// Slots in the slot file, free or not
+size_t LedgerShard::getSlotCount() const {
+    return slotOwners.size();
+}
+
+// Account number in a slot (0 = free)
+int LedgerShard::getSlotOwner(int slot) const {
+    return slotOwners[static_cast<size_t>(slot)];
+}
+
+// Recompute a slot's leaf from scratch, auditing its account's history
+// against its balance. False with the problem if the audit fails.
+bool LedgerShard::auditSlot(int slot, uint64_t& leaf, string& problem) const {
+    int owner = slotOwners[static_cast<size_t>(slot)];
+    if (owner == 0) {
+        leaf = freeLeaf();
+        return true;
+    }
+    auto it = accountIndex.find(owner);
+    if (it == accountIndex.end()) {
+        leaf = 0;
+        problem = "slot holds account " + to_string(owner) + ", which is not loaded";
+        return false;
+    }
+    const BankAccount* resident = residentAt(it->second);
+    optional<BankAccount> copy;
+    if (!resident && !cache->read(it->second, slot, true, copy)) {
+        leaf = 0;
+        problem = "account " + to_string(owner) + " could not be read back from disk";
+        return false;
+    }
+    const BankAccount& account = resident ? *resident : *copy;
+    leaf = accountLeaf(account);
+    if (balanceColumn[it->second] != (account.isClosed() ? 0.0 : account.getBalance()) ||
+        currencyColumn[it->second] != (account.isClosed() ? Currency::NONE : account.getCurrency())) {
+        problem = "revaluation columns are out of date";
+        return false;
+    }
+    return account.getHistory().audit(account.getBalance(), problem);
+}
+
+// Balances in account order (0 for tombstones)
+const vector<double>& LedgerShard::getBalanceColumn() const {
+    return balanceColumn;
+}
+
+// Currencies in account order (NONE for tombstones)
+const vector<CurrencyCode>& LedgerShard::getCurrencyColumn() const {
+    return currencyColumn;
+}
+
+// Tree kept current as slots change
+const MerkleTree& LedgerShard::getIntegrityTree() const {
+    return integrityTree;
+}
+
+// Slots whose record on disk differed from its saved hash at the last load
+const vector<int>& LedgerShard::getIntegrityMismatches() const {
+    return integrityMismatches;
+}
+
+// Whether a verified tree was saved or loaded
+bool LedgerShard::hasVerifiedTree() const {
+    return verifiedKnown;
+}
+
+// Tree as of the last verification that passed
+const MerkleTree& LedgerShard::getVerifiedTree() const {
+    return verifiedTree;
+}
+
+// Keep the current tree as the verified one, in memory and on disk
+bool LedgerShard::saveVerifiedTree() {
+    verifiedTree = integrityTree;
+    verifiedKnown = true;
+    return verifiedTree.save(verifiedFileName);
+}
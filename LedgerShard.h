@@ -0,0 +1,238 @@
+#ifndef LEDGERSHARD_H
+#define LEDGERSHARD_H
+
+#include "BankAccount.h"
+#include "AccountCache.h"
+#include "LedgerFile.h"
+#include "Journal.h"
+#include "ThreadPool.h"
+#include "IdempotencyTable.h"
+#include "TimerWheel.h"
+#include "MerkleTree.h"
+#include "Currency.h"
+#include "RiskStage.h"
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <optional>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <utility>
+#include <cstdint>
+#include <ctime>
+
+using namespace std;
+
+// Ledger-wide values stored in every shard header (the highest wins on load)
+struct LedgerMeta {
+    int32_t nextAccountNumber = 0;
+    int32_t lastPostingDay = 0;
+};
+
+// Time spent in each phase of a shard load (milliseconds)
+struct ShardLoadStats {
+    double readMs = 0.0;        // Header and slots read from disk
+    double parseMs = 0.0;       // Slots turned into accounts on the thread pool
+    double indexMs = 0.0;       // Chunks merged into the store and index
+    double replayMs = 0.0;      // Journal replayed on top
+    size_t replayedRecords = 0;
+};
+
+// Funds reserved on an account until settled, released or expired. The
+// id also routes to the shard: holdId % shardCount is the shard index.
+struct AccountHold {
+    uint64_t holdId;
+    int64_t expiresAt;          // Unix seconds
+    double amount;
+    int32_t accountNumber;
+    int32_t reserved;
+};
+
+// One partition of the ledger. A shard owns its accounts, the index over
+// them, a fixed-slot snapshot file and a journal. Changes are appended to
+// the journal as they happen; a checkpoint writes the changed slots and
+// empties the journal. Closing an account only marks it (a tombstone that
+// keeps its history); compaction later purges old tombstones and rewrites
+// the slot file without the gaps. Callers hold the shard mutex around
+// every call.
+//
+// Each slot is also a leaf of a Merkle tree: the hash of its record
+// combined with its account's history digest, updated as the slot is
+// marked dirty. A checkpoint saves the per-slot hashes next to the slot
+// file, so a load can find slots changed on disk behind the ledger's back
+// by comparing trees instead of trusting the balances it reads.
+//
+// In bounded mode (configureCache) the accounts are not all in memory:
+// the index, slots and revaluation columns still cover every account, but
+// the accounts themselves are read on demand into an AccountCache, and
+// those evicted after changing are kept in its page file. Pointers from
+// find() then stay valid for AccountCache::PINNED_LOOKUPS further lookups.
+class LedgerShard {
+private:
+    int shardIndex;
+    int shardCount;
+    vector<BankAccount> accounts;             // Open accounts and tombstones (empty in bounded mode)
+    unique_ptr<AccountCache> cache;           // Bounded mode: accounts paged in and out (null = all resident)
+    unordered_map<int, size_t> accountIndex;  // Account number -> position in accounts
+    vector<int> accountSlotOf;                // Slot of each account, parallel to accounts
+    vector<double> balanceColumn;             // Balance of each account (0 for tombstones), parallel to accounts
+    vector<CurrencyCode> currencyColumn;      // Currency of each account (NONE for tombstones), parallel to accounts
+    vector<int> slotOwners;                   // Slot -> account number (0 = free)
+    vector<int> freeSlots;
+    set<int> dirtySlots;                      // Slots changed since the last checkpoint
+    set<pair<uint64_t, int>> replayedLegs;    // (transfer id, account) seen during replay
+    size_t tombstoneCount;
+    atomic<size_t> openCount;                 // Read without the shard lock
+
+    LedgerFile snapshotFile;
+    ShardJournal journal;
+    IdempotencyTable requests;                // Keys of requests applied to this shard's accounts
+    int64_t requestTtlSeconds;
+    string requestsFileName;                  // Keys in effect at the last checkpoint
+    unordered_map<uint64_t, AccountHold> holds;  // Open holds on this shard's accounts
+    TimerWheel holdTimers;                    // Fires each hold at its expiry
+    unique_ptr<RiskStage> riskStage;          // Screens this shard's deposits, withdrawals and transfers
+    int64_t holdTtlSeconds;
+    string holdsFileName;                     // Holds open at the last checkpoint
+    bool upgradePending;                      // Slot file is an older format; rewrite at next checkpoint
+    mutex shardMutex;
+    string lastError;
+    ShardLoadStats loadStats;
+    
+    MerkleTree integrityTree;                 // Leaf per slot, kept current with the accounts
+    IntegrityFile integrityFile;              // Slot hashes as of the last checkpoint
+    bool integrityRewrite;                    // Integrity file missing or stale; write it whole at next checkpoint
+    vector<int> integrityMismatches;          // Slots that differed from their saved hashes at load
+    MerkleTree verifiedTree;                  // Tree as it was when the ledger last passed verification
+    string verifiedFileName;
+    bool verifiedKnown;
+
+    int allocateSlot(int accountNumber);
+    void releaseSlot(int slot);
+    void insertAccount(const BankAccount& account);
+    void eraseAccount(int accountNumber);
+    void markClosed(BankAccount& account, time_t when);
+    void refreshColumns(size_t position, const BankAccount& account);
+    BankAccount* accountAt(size_t position);
+    const BankAccount* residentAt(size_t position) const;
+    bool recordAt(size_t position, AccountRecord& record) const;
+    bool loadRequests(int64_t now);
+    bool saveRequests(int64_t now);
+    bool loadHolds(int64_t now);
+    bool saveHolds();
+    void applyRelease(const AccountHold& hold, const string& type);
+    void collectHoldReleases(const set<int>& accountNumbers, vector<JournalRecord>& records,
+                             vector<AccountHold>& released) const;
+    void replay(const JournalRecord& record);
+    bool fail(const string& message);
+    SlotDigest slotDigest(int slot) const;
+    void refreshLeaf(int slot);
+    void checkIntegrity(const IntegrityHeader& saved, const vector<SlotDigest>& digests,
+                        const vector<uint64_t>& recordHashes, bool current);
+    bool writeIntegrity(int64_t checkpointSequence, bool wholeFile);
+
+public:
+    // Constructor
+    LedgerShard(int index, int count, string snapshotName, string journalName, string requestsName,
+                string holdsName, string integrityName, string verifiedName);
+
+    mutex& getMutex();
+    int getIndex() const;
+    size_t size() const;                      // Open accounts (safe without the lock)
+    size_t getTombstoneCount() const;
+    BankAccount* find(int accountNumber);     // Also finds closed accounts
+    vector<BankAccount>& getAccounts();       // Resident mode only
+
+    // Bounded mode. Set before load; budget is the bytes the cache may
+    // hold. forEachAccount() visits every account, reading cold ones from
+    // disk without their history and without caching them; peek() reads
+    // one whole without caching it; prefetch() starts reading one early.
+    void configureCache(size_t budgetBytes, const string& pagesName, bool prefetchCold);
+    bool isBounded() const;
+    void forEachAccount(const function<void(const BankAccount&)>& visit) const;
+    void forEachResident(const function<void(const BankAccount&)>& visit) const;
+    const BankAccount* peek(int accountNumber, optional<BankAccount>& copy) const;
+    void prefetch(int accountNumber);
+    AccountCacheStats getCacheStats() const;
+
+    // Journaled mutations; recordChange is called after the account changed
+    bool addAccount(const BankAccount& account);
+    bool closeAccount(int accountNumber, time_t when);
+    bool closeAccounts(const vector<int>& accountNumbers, time_t when, vector<int>& closed);
+    bool recordChange(const BankAccount& account, const string& type, double amount, uint64_t transferId = 0,
+                      const RequestOutcome* request = nullptr);
+    
+    // Idempotency keys: journaled with the change they belong to
+    void configureRequests(size_t capacity, int ttlSeconds);
+    const RequestOutcome* findRequest(uint64_t keyHash, time_t now) const;
+    int64_t getRequestTtl() const;
+    
+    // Holds and limits (the caller checks BankAccount::canDebit first).
+    // expireHolds() also runs lazily before each debit on the shard.
+    void configureHolds(int ttlSeconds);
+    void setRiskStage(unique_ptr<RiskStage> stage);
+    RiskStage& getRiskStage();
+    uint64_t placeHold(BankAccount& account, double amount, time_t now);  // 0 on failure
+    const AccountHold* findHold(uint64_t holdId) const;
+    bool settleHold(uint64_t holdId, double amount);
+    bool releaseHold(uint64_t holdId);
+    size_t expireHolds(time_t now);
+    size_t getHoldCount() const;
+    bool setLimits(BankAccount& account, double overdraftLimit, double dailyLimit);
+
+    // Replication: the primary ships every journal append and starts each
+    // log with snapshotRecords(); a standby applies them with applyReplicated()
+    void setShipper(ReplicationLog* log);
+    void setChangeFeed(ChangeFeed* feed);     // Publishes the same records (null stops it)
+    void snapshotRecords(vector<JournalRecord>& records, time_t now) const;
+    void applyReplicated(const JournalRecord& record);
+    void shipChange(const BankAccount& account, const string& type, double amount);  // Unjournaled changes
+
+    // Unjournaled changes that reach disk at the next checkpoint
+    void loadAccount(const BankAccount& account);
+    void markDirty(int accountNumber);
+
+    // Persistence. With a storage backend, journal appends are queued and
+    // a commit is durable once waitDurable() returns for its sequence
+    void setStorage(StorageBackend* backend, bool sync);
+    uint64_t lastJournalSequence() const;     // Caller holds the lock
+    bool waitDurable(uint64_t sequence);      // Called without the lock
+    bool exists() const;
+    bool create(const LedgerMeta& meta);
+    bool load(LedgerMeta& meta, ThreadPool& pool);
+    bool checkpoint(const LedgerMeta& meta);
+    
+    // Compaction: purge tombstones closed by a cutoff, then rewrite the
+    // slot file densely once enough slots are free
+    size_t purgeTombstones(time_t cutoff, vector<int>& purged);
+    bool needsRewrite() const;
+    bool rewriteSnapshot(const LedgerMeta& meta);
+    size_t getFreeSlotCount() const;
+    static void finishRewrite(const string& snapshotName);
+    size_t pendingJournalRecords() const;
+    bool hasReplayedLeg(uint64_t transferId, int accountNumber) const;
+    const string& getError() const;
+    const ShardLoadStats& getLoadStats() const;
+    
+    // Integrity. auditSlot() recomputes a slot's leaf from its account,
+    // auditing the account's history against its balance on the way; it
+    // only reads, so workers may audit slots of a locked shard side by side.
+    size_t getSlotCount() const;
+    int getSlotOwner(int slot) const;
+    bool auditSlot(int slot, uint64_t& leaf, string& problem) const;
+    const MerkleTree& getIntegrityTree() const;
+
+    // Revaluation: each account's balance and currency as two dense
+    // columns in account order, kept current as accounts change, so a
+    // pass over the book reads ten bytes per account
+    const vector<double>& getBalanceColumn() const;
+    const vector<CurrencyCode>& getCurrencyColumn() const;
+    const vector<int>& getIntegrityMismatches() const;   // Found by the last load
+    bool hasVerifiedTree() const;
+    const MerkleTree& getVerifiedTree() const;
+    bool saveVerifiedTree();                  // The current tree becomes the verified one
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "LedgerSnapshot.h"
+#include <thread>
+
+using namespace std;
+
+// Constructor
+SnapshotManager::SnapshotManager() : globalEpoch(1), current(nullptr) {
+    for (int i = 0; i < MAX_READERS; i++) {
+        readerEpochs[i] = 0;
+    }
+}
+
+// Destructor (no readers may be active)
+SnapshotManager::~SnapshotManager() {
+    delete current.load();
+    for (const auto& entry : retired) {
+        delete entry.snapshot;
+    }
+}
+
+// Claim a reader slot and pin the current epoch in it
+int SnapshotManager::pinReader() {
+    while (true) {
+        for (int i = 0; i < MAX_READERS; i++) {
+            uint64_t idle = 0;
+            uint64_t epoch = globalEpoch.load();
+            if (readerEpochs[i].compare_exchange_strong(idle, epoch)) {
+                return i;
+            }
+        }
+        // Every slot is busy; wait for a reader to finish
+        this_thread::yield();
+    }
+}
+
+void SnapshotManager::unpinReader(int slot) {
+    readerEpochs[slot].store(0);
+}
+
+// Pin an epoch and return the snapshot that was current at that time
+SnapshotManager::ReadGuard SnapshotManager::read() {
+    int slot = pinReader();
+    return ReadGuard(this, slot, current.load());
+}
+
+uint64_t SnapshotManager::currentVersion() const {
+    const LedgerSnapshot* snapshot = current.load();
+    return snapshot ? snapshot->version : 0;
+}
+
+// Swap in a new snapshot and retire the old one at the current epoch
+void SnapshotManager::publish(const LedgerSnapshot* snapshot) {
+    const LedgerSnapshot* old = current.exchange(snapshot);
+    uint64_t retireEpoch = globalEpoch.fetch_add(1);
+    if (old) {
+        lock_guard<mutex> lock(retireMutex);
+        RetiredSnapshot entry;
+        entry.epoch = retireEpoch;
+        entry.snapshot = old;
+        retired.push_back(entry);
+    }
+    reclaim();
+}
+
+// Free retired snapshots that no pinned reader can still see
+size_t SnapshotManager::reclaim() {
+    uint64_t oldestPinned = UINT64_MAX;
+    for (int i = 0; i < MAX_READERS; i++) {
+        uint64_t epoch = readerEpochs[i].load();
+        if (epoch != 0 && epoch < oldestPinned) {
+            oldestPinned = epoch;
+        }
+    }
+    
+    lock_guard<mutex> lock(retireMutex);
+    size_t freed = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < retired.size(); i++) {
+        if (retired[i].epoch < oldestPinned) {
+            delete retired[i].snapshot;
+            freed++;
+        } else {
+            retired[kept++] = retired[i];
+        }
+    }
+    retired.resize(kept);
+    return freed;
+}
+
+// ReadGuard
+SnapshotManager::ReadGuard::ReadGuard(SnapshotManager* owner, int readerSlot, const LedgerSnapshot* snap)
+    : manager(owner), slot(readerSlot), snapshot(snap) {}
+
+SnapshotManager::ReadGuard::ReadGuard(ReadGuard&& other)
+    : manager(other.manager), slot(other.slot), snapshot(other.snapshot) {
+    other.manager = nullptr;
+}
+
+SnapshotManager::ReadGuard::~ReadGuard() {
+    if (manager) {
+        manager->unpinReader(slot);
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef LEDGERSNAPSHOT_H
+#define LEDGERSNAPSHOT_H
+
+#include "Currency.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <ctime>
+
+using namespace std;
+
+// One account as seen by a snapshot
+struct AccountView {
+    int32_t accountNumber;
+    int32_t accountType;
+    CurrencyCode currency;
+    double balance;
+    string_view holderName;     // Interned, so it outlives the account
+};
+
+// Immutable point-in-time copy of the ledger used by reports
+struct LedgerSnapshot {
+    uint64_t version = 0;           // Ledger version the copy was taken at
+    time_t takenAt = 0;
+    int32_t nextAccountNumber = 0;
+    double totalBalance = 0.0;      // Sum of the balances in this snapshot, in the base currency
+    vector<AccountView> accounts;
+};
+
+// Publishes snapshots to readers and frees old ones with epoch-based
+// reclamation: a reader pins the current epoch while it holds a
+// snapshot, and a replaced snapshot is only deleted once every pinned
+// epoch is newer than the epoch it was retired in.
+class SnapshotManager {
+private:
+    static const int MAX_READERS = 64;
+
+    atomic<uint64_t> globalEpoch;
+    atomic<uint64_t> readerEpochs[MAX_READERS];    // 0 = slot free
+    atomic<const LedgerSnapshot*> current;
+
+    struct RetiredSnapshot {
+        uint64_t epoch;
+        const LedgerSnapshot* snapshot;
+    };
+    mutex retireMutex;
+    vector<RetiredSnapshot> retired;
+
+    int pinReader();
+    void unpinReader(int slot);
+
+public:
+    // Keeps a snapshot alive for the lifetime of the guard
+    class ReadGuard {
+    private:
+        SnapshotManager* manager;
+        int slot;
+        const LedgerSnapshot* snapshot;
+        friend class SnapshotManager;
+        ReadGuard(SnapshotManager* owner, int readerSlot, const LedgerSnapshot* snap);
+
+    public:
+        ReadGuard(ReadGuard&& other);
+        ~ReadGuard();
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+        const LedgerSnapshot* get() const { return snapshot; }
+        const LedgerSnapshot* operator->() const { return snapshot; }
+    };
+
+    // Constructor
+    SnapshotManager();
+    ~SnapshotManager();
+
+    ReadGuard read();
+    uint64_t currentVersion() const;         // Version of the published snapshot (0 = none)
+    void publish(const LedgerSnapshot* snapshot);
+    size_t reclaim();                        // Returns the number of snapshots freed
+};
+
+#endif
@@ -0,0 +1,229 @@
+#include "LockoutPolicy.h"
+#include "StringArena.h"
+#include <sstream>
+
+using namespace std;
+
+// Constructor
+LockoutPolicy::LockoutPolicy()
+    : windowSeconds(900), maxFailures(3), baseLockSeconds(60), maxLockSeconds(3600),
+      tokensPerSecond(10.0 / 60.0), burst(5.0) {}
+
+// Apply settings, clamping them to workable values
+void LockoutPolicy::configure(int window, int failures, int baseLock, int maxLock, int ratePerMinute, int burstSize) {
+    lock_guard<mutex> lock(policyMutex);
+    windowSeconds = window > 0 ? window : 1;
+    maxFailures = failures < 1 ? 1 : (failures > MAX_TRACKED_FAILURES ? MAX_TRACKED_FAILURES : failures);
+    baseLockSeconds = baseLock > 0 ? baseLock : 1;
+    maxLockSeconds = maxLock >= baseLockSeconds ? maxLock : baseLockSeconds;
+    tokensPerSecond = (ratePerMinute > 0 ? ratePerMinute : 1) / 60.0;
+    burst = burstSize > 0 ? burstSize : 1;
+}
+
+// Count ring entries that fall inside the sliding window
+int LockoutPolicy::failuresInWindow(const UserState& state, uint32_t now) const {
+    int recent = 0;
+    for (int i = 0; i < state.count; i++) {
+        if (now - state.failureTimes[i] < static_cast<uint32_t>(windowSeconds)) {
+            recent++;
+        }
+    }
+    return recent;
+}
+
+// Forget earlier lockouts once the user has stayed clean for a full maximum cooldown
+void LockoutPolicy::decayLockLevel(UserState& state, uint32_t now) const {
+    if (state.lockLevel > 0 && now >= state.lockedUntil + static_cast<uint32_t>(maxLockSeconds)) {
+        state.lockLevel = 0;
+    }
+}
+
+// Drop buckets that have refilled completely (their sources went quiet)
+void LockoutPolicy::evictIdleSources(chrono::steady_clock::time_point now) {
+    for (auto it = buckets.begin(); it != buckets.end();) {
+        double idleSeconds = chrono::duration<double>(now - it->second.lastRefill).count();
+        if (it->second.tokens + idleSeconds * tokensPerSecond >= burst) {
+            it = buckets.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Spend one token from the source's bucket. Called before the user is
+// looked up or any password is hashed.
+double LockoutPolicy::acquireToken(const string& source) {
+    lock_guard<mutex> lock(policyMutex);
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+
+    auto it = buckets.find(source);
+    if (it == buckets.end()) {
+        if (buckets.size() >= MAX_SOURCES) {
+            evictIdleSources(now);
+            if (buckets.size() >= MAX_SOURCES) {
+                return 1.0;  // Table full of active sources: make the newcomer wait
+            }
+        }
+        TokenBucket bucket;
+        bucket.tokens = static_cast<float>(burst);
+        bucket.lastRefill = now;
+        it = buckets.emplace(source, bucket).first;
+    }
+
+    TokenBucket& bucket = it->second;
+    double elapsed = chrono::duration<double>(now - bucket.lastRefill).count();
+    double tokens = bucket.tokens + elapsed * tokensPerSecond;
+    if (tokens > burst) {
+        tokens = burst;
+    }
+    bucket.lastRefill = now;
+    if (tokens < 1.0) {
+        bucket.tokens = static_cast<float>(tokens);
+        return (1.0 - tokens) / tokensPerSecond;
+    }
+    bucket.tokens = static_cast<float>(tokens - 1.0);
+    return 0.0;
+}
+
+// Seconds until the user's lock expires (expired locks unlock themselves)
+int LockoutPolicy::lockedFor(string_view username, time_t now) const {
+    lock_guard<mutex> lock(policyMutex);
+    auto it = userStates.find(username);
+    if (it == userStates.end()) {
+        return 0;
+    }
+    uint32_t current = static_cast<uint32_t>(now);
+    if (it->second.lockedUntil <= current) {
+        return 0;
+    }
+    return static_cast<int>(it->second.lockedUntil - current);
+}
+
+// Failures inside the current window
+int LockoutPolicy::recentFailures(string_view username, time_t now) const {
+    lock_guard<mutex> lock(policyMutex);
+    auto it = userStates.find(username);
+    if (it == userStates.end()) {
+        return 0;
+    }
+    return failuresInWindow(it->second, static_cast<uint32_t>(now));
+}
+
+// Failures allowed inside the window before a lockout
+int LockoutPolicy::getMaxFailures() const {
+    lock_guard<mutex> lock(policyMutex);
+    return maxFailures;
+}
+
+// Length of the sliding window in seconds
+int LockoutPolicy::getWindowSeconds() const {
+    lock_guard<mutex> lock(policyMutex);
+    return windowSeconds;
+}
+
+// Record a wrong password and lock the user if the window is full
+int LockoutPolicy::recordFailure(string_view username, time_t now) {
+    lock_guard<mutex> lock(policyMutex);
+    uint32_t current = static_cast<uint32_t>(now);
+    UserState& state = userStates[StringArena::shared().intern(username)];
+    decayLockLevel(state, current);
+
+    state.failureTimes[state.head] = current;
+    state.head = static_cast<uint8_t>((state.head + 1) % MAX_TRACKED_FAILURES);
+    if (state.count < MAX_TRACKED_FAILURES) {
+        state.count++;
+    }
+    if (failuresInWindow(state, current) < maxFailures) {
+        return 0;
+    }
+
+    // Exponential backoff: base, 2x base, 4x base ... up to the maximum
+    int64_t duration = baseLockSeconds;
+    for (int level = 0; level < state.lockLevel && duration < maxLockSeconds; level++) {
+        duration *= 2;
+    }
+    if (duration > maxLockSeconds) {
+        duration = maxLockSeconds;
+    }
+    if (state.lockLevel < 255) {
+        state.lockLevel++;
+    }
+    state.lockedUntil = current + static_cast<uint32_t>(duration);
+    state.count = 0;  // The next lockout needs a fresh run of failures
+    state.head = 0;
+    return static_cast<int>(duration);
+}
+
+// A correct password clears the user's history
+void LockoutPolicy::recordSuccess(string_view username) {
+    lock_guard<mutex> lock(policyMutex);
+    userStates.erase(username);
+}
+
+// Administrator unlock
+void LockoutPolicy::unlock(string_view username) {
+    lock_guard<mutex> lock(policyMutex);
+    userStates.erase(username);
+}
+
+// Drop all state for a removed user
+void LockoutPolicy::forget(string_view username) {
+    lock_guard<mutex> lock(policyMutex);
+    userStates.erase(username);
+}
+
+// Lockout fields written after the user's record in users.txt
+string LockoutPolicy::serialize(string_view username, time_t now) const {
+    lock_guard<mutex> lock(policyMutex);
+    auto it = userStates.find(username);
+    if (it == userStates.end()) {
+        return "0";
+    }
+    const UserState& state = it->second;
+    uint32_t current = static_cast<uint32_t>(now);
+    ostringstream fields;
+    fields << (state.lockedUntil > current ? 1 : 0) << " " << static_cast<int>(state.lockLevel)
+           << " " << state.lockedUntil;
+    for (int i = 0; i < state.count; i++) {
+        // Oldest first, and only failures still inside the window
+        int index = (state.head - state.count + i + MAX_TRACKED_FAILURES) % MAX_TRACKED_FAILURES;
+        if (current - state.failureTimes[index] < static_cast<uint32_t>(windowSeconds)) {
+            fields << " " << state.failureTimes[index];
+        }
+    }
+    return fields.str();
+}
+
+// Rebuild a user's state from the fields written by serialize(). A bare
+// "1" from an older users.txt becomes a lock for the maximum cooldown.
+void LockoutPolicy::restore(string_view username, const string& fields, time_t now) {
+    istringstream input(fields);
+    int locked = 0;
+    input >> locked;
+
+    UserState state;
+    int level = 0;
+    uint32_t lockedUntil = 0;
+    if (input >> level >> lockedUntil) {
+        state.lockLevel = static_cast<uint8_t>(level < 0 ? 0 : (level > 255 ? 255 : level));
+        state.lockedUntil = lockedUntil;
+        uint32_t failureTime;
+        while (input >> failureTime) {
+            state.failureTimes[state.head] = failureTime;
+            state.head = static_cast<uint8_t>((state.head + 1) % MAX_TRACKED_FAILURES);
+            if (state.count < MAX_TRACKED_FAILURES) {
+                state.count++;
+            }
+        }
+    } else if (locked == 1) {
+        lock_guard<mutex> lock(policyMutex);
+        state.lockLevel = 1;
+        state.lockedUntil = static_cast<uint32_t>(now) + static_cast<uint32_t>(maxLockSeconds);
+    }
+
+    if (state.lockLevel == 0 && state.count == 0 && state.lockedUntil == 0) {
+        return;
+    }
+    lock_guard<mutex> lock(policyMutex);
+    userStates[StringArena::shared().intern(username)] = state;
+}
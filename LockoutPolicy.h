@@ -0,0 +1,83 @@
+#ifndef LOCKOUTPOLICY_H
+#define LOCKOUTPOLICY_H
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+
+using namespace std;
+
+// Login protection. Failed passwords are counted per user over a sliding
+// window; reaching the limit locks the user for a cooldown that doubles
+// with each consecutive lockout and unlocks on its own when it expires.
+// Separately, every login request spends a token from its source's bucket
+// before any password is hashed, so a flood of guesses is turned away
+// cheaply.
+class LockoutPolicy {
+public:
+    static const int MAX_TRACKED_FAILURES = 16;
+
+private:
+    // Per-user state (one compact entry per user that has ever failed)
+    struct UserState {
+        uint32_t failureTimes[MAX_TRACKED_FAILURES];  // Ring of recent failures (Unix seconds)
+        uint32_t lockedUntil = 0;                     // Unix seconds; locked while in the future
+        uint8_t head = 0;                             // Next ring position to write
+        uint8_t count = 0;                            // Entries in the ring
+        uint8_t lockLevel = 0;                        // Consecutive lockouts (backoff exponent)
+    };
+
+    // Per-source token bucket
+    struct TokenBucket {
+        float tokens;
+        chrono::steady_clock::time_point lastRefill;
+    };
+
+    static const size_t MAX_SOURCES = 4096;
+
+    unordered_map<string_view, UserState> userStates;   // Keys interned in StringArena::shared()
+    unordered_map<string, TokenBucket> buckets;
+    mutable mutex policyMutex;
+
+    int windowSeconds;
+    int maxFailures;
+    int baseLockSeconds;
+    int maxLockSeconds;
+    double tokensPerSecond;
+    double burst;
+
+    int failuresInWindow(const UserState& state, uint32_t now) const;
+    void decayLockLevel(UserState& state, uint32_t now) const;
+    void evictIdleSources(chrono::steady_clock::time_point now);
+
+public:
+    // Constructor
+    LockoutPolicy();
+
+    void configure(int window, int failures, int baseLock, int maxLock, int ratePerMinute, int burstSize);
+
+    // Rate limiting: 0 if the request may proceed, otherwise seconds to wait
+    double acquireToken(const string& source);
+
+    // Lockout state (seconds remaining, 0 = not locked)
+    int lockedFor(string_view username, time_t now) const;
+    int recentFailures(string_view username, time_t now) const;
+    int getMaxFailures() const;
+    int getWindowSeconds() const;
+
+    // Returns the lock duration in seconds if this failure locked the user
+    int recordFailure(string_view username, time_t now);
+    void recordSuccess(string_view username);
+    void unlock(string_view username);
+    void forget(string_view username);
+
+    // users.txt persistence: "[Locked] [Lock Level] [Locked Until] [Failure Times...]"
+    string serialize(string_view username, time_t now) const;
+    void restore(string_view username, const string& fields, time_t now);
+};
+
+#endif
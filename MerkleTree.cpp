@@ -0,0 +1,287 @@
+#include "MerkleTree.h"
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+using namespace std;
+
+static const char INTEGRITY_MAGIC[8] = { 'B', 'A', 'N', 'K', 'M', 'R', 'K', '1' };
+static const char VERIFIED_MAGIC[8] = { 'B', 'A', 'N', 'K', 'V', 'R', 'F', '1' };
+
+// Final avalanche step of a 64-bit hash
+static uint64_t mix(uint64_t value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return value;
+}
+
+// Constructor
+MerkleTree::MerkleTree() : leafCount(0), capacity(1), nodes(2, 0) {}
+
+// Hash a run of bytes, eight at a time
+uint64_t MerkleTree::hashBytes(const void* data, size_t length, uint64_t seed) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed ^ (length * 0x9e3779b97f4a7c15ULL);
+    size_t pos = 0;
+    for (; pos + 8 <= length; pos += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + pos, sizeof(word));
+        hash = (hash ^ mix(word)) * 0x9e3779b97f4a7c15ULL + 0x632be59bd9b4e019ULL;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, bytes + pos, length - pos);
+    hash ^= mix(tail + length);
+    return mix(hash);
+}
+
+// Hash of a node from its children; two empty children make an empty node
+uint64_t MerkleTree::combine(uint64_t left, uint64_t right) {
+    if (left == 0 && right == 0) {
+        return 0;
+    }
+    uint64_t pair[2] = { left, right };
+    uint64_t hash = hashBytes(pair, sizeof(pair), 0x4d45524b4c45ULL);
+    return hash != 0 ? hash : 1;
+}
+
+// Recompute every inner node from the leaves
+void MerkleTree::rebuildInner() {
+    for (size_t node = capacity - 1; node >= 1; node--) {
+        nodes[node] = combine(nodes[2 * node], nodes[2 * node + 1]);
+    }
+}
+
+// Replace every leaf and rebuild
+void MerkleTree::assign(const vector<uint64_t>& leaves) {
+    leafCount = leaves.size();
+    capacity = 1;
+    while (capacity < leafCount) {
+        capacity *= 2;
+    }
+    nodes.assign(2 * capacity, 0);
+    if (!leaves.empty()) {
+        memcpy(&nodes[capacity], leaves.data(), leaves.size() * sizeof(uint64_t));
+    }
+    rebuildInner();
+}
+
+// Change the number of leaves; capacity doubles when it runs out, which
+// rebuilds the tree once per doubling
+void MerkleTree::resize(size_t count) {
+    if (count > capacity) {
+        vector<uint64_t> leaves(nodes.begin() + static_cast<ptrdiff_t>(capacity),
+                                nodes.begin() + static_cast<ptrdiff_t>(capacity + leafCount));
+        leaves.resize(count, 0);
+        assign(leaves);
+        return;
+    }
+    for (size_t index = count; index < leafCount; index++) {
+        setLeaf(index, 0);
+    }
+    leafCount = count;
+}
+
+// Set one leaf and rehash its path to the root
+void MerkleTree::setLeaf(size_t index, uint64_t hash) {
+    if (index >= leafCount) {
+        resize(index + 1);
+    }
+    size_t node = capacity + index;
+    if (nodes[node] == hash) {
+        return;
+    }
+    nodes[node] = hash;
+    for (node /= 2; node >= 1; node /= 2) {
+        nodes[node] = combine(nodes[2 * node], nodes[2 * node + 1]);
+    }
+}
+
+uint64_t MerkleTree::getLeaf(size_t index) const {
+    return index < leafCount ? nodes[capacity + index] : 0;
+}
+
+uint64_t MerkleTree::root() const {
+    return nodes[1];
+}
+
+size_t MerkleTree::size() const {
+    return leafCount;
+}
+
+// Descend both trees together, skipping any subtree whose hashes agree.
+// The trees are first brought to the same shape by comparing a copy of the
+// smaller one grown to the larger capacity.
+size_t MerkleTree::diff(const MerkleTree& other, vector<size_t>& changed) const {
+    if (other.capacity != capacity) {
+        MerkleTree grown = other.capacity < capacity ? other : *this;
+        grown.resize(max(capacity, other.capacity));
+        return other.capacity < capacity ? diff(grown, changed) : grown.diff(other, changed);
+    }
+    size_t compared = 0;
+    vector<size_t> pending;
+    pending.push_back(1);
+    while (!pending.empty()) {
+        size_t node = pending.back();
+        pending.pop_back();
+        compared++;
+        if (nodes[node] == other.nodes[node]) {
+            continue;
+        }
+        if (node >= capacity) {
+            changed.push_back(node - capacity);
+            continue;
+        }
+        pending.push_back(2 * node + 1);
+        pending.push_back(2 * node);
+    }
+    return compared;
+}
+
+// Write the leaves and root to a new file, then rename it into place
+bool MerkleTree::save(const string& fileName) const {
+    string tempName = fileName + ".tmp";
+    ofstream outFile(tempName, ios::binary | ios::trunc);
+    uint64_t count = leafCount;
+    uint64_t rootHash = root();
+    outFile.write(VERIFIED_MAGIC, sizeof(VERIFIED_MAGIC));
+    outFile.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    outFile.write(reinterpret_cast<const char*>(&rootHash), sizeof(rootHash));
+    outFile.write(reinterpret_cast<const char*>(&nodes[capacity]), static_cast<streamsize>(leafCount * sizeof(uint64_t)));
+    outFile.close();
+    if (!outFile) {
+        remove(tempName.c_str());
+        return false;
+    }
+    remove(fileName.c_str());
+    return rename(tempName.c_str(), fileName.c_str()) == 0;
+}
+
+// Read leaves saved by save() and check them against the saved root
+bool MerkleTree::load(const string& fileName) {
+    ifstream inFile(fileName, ios::binary);
+    if (!inFile) {
+        return false;
+    }
+    char magic[8];
+    uint64_t count = 0, rootHash = 0;
+    inFile.read(magic, sizeof(magic));
+    inFile.read(reinterpret_cast<char*>(&count), sizeof(count));
+    inFile.read(reinterpret_cast<char*>(&rootHash), sizeof(rootHash));
+    if (!inFile || memcmp(magic, VERIFIED_MAGIC, sizeof(magic)) != 0 || count > (1ULL << 31)) {
+        return false;
+    }
+    vector<uint64_t> leaves(static_cast<size_t>(count));
+    inFile.read(reinterpret_cast<char*>(leaves.data()), static_cast<streamsize>(leaves.size() * sizeof(uint64_t)));
+    if (!inFile) {
+        return false;
+    }
+    assign(leaves);
+    return root() == rootHash;
+}
+
+// Constructor
+IntegrityFile::IntegrityFile(string name) : fileName(name) {}
+
+const string& IntegrityFile::getFileName() const {
+    return fileName;
+}
+
+// Open the file for positioned writes
+bool IntegrityFile::ensureOpen() {
+    if (file.is_open()) {
+        return true;
+    }
+    file.open(fileName, ios::in | ios::out | ios::binary);
+    return file.is_open();
+}
+
+// Read the header and every slot; false if the file is missing or damaged
+bool IntegrityFile::read(IntegrityHeader& header, vector<SlotDigest>& slots) {
+    close();
+    ifstream inFile(fileName, ios::binary);
+    if (!inFile) {
+        return false;
+    }
+    inFile.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!inFile || memcmp(header.magic, INTEGRITY_MAGIC, sizeof(INTEGRITY_MAGIC)) != 0 || header.version != 1 ||
+        header.slotCount < 0) {
+        return false;
+    }
+    slots.resize(static_cast<size_t>(header.slotCount));
+    inFile.read(reinterpret_cast<char*>(slots.data()), static_cast<streamsize>(slots.size() * sizeof(SlotDigest)));
+    return static_cast<bool>(inFile);
+}
+
+// Start an empty file
+bool IntegrityFile::create() {
+    close();
+    ofstream outFile(fileName, ios::binary | ios::trunc);
+    IntegrityHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INTEGRITY_MAGIC, sizeof(INTEGRITY_MAGIC));
+    header.version = 1;
+    header.checkpointSequence = -1;     // Matches no slot file until the first header is written
+    outFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    outFile.close();
+    return !outFile.fail() && ensureOpen();
+}
+
+// Overwrite one slot's hashes in place
+bool IntegrityFile::writeSlot(int slot, const SlotDigest& digest) {
+    if (!ensureOpen()) {
+        return false;
+    }
+    file.clear();
+    file.seekp(static_cast<streamoff>(sizeof(IntegrityHeader)) + static_cast<streamoff>(slot) * sizeof(SlotDigest));
+    file.write(reinterpret_cast<const char*>(&digest), sizeof(digest));
+    return file.good();
+}
+
+// Write every slot in one pass
+bool IntegrityFile::writeSlots(const vector<SlotDigest>& digests) {
+    if (!ensureOpen()) {
+        return false;
+    }
+    file.clear();
+    file.seekp(static_cast<streamoff>(sizeof(IntegrityHeader)));
+    file.write(reinterpret_cast<const char*>(digests.data()),
+               static_cast<streamsize>(digests.size() * sizeof(SlotDigest)));
+    return file.good();
+}
+
+// Overwrite the header in place
+bool IntegrityFile::writeHeader(int32_t slotCount, int64_t checkpointSequence, uint64_t root) {
+    if (!ensureOpen()) {
+        return false;
+    }
+    IntegrityHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INTEGRITY_MAGIC, sizeof(INTEGRITY_MAGIC));
+    header.version = 1;
+    header.slotCount = slotCount;
+    header.checkpointSequence = checkpointSequence;
+    header.root = root;
+    file.clear();
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    return file.good();
+}
+
+// Push buffered writes to disk
+bool IntegrityFile::flush() {
+    if (!file.is_open()) {
+        return true;
+    }
+    file.flush();
+    return file.good();
+}
+
+// Close the file handle
+void IntegrityFile::close() {
+    if (file.is_open()) {
+        file.close();
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef MERKLETREE_H
+#define MERKLETREE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+using namespace std;
+
+// Binary hash tree over a row of leaves (a shard's slots). Leaves and
+// inner nodes live in one array: node 1 is the root, node i has children
+// 2i and 2i+1, and leaf k is node capacity + k. Changing a leaf rehashes
+// only its path to the root. An empty leaf is 0 and a node over two empty
+// children is 0, so unused capacity costs no hashing. The hash is a fast
+// 64-bit mix meant to catch corruption and mistakes, not deliberate forgery.
+class MerkleTree {
+private:
+    size_t leafCount;
+    size_t capacity;            // Power of two, at least leafCount
+    vector<uint64_t> nodes;     // 2 * capacity entries; nodes[0] unused
+
+    void rebuildInner();
+
+public:
+    // Constructor
+    MerkleTree();
+
+    // Replace every leaf and rebuild the tree bottom-up
+    void assign(const vector<uint64_t>& leaves);
+    void resize(size_t count);  // New leaves are empty; capacity grows by doubling
+    void setLeaf(size_t index, uint64_t hash);
+    uint64_t getLeaf(size_t index) const;
+    uint64_t root() const;
+    size_t size() const;
+
+    // Leaves that differ from other, found by descending only into
+    // subtrees whose hashes differ. Trees of different sizes are compared
+    // as if the shorter one had empty leaves. Returns nodes compared.
+    size_t diff(const MerkleTree& other, vector<size_t>& changed) const;
+
+    // Leaves and root, written to a new file and renamed into place
+    bool save(const string& fileName) const;
+    bool load(const string& fileName);   // False if missing or its root does not match its leaves
+
+    static uint64_t hashBytes(const void* data, size_t length, uint64_t seed = 0);
+    static uint64_t combine(uint64_t left, uint64_t right);
+};
+
+// Hashes saved for one slot at a checkpoint
+struct SlotDigest {
+    uint64_t recordHash;        // Hash of the slot record as written
+    uint64_t historyDigest;     // The account's history digest when it was written
+};
+
+// Header of a shard's integrity file
+struct IntegrityHeader {
+    char magic[8];              // "BANKMRK1"
+    int32_t version;
+    int32_t slotCount;
+    int64_t checkpointSequence; // Matches the slot file header it was written with
+    uint64_t root;              // Root over combine(recordHash, historyDigest) for every slot
+};
+
+// bank_data.N.merkle: a SlotDigest per slot of the slot file, at the same
+// positions, so a checkpoint rewrites only the slots it wrote
+class IntegrityFile {
+private:
+    string fileName;
+    fstream file;
+
+    bool ensureOpen();
+
+public:
+    // Constructor
+    IntegrityFile(string name);
+
+    const string& getFileName() const;
+    bool read(IntegrityHeader& header, vector<SlotDigest>& slots);
+    bool create();              // Empty file with a zero header
+    bool writeSlot(int slot, const SlotDigest& digest);
+    bool writeSlots(const vector<SlotDigest>& digests);   // Every slot, from slot 0
+    bool writeHeader(int32_t slotCount, int64_t checkpointSequence, uint64_t root);
+    bool flush();
+    void close();
+};
+
+#endif
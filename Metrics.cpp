@@ -0,0 +1,259 @@
+#include "Metrics.h"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <chrono>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define BANK_HAVE_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BANK_HAVE_TSC 1
+#else
+#define BANK_HAVE_TSC 0
+#endif
+
+using namespace std;
+
+namespace {
+
+// Counters for one operation on one thread (written only by that thread)
+struct OpStats {
+    atomic<uint64_t> count;
+    atomic<uint64_t> totalTicks;
+    atomic<uint64_t> maxTicks;
+    atomic<uint64_t> buckets[Metrics::BUCKET_COUNT];
+};
+
+struct ThreadMetrics {
+    OpStats ops[METRIC_OP_COUNT];
+};
+
+mutex registryMutex;
+vector<unique_ptr<ThreadMetrics>>& registry() {
+    static vector<unique_ptr<ThreadMetrics>> blocks;
+    return blocks;
+}
+
+// Reference points for converting ticks to nanoseconds
+const uint64_t startTicks = Metrics::now();
+const chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+
+ThreadMetrics* threadBlock() {
+    thread_local ThreadMetrics* block = nullptr;
+    if (!block) {
+        unique_ptr<ThreadMetrics> created(new ThreadMetrics());
+        for (auto& op : created->ops) {
+            op.count = 0;
+            op.totalTicks = 0;
+            op.maxTicks = 0;
+            for (auto& bucket : op.buckets) {
+                bucket = 0;
+            }
+        }
+        block = created.get();
+        lock_guard<mutex> lock(registryMutex);
+        registry().push_back(move(created));
+    }
+    return block;
+}
+
+// Owner-only increment: a relaxed load/store pair, no locked instruction
+inline void bump(atomic<uint64_t>& counter, uint64_t amount) {
+    counter.store(counter.load(memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+int bucketFor(uint64_t ticks) {
+    if (ticks < static_cast<uint64_t>(Metrics::SUB_BUCKETS)) {
+        return static_cast<int>(ticks);
+    }
+    int msb = 63;
+    while (!(ticks >> msb)) {
+        msb--;
+    }
+    int shift = msb - Metrics::SUB_BUCKET_BITS;
+    int sub = static_cast<int>((ticks >> shift) & (Metrics::SUB_BUCKETS - 1));
+    return (shift + 1) * Metrics::SUB_BUCKETS + sub;
+}
+
+// Upper bound (in ticks) of a bucket
+uint64_t bucketLimit(int bucket) {
+    if (bucket < Metrics::SUB_BUCKETS) {
+        return static_cast<uint64_t>(bucket);
+    }
+    int shift = bucket / Metrics::SUB_BUCKETS - 1;
+    uint64_t sub = static_cast<uint64_t>(bucket % Metrics::SUB_BUCKETS) | Metrics::SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+// Merged view of one operation across all threads
+struct OpSummary {
+    uint64_t count = 0;
+    uint64_t totalTicks = 0;
+    uint64_t maxTicks = 0;
+    vector<uint64_t> buckets = vector<uint64_t>(Metrics::BUCKET_COUNT, 0);
+
+    uint64_t percentileTicks(double fraction) const {
+        if (count == 0) {
+            return 0;
+        }
+        uint64_t target = static_cast<uint64_t>(fraction * count);
+        if (target == 0) {
+            target = 1;
+        }
+        uint64_t seen = 0;
+        for (int b = 0; b < Metrics::BUCKET_COUNT; b++) {
+            seen += buckets[b];
+            if (seen >= target) {
+                uint64_t limit = bucketLimit(b);
+                return limit < maxTicks ? limit : maxTicks;
+            }
+        }
+        return maxTicks;
+    }
+};
+
+void collect(OpSummary summaries[METRIC_OP_COUNT]) {
+    lock_guard<mutex> lock(registryMutex);
+    for (const auto& block : registry()) {
+        for (int op = 0; op < METRIC_OP_COUNT; op++) {
+            const OpStats& stats = block->ops[op];
+            OpSummary& summary = summaries[op];
+            summary.count += stats.count.load(memory_order_relaxed);
+            summary.totalTicks += stats.totalTicks.load(memory_order_relaxed);
+            uint64_t maxTicks = stats.maxTicks.load(memory_order_relaxed);
+            if (maxTicks > summary.maxTicks) {
+                summary.maxTicks = maxTicks;
+            }
+            for (int b = 0; b < Metrics::BUCKET_COUNT; b++) {
+                summary.buckets[b] += stats.buckets[b].load(memory_order_relaxed);
+            }
+        }
+    }
+}
+
+// Nanoseconds per tick, measured over the whole process lifetime
+double nsPerTick() {
+#if BANK_HAVE_TSC
+    uint64_t ticks = Metrics::now() - startTicks;
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - startTime).count();
+    return ticks > 0 ? ns / static_cast<double>(ticks) : 1.0;
+#else
+    return 1.0;
+#endif
+}
+
+} // namespace
+
+// Read the timestamp counter (or the steady clock where there is none)
+uint64_t Metrics::now() {
+#if BANK_HAVE_TSC
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// Record one completed operation
+void Metrics::record(MetricOp op, uint64_t startTicks) {
+    uint64_t end = now();
+    uint64_t elapsed = end > startTicks ? end - startTicks : 0;
+    OpStats& stats = threadBlock()->ops[op];
+    bump(stats.count, 1);
+    bump(stats.totalTicks, elapsed);
+    if (elapsed > stats.maxTicks.load(memory_order_relaxed)) {
+        stats.maxTicks.store(elapsed, memory_order_relaxed);
+    }
+    bump(stats.buckets[bucketFor(elapsed)], 1);
+}
+
+const char* Metrics::opName(MetricOp op) {
+    switch (op) {
+        case OP_FIND_ACCOUNT: return "find_account";
+        case OP_DEPOSIT: return "deposit";
+        case OP_WITHDRAW: return "withdraw";
+        case OP_SAVE_ACCOUNTS: return "save_accounts";
+        case OP_LOAD_ACCOUNTS: return "load_accounts";
+        case OP_SAVE_USERS: return "save_users";
+        case OP_LOGIN: return "login";
+        default: return "unknown";
+    }
+}
+
+// Display merged statistics (times in microseconds)
+void Metrics::display() {
+    OpSummary summaries[METRIC_OP_COUNT];
+    collect(summaries);
+    double scale = nsPerTick() / 1000.0;
+    
+    cout << "\n========================================" << endl;
+    cout << "        PERFORMANCE STATISTICS" << endl;
+    cout << "========================================" << endl;
+#if !BANK_METRICS
+    cout << "(Instrumentation is compiled out: build with BANK_METRICS=1)" << endl;
+#endif
+    cout << left << setw(15) << "Operation" << right << setw(9) << "Count"
+         << setw(10) << "Mean us" << setw(10) << "p50 us" << setw(10) << "p99 us"
+         << setw(11) << "Max us" << endl;
+    cout << "----------------------------------------" << endl;
+    for (int op = 0; op < METRIC_OP_COUNT; op++) {
+        const OpSummary& summary = summaries[op];
+        double mean = summary.count ? summary.totalTicks * scale / summary.count : 0.0;
+        cout << left << setw(15) << opName(static_cast<MetricOp>(op))
+             << right << setw(9) << summary.count
+             << fixed << setprecision(2)
+             << setw(10) << mean
+             << setw(10) << summary.percentileTicks(0.50) * scale
+             << setw(10) << summary.percentileTicks(0.99) * scale
+             << setw(11) << summary.maxTicks * scale << endl;
+    }
+    cout << "========================================\n" << endl;
+}
+
+// Write all metrics in Prometheus text exposition format
+bool Metrics::dumpPrometheus(const string& fileName) {
+    ofstream outFile(fileName);
+    if (!outFile) {
+        cerr << "Error: Could not open stats file for saving!" << endl;
+        return false;
+    }
+    
+    OpSummary summaries[METRIC_OP_COUNT];
+    collect(summaries);
+    double secondsPerTick = nsPerTick() / 1e9;
+    
+    outFile << "# HELP bank_operation_seconds Latency of banking operations." << endl;
+    outFile << "# TYPE bank_operation_seconds histogram" << endl;
+    outFile << setprecision(9);
+    for (int op = 0; op < METRIC_OP_COUNT; op++) {
+        const OpSummary& summary = summaries[op];
+        const char* name = opName(static_cast<MetricOp>(op));
+        uint64_t cumulative = 0;
+        for (int b = 0; b < BUCKET_COUNT; b++) {
+            if (summary.buckets[b] == 0) {
+                continue;
+            }
+            cumulative += summary.buckets[b];
+            outFile << "bank_operation_seconds_bucket{op=\"" << name << "\",le=\""
+                    << (bucketLimit(b) + 1) * secondsPerTick << "\"} " << cumulative << endl;
+        }
+        outFile << "bank_operation_seconds_bucket{op=\"" << name << "\",le=\"+Inf\"} " << summary.count << endl;
+        outFile << "bank_operation_seconds_sum{op=\"" << name << "\"} " << summary.totalTicks * secondsPerTick << endl;
+        outFile << "bank_operation_seconds_count{op=\"" << name << "\"} " << summary.count << endl;
+    }
+    
+    outFile << "# HELP bank_operation_max_seconds Slowest observed operation." << endl;
+    outFile << "# TYPE bank_operation_max_seconds gauge" << endl;
+    for (int op = 0; op < METRIC_OP_COUNT; op++) {
+        outFile << "bank_operation_max_seconds{op=\"" << opName(static_cast<MetricOp>(op)) << "\"} "
+                << summaries[op].maxTicks * secondsPerTick << endl;
+    }
+    outFile.close();
+    return true;
+}
@@ -0,0 +1,65 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+// Set BANK_METRICS to 0 (e.g. /DBANK_METRICS=0) to compile all
+// instrumentation out; the macros below then expand to nothing.
+#ifndef BANK_METRICS
+#define BANK_METRICS 1
+#endif
+
+// Instrumented operations
+enum MetricOp {
+    OP_FIND_ACCOUNT,
+    OP_DEPOSIT,
+    OP_WITHDRAW,
+    OP_SAVE_ACCOUNTS,
+    OP_LOAD_ACCOUNTS,
+    OP_SAVE_USERS,
+    OP_LOGIN,
+    METRIC_OP_COUNT
+};
+
+// Per-thread counters and log-linear latency histograms. Each thread
+// records into its own block with plain relaxed stores (no locks, no
+// shared cache lines); reports merge all blocks on demand.
+class Metrics {
+public:
+    // Histogram layout: 8 sub-buckets per power of two (about 12% resolution)
+    static const int SUB_BUCKET_BITS = 3;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int BUCKET_COUNT = 64 * SUB_BUCKETS;
+
+    static uint64_t now();                  // Raw timestamp in clock ticks
+    static void record(MetricOp op, uint64_t startTicks);
+
+    // Admin surface
+    static void display();
+    static bool dumpPrometheus(const string& fileName);
+    static const char* opName(MetricOp op);
+};
+
+// Times the enclosing scope
+class ScopedMetric {
+private:
+    MetricOp op;
+    uint64_t start;
+
+public:
+    explicit ScopedMetric(MetricOp operation) : op(operation), start(Metrics::now()) {}
+    ~ScopedMetric() { Metrics::record(op, start); }
+};
+
+#if BANK_METRICS
+#define BANK_METRIC_CONCAT2(a, b) a##b
+#define BANK_METRIC_CONCAT(a, b) BANK_METRIC_CONCAT2(a, b)
+#define BANK_TIMED(op) ScopedMetric BANK_METRIC_CONCAT(bankMetric_, __LINE__)(op)
+#else
+#define BANK_TIMED(op) ((void)0)
+#endif
+
+#endif
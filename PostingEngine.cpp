@@ -0,0 +1,258 @@
+#include "PostingEngine.h"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <cmath>
+#include <ctime>
+#include <cstdio>
+
+using namespace std;
+
+static const char* RATE_TYPE_NAMES[ACCOUNT_TYPE_COUNT] = { "CHECKING", "SAVINGS" };
+
+// Below this many accounts a single thread is faster than spawning workers
+static const size_t MIN_ACCOUNTS_PER_THREAD = 50000;
+
+// Constructor
+PostingEngine::PostingEngine(string rateFile, string batchFile)
+    : rateFileName(rateFile), batchFileName(batchFile) {
+    // Defaults used until a rate file is loaded
+    rates[CHECKING].annualRateBps = 10;
+    rates[CHECKING].monthlyFeeCents = 500;
+    rates[CHECKING].feeWaiverCents = 100000;
+    rates[SAVINGS].annualRateBps = 250;
+    rates[SAVINGS].monthlyFeeCents = 0;
+    rates[SAVINGS].feeWaiverCents = 0;
+}
+
+// Load the rate table, writing the defaults if the file doesn't exist
+bool PostingEngine::loadRates() {
+    ifstream inFile(rateFileName);
+    if (!inFile) {
+        return saveRates();
+    }
+    
+    string line;
+    while (getline(inFile, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        istringstream fields(line);
+        string typeName;
+        RateEntry entry;
+        if (!(fields >> typeName >> entry.annualRateBps >> entry.monthlyFeeCents >> entry.feeWaiverCents)) {
+            cerr << "Warning: Skipping malformed rate line: " << line << endl;
+            continue;
+        }
+        for (int t = 0; t < ACCOUNT_TYPE_COUNT; t++) {
+            if (typeName == RATE_TYPE_NAMES[t]) {
+                rates[t] = entry;
+            }
+        }
+    }
+    inFile.close();
+    return true;
+}
+
+// Save the rate table
+bool PostingEngine::saveRates() const {
+    ofstream outFile(rateFileName);
+    if (!outFile) {
+        cerr << "Error: Could not open rate file for saving!" << endl;
+        return false;
+    }
+    outFile << "# type annualRateBps monthlyFeeCents feeWaiverCents" << endl;
+    for (int t = 0; t < ACCOUNT_TYPE_COUNT; t++) {
+        outFile << RATE_TYPE_NAMES[t] << " " << rates[t].annualRateBps << " "
+                << rates[t].monthlyFeeCents << " " << rates[t].feeWaiverCents << endl;
+    }
+    outFile.close();
+    return true;
+}
+
+// Print one row of the rate table
+static void displayRateRow(const char* name, const RateEntry& entry) {
+    cout << left << setw(12) << name
+         << right << setw(10) << fixed << setprecision(2) << entry.annualRateBps / 100.0 << "%"
+         << setw(12) << entry.monthlyFeeCents / 100.0
+         << setw(14) << entry.feeWaiverCents / 100.0 << endl;
+}
+
+// Display the rate table
+void PostingEngine::displayRates() const {
+    cout << "\n========================================" << endl;
+    cout << "           RATE TABLE" << endl;
+    cout << "========================================" << endl;
+    cout << left << setw(12) << "Type" << right << setw(11) << "Interest"
+         << setw(13) << "Monthly Fee" << setw(15) << "Fee Waived At" << endl;
+    cout << "----------------------------------------" << endl;
+    for (int t = 0; t < ACCOUNT_TYPE_COUNT; t++) {
+        displayRateRow(RATE_TYPE_NAMES[t], rates[t]);
+    }
+    cout << "Fees and waivers are in each account's own currency." << endl;
+    cout << "Edit " << rateFileName << " to change rates." << endl;
+    cout << "========================================\n" << endl;
+}
+
+const RateEntry& PostingEngine::getRate(AccountType type) const {
+    return rates[type];
+}
+
+// Compute postings for accounts[begin, end)
+void PostingEngine::computeRange(const vector<BankAccount>& accounts, size_t begin, size_t end,
+                                 int days, int monthsCrossed, vector<Posting>& out) const {
+    for (size_t i = begin; i < end; i++) {
+        computeAccount(accounts[i], days, monthsCrossed, out);
+    }
+}
+
+// Compute one account's interest and fee, adding a posting if either is due
+void PostingEngine::computeAccount(const BankAccount& account, int days, int monthsCrossed,
+                                   vector<Posting>& out) const {
+    const int64_t denominator = 10000LL * 365;
+    if (account.isClosed()) {
+        return;  // Tombstones earn no interest and pay no fees
+    }
+    const RateEntry& rate = rates[account.getAccountType()];
+    int64_t balance = toCents(account.getBalance());
+    
+    // Simple daily accrual, rounded half-up to the cent
+    int64_t interest = 0;
+    if (balance > 0 && rate.annualRateBps > 0) {
+        interest = (balance * rate.annualRateBps * days + denominator / 2) / denominator;
+    }
+    
+    int64_t fee = 0;
+    if (monthsCrossed > 0 && rate.monthlyFeeCents > 0 &&
+        (rate.feeWaiverCents == 0 || balance < rate.feeWaiverCents)) {
+        fee = rate.monthlyFeeCents * monthsCrossed;
+        // Fees never take an account below zero
+        int64_t available = balance + interest;
+        if (fee > available) {
+            fee = available > 0 ? available : 0;
+        }
+    }
+    
+    if (interest != 0 || fee != 0) {
+        Posting posting;
+        posting.accountNumber = account.getAccountNumber();
+        posting.interestCents = interest;
+        posting.feeCents = fee;
+        posting.newBalanceCents = balance + interest - fee;
+        out.push_back(posting);
+    }
+}
+
+// Compute postings for the whole book in parallel chunks
+vector<Posting> PostingEngine::computePostings(const vector<BankAccount>& accounts, int days, int monthsCrossed) const {
+    size_t threadCount = thread::hardware_concurrency();
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+    size_t wanted = accounts.size() / MIN_ACCOUNTS_PER_THREAD;
+    if (wanted < threadCount) {
+        threadCount = wanted > 0 ? wanted : 1;
+    }
+    
+    vector<vector<Posting>> partial(threadCount);
+    size_t chunk = (accounts.size() + threadCount - 1) / threadCount;
+    vector<thread> workers;
+    for (size_t t = 1; t < threadCount; t++) {
+        size_t begin = t * chunk;
+        size_t end = begin + chunk < accounts.size() ? begin + chunk : accounts.size();
+        if (begin >= end) {
+            break;
+        }
+        workers.push_back(thread(&PostingEngine::computeRange, this, cref(accounts), begin, end,
+                                 days, monthsCrossed, ref(partial[t])));
+    }
+    computeRange(accounts, 0, chunk < accounts.size() ? chunk : accounts.size(), days, monthsCrossed, partial[0]);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    
+    // Merge in account order
+    size_t total = 0;
+    for (const auto& part : partial) {
+        total += part.size();
+    }
+    vector<Posting> postings;
+    postings.reserve(total);
+    for (const auto& part : partial) {
+        postings.insert(postings.end(), part.begin(), part.end());
+    }
+    return postings;
+}
+
+// Write the batch intent file before any account is touched
+bool PostingEngine::writeBatch(int32_t postingDay, const vector<Posting>& postings) const {
+    ofstream outFile(batchFileName, ios::binary | ios::trunc);
+    if (!outFile) {
+        cerr << "Error: Could not create posting batch file!" << endl;
+        return false;
+    }
+    uint64_t count = postings.size();
+    outFile.write(reinterpret_cast<const char*>(&postingDay), sizeof(postingDay));
+    outFile.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    if (count > 0) {
+        outFile.write(reinterpret_cast<const char*>(postings.data()),
+                      static_cast<streamsize>(count * sizeof(Posting)));
+    }
+    outFile.flush();
+    return outFile.good();
+}
+
+// Read a batch intent file left behind by an interrupted run
+bool PostingEngine::readBatch(int32_t& postingDay, vector<Posting>& postings) const {
+    ifstream inFile(batchFileName, ios::binary);
+    if (!inFile) {
+        return false;
+    }
+    uint64_t count = 0;
+    inFile.read(reinterpret_cast<char*>(&postingDay), sizeof(postingDay));
+    inFile.read(reinterpret_cast<char*>(&count), sizeof(count));
+    if (!inFile) {
+        return false;
+    }
+    postings.resize(static_cast<size_t>(count));
+    if (count > 0) {
+        inFile.read(reinterpret_cast<char*>(postings.data()),
+                    static_cast<streamsize>(count * sizeof(Posting)));
+    }
+    return inFile.good();
+}
+
+// Remove the batch intent file once the batch is durable
+void PostingEngine::clearBatch() const {
+    remove(batchFileName.c_str());
+}
+
+// Current day number (UTC)
+int32_t PostingEngine::today() {
+    return static_cast<int32_t>(time(0) / 86400);
+}
+
+// Number of calendar month starts in (fromDay, toDay]
+int PostingEngine::monthsBetween(int32_t fromDay, int32_t toDay) {
+    // Civil-from-days conversion (proleptic Gregorian calendar)
+    auto monthIndex = [](int32_t day) {
+        int64_t z = static_cast<int64_t>(day) + 719468;
+        int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+        int64_t doe = z - era * 146097;
+        int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        int64_t mp = (5 * doy + 2) / 153;
+        int64_t month = mp < 10 ? mp + 3 : mp - 9;
+        int64_t year = yoe + era * 400 + (month <= 2 ? 1 : 0);
+        return year * 12 + (month - 1);
+    };
+    int64_t months = monthIndex(toDay) - monthIndex(fromDay);
+    return months > 0 ? static_cast<int>(months) : 0;
+}
+
+// Convert a balance to integer cents
+int64_t PostingEngine::toCents(double amount) {
+    return llround(amount * 100.0);
+}
@@ -0,0 +1,65 @@
+#ifndef POSTINGENGINE_H
+#define POSTINGENGINE_H
+
+#include "BankAccount.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// Interest and fee schedule for one account type
+struct RateEntry {
+    int32_t annualRateBps = 0;      // Yearly interest in basis points (250 = 2.50%)
+    int64_t monthlyFeeCents = 0;    // Maintenance fee charged once per calendar month
+    int64_t feeWaiverCents = 0;     // Fee waived at or above this balance (0 = never waived)
+};
+
+// Result of one batch for one account (all amounts in cents)
+struct Posting {
+    int32_t accountNumber = 0;
+    int64_t interestCents = 0;
+    int64_t feeCents = 0;
+    int64_t newBalanceCents = 0;
+};
+
+// Computes interest accrual and maintenance fees for the whole book.
+// All arithmetic is done in integer cents so results are exact and
+// identical no matter how the work is split across threads.
+class PostingEngine {
+private:
+    string rateFileName;
+    string batchFileName;
+    RateEntry rates[ACCOUNT_TYPE_COUNT];
+
+    void computeRange(const vector<BankAccount>& accounts, size_t begin, size_t end,
+                      int days, int monthsCrossed, vector<Posting>& out) const;
+
+public:
+    // Constructor
+    PostingEngine(string rateFile, string batchFile);
+
+    // Rate table
+    bool loadRates();
+    bool saveRates() const;
+    void displayRates() const;
+    const RateEntry& getRate(AccountType type) const;
+
+    // Parallel computation (does not modify accounts); computeAccount()
+    // adds one account's posting, if it has one, for callers that visit
+    // accounts themselves
+    vector<Posting> computePostings(const vector<BankAccount>& accounts, int days, int monthsCrossed) const;
+    void computeAccount(const BankAccount& account, int days, int monthsCrossed, vector<Posting>& out) const;
+
+    // Batch intent file so a posting run commits all-or-nothing
+    bool writeBatch(int32_t postingDay, const vector<Posting>& postings) const;
+    bool readBatch(int32_t& postingDay, vector<Posting>& postings) const;
+    void clearBatch() const;
+
+    // Calendar helpers (day numbers are days since 1970-01-01 UTC)
+    static int32_t today();
+    static int monthsBetween(int32_t fromDay, int32_t toDay);
+    static int64_t toCents(double amount);
+};
+
+#endif
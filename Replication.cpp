@@ -0,0 +1,332 @@
+#include "Replication.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+static const char REPLICATION_MAGIC[8] = { 'B', 'A', 'N', 'K', 'R', 'E', 'P', '1' };
+
+// Constructor
+ReplicationLog::ReplicationLog(string name, string ackName)
+    : fileName(name), ackFileName(ackName), generation(0), fileSize(0), shippedCount(0), active(false),
+      stopping(false), heartbeatMs(1000), lastWriteMs(0) {}
+
+// Destructor: stop the heartbeat thread
+ReplicationLog::~ReplicationLog() {
+    stop();
+}
+
+// Milliseconds since the epoch; the primary and standby share a machine, so
+// their clocks agree
+int64_t ReplicationLog::nowMs() {
+    return chrono::duration_cast<chrono::milliseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Meta or heartbeat entry; its record carries no journal op
+static ReplicationEntry makeControlEntry(ReplicationKind kind, int32_t first, int32_t second, const string& text) {
+    ReplicationEntry entry;
+    entry.shippedAtMs = ReplicationLog::nowMs();
+    entry.shardIndex = 0;
+    entry.kind = kind;
+    entry.record = ShardJournal::makeRecord(static_cast<JournalOp>(0), first, second, 0.0, 0.0, text);
+    entry.record.checksum = ShardJournal::computeChecksum(entry.record);
+    return entry;
+}
+
+// Check an entry's journal record against its checksum
+bool ReplicationLog::isIntact(const ReplicationEntry& entry) {
+    return entry.record.checksum == ShardJournal::computeChecksum(entry.record);
+}
+
+// Append entries with a single flush (caller holds logMutex)
+bool ReplicationLog::writeEntries(const ReplicationEntry* entries, size_t count) {
+    if (!out.is_open()) {
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(entries), static_cast<streamsize>(count * sizeof(ReplicationEntry)));
+    out.flush();
+    if (!out) {
+        return false;
+    }
+    fileSize += count * sizeof(ReplicationEntry);
+    shippedCount += count;
+    lastWriteMs = nowMs();
+    return true;
+}
+
+// Write a new log: header, the snapshot records of every shard, then the
+// ledger-wide values. It is written aside and renamed into place, so a
+// standby never reads a half-written start.
+bool ReplicationLog::begin(const vector<vector<JournalRecord>>& snapshot, int32_t nextAccountNumber,
+                           int32_t lastPostingDay) {
+    lock_guard<mutex> lock(logMutex);
+    string tempName = fileName + ".tmp";
+    ofstream newFile(tempName, ios::binary | ios::trunc);
+    ReplicationHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, REPLICATION_MAGIC, sizeof(header.magic));
+    header.generation = max(nowMs(), generation + 1);
+    header.shardCount = static_cast<int32_t>(snapshot.size());
+    newFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    int64_t shippedAt = nowMs();
+    vector<ReplicationEntry> entries;
+    for (size_t shard = 0; shard < snapshot.size(); shard++) {
+        entries.clear();
+        entries.reserve(snapshot[shard].size());
+        for (const auto& record : snapshot[shard]) {
+            ReplicationEntry entry;
+            entry.shippedAtMs = shippedAt;
+            entry.shardIndex = static_cast<int32_t>(shard);
+            entry.kind = REPLICATE_RECORD;
+            entry.record = record;
+            entry.record.checksum = ShardJournal::computeChecksum(entry.record);
+            entries.push_back(entry);
+        }
+        newFile.write(reinterpret_cast<const char*>(entries.data()),
+                      static_cast<streamsize>(entries.size() * sizeof(ReplicationEntry)));
+    }
+    ReplicationEntry meta = makeControlEntry(REPLICATE_META, nextAccountNumber, lastPostingDay, "Meta");
+    newFile.write(reinterpret_cast<const char*>(&meta), sizeof(meta));
+    newFile.close();
+    if (!newFile) {
+        remove(tempName.c_str());
+        return false;
+    }
+
+    // If the new log cannot be put in place, shipping stops until the next begin()
+    if (out.is_open()) {
+        out.close();
+    }
+    remove(fileName.c_str());
+    if (rename(tempName.c_str(), fileName.c_str()) != 0) {
+        active = false;
+        return false;
+    }
+    out.open(fileName, ios::binary | ios::app);
+    if (!out) {
+        active = false;
+        return false;
+    }
+    generation = header.generation;
+    fileSize = sizeof(header);
+    for (const auto& records : snapshot) {
+        fileSize += records.size() * sizeof(ReplicationEntry);
+    }
+    fileSize += sizeof(meta);
+    lastWriteMs = shippedAt;
+    active = true;
+    return true;
+}
+
+// Copy records just appended to a shard journal (caller holds the shard lock)
+void ReplicationLog::ship(int shardIndex, const JournalRecord* records, size_t count) {
+    if (!active || count == 0) {
+        return;
+    }
+    int64_t shippedAt = nowMs();
+    vector<ReplicationEntry> entries(count);
+    for (size_t i = 0; i < count; i++) {
+        entries[i].shippedAtMs = shippedAt;
+        entries[i].shardIndex = shardIndex;
+        entries[i].kind = REPLICATE_RECORD;
+        entries[i].record = records[i];
+    }
+    lock_guard<mutex> lock(logMutex);
+    writeEntries(entries.data(), entries.size());
+}
+
+// Ship the ledger-wide values after they moved
+void ReplicationLog::shipMeta(int32_t nextAccountNumber, int32_t lastPostingDay) {
+    if (!active) {
+        return;
+    }
+    ReplicationEntry entry = makeControlEntry(REPLICATE_META, nextAccountNumber, lastPostingDay, "Meta");
+    lock_guard<mutex> lock(logMutex);
+    writeEntries(&entry, 1);
+}
+
+// Start writing a heartbeat whenever nothing was shipped for an interval
+void ReplicationLog::startHeartbeat(int intervalMs) {
+    if (heartbeat.joinable()) {
+        return;
+    }
+    heartbeatMs = intervalMs > 0 ? intervalMs : 1;
+    stopping = false;
+    heartbeat = thread(&ReplicationLog::heartbeatLoop, this);
+}
+
+// Heartbeat thread
+void ReplicationLog::heartbeatLoop() {
+    unique_lock<mutex> lock(logMutex);
+    while (!stopping) {
+        heartbeatWake.wait_for(lock, chrono::milliseconds(heartbeatMs), [this]() { return stopping; });
+        if (stopping) {
+            break;
+        }
+        if (active && nowMs() - lastWriteMs >= heartbeatMs) {
+            ReplicationEntry entry = makeControlEntry(REPLICATE_HEARTBEAT, 0, 0, "Heartbeat");
+            writeEntries(&entry, 1);
+        }
+    }
+}
+
+// Stop the heartbeat and close the log
+void ReplicationLog::stop() {
+    {
+        lock_guard<mutex> lock(logMutex);
+        stopping = true;
+    }
+    heartbeatWake.notify_all();
+    if (heartbeat.joinable()) {
+        heartbeat.join();
+    }
+    lock_guard<mutex> lock(logMutex);
+    active = false;
+    if (out.is_open()) {
+        out.close();
+    }
+}
+
+// Whether records are being shipped
+bool ReplicationLog::isActive() const {
+    return active;
+}
+
+// Entries written since this process started
+uint64_t ReplicationLog::getShippedCount() const {
+    return shippedCount;
+}
+
+// Current length of the log in bytes
+uint64_t ReplicationLog::getSize() {
+    lock_guard<mutex> lock(logMutex);
+    return fileSize;
+}
+
+// Generation of the current log
+int64_t ReplicationLog::getGeneration() {
+    lock_guard<mutex> lock(logMutex);
+    return generation;
+}
+
+// Read the standby's last acknowledgement (one "key=value" per line)
+bool ReplicationLog::readAck(ReplicationAck& ack) const {
+    ifstream inFile(ackFileName);
+    if (!inFile) {
+        return false;
+    }
+    string line;
+    while (getline(inFile, line)) {
+        size_t equals = line.find('=');
+        if (equals == string::npos) {
+            continue;
+        }
+        string key = line.substr(0, equals);
+        long long value = atoll(line.c_str() + equals + 1);
+        if (key == "generation") {
+            ack.generation = value;
+        } else if (key == "offset") {
+            ack.offset = static_cast<uint64_t>(value);
+        } else if (key == "entries_applied") {
+            ack.entriesApplied = static_cast<uint64_t>(value);
+        } else if (key == "last_lag_ms") {
+            ack.lastLagMs = value;
+        } else if (key == "max_lag_ms") {
+            ack.maxLagMs = value;
+        } else if (key == "acked_at_ms") {
+            ack.ackedAtMs = value;
+        }
+    }
+    return ack.ackedAtMs != 0;
+}
+
+// Constructor
+ReplicationTail::ReplicationTail(string name, string ackName)
+    : fileName(name), ackFileName(ackName), generation(0), shardCount(0), offset(0), lastFileSize(0) {}
+
+// Read whole entries appended since the last poll. The file is opened
+// afresh each time, so a log replaced by a new generation is noticed.
+bool ReplicationTail::poll(vector<ReplicationEntry>& entries, bool& restarted, size_t maxEntries) {
+    entries.clear();
+    restarted = false;
+    ifstream inFile(fileName, ios::binary);
+    if (!inFile) {
+        return false;
+    }
+    ReplicationHeader header;
+    if (!inFile.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        memcmp(header.magic, REPLICATION_MAGIC, sizeof(header.magic)) != 0 || header.shardCount < 1) {
+        return false;
+    }
+    if (header.generation != generation) {
+        generation = header.generation;
+        shardCount = header.shardCount;
+        offset = sizeof(header);
+        restarted = true;
+    }
+
+    inFile.seekg(0, ios::end);
+    lastFileSize = static_cast<uint64_t>(inFile.tellg());
+    if (lastFileSize <= offset) {
+        return true;
+    }
+    size_t available = static_cast<size_t>((lastFileSize - offset) / sizeof(ReplicationEntry));
+    size_t wanted = available < maxEntries ? available : maxEntries;
+    entries.resize(wanted);
+    inFile.seekg(static_cast<streamoff>(offset));
+    inFile.read(reinterpret_cast<char*>(entries.data()), static_cast<streamsize>(wanted * sizeof(ReplicationEntry)));
+    size_t good = static_cast<size_t>(inFile.gcount()) / sizeof(ReplicationEntry);
+    for (size_t i = 0; i < good; i++) {
+        if (!ReplicationLog::isIntact(entries[i])) {
+            good = i;  // Still being written; read it again next time
+            break;
+        }
+        entries[i].record.text[sizeof(entries[i].record.text) - 1] = '\0';
+    }
+    entries.resize(good);
+    offset += good * sizeof(ReplicationEntry);
+    return true;
+}
+
+// Report progress to the primary, replacing the file in one step
+bool ReplicationTail::writeAck(const ReplicationAck& ack) const {
+    string tempName = ackFileName + ".tmp";
+    ofstream outFile(tempName, ios::trunc);
+    outFile << "generation=" << ack.generation << "\n"
+            << "offset=" << ack.offset << "\n"
+            << "entries_applied=" << ack.entriesApplied << "\n"
+            << "last_lag_ms=" << ack.lastLagMs << "\n"
+            << "max_lag_ms=" << ack.maxLagMs << "\n"
+            << "acked_at_ms=" << ack.ackedAtMs << "\n";
+    outFile.close();
+    if (!outFile) {
+        return false;
+    }
+    remove(ackFileName.c_str());
+    return rename(tempName.c_str(), ackFileName.c_str()) == 0;
+}
+
+// Generation being followed (0 before the first poll)
+int64_t ReplicationTail::getGeneration() const {
+    return generation;
+}
+
+// Shards in the primary's ledger
+int32_t ReplicationTail::getShardCount() const {
+    return shardCount;
+}
+
+// Bytes of the log consumed
+uint64_t ReplicationTail::getOffset() const {
+    return offset;
+}
+
+// Bytes in the log not yet consumed, as of the last poll
+uint64_t ReplicationTail::getBytesBehind() const {
+    return lastFileSize > offset ? lastFileSize - offset : 0;
+}
@@ -0,0 +1,126 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include "Journal.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+// Kinds of entry in the replication log
+enum ReplicationKind {
+    REPLICATE_RECORD = 1,       // A shard journal record (or a snapshot record standing for one)
+    REPLICATE_META = 2,         // Ledger-wide values (accountNumber = next number, accountType = posting day)
+    REPLICATE_HEARTBEAT = 3     // Nothing changed; shows the primary is alive
+};
+
+// Start of the replication log. A new generation starts whenever the
+// primary starts or rewrites the log; a standby that sees the generation
+// change rebuilds its ledger from the new log.
+struct ReplicationHeader {
+    char magic[8];              // "BANKREP1"
+    int64_t generation;         // Primary's clock in ms when the log was started
+    int32_t shardCount;
+    int32_t reserved;
+};
+
+// One fixed-size log entry: a journal record stamped with when it was shipped
+struct ReplicationEntry {
+    int64_t shippedAtMs;
+    int32_t shardIndex;
+    int32_t kind;               // ReplicationKind value
+    JournalRecord record;       // Checksummed, so a torn entry is never applied
+};
+
+// What a standby reports back through the acknowledgement file
+struct ReplicationAck {
+    int64_t generation = 0;
+    uint64_t offset = 0;        // Bytes of the log applied
+    uint64_t entriesApplied = 0;
+    int64_t lastLagMs = 0;      // Apply time minus ship time of the newest entry
+    int64_t maxLagMs = 0;
+    int64_t ackedAtMs = 0;
+};
+
+// Primary side. The log starts with the ledger as replayable records,
+// then every shard journal append is copied to it as it is written
+// (from inside the shard lock, so each shard's order is kept). A
+// heartbeat thread writes an entry when the ledger is idle, so a standby
+// can tell a quiet primary from a dead one.
+class ReplicationLog {
+private:
+    string fileName;
+    string ackFileName;
+    ofstream out;
+    mutex logMutex;
+    int64_t generation;
+    uint64_t fileSize;
+    atomic<uint64_t> shippedCount;
+    atomic<bool> active;
+
+    thread heartbeat;
+    condition_variable heartbeatWake;
+    bool stopping;
+    int heartbeatMs;
+    int64_t lastWriteMs;
+
+    bool writeEntries(const ReplicationEntry* entries, size_t count);  // Caller holds logMutex
+    void heartbeatLoop();
+
+public:
+    // Constructor
+    ReplicationLog(string name, string ackName);
+    ~ReplicationLog();
+
+    // Start a new generation holding the snapshot (one list per shard;
+    // the caller keeps the shards still while this runs)
+    bool begin(const vector<vector<JournalRecord>>& snapshot, int32_t nextAccountNumber, int32_t lastPostingDay);
+    void ship(int shardIndex, const JournalRecord* records, size_t count);
+    void shipMeta(int32_t nextAccountNumber, int32_t lastPostingDay);
+    void startHeartbeat(int intervalMs);
+    void stop();
+
+    bool isActive() const;
+    uint64_t getShippedCount() const;
+    uint64_t getSize();
+    int64_t getGeneration();
+    bool readAck(ReplicationAck& ack) const;   // False if no standby has reported yet
+
+    static int64_t nowMs();
+    static bool isIntact(const ReplicationEntry& entry);
+};
+
+// Standby side. Reads the entries appended to a primary's log since the
+// last poll; only whole, intact entries are returned, so an entry still
+// being written is picked up on a later poll.
+class ReplicationTail {
+private:
+    string fileName;
+    string ackFileName;
+    int64_t generation;
+    int32_t shardCount;
+    uint64_t offset;
+    uint64_t lastFileSize;
+
+public:
+    // Constructor
+    ReplicationTail(string name, string ackName);
+
+    // Returns false if the log cannot be read yet. restarted is set when
+    // a new generation began; the entries then start from its snapshot.
+    bool poll(vector<ReplicationEntry>& entries, bool& restarted, size_t maxEntries = 4096);
+    bool writeAck(const ReplicationAck& ack) const;
+
+    int64_t getGeneration() const;
+    int32_t getShardCount() const;
+    uint64_t getOffset() const;
+    uint64_t getBytesBehind() const;      // As of the last poll
+};
+
+#endif
@@ -0,0 +1,309 @@
+#include "RiskStage.h"
+#include <iostream>
+#include <sstream>
+#include <cmath>
+
+using namespace std;
+
+RiskStage::~RiskStage() {}
+
+// Build the stage named by risk_stage
+unique_ptr<RiskStage> RiskStage::create(const string& kind, const RiskConfig& config) {
+    if (kind == "none") {
+        return unique_ptr<RiskStage>(new NoRiskStage());
+    }
+    if (kind != "rolling") {
+        cerr << "Warning: Unknown risk_stage '" << kind << "'; using rolling" << endl;
+    }
+    return unique_ptr<RiskStage>(new RollingRiskStage(config));
+}
+
+// Reasons as words
+string RiskStage::describe(uint32_t reasons) {
+    string text;
+    if (reasons & RISK_VELOCITY) {
+        text += "velocity";
+    }
+    if (reasons & RISK_OUTLIER) {
+        text += text.empty() ? "outlier" : ", outlier";
+    }
+    if (reasons & RISK_DORMANT) {
+        text += text.empty() ? "dormant" : ", dormant";
+    }
+    return text.empty() ? "none" : text;
+}
+
+const char* NoRiskStage::name() const {
+    return "none";
+}
+
+uint32_t NoRiskStage::score(int, double, int64_t) const {
+    return 0;
+}
+
+void NoRiskStage::observe(int, double, int64_t) {}
+
+// Constructor: the table is allocated once, rounded up to a power of two
+RollingRiskStage::RollingRiskStage(const RiskConfig& settings) : config(settings) {
+    if (config.windowSeconds < 1) {
+        config.windowSeconds = 1;
+    }
+    size_t setCount = 8;
+    while (setCount * 2 < config.accountsPerShard) {
+        setCount *= 2;
+    }
+    sets.assign(setCount * 2, AccountState());
+    setMask = setCount - 1;
+}
+
+const char* RollingRiskStage::name() const {
+    return "rolling";
+}
+
+// First of the two entries an account can occupy
+size_t RollingRiskStage::setOf(int accountNumber) const {
+    uint32_t mixed = static_cast<uint32_t>(accountNumber) * 0x9E3779B1u;
+    return ((mixed >> 16) & setMask) * 2;
+}
+
+// The account's state, or nullptr if it has none in the table
+const RollingRiskStage::AccountState* RollingRiskStage::find(int accountNumber) const {
+    const AccountState* entry = &sets[setOf(accountNumber)];
+    if (entry[0].accountNumber == accountNumber) {
+        return &entry[0];
+    }
+    if (entry[1].accountNumber == accountNumber) {
+        return &entry[1];
+    }
+    return nullptr;
+}
+
+// Amounts in the sliding window ending now: this bucket's count plus the
+// part of the previous bucket's that the window still covers
+double RollingRiskStage::windowCount(const AccountState& state, int64_t now) const {
+    int64_t bucket = now / config.windowSeconds;
+    int64_t lastBucket = static_cast<int64_t>(state.lastSeen) / config.windowSeconds;
+    double current = 0.0;
+    double previous = 0.0;
+    if (bucket == lastBucket) {
+        current = state.bucketCount;
+        previous = state.previousCount;
+    } else if (bucket == lastBucket + 1) {
+        previous = state.bucketCount;
+    }
+    double uncovered = static_cast<double>(now % config.windowSeconds) / config.windowSeconds;
+    return current + previous * (1.0 - uncovered);
+}
+
+// Score an amount against the account's statistics
+uint32_t RollingRiskStage::score(int accountNumber, double amount, int64_t now) const {
+    const AccountState* state = find(accountNumber);
+    if (!state) {
+        return 0;
+    }
+    uint32_t reasons = 0;
+    if (windowCount(*state, now) + 1.0 > config.maxPerWindow) {
+        reasons |= RISK_VELOCITY;
+    }
+    if (amount >= config.minAmount) {
+        // The deviation is taken as at least a quarter of the mean, so an
+        // account whose amounts never vary is not flagged for a small change
+        double deviation = max(static_cast<double>(state->meanDeviation), state->meanAmount * 0.25);
+        if (state->samples >= config.minSamples && amount > state->meanAmount + config.outlierFactor * deviation) {
+            reasons |= RISK_OUTLIER;
+        }
+        if (now - static_cast<int64_t>(state->lastSeen) >= config.dormantSeconds) {
+            reasons |= RISK_DORMANT;
+        }
+    }
+    return reasons;
+}
+
+// Add an applied amount to the account's statistics, taking the older of
+// the set's two entries if the account has none
+void RollingRiskStage::observe(int accountNumber, double amount, int64_t now) {
+    AccountState* entry = &sets[setOf(accountNumber)];
+    AccountState* state = entry[0].accountNumber == accountNumber ? &entry[0] :
+                          entry[1].accountNumber == accountNumber ? &entry[1] :
+                          entry[0].lastSeen <= entry[1].lastSeen ? &entry[0] : &entry[1];
+    float value = static_cast<float>(fabs(amount));
+    if (state->accountNumber != accountNumber) {
+        *state = AccountState();
+        state->accountNumber = accountNumber;
+        state->meanAmount = value;
+    } else {
+        int64_t bucket = now / config.windowSeconds;
+        int64_t lastBucket = static_cast<int64_t>(state->lastSeen) / config.windowSeconds;
+        if (bucket != lastBucket) {
+            state->previousCount = bucket == lastBucket + 1 ? state->bucketCount : 0;
+            state->bucketCount = 0;
+        }
+        state->meanDeviation += (fabs(value - state->meanAmount) - state->meanDeviation) / 8.0f;
+        state->meanAmount += (value - state->meanAmount) / 8.0f;
+    }
+    if (state->bucketCount < UINT16_MAX) {
+        state->bucketCount++;
+    }
+    if (state->samples < UINT16_MAX) {
+        state->samples++;
+    }
+    state->lastSeen = static_cast<uint32_t>(now);
+}
+
+// Constructor
+ReviewQueue::ReviewQueue(string name)
+    : fileName(name), lastId(0), maxOpen(10000), flaggedCount(0), heldCount(0), droppedCount(0) {}
+
+// Set how many items may be open at once (held items are always queued)
+void ReviewQueue::configure(size_t maxOpenItems) {
+    lock_guard<mutex> lock(queueMutex);
+    maxOpen = maxOpenItems;
+}
+
+// Append one line and push it to disk (caller holds queueMutex)
+bool ReviewQueue::writeLine(const string& line) {
+    if (!out.is_open()) {
+        out.open(fileName, ios::app);
+        if (!out) {
+            return false;
+        }
+    }
+    out << line << "\n";
+    out.flush();
+    return out.good();
+}
+
+// Read the open items and rewrite the log with only them
+bool ReviewQueue::load() {
+    lock_guard<mutex> lock(queueMutex);
+    open.clear();
+    ifstream inFile(fileName);
+    string line;
+    while (inFile && getline(inFile, line)) {
+        istringstream fields(line);
+        string kind;
+        int32_t id = 0;
+        if (!(fields >> kind >> id) || id <= 0) {
+            continue;  // Torn last line
+        }
+        lastId = max(lastId, id);
+        if (kind == "ADD") {
+            ReviewItem item;
+            int operation = 0;
+            int held = 0;
+            item.id = id;
+            if (fields >> item.createdAt >> operation >> item.accountNumber >> item.toAccount >> item.amount
+                       >> item.reasons >> held >> item.user) {
+                item.operation = static_cast<CommandId>(operation);
+                item.held = held != 0;
+                open[id] = item;
+            }
+        } else if (kind == "RESOLVE") {
+            open.erase(id);
+        }
+    }
+    inFile.close();
+
+    if (out.is_open()) {
+        out.close();
+    }
+    ofstream rewritten(fileName, ios::trunc);
+    if (!rewritten) {
+        cerr << "Error: Could not rewrite " << fileName << "!" << endl;
+        return false;
+    }
+    rewritten.precision(17);
+    for (const auto& entry : open) {
+        const ReviewItem& item = entry.second;
+        rewritten << "ADD " << item.id << " " << item.createdAt << " " << item.operation << " " << item.accountNumber
+                  << " " << item.toAccount << " " << item.amount << " " << item.reasons << " " << item.held << " "
+                  << item.user << "\n";
+    }
+    return rewritten.good();
+}
+
+// Queue an item and log it
+int32_t ReviewQueue::add(ReviewItem item) {
+    lock_guard<mutex> lock(queueMutex);
+    if (item.held) {
+        heldCount++;
+    } else {
+        flaggedCount++;
+        if (open.size() >= maxOpen) {
+            droppedCount++;
+            return 0;
+        }
+    }
+    item.id = ++lastId;
+    if (item.user.empty()) {
+        item.user = "-";
+    }
+    ostringstream line;
+    line.precision(17);
+    line << "ADD " << item.id << " " << item.createdAt << " " << item.operation << " " << item.accountNumber << " "
+         << item.toAccount << " " << item.amount << " " << item.reasons << " " << item.held << " " << item.user;
+    if (!writeLine(line.str())) {
+        cerr << "Error: Could not write " << fileName << "!" << endl;
+        return 0;
+    }
+    open[item.id] = item;
+    return item.id;
+}
+
+// Remove an open item for a reviewer to act on
+bool ReviewQueue::take(int32_t id, ReviewItem& item) {
+    lock_guard<mutex> lock(queueMutex);
+    auto it = open.find(id);
+    if (it == open.end()) {
+        return false;
+    }
+    item = it->second;
+    open.erase(it);
+    return true;
+}
+
+// Log the reviewer's decision on a taken item
+bool ReviewQueue::close(const ReviewItem& item, bool approved) {
+    lock_guard<mutex> lock(queueMutex);
+    if (!writeLine("RESOLVE " + to_string(item.id) + " " + (approved ? "1" : "0"))) {
+        cerr << "Error: Could not write " << fileName << "!" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Return a taken item to the queue, unchanged
+void ReviewQueue::putBack(const ReviewItem& item) {
+    lock_guard<mutex> lock(queueMutex);
+    open[item.id] = item;
+}
+
+// The oldest open items
+vector<ReviewItem> ReviewQueue::list(size_t max) const {
+    lock_guard<mutex> lock(queueMutex);
+    vector<ReviewItem> items;
+    for (auto it = open.begin(); it != open.end() && items.size() < max; ++it) {
+        items.push_back(it->second);
+    }
+    return items;
+}
+
+size_t ReviewQueue::size() const {
+    lock_guard<mutex> lock(queueMutex);
+    return open.size();
+}
+
+uint64_t ReviewQueue::getFlaggedCount() const {
+    lock_guard<mutex> lock(queueMutex);
+    return flaggedCount;
+}
+
+uint64_t ReviewQueue::getHeldCount() const {
+    lock_guard<mutex> lock(queueMutex);
+    return heldCount;
+}
+
+uint64_t ReviewQueue::getDroppedCount() const {
+    lock_guard<mutex> lock(queueMutex);
+    return droppedCount;
+}
@@ -0,0 +1,152 @@
+#ifndef RISKSTAGE_H
+#define RISKSTAGE_H
+
+#include "Command.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+
+using namespace std;
+
+// Why a transaction was screened out (bits, so one can have several)
+enum RiskReason : uint32_t {
+    RISK_VELOCITY = 1u << 0,    // Too many operations in the sliding window
+    RISK_OUTLIER  = 1u << 1,    // Amount far above the account's usual amounts
+    RISK_DORMANT  = 1u << 2     // Large amount after a long quiet spell
+};
+
+// What happens to a screened-out transaction
+enum RiskAction {
+    RISK_FLAG,                  // Applied, and queued for review
+    RISK_HOLD                   // Not applied until a reviewer approves it
+};
+
+// Thresholds shared by every shard's stage (from settings.txt)
+struct RiskConfig {
+    int windowSeconds = 60;
+    int maxPerWindow = 30;
+    int outlierFactor = 8;      // Deviations above the mean that make an outlier
+    int minSamples = 8;         // Amounts seen before outliers are scored
+    double minAmount = 1000.0;  // Smaller amounts are never outliers or dormant
+    int64_t dormantSeconds = 180 * 86400;
+    size_t accountsPerShard = 16384;
+};
+
+// Screening stage in front of deposits, withdrawals and transfers. score()
+// looks at an amount without changing anything; observe() adds an applied
+// amount to the account's statistics. Each shard owns one and calls it
+// under the shard lock, so a stage needs no locking of its own.
+class RiskStage {
+public:
+    virtual ~RiskStage();
+
+    // Stage named by the risk_stage setting ("rolling" or "none")
+    static unique_ptr<RiskStage> create(const string& kind, const RiskConfig& config);
+    static string describe(uint32_t reasons);     // "velocity, outlier"
+
+    virtual const char* name() const = 0;
+    virtual uint32_t score(int accountNumber, double amount, int64_t now) const = 0;   // RiskReason bits
+    virtual void observe(int accountNumber, double amount, int64_t now) = 0;
+};
+
+// Stage that passes everything
+class NoRiskStage : public RiskStage {
+public:
+    const char* name() const override;
+    uint32_t score(int accountNumber, double amount, int64_t now) const override;
+    void observe(int accountNumber, double amount, int64_t now) override;
+};
+
+// Rolling per-account statistics in a fixed table. Each account's state is
+// 32 bytes and two accounts share a set, so scoring reads one cache line:
+// a set holds whichever two of its accounts were active most recently, and
+// an account pushed out starts again from nothing. Amounts are tracked as
+// an exponentially weighted mean and mean deviation (weight 1/8); the
+// window count is two fixed buckets, the previous one weighted by how much
+// of it still lies inside the sliding window.
+class RollingRiskStage : public RiskStage {
+private:
+    struct alignas(32) AccountState {
+        int32_t accountNumber;      // 0 = empty
+        uint32_t lastSeen;          // Unix seconds of the last applied amount
+        float meanAmount;
+        float meanDeviation;
+        uint16_t bucketCount;       // Amounts in lastSeen's window bucket
+        uint16_t previousCount;     // Amounts in the bucket before it
+        uint16_t samples;           // Amounts seen (stops at 65535)
+        uint16_t reserved;
+    };
+
+    RiskConfig config;
+    vector<AccountState> sets;      // Two entries per set
+    size_t setMask;
+
+    size_t setOf(int accountNumber) const;
+    const AccountState* find(int accountNumber) const;
+    double windowCount(const AccountState& state, int64_t now) const;   // Before this operation
+
+public:
+    // Constructor
+    RollingRiskStage(const RiskConfig& settings);
+
+    const char* name() const override;
+    uint32_t score(int accountNumber, double amount, int64_t now) const override;
+    void observe(int accountNumber, double amount, int64_t now) override;
+};
+
+// One screened-out transaction awaiting a reviewer
+struct ReviewItem {
+    int32_t id = 0;
+    int64_t createdAt = 0;
+    CommandId operation = CMD_DEPOSIT;      // Deposit, withdraw or transfer
+    int32_t accountNumber = 0;
+    int32_t toAccount = 0;                  // Transfers only
+    double amount = 0.0;
+    uint32_t reasons = 0;
+    bool held = false;                      // Not applied yet
+    string user;                            // Who asked for it
+};
+
+// Review queue shown in the admin menu. Items are appended to
+// review_queue.log as they arrive and a line is added when one is
+// resolved; the log is rewritten with only the open items at startup.
+// Flagged items past maxOpen are counted but not queued; held items are
+// always queued, since they are not applied otherwise.
+class ReviewQueue {
+private:
+    string fileName;
+    ofstream out;
+    map<int32_t, ReviewItem> open;          // Id -> item, oldest first
+    int32_t lastId;
+    size_t maxOpen;
+    uint64_t flaggedCount;                  // Since startup
+    uint64_t heldCount;
+    uint64_t droppedCount;
+    mutable mutex queueMutex;
+
+    bool writeLine(const string& line);
+
+public:
+    // Constructor
+    ReviewQueue(string name);
+
+    void configure(size_t maxOpenItems);
+    bool load();
+    int32_t add(ReviewItem item);           // Returns the id, 0 if dropped or not written
+    // A reviewer takes an item out of the queue, so no one else can act on
+    // it, then either closes it or (if approving it failed) puts it back
+    bool take(int32_t id, ReviewItem& item);
+    bool close(const ReviewItem& item, bool approved);
+    void putBack(const ReviewItem& item);
+    vector<ReviewItem> list(size_t max) const;   // Oldest first
+    size_t size() const;
+    uint64_t getFlaggedCount() const;
+    uint64_t getHeldCount() const;
+    uint64_t getDroppedCount() const;
+};
+
+#endif
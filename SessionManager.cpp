@@ -0,0 +1,149 @@
+#include "SessionManager.h"
+#include <random>
+#include <sstream>
+#include <iomanip>
+
+using namespace std;
+
+// Constructor
+SessionManager::SessionManager()
+    : idleTimeout(900), sweepInterval(60), activeCount(0), stopping(false) {}
+
+// Destructor
+SessionManager::~SessionManager() {
+    stop();
+}
+
+// Apply settings
+void SessionManager::configure(int idleSeconds, int sweepSeconds) {
+    idleTimeout = chrono::seconds(idleSeconds > 0 ? idleSeconds : 1);
+    sweepInterval = chrono::seconds(sweepSeconds > 0 ? sweepSeconds : 1);
+}
+
+// Start the background sweeper
+void SessionManager::start() {
+    if (sweeper.joinable()) {
+        return;
+    }
+    stopping = false;
+    sweeper = thread(&SessionManager::sweepLoop, this);
+}
+
+// Stop the background sweeper
+void SessionManager::stop() {
+    {
+        lock_guard<mutex> lock(sweeperMutex);
+        stopping = true;
+    }
+    sweeperWake.notify_all();
+    if (sweeper.joinable()) {
+        sweeper.join();
+    }
+}
+
+// Stripe that holds a token (tokens are random, so any bits will do)
+SessionManager::Stripe& SessionManager::stripeFor(const string& token) {
+    return stripes[hash<string>()(token) % STRIPE_COUNT];
+}
+
+// 128 random bits as 32 hex characters
+string SessionManager::newToken() {
+    static mutex deviceMutex;
+    static random_device device;
+    ostringstream token;
+    lock_guard<mutex> lock(deviceMutex);
+    for (int i = 0; i < 4; i++) {
+        token << hex << setw(8) << setfill('0') << static_cast<uint32_t>(device());
+    }
+    return token.str();
+}
+
+// Wake up every sweep interval and drop expired sessions
+void SessionManager::sweepLoop() {
+    unique_lock<mutex> lock(sweeperMutex);
+    while (!stopping) {
+        sweeperWake.wait_for(lock, sweepInterval, [this]() { return stopping; });
+        if (stopping) {
+            break;
+        }
+        lock.unlock();
+        sweep();
+        lock.lock();
+    }
+}
+
+// Start a session for a user who just authenticated
+string SessionManager::create(const User& user) {
+    Session session;
+    session.username = user.getUsername();
+    session.role = user.getRole();
+    session.createdAt = time(0);
+    session.expiresAt = chrono::steady_clock::now() + idleTimeout;
+
+    while (true) {
+        string token = newToken();
+        Stripe& stripe = stripeFor(token);
+        lock_guard<mutex> lock(stripe.stripeMutex);
+        if (stripe.sessions.emplace(token, session).second) {
+            activeCount++;
+            return token;
+        }
+    }
+}
+
+// Look up a token; an expired session is removed and rejected
+bool SessionManager::validate(const string& token, Session& session) {
+    Stripe& stripe = stripeFor(token);
+    lock_guard<mutex> lock(stripe.stripeMutex);
+    auto it = stripe.sessions.find(token);
+    if (it == stripe.sessions.end()) {
+        return false;
+    }
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    if (it->second.expiresAt <= now) {
+        stripe.sessions.erase(it);
+        activeCount--;
+        return false;
+    }
+    it->second.expiresAt = now + idleTimeout;
+    session = it->second;
+    return true;
+}
+
+// End one session
+void SessionManager::revoke(const string& token) {
+    Stripe& stripe = stripeFor(token);
+    lock_guard<mutex> lock(stripe.stripeMutex);
+    if (stripe.sessions.erase(token) > 0) {
+        activeCount--;
+    }
+}
+
+// Remove expired sessions, one stripe at a time
+size_t SessionManager::sweep() {
+    size_t removed = 0;
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    for (auto& stripe : stripes) {
+        lock_guard<mutex> lock(stripe.stripeMutex);
+        for (auto it = stripe.sessions.begin(); it != stripe.sessions.end();) {
+            if (it->second.expiresAt <= now) {
+                it = stripe.sessions.erase(it);
+                removed++;
+            } else {
+                ++it;
+            }
+        }
+    }
+    activeCount -= removed;
+    return removed;
+}
+
+// Sessions currently in the table
+size_t SessionManager::getActiveCount() const {
+    return activeCount.load();
+}
+
+// Idle timeout in seconds
+int SessionManager::getIdleTimeoutSeconds() const {
+    return static_cast<int>(idleTimeout.count());
+}
@@ -0,0 +1,71 @@
+#ifndef SESSIONMANAGER_H
+#define SESSIONMANAGER_H
+
+#include "User.h"
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+
+using namespace std;
+
+// An authenticated session
+struct Session {
+    string username;
+    UserRole role = GUEST;
+    time_t createdAt = 0;
+    chrono::steady_clock::time_point expiresAt;
+};
+
+// Issues opaque random tokens on login. A request presents its token
+// and is checked with one hash lookup instead of re-hashing a password.
+// The table is split into independently locked stripes so concurrent
+// clients rarely contend; sessions expire after an idle timeout and are
+// removed by a background sweeper.
+class SessionManager {
+private:
+    static const size_t STRIPE_COUNT = 16;
+
+    struct Stripe {
+        mutex stripeMutex;
+        unordered_map<string, Session> sessions;
+    };
+
+    Stripe stripes[STRIPE_COUNT];
+    chrono::seconds idleTimeout;
+    chrono::seconds sweepInterval;
+    atomic<size_t> activeCount;
+
+    thread sweeper;
+    mutex sweeperMutex;
+    condition_variable sweeperWake;
+    bool stopping;
+
+    Stripe& stripeFor(const string& token);
+    static string newToken();
+    void sweepLoop();
+
+public:
+    // Constructor
+    SessionManager();
+    ~SessionManager();
+
+    void configure(int idleSeconds, int sweepSeconds);
+    void start();
+    void stop();
+
+    // Session lifecycle
+    string create(const User& user);
+    bool validate(const string& token, Session& session);  // Also extends the idle timeout
+    void revoke(const string& token);
+    size_t sweep();
+
+    size_t getActiveCount() const;
+    int getIdleTimeoutSeconds() const;
+};
+
+#endif
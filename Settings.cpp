@@ -0,0 +1,172 @@
+#include "Settings.h"
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+
+using namespace std;
+
+// Constructor
+Settings::Settings(string name) : fileName(name) {}
+
+// Trim spaces and tabs from both ends
+static string trim(const string& text) {
+    size_t first = text.find_first_not_of(" \t\r");
+    if (first == string::npos) {
+        return "";
+    }
+    size_t last = text.find_last_not_of(" \t\r");
+    return text.substr(first, last - first + 1);
+}
+
+// Load settings from file
+bool Settings::load() {
+    ifstream inFile(fileName);
+    if (!inFile) {
+        return writeDefaults();
+    }
+    
+    values.clear();
+    string line;
+    while (getline(inFile, line)) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        size_t equals = line.find('=');
+        if (equals == string::npos) {
+            cerr << "Warning: Ignoring setting without '=': " << line << endl;
+            continue;
+        }
+        values[trim(line.substr(0, equals))] = trim(line.substr(equals + 1));
+    }
+    inFile.close();
+    return true;
+}
+
+// Write a settings file listing every option with its default value
+bool Settings::writeDefaults() const {
+    ofstream outFile(fileName);
+    if (!outFile) {
+        cerr << "Error: Could not create settings file!" << endl;
+        return false;
+    }
+    outFile << "# Automated Banking System settings (key = value)" << endl;
+    outFile << endl;
+    outFile << "# Account numbers" << endl;
+    outFile << "# Numbers reserved ahead of use; a crash may skip at most this many" << endl;
+    outFile << "number_reserve_chunk = 64" << endl;
+    outFile << "# Reissue numbers of deleted accounts after the quarantine period" << endl;
+    outFile << "reuse_retired_numbers = 0" << endl;
+    outFile << "retired_quarantine_days = 90" << endl;
+    outFile << endl;
+    outFile << "# Ledger shards (bank_data.N.dat); only used when a new ledger is created" << endl;
+    outFile << "shard_count = 4" << endl;
+    outFile << "# Journal records a shard collects before its slot file is rewritten" << endl;
+    outFile << "journal_checkpoint_records = 1000" << endl;
+    outFile << "# Closed accounts keep their history this long before compaction purges them" << endl;
+    outFile << "tombstone_retention_days = 90" << endl;
+    outFile << "compaction_interval_seconds = 300" << endl;
+    outFile << "# Idempotency keys remembered per shard (oldest evicted first) and for how long" << endl;
+    outFile << "idempotency_keys_per_shard = 4096" << endl;
+    outFile << "idempotency_ttl_hours = 24" << endl;
+    outFile << "# Holds not settled or released within this time expire and free their funds" << endl;
+    outFile << "hold_expiry_hours = 168" << endl;
+    outFile << endl;
+    outFile << "# Risk screening of deposits, withdrawals and transfers: rolling or none" << endl;
+    outFile << "risk_stage = rolling" << endl;
+    outFile << "# flag = apply and queue for review; hold = queue and apply only once approved" << endl;
+    outFile << "risk_action = flag" << endl;
+    outFile << "# More than risk_max_per_window operations on an account in the window" << endl;
+    outFile << "risk_window_seconds = 60" << endl;
+    outFile << "risk_max_per_window = 30" << endl;
+    outFile << "# An amount this many mean deviations above the account's mean, once it has" << endl;
+    outFile << "# risk_min_samples amounts, or after risk_dormant_days without activity" << endl;
+    outFile << "risk_outlier_factor = 8" << endl;
+    outFile << "risk_min_samples = 8" << endl;
+    outFile << "risk_dormant_days = 180" << endl;
+    outFile << "# Amounts below this are never outliers or dormant (account's own currency)" << endl;
+    outFile << "risk_min_amount = 1000" << endl;
+    outFile << "# Accounts whose statistics each shard keeps (32 bytes each)" << endl;
+    outFile << "risk_accounts_per_shard = 16384" << endl;
+    outFile << "# Flagged items kept for review; later ones are counted but not queued" << endl;
+    outFile << "review_max_open = 10000" << endl;
+    outFile << endl;
+    outFile << "# Hot standby: a primary writes replication.log for a process started with --standby DIR" << endl;
+    outFile << "replication_enabled = 0" << endl;
+    outFile << "# A heartbeat is written when the ledger is idle this long" << endl;
+    outFile << "replication_heartbeat_ms = 1000" << endl;
+    outFile << "# A longer log is restarted from a fresh snapshot" << endl;
+    outFile << "replication_max_mb = 64" << endl;
+    outFile << "# How often a standby checks the log, and how long without word from the" << endl;
+    outFile << "# primary before it promotes itself (0 = only on the promote command)" << endl;
+    outFile << "standby_poll_ms = 50" << endl;
+    outFile << "standby_promote_after_seconds = 0" << endl;
+    outFile << endl;
+    outFile << "# Change feed: publish every committed change to a shared-memory ring per shard" << endl;
+    outFile << "# (follow it with banking --changes DIR)" << endl;
+    outFile << "change_feed = 0" << endl;
+    outFile << "change_feed_name = /banking_changes" << endl;
+    outFile << "# Events each shard's ring holds (64 bytes each); a slower reader falls back on the journal" << endl;
+    outFile << "change_feed_events = 65536" << endl;
+    outFile << endl;
+    outFile << "# Where journal, slot and users-file writes go: io_uring, threads or sync" << endl;
+    outFile << "# (io_uring falls back to threads where the kernel does not offer it)" << endl;
+    outFile << "storage_backend = io_uring" << endl;
+    outFile << "storage_threads = 4" << endl;
+    outFile << "# Force each batch of writes to the device before a commit is reported" << endl;
+    outFile << "storage_fsync = 0" << endl;
+    outFile << endl;
+    outFile << "# Bounded memory: keep at most this many MB of accounts in memory, split across" << endl;
+    outFile << "# the shards, and page the rest to disk (0 = every account stays in memory)" << endl;
+    outFile << "account_cache_mb = 0" << endl;
+    outFile << "# Read cold accounts ahead of batch and replay commands on a background thread" << endl;
+    outFile << "account_cache_prefetch = 1" << endl;
+    outFile << endl;
+    outFile << "# Write every command and login to trace.log for banking --replay (replaced each start)" << endl;
+    outFile << "trace_capture = 0" << endl;
+    outFile << endl;
+    outFile << "# Login protection" << endl;
+    outFile << "# Failures within the window that lock a user" << endl;
+    outFile << "login_window_seconds = 900" << endl;
+    outFile << "login_max_failures = 3" << endl;
+    outFile << "# First lockout length; each further lockout doubles it up to the maximum" << endl;
+    outFile << "lockout_base_seconds = 60" << endl;
+    outFile << "lockout_max_seconds = 3600" << endl;
+    outFile << "# Login requests per terminal, checked before any password is hashed" << endl;
+    outFile << "login_rate_per_minute = 10" << endl;
+    outFile << "login_burst = 5" << endl;
+    outFile << "# Sessions end after this long without a request" << endl;
+    outFile << "session_idle_minutes = 15" << endl;
+    outFile << "session_sweep_seconds = 60" << endl;
+    outFile << endl;
+    outFile << "# Audit log (audit.log, rotated to audit.1.log ...)" << endl;
+    outFile << "audit_max_file_kb = 1024" << endl;
+    outFile << "audit_max_files = 5" << endl;
+    outFile.close();
+    return true;
+}
+
+int Settings::getInt(const string& key, int defaultValue) const {
+    auto it = values.find(key);
+    if (it == values.end() || it->second.empty()) {
+        return defaultValue;
+    }
+    return atoi(it->second.c_str());
+}
+
+bool Settings::getBool(const string& key, bool defaultValue) const {
+    auto it = values.find(key);
+    if (it == values.end() || it->second.empty()) {
+        return defaultValue;
+    }
+    const string& value = it->second;
+    return value == "1" || value == "true" || value == "yes" || value == "on";
+}
+
+string Settings::getString(const string& key, const string& defaultValue) const {
+    auto it = values.find(key);
+    if (it == values.end()) {
+        return defaultValue;
+    }
+    return it->second;
+}
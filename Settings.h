@@ -0,0 +1,27 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <string>
+#include <map>
+
+using namespace std;
+
+// Simple key=value configuration file (lines starting with '#' are comments)
+class Settings {
+private:
+    string fileName;
+    map<string, string> values;
+
+public:
+    // Constructor
+    Settings(string name);
+
+    bool load();              // Writes a commented default file if missing
+    bool writeDefaults() const;
+
+    int getInt(const string& key, int defaultValue) const;
+    bool getBool(const string& key, bool defaultValue) const;
+    string getString(const string& key, const string& defaultValue) const;
+};
+
+#endif
@@ -0,0 +1,344 @@
+#include "StatementRun.h"
+#include <iostream>
+#include <sstream>
+#include <filesystem>
+#include <cstdio>
+#include <cmath>
+
+using namespace std;
+
+// Constructor
+StatementRun::StatementRun()
+    : periodStart(0), periodEnd(0), endAccount(0), shardCount(0), statementsWritten(0), statementsResumed(0),
+      resumed(false) {}
+
+// Parse YYYY-MM into the month's first and last second (local time)
+bool StatementRun::setPeriod(const string& month) {
+    int year, monthNumber;
+    char extra;
+    if (sscanf(month.c_str(), "%d-%d%c", &year, &monthNumber, &extra) != 2 || year < 1970 || monthNumber < 1 ||
+        monthNumber > 12) {
+        return false;
+    }
+    tm timeInfo = {};
+    timeInfo.tm_year = year - 1900;
+    timeInfo.tm_mon = monthNumber - 1;
+    timeInfo.tm_mday = 1;
+    timeInfo.tm_isdst = -1;
+    time_t start = mktime(&timeInfo);
+    timeInfo = {};
+    timeInfo.tm_year = year - 1900;
+    timeInfo.tm_mon = monthNumber;      // mktime carries December into January
+    timeInfo.tm_mday = 1;
+    timeInfo.tm_isdst = -1;
+    time_t end = mktime(&timeInfo) - 1;
+    if (start <= 0 || start > time(0)) {
+        return false;
+    }
+    char name[16];
+    snprintf(name, sizeof(name), "%04d-%02d", year, monthNumber);
+    period = name;
+    periodStart = start;
+    periodEnd = end;
+    return true;
+}
+
+const string& StatementRun::getPeriod() const {
+    return period;
+}
+
+time_t StatementRun::getPeriodStart() const {
+    return periodStart;
+}
+
+time_t StatementRun::getPeriodEnd() const {
+    return periodEnd;
+}
+
+// statements_YYYY-MM.N.txt
+string StatementRun::outputFileName(int shard) const {
+    return "statements_" + period + "." + to_string(shard) + ".txt";
+}
+
+// statements_YYYY-MM.progress
+string StatementRun::progressFileName() const {
+    return "statements_" + period + ".progress";
+}
+
+// Read the progress of an earlier run of this month. False if there is
+// none, it finished, or it cannot be read; a torn last line is ignored.
+bool StatementRun::readProgress(int32_t& recordedEnd, int& recordedShards) {
+    ifstream inFile(progressFileName());
+    if (!inFile) {
+        return false;
+    }
+    bool haveRun = false;
+    string line;
+    while (getline(inFile, line)) {
+        istringstream fields(line);
+        string kind;
+        if (!(fields >> kind) || kind[0] == '#') {
+            continue;
+        }
+        if (kind == "run") {
+            string recordedPeriod;
+            if (!(fields >> recordedPeriod >> recordedEnd >> recordedShards) || recordedPeriod != period ||
+                recordedShards <= 0) {
+                return false;
+            }
+            haveRun = true;
+        } else if (kind == "done" && haveRun) {
+            int shard;
+            size_t chunk;
+            uint64_t bytes, statements;
+            if (!(fields >> shard >> chunk >> bytes >> statements) || shard < 0 || shard >= recordedShards) {
+                continue;
+            }
+            doneChunks[make_pair(shard, chunk)] = ChunkRecord{bytes, statements};
+        } else if (kind == "complete") {
+            return false;
+        }
+    }
+    return haveRun;
+}
+
+// Open the shard files and the progress file. An unfinished run of the
+// same month and shard count is resumed: each shard file is cut back to
+// the length of its last finished chunk and those chunks are skipped.
+bool StatementRun::open(int32_t end, int shards) {
+    int32_t recordedEnd = 0;
+    int recordedShards = 0;
+    doneChunks.clear();
+    resumed = readProgress(recordedEnd, recordedShards) && recordedShards == shards;
+    vector<uint64_t> committed(static_cast<size_t>(shards), 0);
+    statementsResumed = 0;
+    if (resumed) {
+        for (const auto& done : doneChunks) {
+            uint64_t& bytes = committed[static_cast<size_t>(done.first.first)];
+            bytes = max(bytes, done.second.fileBytes);
+            statementsResumed += done.second.statements;
+        }
+        for (int s = 0; s < shards && resumed; s++) {
+            error_code error;
+            uintmax_t size = filesystem::file_size(outputFileName(s), error);
+            if (error ? committed[static_cast<size_t>(s)] > 0 : size < committed[static_cast<size_t>(s)]) {
+                resumed = false;        // A shard file went missing or shrank; start over
+            } else if (!error) {
+                filesystem::resize_file(outputFileName(s), committed[static_cast<size_t>(s)], error);
+                resumed = !error;
+            }
+        }
+    }
+    if (resumed) {
+        endAccount = recordedEnd;
+    } else {
+        endAccount = end;
+        doneChunks.clear();
+        committed.assign(static_cast<size_t>(shards), 0);
+        statementsResumed = 0;
+    }
+    shardCount = shards;
+    statementsWritten = 0;
+
+    outputs.clear();
+    for (int s = 0; s < shards; s++) {
+        outputs.push_back(make_unique<ShardOutput>());
+        ShardOutput& output = *outputs.back();
+        output.out.open(outputFileName(s), ios::binary | (resumed ? ios::app : ios::trunc));
+        if (!output.out) {
+            cout << "Error: Could not write " << outputFileName(s) << "!" << endl;
+            return false;
+        }
+        output.bytes = committed[static_cast<size_t>(s)];
+    }
+
+    // Rewrite the progress file so a torn last line does not linger
+    progress.open(progressFileName(), ios::trunc);
+    if (!progress) {
+        cout << "Error: Could not write " << progressFileName() << "!" << endl;
+        return false;
+    }
+    progress << "# statements v1: run <period> <end account> <shards>, "
+             << "then done <shard> <chunk> <file bytes> <statements>\n";
+    progress << "run " << period << ' ' << endAccount << ' ' << shardCount << '\n';
+    for (const auto& done : doneChunks) {
+        progress << "done " << done.first.first << ' ' << done.first.second << ' ' << done.second.fileBytes << ' '
+                 << done.second.statements << '\n';
+    }
+    progress.flush();
+    return true;
+}
+
+bool StatementRun::isResumed() const {
+    return resumed;
+}
+
+// Chunks needed to cover account numbers below endAccount
+size_t StatementRun::getChunkCount() const {
+    return static_cast<size_t>((static_cast<int64_t>(endAccount) + CHUNK_ACCOUNTS - 1) / CHUNK_ACCOUNTS);
+}
+
+bool StatementRun::isDone(int shard, size_t chunk) const {
+    return doneChunks.count(make_pair(shard, chunk)) != 0;
+}
+
+// Account numbers in a chunk
+pair<int32_t, int32_t> StatementRun::chunkRange(size_t chunk) const {
+    int64_t first = static_cast<int64_t>(chunk) * CHUNK_ACCOUNTS;
+    int64_t end = min(first + CHUNK_ACCOUNTS, static_cast<int64_t>(endAccount));
+    return make_pair(static_cast<int32_t>(first), static_cast<int32_t>(end));
+}
+
+// Write the rest of a chunk and record it as finished. The caller holds
+// the shard file's lock.
+bool StatementRun::commitChunk(int shard, size_t chunk, uint64_t statements, const string& text) {
+    ShardOutput& output = *outputs[static_cast<size_t>(shard)];
+    output.out.write(text.data(), static_cast<streamsize>(text.size()));
+    output.out.flush();
+    if (!output.out) {
+        return false;
+    }
+    output.bytes += text.size();
+
+    lock_guard<mutex> lock(progressMutex);
+    progress << "done " << shard << ' ' << chunk << ' ' << output.bytes << ' ' << statements << '\n';
+    progress.flush();
+    statementsWritten += statements;
+    return static_cast<bool>(progress);
+}
+
+// Close the files and mark the month finished, so the next run starts over
+bool StatementRun::finish() {
+    bool ok = true;
+    for (auto& output : outputs) {
+        output->out.close();
+        ok = ok && !output->out.fail();
+    }
+    if (ok) {
+        progress << "complete " << statementsResumed + statementsWritten << '\n';
+    }
+    progress.close();
+    return ok && !progress.fail();
+}
+
+uint64_t StatementRun::getStatementsWritten() const {
+    return statementsWritten;
+}
+
+uint64_t StatementRun::getStatementsResumed() const {
+    return statementsResumed;
+}
+
+// Total size of the shard files
+uint64_t StatementRun::getBytesWritten() const {
+    uint64_t bytes = 0;
+    for (const auto& output : outputs) {
+        bytes += output->bytes;
+    }
+    return bytes;
+}
+
+// Name of an account type as printed on a statement
+static const char* typeName(AccountType type) {
+    switch (type) {
+        case CHECKING: return "Checking";
+        case SAVINGS: return "Savings";
+        default: return "Unknown";
+    }
+}
+
+// Append one statement. Amounts are signed by how they moved the balance;
+// entries that leave it unchanged (holds, closure) show the amount unsigned.
+void StatementRun::format(const StatementInput& input, time_t periodStart, time_t periodEnd, string& text) {
+    static const char RULE[] = "--------------------------------------------------------------------\n";
+    char line[192];
+    char fromDate[16], toDate[16], when[24];
+    tm timeInfo;
+    localtime_s(&timeInfo, &periodStart);
+    strftime(fromDate, sizeof(fromDate), "%Y-%m-%d", &timeInfo);
+    localtime_s(&timeInfo, &periodEnd);
+    strftime(toDate, sizeof(toDate), "%Y-%m-%d", &timeInfo);
+
+    text += "====================================================================\n";
+    snprintf(line, sizeof(line), "STATEMENT %.7s   Account %d (%s)\n", fromDate, input.accountNumber,
+             typeName(input.accountType));
+    text += line;
+    text += "Holder: ";
+    text.append(input.holderName.data(), input.holderName.size());
+    text += '\n';
+    snprintf(line, sizeof(line), "Period: %s to %s   Currency: %s\n", fromDate, toDate,
+             Currency::name(input.currency).c_str());
+    text += line;
+    text += RULE;
+    snprintf(line, sizeof(line), "%-18s%-24s%13s%13s\n", "Date", "Description", "Amount", "Balance");
+    text += line;
+    snprintf(line, sizeof(line), "%-18s%-24s%13s%13.2f\n", "", "Opening Balance", "", input.openingBalance);
+    text += line;
+
+    double previous = input.openingBalance;
+    double credits = 0.0, debits = 0.0;
+    int creditCount = 0, debitCount = 0;
+    for (const Transaction& entry : input.entries) {
+        localtime_s(&timeInfo, &entry.timestamp);
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &timeInfo);
+        double change = entry.balanceAfter - previous;
+        char amount[32];
+        if (fabs(change) < 0.005) {
+            snprintf(amount, sizeof(amount), "%.2f", entry.amount);
+        } else {
+            snprintf(amount, sizeof(amount), "%+.2f", change);
+            if (change > 0) {
+                credits += change;
+                creditCount++;
+            } else {
+                debits -= change;
+                debitCount++;
+            }
+        }
+        snprintf(line, sizeof(line), "%-18s%-24.24s%13s%13.2f\n", when, entry.type.c_str(), amount,
+                 entry.balanceAfter);
+        text += line;
+        previous = entry.balanceAfter;
+    }
+    if (input.entries.empty()) {
+        text += "                  No transactions this period.\n";
+    }
+    text += RULE;
+    snprintf(line, sizeof(line), "Credits: %d totalling %.2f   Debits: %d totalling %.2f\n", creditCount, credits,
+             debitCount, debits);
+    text += line;
+    snprintf(line, sizeof(line), "%-18s%-24s%13s%13.2f\n\n", "", "Closing Balance", "", previous);
+    text += line;
+}
+
+// Constructor
+StatementRun::Chunk::Chunk(StatementRun& owner, int shardIndex, size_t chunkIndex, string& buffer)
+    : run(owner), shard(shardIndex), chunk(chunkIndex), text(buffer), statements(0) {
+    text.clear();
+}
+
+// Format a statement into the buffer, writing the buffer out once it is full
+void StatementRun::Chunk::add(const StatementInput& input) {
+    format(input, run.periodStart, run.periodEnd, text);
+    statements++;
+    if (text.size() >= FLUSH_BYTES) {
+        ShardOutput& output = *run.outputs[static_cast<size_t>(shard)];
+        if (!fileLock.owns_lock()) {
+            fileLock = unique_lock<mutex>(output.outputMutex);
+        }
+        output.out.write(text.data(), static_cast<streamsize>(text.size()));
+        output.bytes += text.size();
+        text.clear();
+    }
+}
+
+// Write what is left and record the chunk as finished
+bool StatementRun::Chunk::commit() {
+    if (!fileLock.owns_lock()) {
+        fileLock = unique_lock<mutex>(run.outputs[static_cast<size_t>(shard)]->outputMutex);
+    }
+    bool ok = run.commitChunk(shard, chunk, statements, text);
+    fileLock.unlock();
+    text.clear();
+    return ok;
+}
@@ -0,0 +1,119 @@
+#ifndef STATEMENTRUN_H
+#define STATEMENTRUN_H
+
+#include "BankAccount.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <mutex>
+#include <memory>
+#include <utility>
+#include <ctime>
+#include <cstdint>
+
+using namespace std;
+
+// One account's month, copied out of its shard so the statement can be
+// formatted without holding the shard lock
+struct StatementInput {
+    int32_t accountNumber = 0;
+    AccountType accountType = CHECKING;
+    CurrencyCode currency = Currency::USD;    // Amounts on the statement are in it
+    string_view holderName;         // Interned
+    double openingBalance = 0.0;    // Balance after the last entry before the period
+    vector<Transaction> entries;    // Entries in the period, oldest first
+};
+
+// A month of statements, written to statements_YYYY-MM.N.txt (one file per
+// shard). Account numbers are split into chunks of CHUNK_ACCOUNTS (chunk c
+// starts at c * CHUNK_ACCOUNTS); each shard's part of a chunk is one unit
+// of work. A finished chunk is
+// recorded in statements_YYYY-MM.progress with its shard file's length, so
+// an interrupted run resumes by cutting each file back to its last
+// recorded length and skipping the chunks already done.
+class StatementRun {
+public:
+    static const int32_t CHUNK_ACCOUNTS = 4096;
+    static const size_t FLUSH_BYTES = 1 << 20;    // Chunk text buffered before it is written out
+
+    class Chunk;
+
+private:
+    struct ShardOutput {
+        ofstream out;
+        mutex outputMutex;
+        uint64_t bytes = 0;
+    };
+
+    string period;                  // YYYY-MM
+    time_t periodStart;
+    time_t periodEnd;               // Last second of the month
+    int32_t endAccount;             // One past the highest account number covered
+    int shardCount;
+    struct ChunkRecord {
+        uint64_t fileBytes;         // Shard file length once the chunk was written
+        uint64_t statements;
+    };
+    map<pair<int, size_t>, ChunkRecord> doneChunks;   // (shard, chunk) recorded as finished
+    vector<unique_ptr<ShardOutput>> outputs;
+    ofstream progress;
+    mutex progressMutex;
+    uint64_t statementsWritten;
+    uint64_t statementsResumed;     // Written by an earlier, interrupted run
+    bool resumed;
+
+    string progressFileName() const;
+    bool readProgress(int32_t& recordedEnd, int& recordedShards);
+    bool commitChunk(int shard, size_t chunk, uint64_t statements, const string& text);
+
+public:
+    // Constructor
+    StatementRun();
+
+    // Parses YYYY-MM; false if it is not a past or current month
+    bool setPeriod(const string& month);
+    const string& getPeriod() const;
+    time_t getPeriodStart() const;
+    time_t getPeriodEnd() const;
+    string outputFileName(int shard) const;
+
+    // Opens the shard files, resuming an unfinished run of this month with
+    // the same shard count (endAccount is then the one it recorded)
+    bool open(int32_t end, int shards);
+    bool isResumed() const;
+    size_t getChunkCount() const;
+    bool isDone(int shard, size_t chunk) const;
+    pair<int32_t, int32_t> chunkRange(size_t chunk) const;   // [first, end) account numbers
+    bool finish();                  // Records the run as complete and closes the files
+
+    uint64_t getStatementsWritten() const;
+    uint64_t getStatementsResumed() const;
+    uint64_t getBytesWritten() const;
+
+    // Appends one statement to text
+    static void format(const StatementInput& input, time_t periodStart, time_t periodEnd, string& text);
+
+    // Builds one chunk of one shard in a caller-owned buffer that is reused
+    // from chunk to chunk. Past FLUSH_BYTES the text is written out and the
+    // shard file stays locked until commit(), so a chunk is contiguous.
+    class Chunk {
+    private:
+        StatementRun& run;
+        int shard;
+        size_t chunk;
+        string& text;
+        unique_lock<mutex> fileLock;
+        uint64_t statements;
+
+    public:
+        // Constructor
+        Chunk(StatementRun& owner, int shardIndex, size_t chunkIndex, string& buffer);
+
+        void add(const StatementInput& input);
+        bool commit();
+    };
+};
+
+#endif
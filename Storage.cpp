@@ -0,0 +1,704 @@
+#include "Storage.h"
+#include <iostream>
+#include <algorithm>
+#include <future>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <cerrno>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if BANK_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace std;
+
+// Queued requests taken from the queue beyond this many are left for the
+// next batch, so one flood of writes does not hold back every callback
+static const size_t MAX_BATCH_REQUESTS = 4096;
+
+#ifdef _WIN32
+// Open for writing, creating the file if needed
+static int openFd(const string& fileName, bool append, bool truncate) {
+    int flags = _O_WRONLY | _O_CREAT | _O_BINARY | (append ? _O_APPEND : 0) | (truncate ? _O_TRUNC : 0);
+    return _open(fileName.c_str(), flags, _S_IREAD | _S_IWRITE);
+}
+
+// One write at an offset, or at the end of an append-mode file
+static long long writeFd(int fd, int64_t offset, const char* data, size_t size) {
+    if (offset != StorageBackend::APPEND && _lseeki64(fd, offset, SEEK_SET) < 0) {
+        return -1;
+    }
+    return _write(fd, data, static_cast<unsigned>(min(size, static_cast<size_t>(INT_MAX))));
+}
+
+static bool syncFd(int fd) {
+    return _commit(fd) == 0;
+}
+
+static void closeFd(int fd) {
+    _close(fd);
+}
+
+// Windows cannot rename over an existing file
+static bool renameOver(const string& tempName, const string& fileName) {
+    remove(fileName.c_str());
+    return rename(tempName.c_str(), fileName.c_str()) == 0;
+}
+#else
+// Open for writing, creating the file if needed
+static int openFd(const string& fileName, bool append, bool truncate) {
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : 0) | (truncate ? O_TRUNC : 0);
+    return ::open(fileName.c_str(), flags, 0644);
+}
+
+// One write at an offset, or at the end of an append-mode file
+static long long writeFd(int fd, int64_t offset, const char* data, size_t size) {
+    ssize_t written = offset == StorageBackend::APPEND ? ::write(fd, data, size)
+                                                       : ::pwrite(fd, data, size, static_cast<off_t>(offset));
+    return written;
+}
+
+// Force written data to the device (metadata only as far as needed to read it)
+static bool syncFd(int fd) {
+#ifdef __APPLE__
+    return ::fsync(fd) == 0;
+#else
+    return ::fdatasync(fd) == 0;
+#endif
+}
+
+static void closeFd(int fd) {
+    ::close(fd);
+}
+
+// rename() replaces the old file in one step
+static bool renameOver(const string& tempName, const string& fileName) {
+    return rename(tempName.c_str(), fileName.c_str()) == 0;
+}
+#endif
+
+// Constructor
+StorageBackend::StorageBackend()
+    : requestCount(0), batchCount(0), syscallCount(0), byteCount(0), syncCount(0) {}
+
+// Destructor: close every file still open
+StorageBackend::~StorageBackend() {
+    for (int fd : files) {
+        if (fd >= 0) {
+            closeFd(fd);
+        }
+    }
+}
+
+// Build the backend named by the storage_backend setting
+unique_ptr<StorageBackend> StorageBackend::create(const string& kind, size_t threads) {
+    if (kind == "sync") {
+        return unique_ptr<StorageBackend>(new DirectStorage());
+    }
+    if (kind == "io_uring") {
+#if BANK_IO_URING
+        unique_ptr<UringStorage> uring(new UringStorage());
+        if (uring->setup(256)) {
+            return unique_ptr<StorageBackend>(uring.release());
+        }
+        cerr << "Warning: io_uring could not be set up; using the thread-pool storage backend" << endl;
+#else
+        cerr << "Warning: io_uring is not in this build; using the thread-pool storage backend" << endl;
+#endif
+    } else if (kind != "threads") {
+        cerr << "Warning: Unknown storage_backend " << kind << "; using the thread-pool storage backend" << endl;
+    }
+    return unique_ptr<StorageBackend>(new PooledStorage(max(threads, static_cast<size_t>(1))));
+}
+
+// Open a file and return its handle
+int StorageBackend::open(const string& fileName, bool append) {
+    int fd = openFd(fileName, append, false);
+    syscallCount++;
+    if (fd < 0) {
+        return -1;
+    }
+    lock_guard<mutex> lock(filesMutex);
+    for (size_t handle = 0; handle < files.size(); handle++) {
+        if (files[handle] < 0) {
+            files[handle] = fd;
+            return static_cast<int>(handle);
+        }
+    }
+    files.push_back(fd);
+    return static_cast<int>(files.size() - 1);
+}
+
+// Close a handle once everything queued for it has completed
+void StorageBackend::close(int handle) {
+    drain();
+    lock_guard<mutex> lock(filesMutex);
+    if (handle < 0 || handle >= static_cast<int>(files.size()) || files[handle] < 0) {
+        return;
+    }
+    closeFd(files[handle]);
+    syscallCount++;
+    files[handle] = -1;
+}
+
+// Descriptor behind a handle (-1 if closed)
+int StorageBackend::fdFor(int handle) {
+    lock_guard<mutex> lock(filesMutex);
+    if (handle < 0 || handle >= static_cast<int>(files.size())) {
+        return -1;
+    }
+    return files[handle];
+}
+
+// Replace a file and wait for the outcome
+bool StorageBackend::replaceAndWait(const string& fileName, string contents, bool sync) {
+    promise<bool> outcome;
+    future<bool> written = outcome.get_future();
+    replace(fileName, move(contents), sync, [&outcome](bool ok) { outcome.set_value(ok); });
+    return written.get();
+}
+
+// Nothing is queued by default
+void StorageBackend::runPending() {}
+
+// Snapshot of the counters
+StorageStats StorageBackend::getStats() const {
+    StorageStats stats;
+    stats.requests = requestCount.load();
+    stats.batches = batchCount.load();
+    stats.syscalls = syscallCount.load();
+    stats.bytes = byteCount.load();
+    stats.syncs = syncCount.load();
+    return stats;
+}
+
+// Write every byte, retrying short writes
+bool StorageBackend::writeAll(int fd, int64_t offset, const char* data, size_t size) {
+    while (size > 0) {
+        long long written = writeFd(fd, offset, data, size);
+        syscallCount++;
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        byteCount += static_cast<uint64_t>(written);
+        data += written;
+        size -= static_cast<size_t>(written);
+        if (offset != APPEND) {
+            offset += written;
+        }
+    }
+    return true;
+}
+
+// Force a file's data to the device
+bool StorageBackend::syncFile(int fd) {
+    syscallCount++;
+    syncCount++;
+    return syncFd(fd);
+}
+
+// Carry out one file's requests with plain system calls
+bool StorageBackend::runFileBatch(FileBatch& batch) {
+    if (!batch.replaceName.empty()) {
+        string tempName = batch.replaceName + ".tmp";
+        int fd = openFd(tempName, false, true);
+        syscallCount++;
+        if (fd < 0) {
+            return batch.ok = false;
+        }
+        bool ok = writeAll(fd, 0, batch.appended.data(), batch.appended.size()) && (!batch.sync || syncFile(fd));
+        closeFd(fd);
+        syscallCount += 2;
+        if (!ok || !renameOver(tempName, batch.replaceName)) {
+            remove(tempName.c_str());
+            return batch.ok = false;
+        }
+        return batch.ok = true;
+    }
+    if (batch.fd < 0) {
+        return batch.ok = false;
+    }
+    bool ok = batch.appended.empty() || writeAll(batch.fd, APPEND, batch.appended.data(), batch.appended.size());
+    for (const auto& write : batch.writes) {
+        ok = writeAll(batch.fd, write.first, write.second.data(), write.second.size()) && ok;
+    }
+    if (batch.sync) {
+        ok = syncFile(batch.fd) && ok;
+    }
+    return batch.ok = ok;
+}
+
+// Name shown in statistics
+const char* DirectStorage::name() const {
+    return "sync";
+}
+
+// Write now, on the caller's thread
+void DirectStorage::write(int handle, int64_t offset, string data, bool sync, StorageCallback done) {
+    requestCount++;
+    batchCount++;
+    FileBatch batch;
+    batch.fd = fdFor(handle);
+    if (offset == APPEND) {
+        batch.appended = move(data);
+    } else {
+        batch.writes.emplace_back(offset, move(data));
+    }
+    batch.sync = sync;
+    bool ok = runFileBatch(batch);
+    if (done) {
+        done(ok);
+    }
+}
+
+// Replace a file now, on the caller's thread
+void DirectStorage::replace(const string& fileName, string contents, bool sync, StorageCallback done) {
+    requestCount++;
+    batchCount++;
+    FileBatch batch;
+    batch.replaceName = fileName;
+    batch.appended = move(contents);
+    batch.sync = sync;
+    bool ok = runFileBatch(batch);
+    if (done) {
+        done(ok);
+    }
+}
+
+// Nothing is ever in flight
+void DirectStorage::drain() {}
+
+// Constructor (derived classes start the I/O thread once they are ready)
+QueuedStorage::QueuedStorage() : queuedCount(0), completedCount(0), running(false), stopping(false) {}
+
+// Destructor
+QueuedStorage::~QueuedStorage() {
+    stop();
+}
+
+// Start the I/O thread
+void QueuedStorage::start() {
+    ioThread = thread(&QueuedStorage::ioLoop, this);
+}
+
+// Let the I/O thread finish what is queued, then stop it
+void QueuedStorage::stop() {
+    {
+        lock_guard<mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueReady.notify_all();
+    if (ioThread.joinable()) {
+        ioThread.join();
+    }
+}
+
+// Queue a request; the I/O thread is only woken if it may be asleep
+void QueuedStorage::enqueue(Request request) {
+    requestCount++;
+    bool wasEmpty;
+    {
+        lock_guard<mutex> lock(queueMutex);
+        wasEmpty = queue.empty();
+        queue.push_back(move(request));
+        queuedCount++;
+    }
+    if (wasEmpty) {
+        queueReady.notify_one();
+    }
+}
+
+// Queue a write
+void QueuedStorage::write(int handle, int64_t offset, string data, bool sync, StorageCallback done) {
+    Request request;
+    request.handle = handle;
+    request.offset = offset;
+    request.data = move(data);
+    request.sync = sync;
+    request.done = move(done);
+    enqueue(move(request));
+}
+
+// Queue a whole-file replacement
+void QueuedStorage::replace(const string& fileName, string contents, bool sync, StorageCallback done) {
+    Request request;
+    request.handle = -1;
+    request.offset = 0;
+    request.data = move(contents);
+    request.replaceName = fileName;
+    request.sync = sync;
+    request.done = move(done);
+    enqueue(move(request));
+}
+
+// Wait until every request queued so far has completed (never from a callback)
+void QueuedStorage::drain() {
+    unique_lock<mutex> lock(queueMutex);
+    uint64_t target = queuedCount;
+    queueDrained.wait(lock, [this, target]() { return completedCount >= target; });
+}
+
+// Group taken requests by file. Appends keep their order; positioned
+// writes are sorted and joined where one ends at the next one's offset; a
+// later replacement of the same file supersedes an earlier one.
+void QueuedStorage::groupByFile(vector<Request>& requests, vector<FileBatch>& batches,
+                                vector<pair<size_t, StorageCallback>>& callbacks) {
+    vector<int> batchHandles;
+    for (auto& request : requests) {
+        size_t index = batches.size();
+        for (size_t i = 0; i < batches.size(); i++) {
+            bool same = request.replaceName.empty() ? batchHandles[i] == request.handle
+                                                    : batches[i].replaceName == request.replaceName;
+            if (same) {
+                index = i;
+                break;
+            }
+        }
+        if (index == batches.size()) {
+            batches.emplace_back();
+            batchHandles.push_back(request.handle);
+            batches.back().replaceName = request.replaceName;
+            batches.back().fd = request.replaceName.empty() ? fdFor(request.handle) : -1;
+        }
+        FileBatch& batch = batches[index];
+        if (!request.replaceName.empty()) {
+            batch.appended = move(request.data);
+        } else if (request.offset == APPEND) {
+            batch.appended += request.data;
+        } else if (!request.data.empty()) {
+            batch.writes.emplace_back(request.offset, move(request.data));
+        }
+        batch.sync = batch.sync || request.sync;
+        callbacks.emplace_back(index, move(request.done));
+    }
+
+    for (auto& batch : batches) {
+        if (batch.writes.size() < 2) {
+            continue;
+        }
+        stable_sort(batch.writes.begin(), batch.writes.end(),
+                    [](const pair<int64_t, string>& a, const pair<int64_t, string>& b) { return a.first < b.first; });
+        size_t kept = 0;
+        for (size_t i = 1; i < batch.writes.size(); i++) {
+            pair<int64_t, string>& last = batch.writes[kept];
+            if (last.first + static_cast<int64_t>(last.second.size()) == batch.writes[i].first) {
+                last.second += batch.writes[i].second;
+            } else if (++kept != i) {
+                batch.writes[kept] = move(batch.writes[i]);
+            }
+        }
+        batch.writes.resize(kept + 1);
+    }
+}
+
+// Take the queue (or its first MAX_BATCH_REQUESTS) to run as one batch
+// (caller holds queueMutex; only one batch runs at a time)
+void QueuedStorage::takeBatch(vector<Request>& taken) {
+    if (queue.size() <= MAX_BATCH_REQUESTS) {
+        taken.swap(queue);
+    } else {
+        taken.assign(make_move_iterator(queue.begin()),
+                     make_move_iterator(queue.begin() + static_cast<ptrdiff_t>(MAX_BATCH_REQUESTS)));
+        queue.erase(queue.begin(), queue.begin() + static_cast<ptrdiff_t>(MAX_BATCH_REQUESTS));
+    }
+    running = true;
+}
+
+// Write a taken batch, report each request, then let the next batch run
+void QueuedStorage::runTaken(vector<Request>& taken) {
+    vector<FileBatch> batches;
+    vector<pair<size_t, StorageCallback>> callbacks;
+    size_t count = taken.size();
+    groupByFile(taken, batches, callbacks);
+    run(batches);
+    batchCount++;
+    for (auto& callback : callbacks) {
+        if (callback.second) {
+            callback.second(batches[callback.first].ok);
+        }
+    }
+    taken.clear();
+    bool more;
+    {
+        lock_guard<mutex> lock(queueMutex);
+        completedCount += count;
+        running = false;
+        more = !queue.empty();
+    }
+    queueDrained.notify_all();
+    if (more) {
+        queueReady.notify_one();
+    }
+}
+
+// I/O thread: run batches until stopped with nothing queued
+void QueuedStorage::ioLoop() {
+    vector<Request> taken;
+    while (true) {
+        {
+            unique_lock<mutex> lock(queueMutex);
+            queueReady.wait(lock, [this]() { return !running && (stopping || !queue.empty()); });
+            if (queue.empty()) {
+                return;
+            }
+            takeBatch(taken);
+        }
+        runTaken(taken);
+    }
+}
+
+// Group commit: a caller about to wait for its writes runs the queue
+// itself when no batch is in progress, saving the hand-off to the I/O
+// thread; requests queued meanwhile go out with the next batch
+void QueuedStorage::runPending() {
+    vector<Request> taken;
+    {
+        lock_guard<mutex> lock(queueMutex);
+        if (running || queue.empty()) {
+            return;
+        }
+        takeBatch(taken);
+    }
+    runTaken(taken);
+}
+
+// Constructor
+PooledStorage::PooledStorage(size_t threads) : pool(threads) {
+    start();
+}
+
+// Destructor: finish the queue while the pool still exists
+PooledStorage::~PooledStorage() {
+    stop();
+}
+
+// Name shown in statistics
+const char* PooledStorage::name() const {
+    return "threads";
+}
+
+// Write each file of the batch on its own pool worker
+void PooledStorage::run(vector<FileBatch>& batches) {
+    if (batches.size() == 1) {
+        runFileBatch(batches[0]);
+        return;
+    }
+    pool.parallelFor(batches.size(), [this, &batches](size_t i) { runFileBatch(batches[i]); });
+}
+
+#if BANK_IO_URING
+// Raw system calls; liburing is not required
+static int ioUringSetup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int ioUringEnter(int ringFd, unsigned submit, unsigned complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ringFd, submit, complete, flags, nullptr, 0));
+}
+
+// Constructor (setup() maps the rings)
+UringStorage::UringStorage()
+    : ringFd(-1), ringEntries(0), broken(false), sqRing(nullptr), cqRing(nullptr), sqRingSize(0), cqRingSize(0),
+      sqeMemory(nullptr), sqeSize(0), sqHead(nullptr), sqTail(nullptr), sqMask(nullptr), sqArray(nullptr),
+      cqHead(nullptr), cqTail(nullptr), cqMask(nullptr), cqes(nullptr) {}
+
+// Destructor: finish the queue, then unmap the rings
+UringStorage::~UringStorage() {
+    stop();
+    if (sqeMemory) {
+        munmap(sqeMemory, sqeSize);
+    }
+    if (cqRing && cqRing != sqRing) {
+        munmap(cqRing, cqRingSize);
+    }
+    if (sqRing) {
+        munmap(sqRing, sqRingSize);
+    }
+    if (ringFd >= 0) {
+        ::close(ringFd);
+    }
+}
+
+// Create the ring and map its queues; false if the kernel refuses
+bool UringStorage::setup(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd = ioUringSetup(entries, &params);
+    if (ringFd < 0) {
+        return false;
+    }
+    ringEntries = params.sq_entries;
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap) {
+        sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+    }
+    void* mapped = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                        IORING_OFF_SQ_RING);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    sqRing = mapped;
+    if (singleMap) {
+        cqRing = sqRing;
+    } else {
+        mapped = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                      IORING_OFF_CQ_RING);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        cqRing = mapped;
+    }
+    sqeSize = params.sq_entries * sizeof(io_uring_sqe);
+    mapped = mmap(nullptr, sqeSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    sqeMemory = mapped;
+
+    char* sq = static_cast<char*>(sqRing);
+    sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    char* cq = static_cast<char*>(cqRing);
+    cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = cq + params.cq_off.cqes;
+    start();
+    return true;
+}
+
+// Name shown in statistics
+const char* UringStorage::name() const {
+    return "io_uring";
+}
+
+// Submit operations a ring's worth at a time, each time waiting for all of
+// them; a write the kernel cut short is finished with plain writes
+bool UringStorage::submitAndWait(vector<Operation>& operations, vector<FileBatch>& batches) {
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(sqeMemory);
+    io_uring_cqe* completions = static_cast<io_uring_cqe*>(cqes);
+    for (size_t next = 0; next < operations.size();) {
+        unsigned count = static_cast<unsigned>(min(static_cast<size_t>(ringEntries), operations.size() - next));
+        unsigned tail = *sqTail;
+        for (unsigned i = 0; i < count; i++) {
+            const Operation& operation = operations[next + i];
+            unsigned index = tail & *sqMask;
+            io_uring_sqe* sqe = &sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->fd = operation.fd;
+            sqe->user_data = next + i;
+            if (operation.sync) {
+                sqe->opcode = IORING_OP_FSYNC;
+                sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+            } else {
+                // Append-mode files ignore the offset and write at the end
+                sqe->opcode = IORING_OP_WRITE;
+                sqe->addr = reinterpret_cast<uint64_t>(operation.data);
+                sqe->len = static_cast<uint32_t>(operation.size);
+                sqe->off = operation.offset == APPEND ? 0 : static_cast<uint64_t>(operation.offset);
+            }
+            sqArray[index] = index;
+            tail++;
+        }
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+
+        unsigned unsubmitted = count;
+        unsigned completed = 0;
+        while (completed < count) {
+            int result = ioUringEnter(ringFd, unsubmitted, count - completed, IORING_ENTER_GETEVENTS);
+            syscallCount++;
+            if (result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                broken = true;
+                return false;
+            }
+            if (result > 0) {
+                unsubmitted -= min(static_cast<unsigned>(result), unsubmitted);
+            }
+            unsigned head = *cqHead;
+            unsigned available = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != available; head++, completed++) {
+                const io_uring_cqe& cqe = completions[head & *cqMask];
+                const Operation& operation = operations[static_cast<size_t>(cqe.user_data)];
+                FileBatch& batch = batches[operation.batch];
+                if (cqe.res < 0) {
+                    batch.ok = false;
+                } else if (!operation.sync) {
+                    size_t written = static_cast<size_t>(cqe.res);
+                    byteCount += written;
+                    if (written < operation.size) {
+                        int64_t rest = operation.offset == APPEND ? APPEND
+                                                                  : operation.offset + static_cast<int64_t>(written);
+                        batch.ok = writeAll(operation.fd, rest, operation.data + written, operation.size - written) &&
+                                   batch.ok;
+                    }
+                }
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+        next += count;
+    }
+    return true;
+}
+
+// Write the whole batch with one submission, then sync the files that
+// asked for it with a second. Replacements need open and rename, so they
+// are done with plain system calls on this thread.
+void UringStorage::run(vector<FileBatch>& batches) {
+    if (broken) {
+        for (auto& batch : batches) {
+            runFileBatch(batch);
+        }
+        return;
+    }
+    vector<Operation> writes;
+    vector<Operation> syncs;
+    for (size_t i = 0; i < batches.size(); i++) {
+        FileBatch& batch = batches[i];
+        if (!batch.replaceName.empty()) {
+            runFileBatch(batch);
+            continue;
+        }
+        if (batch.fd < 0) {
+            batch.ok = false;
+            continue;
+        }
+        if (!batch.appended.empty()) {
+            writes.push_back(Operation{ i, batch.fd, APPEND, batch.appended.data(), batch.appended.size(), false });
+        }
+        for (const auto& write : batch.writes) {
+            writes.push_back(Operation{ i, batch.fd, write.first, write.second.data(), write.second.size(), false });
+        }
+        if (batch.sync) {
+            syncs.push_back(Operation{ i, batch.fd, 0, nullptr, 0, true });
+        }
+    }
+    syncCount += syncs.size();
+    if (!submitAndWait(writes, batches) || !submitAndWait(syncs, batches)) {
+        // The ring itself failed: what it did not finish counts as failed,
+        // and later batches use plain system calls
+        cerr << "Error: io_uring submission failed (" << strerror(errno) << ")!" << endl;
+        for (auto& batch : batches) {
+            batch.ok = false;
+        }
+    }
+}
+#endif
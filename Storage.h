@@ -0,0 +1,225 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include "ThreadPool.h"
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+// Set BANK_IO_URING to 0 (e.g. -DBANK_IO_URING=0) to leave the io_uring
+// backend out. It is built on Linux when the kernel headers provide it;
+// elsewhere the thread-pool backend is used instead.
+#ifndef BANK_IO_URING
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define BANK_IO_URING 1
+#endif
+#endif
+#endif
+#ifndef BANK_IO_URING
+#define BANK_IO_URING 0
+#endif
+
+using namespace std;
+
+// Called once when a request is on disk or has failed. Queued backends
+// call it on their I/O thread, so it must not take a shard lock.
+typedef function<void(bool ok)> StorageCallback;
+
+// Counters shown on the Performance Statistics screen
+struct StorageStats {
+    uint64_t requests = 0;      // Writes, syncs and file replacements accepted
+    uint64_t batches = 0;       // Times queued requests were handed to the disk together
+    uint64_t syscalls = 0;      // write, pwrite, fdatasync, io_uring_enter, ...
+    uint64_t bytes = 0;
+    uint64_t syncs = 0;
+};
+
+// Where persistence writes go. Files are opened once and then named by a
+// handle; writes are positioned or appended, may ask for the data to be
+// forced to the device, and report through a callback. Writes to one file
+// complete in the order they were made; positioned writes in flight at the
+// same time must not overlap.
+class StorageBackend {
+public:
+    static const int64_t APPEND = -1;   // Offset meaning the end of the file
+
+    virtual ~StorageBackend();
+
+    // Backend named by the storage_backend setting ("io_uring", "threads"
+    // or "sync"); io_uring falls back to threads if the kernel refuses it
+    static unique_ptr<StorageBackend> create(const string& kind, size_t threads);
+
+    virtual const char* name() const = 0;
+
+    int open(const string& fileName, bool append);     // -1 if it cannot be opened
+    void close(int handle);                            // Waits for the file's requests first
+
+    // An empty write with sync set only forces earlier writes to the device
+    virtual void write(int handle, int64_t offset, string data, bool sync, StorageCallback done) = 0;
+
+    // Write contents to a new file and rename it over fileName
+    virtual void replace(const string& fileName, string contents, bool sync, StorageCallback done) = 0;
+    bool replaceAndWait(const string& fileName, string contents, bool sync);
+
+    // Wait until every request made so far has completed
+    virtual void drain() = 0;
+
+    // Run queued requests on this thread if the backend is idle (called by
+    // threads that are about to wait for their writes; never under a shard lock)
+    virtual void runPending();
+
+    StorageStats getStats() const;
+
+protected:
+    // Requests for one file taken from the queue together: appends are
+    // joined into one buffer and adjacent positioned writes into one write
+    struct FileBatch {
+        int fd = -1;
+        string appended;
+        vector<pair<int64_t, string>> writes;   // Offset -> bytes
+        string replaceName;                     // Non-empty: write appended to a new file of this name
+        bool sync = false;
+        bool ok = true;
+    };
+
+    vector<int> files;                          // Descriptor per handle; -1 when free
+    mutex filesMutex;
+
+    atomic<uint64_t> requestCount;
+    atomic<uint64_t> batchCount;
+    atomic<uint64_t> syscallCount;
+    atomic<uint64_t> byteCount;
+    atomic<uint64_t> syncCount;
+
+    StorageBackend();
+    int fdFor(int handle);
+    bool runFileBatch(FileBatch& batch);        // On the calling thread, with plain system calls
+    bool writeAll(int fd, int64_t offset, const char* data, size_t size);
+    bool syncFile(int fd);
+};
+
+// The synchronous path: every request runs on the caller's thread before
+// write() returns, one system call per write as before
+class DirectStorage : public StorageBackend {
+public:
+    const char* name() const override;
+    void write(int handle, int64_t offset, string data, bool sync, StorageCallback done) override;
+    void replace(const string& fileName, string contents, bool sync, StorageCallback done) override;
+    void drain() override;
+};
+
+// Requests are queued and return at once. An I/O thread takes everything
+// queued, groups it by file and hands the batch to run(); callers keep
+// working (and keep queueing) while it is on its way to disk.
+class QueuedStorage : public StorageBackend {
+private:
+    struct Request {
+        int handle;
+        int64_t offset;
+        string data;
+        string replaceName;
+        bool sync;
+        StorageCallback done;
+    };
+
+    vector<Request> queue;
+    mutex queueMutex;
+    condition_variable queueReady;
+    condition_variable queueDrained;
+    uint64_t queuedCount;                       // Requests ever queued (under queueMutex)
+    uint64_t completedCount;                    // Requests whose callbacks have run
+    bool running;                               // A batch is being written (by any thread)
+    bool stopping;
+    thread ioThread;
+
+    void enqueue(Request request);
+    void takeBatch(vector<Request>& taken);
+    void runTaken(vector<Request>& taken);
+    void ioLoop();
+    void groupByFile(vector<Request>& requests, vector<FileBatch>& batches,
+                     vector<pair<size_t, StorageCallback>>& callbacks);
+
+protected:
+    QueuedStorage();
+    void start();
+    void stop();                                // Finishes queued requests; derived destructors call it
+    virtual void run(vector<FileBatch>& batches) = 0;
+
+public:
+    ~QueuedStorage() override;
+    void write(int handle, int64_t offset, string data, bool sync, StorageCallback done) override;
+    void replace(const string& fileName, string contents, bool sync, StorageCallback done) override;
+    void drain() override;
+    void runPending() override;
+};
+
+// Portable backend: the files of a batch are written side by side on a
+// small pool of its own (not the shared worker pool, which bulk jobs may
+// keep busy while commits wait)
+class PooledStorage : public QueuedStorage {
+private:
+    ThreadPool pool;
+
+protected:
+    void run(vector<FileBatch>& batches) override;
+
+public:
+    explicit PooledStorage(size_t threads);
+    ~PooledStorage() override;
+    const char* name() const override;
+};
+
+#if BANK_IO_URING
+// Linux io_uring backend: a batch's writes go into the submission ring and
+// are submitted and waited for with one io_uring_enter; files asking for a
+// sync get their fdatasync in a second one once their writes are done
+class UringStorage : public QueuedStorage {
+private:
+    int ringFd;
+    unsigned ringEntries;
+    bool broken;                // Set if the ring fails; plain system calls from then on
+    void* sqRing;
+    void* cqRing;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    void* sqeMemory;
+    size_t sqeSize;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    void* cqes;
+
+    struct Operation {
+        size_t batch;           // Index into the batches being run
+        int fd;
+        int64_t offset;
+        const char* data;
+        size_t size;
+        bool sync;              // fdatasync instead of a write
+    };
+
+    bool submitAndWait(vector<Operation>& operations, vector<FileBatch>& batches);
+
+protected:
+    void run(vector<FileBatch>& batches) override;
+
+public:
+    UringStorage();
+    ~UringStorage() override;
+    bool setup(unsigned entries);
+    const char* name() const override;
+};
+#endif
+
+#endif
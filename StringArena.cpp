@@ -0,0 +1,69 @@
+#include "StringArena.h"
+#include <cstring>
+
+using namespace std;
+
+// Copy text into the stripe's last chunk, starting a new chunk when it does
+// not fit (a string longer than a chunk gets one of its own)
+const char* StringArena::store(Stripe& stripe, string_view text) {
+    size_t needed = text.size() + 1;
+    if (stripe.chunkUsed + needed > CHUNK_SIZE) {
+        size_t chunkSize = needed > CHUNK_SIZE ? needed : CHUNK_SIZE;
+        stripe.chunks.push_back(unique_ptr<char[]>(new char[chunkSize]));
+        stripe.chunkUsed = 0;
+        if (needed > CHUNK_SIZE) {
+            // Keep the shared chunk full so the next string starts a fresh one
+            stripe.chunkUsed = CHUNK_SIZE;
+            memcpy(stripe.chunks.back().get(), text.data(), text.size());
+            stripe.chunks.back()[text.size()] = '\0';
+            stripe.bytesStored += needed;
+            return stripe.chunks.back().get();
+        }
+    }
+    char* copy = stripe.chunks.back().get() + stripe.chunkUsed;
+    memcpy(copy, text.data(), text.size());
+    copy[text.size()] = '\0';
+    stripe.chunkUsed += needed;
+    stripe.bytesStored += needed;
+    return copy;
+}
+
+// Look text up in its stripe and store it if it is new
+string_view StringArena::intern(string_view text) {
+    size_t hash = std::hash<string_view>()(text);
+    Stripe& stripe = stripes[hash % STRIPE_COUNT];
+    lock_guard<mutex> lock(stripe.stripeMutex);
+    auto it = stripe.strings.find(text);
+    if (it != stripe.strings.end()) {
+        return *it;
+    }
+    string_view stored(store(stripe, text), text.size());
+    stripe.strings.insert(stored);
+    return stored;
+}
+
+// Distinct strings interned
+size_t StringArena::size() {
+    size_t count = 0;
+    for (auto& stripe : stripes) {
+        lock_guard<mutex> lock(stripe.stripeMutex);
+        count += stripe.strings.size();
+    }
+    return count;
+}
+
+// Characters stored, terminators included
+size_t StringArena::bytesUsed() {
+    size_t bytes = 0;
+    for (auto& stripe : stripes) {
+        lock_guard<mutex> lock(stripe.stripeMutex);
+        bytes += stripe.bytesStored;
+    }
+    return bytes;
+}
+
+// The arena holder names, usernames and password hashes are interned in
+StringArena& StringArena::shared() {
+    static StringArena arena;
+    return arena;
+}
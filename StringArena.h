@@ -0,0 +1,46 @@
+#ifndef STRINGARENA_H
+#define STRINGARENA_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+
+using namespace std;
+
+// Interned strings. Each distinct string is stored once, null-terminated,
+// in chunks that never move or shrink, so a view handed out stays valid
+// until the program exits. Holder names, usernames and password hashes
+// live here and accounts and users keep only a view, so copying one or
+// reading its name never allocates. Strings are never freed; names repeat
+// and a purged account leaves at most one behind. Striped by hash so the
+// loader threads can intern in parallel.
+class StringArena {
+private:
+    static const int STRIPE_COUNT = 16;
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    struct Stripe {
+        mutex stripeMutex;
+        vector<unique_ptr<char[]>> chunks;
+        size_t chunkUsed = CHUNK_SIZE;         // Bytes used in the last chunk (full until one exists)
+        unordered_set<string_view> strings;
+        size_t bytesStored = 0;
+    };
+    Stripe stripes[STRIPE_COUNT];
+
+    static const char* store(Stripe& stripe, string_view text);  // Caller holds the stripe lock
+
+public:
+    // Returns the stored copy of text, adding it on first sight
+    string_view intern(string_view text);
+
+    size_t size();                             // Distinct strings
+    size_t bytesUsed();                        // Characters stored, terminators included
+
+    static StringArena& shared();              // The arena names and hashes are interned in
+};
+
+#endif
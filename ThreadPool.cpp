@@ -0,0 +1,86 @@
+#include "ThreadPool.h"
+
+using namespace std;
+
+// Constructor
+ThreadPool::ThreadPool(size_t threadCount) : stopping(false) {
+    if (threadCount == 0) {
+        threadCount = thread::hardware_concurrency();
+    }
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+    for (size_t i = 0; i < threadCount; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+// Destructor: finish queued tasks, then stop the workers
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueReady.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// Take tasks off the queue until the pool is destroyed
+void ThreadPool::workerLoop() {
+    while (true) {
+        function<void()> task;
+        {
+            unique_lock<mutex> lock(queueMutex);
+            queueReady.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;
+            }
+            task = move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+// Queue a task for the next free worker
+void ThreadPool::submit(function<void()> task) {
+    {
+        lock_guard<mutex> lock(queueMutex);
+        tasks.push_back(move(task));
+    }
+    queueReady.notify_one();
+}
+
+// Run a loop body across the workers and block until every index is done
+void ThreadPool::parallelFor(size_t count, const function<void(size_t)>& body) {
+    if (count == 0) {
+        return;
+    }
+    if (count == 1) {
+        body(0);
+        return;
+    }
+
+    mutex doneMutex;
+    condition_variable doneReady;
+    size_t remaining = count;
+    for (size_t i = 0; i < count; i++) {
+        submit([&body, &doneMutex, &doneReady, &remaining, i]() {
+            body(i);
+            lock_guard<mutex> lock(doneMutex);
+            if (--remaining == 0) {
+                doneReady.notify_all();
+            }
+        });
+    }
+
+    unique_lock<mutex> lock(doneMutex);
+    doneReady.wait(lock, [&remaining]() { return remaining == 0; });
+}
+
+// Number of worker threads
+size_t ThreadPool::size() const {
+    return workers.size();
+}
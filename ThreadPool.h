@@ -0,0 +1,42 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+// Fixed set of worker threads shared by bulk jobs (startup parsing and the
+// like), so each job does not pay for creating and joining its own threads.
+class ThreadPool {
+private:
+    vector<thread> workers;
+    deque<function<void()>> tasks;
+    mutex queueMutex;
+    condition_variable queueReady;
+    bool stopping;
+
+    void workerLoop();
+
+public:
+    // Constructor (0 = one worker per hardware thread)
+    explicit ThreadPool(size_t threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(function<void()> task);
+
+    // Run body(0) .. body(count - 1) on the workers and wait for all of them.
+    // Must not be called from inside a pool task.
+    void parallelFor(size_t count, const function<void(size_t)>& body);
+
+    size_t size() const;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#include "TimerWheel.h"
+
+using namespace std;
+
+// Constructor
+TimerWheel::TimerWheel(size_t slotCount, int64_t tick)
+    : slots(slotCount > 0 ? slotCount : 1), tickSeconds(tick > 0 ? tick : 1), currentTick(0), pending(0) {}
+
+// Slot holding the timers of a tick
+size_t TimerWheel::slotFor(int64_t tick) const {
+    return static_cast<size_t>(tick) % slots.size();
+}
+
+// Drop every timer and start the clock at now
+void TimerWheel::reset(int64_t now) {
+    for (auto& slot : slots) {
+        slot.clear();
+    }
+    currentTick = now / tickSeconds;
+    pending = 0;
+}
+
+// File a timer under its due tick; one already overdue fires on the next advance
+void TimerWheel::schedule(uint64_t id, int64_t due) {
+    int64_t tick = due / tickSeconds;
+    if (tick < currentTick) {
+        tick = currentTick;
+    }
+    slots[slotFor(tick)].push_back(make_pair(id, due));
+    pending++;
+}
+
+// Move the clock to now, collecting the ids that fell due. The current
+// tick's slot is visited again, since timers in it may have come due
+// since the last call; a gap longer than one turn visits each slot once.
+void TimerWheel::advance(int64_t now, vector<uint64_t>& expired) {
+    int64_t nowTick = now / tickSeconds;
+    if (nowTick < currentTick) {
+        return;
+    }
+    int64_t firstTick = currentTick;
+    if (nowTick - firstTick >= static_cast<int64_t>(slots.size())) {
+        firstTick = nowTick - static_cast<int64_t>(slots.size()) + 1;
+    }
+    for (int64_t tick = firstTick; tick <= nowTick; tick++) {
+        vector<pair<uint64_t, int64_t>>& slot = slots[slotFor(tick)];
+        for (size_t i = 0; i < slot.size();) {
+            if (slot[i].second <= now) {
+                expired.push_back(slot[i].first);
+                slot[i] = slot.back();
+                slot.pop_back();
+                pending--;
+            } else {
+                i++;
+            }
+        }
+    }
+    currentTick = nowTick;
+}
+
+// Timers not yet fired
+size_t TimerWheel::size() const {
+    return pending;
+}
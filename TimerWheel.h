@@ -0,0 +1,35 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+using namespace std;
+
+// Hashed timer wheel. Each id is filed in the slot of the tick it falls
+// due, so scheduling is O(1) and advancing the clock visits only the
+// slots for the ticks that passed. Ids due more than one turn ahead wait
+// in their slot until their time comes round. Cancelling is left to the
+// caller: an id whose timer no longer matters is simply ignored when it
+// fires. Not thread-safe; the owner's lock guards it.
+class TimerWheel {
+private:
+    vector<vector<pair<uint64_t, int64_t>>> slots;  // (id, due time in seconds)
+    int64_t tickSeconds;
+    int64_t currentTick;        // Last tick advanced to
+    size_t pending;
+
+    size_t slotFor(int64_t tick) const;
+
+public:
+    // Constructor
+    TimerWheel(size_t slotCount = 1024, int64_t tickSeconds = 60);
+
+    void reset(int64_t now);    // Drop every timer and start the clock at now
+    void schedule(uint64_t id, int64_t due);
+    void advance(int64_t now, vector<uint64_t>& expired);  // Appends ids due by now
+    size_t size() const;
+};
+
+#endif
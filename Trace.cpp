@@ -0,0 +1,225 @@
+#include "Trace.h"
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+using namespace std;
+
+// Constructor
+TraceWriter::TraceWriter(string name) : fileName(name), nextStream(1), writtenCount(0) {}
+
+// Destructor: write out what is buffered
+TraceWriter::~TraceWriter() {
+    close();
+}
+
+// Start a new trace; offsets count from now
+bool TraceWriter::open() {
+    lock_guard<mutex> lock(traceMutex);
+    out.open(fileName, ios::trunc);
+    if (!out) {
+        return false;
+    }
+    out << "# banking trace v1: <offset ms> <stream> <latency us> <op> [fields...]\n";
+    startedAt = chrono::steady_clock::now();
+    streams.clear();
+    nextStream = 1;
+    writtenCount = 0;
+    return true;
+}
+
+// Flush and close the trace
+void TraceWriter::close() {
+    lock_guard<mutex> lock(traceMutex);
+    if (out.is_open()) {
+        out.close();
+    }
+}
+
+// Whether operations are being captured
+bool TraceWriter::isOpen() {
+    lock_guard<mutex> lock(traceMutex);
+    return out.is_open();
+}
+
+// Append an operation that began at started and has just finished
+void TraceWriter::record(const string& token, chrono::steady_clock::time_point started, const string& op,
+                         const string& fields) {
+    chrono::steady_clock::time_point finished = chrono::steady_clock::now();
+    lock_guard<mutex> lock(traceMutex);
+    if (!out.is_open()) {
+        return;
+    }
+    TraceEvent event;
+    event.offsetMs = chrono::duration_cast<chrono::milliseconds>(started - startedAt).count();
+    event.stream = 0;
+    if (!token.empty()) {
+        auto it = streams.find(token);
+        if (it == streams.end()) {
+            it = streams.emplace(token, nextStream++).first;
+        }
+        event.stream = it->second;
+    }
+    event.latencyUs = chrono::duration_cast<chrono::microseconds>(finished - started).count();
+    event.op = op;
+    event.fields = fields;
+    TraceFile::writeEvent(out, event);
+    writtenCount++;
+}
+
+// Operations captured since the trace was opened
+uint64_t TraceWriter::getWrittenCount() {
+    lock_guard<mutex> lock(traceMutex);
+    return writtenCount;
+}
+
+// Where the trace is written
+const string& TraceWriter::getFileName() const {
+    return fileName;
+}
+
+// Constructor: cumulative weights of every rank
+ZipfGenerator::ZipfGenerator(size_t count, double skew) : cdf(count > 0 ? count : 1) {
+    double total = 0.0;
+    for (size_t rank = 0; rank < cdf.size(); rank++) {
+        total += 1.0 / pow(static_cast<double>(rank + 1), skew);
+        cdf[rank] = total;
+    }
+    for (auto& weight : cdf) {
+        weight /= total;
+    }
+}
+
+// Draw a rank
+size_t ZipfGenerator::next(mt19937_64& random) const {
+    double point = uniform_real_distribution<double>(0.0, 1.0)(random);
+    size_t rank = static_cast<size_t>(lower_bound(cdf.begin(), cdf.end(), point) - cdf.begin());
+    return rank < cdf.size() ? rank : cdf.size() - 1;
+}
+
+// Write one trace line
+void TraceFile::writeEvent(ostream& out, const TraceEvent& event) {
+    out << event.offsetMs << ' ' << event.stream << ' ' << event.latencyUs << ' ' << event.op;
+    if (!event.fields.empty()) {
+        out << ' ' << event.fields;
+    }
+    out << '\n';
+}
+
+// Read a trace, keeping its order
+bool TraceFile::load(const string& fileName, vector<TraceEvent>& events) {
+    ifstream inFile(fileName);
+    if (!inFile) {
+        cout << "Error: Could not open " << fileName << "!" << endl;
+        return false;
+    }
+    events.clear();
+    int lineNumber = 0;
+    string line;
+    while (getline(inFile, line)) {
+        lineNumber++;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        istringstream fields(line);
+        TraceEvent event;
+        if (!(fields >> event.offsetMs >> event.stream >> event.latencyUs >> event.op)) {
+            cout << "Error: Bad trace line " << lineNumber << " in " << fileName << "!" << endl;
+            return false;
+        }
+        getline(fields, event.fields);
+        size_t first = event.fields.find_first_not_of(' ');
+        event.fields.erase(0, first == string::npos ? event.fields.size() : first);
+        events.push_back(event);
+    }
+    return true;
+}
+
+// Operation mix of a synthetic trace, in percent
+static const struct {
+    const char* op;
+    int percent;
+} SYNTHETIC_MIX[] = {
+    {"deposit", 40},
+    {"withdraw", 25},
+    {"transfer", 15},
+    {"balance", 15},
+    {"history", 5}
+};
+
+// Write a synthetic trace: every stream logs in as admin, stream 1 opens
+// the accounts, then operations arrive at random (Poisson) on random
+// streams, picking accounts with a Zipf skew so a few are hot
+bool TraceFile::generate(const string& fileName, const TraceProfile& profile) {
+    ofstream outFile(fileName, ios::trunc);
+    if (!outFile) {
+        cout << "Error: Could not write " << fileName << "!" << endl;
+        return false;
+    }
+    int accounts = max(profile.accounts, 2);
+    int streams = max(profile.streams, 1);
+    mt19937_64 random(profile.seed);
+    ZipfGenerator accountPicker(static_cast<size_t>(accounts), profile.skew);
+    exponential_distribution<double> gapMs(max(profile.opsPerSecond, 0.001) / 1000.0);
+    uniform_int_distribution<int> streamPicker(1, streams);
+    uniform_int_distribution<int> mixPicker(0, 99);
+    uniform_int_distribution<int> cents(100, 20000);
+
+    outFile << "# banking trace v1 (synthetic: accounts=" << accounts << " operations=" << profile.operations
+            << " skew=" << profile.skew << " streams=" << streams << " rate=" << profile.opsPerSecond
+            << " seed=" << profile.seed << ")\n";
+    TraceEvent event;
+    event.offsetMs = 0;
+    event.latencyUs = 0;
+    for (int stream = 1; stream <= streams; stream++) {
+        event.stream = stream;
+        event.op = "login";
+        event.fields = "admin 0";
+        writeEvent(outFile, event);
+    }
+    event.stream = 1;
+    event.op = "create";
+    for (int i = 0; i < accounts; i++) {
+        event.fields = "\"Customer " + to_string(i + 1) + "\" 1000 " + to_string(i % 2 + 1);
+        writeEvent(outFile, event);
+    }
+
+    double offsetMs = 0.0;
+    char amount[32];
+    for (int i = 0; i < profile.operations; i++) {
+        offsetMs += gapMs(random);
+        event.offsetMs = static_cast<int64_t>(offsetMs);
+        event.stream = streamPicker(random);
+        int roll = mixPicker(random);
+        size_t choice = 0;
+        while (roll >= SYNTHETIC_MIX[choice].percent && choice + 1 < sizeof(SYNTHETIC_MIX) / sizeof(SYNTHETIC_MIX[0])) {
+            roll -= SYNTHETIC_MIX[choice].percent;
+            choice++;
+        }
+        event.op = SYNTHETIC_MIX[choice].op;
+        int account = profile.firstAccount + static_cast<int>(accountPicker.next(random));
+        int value = cents(random);
+        snprintf(amount, sizeof(amount), "%d.%02d", value / 100, value % 100);
+        string key = "g" + to_string(profile.seed) + "-" + to_string(i);
+        if (event.op == "deposit" || event.op == "withdraw") {
+            event.fields = to_string(account) + " " + amount + " " + key;
+        } else if (event.op == "transfer") {
+            int other = account;
+            while (other == account) {
+                other = profile.firstAccount + static_cast<int>(accountPicker.next(random));
+            }
+            event.fields = to_string(account) + " " + to_string(other) + " " + amount + " " + key;
+        } else {
+            event.fields = to_string(account);
+        }
+        writeEvent(outFile, event);
+    }
+    outFile.close();
+    if (!outFile) {
+        cout << "Error: Could not write " << fileName << "!" << endl;
+        return false;
+    }
+    return true;
+}
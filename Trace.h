@@ -0,0 +1,94 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <chrono>
+#include <random>
+#include <unordered_map>
+#include <cstdint>
+
+using namespace std;
+
+// One operation in a trace file. A line is
+//   <offset ms> <stream> <latency us> <op> [fields...]
+// where op is a command's batch name (its fields in batch syntax) or one
+// of the auth operations: login <user> <role>, login-failed <user>,
+// logout, signup <user> <role>. Lines starting with '#' are comments.
+struct TraceEvent {
+    int64_t offsetMs;           // Since the trace started
+    int stream;                 // Session the operation ran in (0 = before login)
+    int64_t latencyUs;          // How long it took when it was captured
+    string op;
+    string fields;
+};
+
+// Shape of a synthetic trace
+struct TraceProfile {
+    int accounts = 1000;
+    int operations = 100000;
+    double skew = 0.99;         // Zipf exponent for picking accounts; 0 = uniform
+    int streams = 8;            // Concurrent sessions the operations are spread over
+    double opsPerSecond = 1000.0;
+    int firstAccount = 1001;    // Number the fresh ledger gives its first account
+    uint64_t seed = 1;
+};
+
+// How a trace is replayed
+struct ReplayOptions {
+    string traceFile;
+    double speed = 0.0;         // 1 = original pace, 2 = twice as fast, 0 = as fast as possible
+    int threads = 1;            // Each thread replays its own copy of the trace
+};
+
+// Captures operations as they run. Each session token gets a stream
+// number the first time it is seen, so a replay can give every stream
+// its own session. Lines are buffered and written on close.
+class TraceWriter {
+private:
+    string fileName;
+    ofstream out;
+    mutex traceMutex;
+    chrono::steady_clock::time_point startedAt;
+    unordered_map<string, int> streams;     // Session token -> stream
+    int nextStream;
+    uint64_t writtenCount;
+
+public:
+    // Constructor
+    TraceWriter(string name);
+    ~TraceWriter();
+
+    bool open();                            // Starts a new trace, replacing the file
+    void close();
+    bool isOpen();
+    void record(const string& token, chrono::steady_clock::time_point started, const string& op,
+                const string& fields);      // Empty token = stream 0
+    uint64_t getWrittenCount();
+    const string& getFileName() const;
+};
+
+// Picks ranks 0..count-1 with probability proportional to 1 / (rank + 1)^skew,
+// so rank 0 is the hottest
+class ZipfGenerator {
+private:
+    vector<double> cdf;
+
+public:
+    // Constructor
+    ZipfGenerator(size_t count, double skew);
+
+    size_t next(mt19937_64& random) const;
+};
+
+// Reading and generating trace files
+class TraceFile {
+public:
+    static bool load(const string& fileName, vector<TraceEvent>& events);
+    static bool generate(const string& fileName, const TraceProfile& profile);
+    static void writeEvent(ostream& out, const TraceEvent& event);
+};
+
+#endif
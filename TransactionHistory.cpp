@@ -0,0 +1,459 @@
+#include "TransactionHistory.h"
+#include "MerkleTree.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+// Types stored as a one-byte code in sealed blocks; code 0 is followed by
+// the type written out, for anything not listed here
+static const char* const KNOWN_TYPES[] = {
+    "",
+    "Initial Deposit",
+    "Deposit",
+    "Withdrawal",
+    "Transfer In",
+    "Transfer Out",
+    "Transfer In (recovered)",
+    "Transfer Out (recovered)",
+    "Interest",
+    "Maintenance Fee",
+    "Interest Posting (recovered)",
+    "Hold Placed",
+    "Hold Released",
+    "Hold Expired",
+    "Hold Settled",
+    "Account Closed"
+};
+static const size_t KNOWN_TYPE_COUNT = sizeof(KNOWN_TYPES) / sizeof(KNOWN_TYPES[0]);
+
+// How each known type moves the balance, parallel to KNOWN_TYPES: up or
+// down by its amount, not at all, or by its amount either way
+enum BalanceEffect { EFFECT_ANY, EFFECT_CREDIT, EFFECT_DEBIT, EFFECT_NONE };
+static const BalanceEffect TYPE_EFFECTS[] = {
+    EFFECT_ANY,
+    EFFECT_CREDIT,
+    EFFECT_CREDIT,
+    EFFECT_DEBIT,
+    EFFECT_CREDIT,
+    EFFECT_DEBIT,
+    EFFECT_CREDIT,
+    EFFECT_DEBIT,
+    EFFECT_CREDIT,
+    EFFECT_DEBIT,
+    EFFECT_ANY,
+    EFFECT_NONE,
+    EFFECT_NONE,
+    EFFECT_NONE,
+    EFFECT_DEBIT,
+    EFFECT_NONE
+};
+static_assert(sizeof(TYPE_EFFECTS) / sizeof(TYPE_EFFECTS[0]) == KNOWN_TYPE_COUNT, "one effect per known type");
+
+// Code for a type, or 0 if it has to be written out
+static uint8_t typeCode(const string& type) {
+    for (size_t code = 1; code < KNOWN_TYPE_COUNT; code++) {
+        if (type == KNOWN_TYPES[code]) {
+            return static_cast<uint8_t>(code);
+        }
+    }
+    return 0;
+}
+
+// Amount in whole cents
+static int64_t toCents(double amount) {
+    return static_cast<int64_t>(llround(amount * 100.0));
+}
+
+// Cents written as dollars, for audit messages
+static string centsText(int64_t cents) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.2f", cents / 100.0);
+    return text;
+}
+
+// Append an unsigned value, seven bits per byte, low bits first
+static void putVarint(vector<uint8_t>& bytes, uint64_t value) {
+    while (value >= 0x80) {
+        bytes.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back(static_cast<uint8_t>(value));
+}
+
+// Append a signed value zig-zag encoded, so small negatives stay short
+static void putSigned(vector<uint8_t>& bytes, int64_t value) {
+    putVarint(bytes, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+// Read an unsigned value written by putVarint
+static uint64_t getVarint(const vector<uint8_t>& bytes, size_t& pos) {
+    uint64_t value = 0;
+    int shift = 0;
+    while (pos < bytes.size()) {
+        uint8_t byte = bytes[pos++];
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            break;
+        }
+        shift += 7;
+    }
+    return value;
+}
+
+// Read a signed value written by putSigned
+static int64_t getSigned(const vector<uint8_t>& bytes, size_t& pos) {
+    uint64_t value = getVarint(bytes, pos);
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Append eight bytes as they are in memory (digests and exact amounts)
+static void putWord(vector<uint8_t>& bytes, const void* word) {
+    const uint8_t* first = static_cast<const uint8_t*>(word);
+    bytes.insert(bytes.end(), first, first + 8);
+}
+
+// Read eight bytes written by putWord; false if fewer are left
+static bool getWord(const vector<uint8_t>& bytes, size_t& pos, void* word) {
+    if (bytes.size() - pos < 8) {
+        return false;
+    }
+    memcpy(word, bytes.data() + pos, 8);
+    pos += 8;
+    return true;
+}
+
+// Read a length written by putVarint; false if it runs past the end
+static bool getLength(const vector<uint8_t>& bytes, size_t& pos, size_t& length) {
+    length = static_cast<size_t>(getVarint(bytes, pos));
+    return pos <= bytes.size() && length <= bytes.size() - pos;
+}
+
+// Constructor
+TransactionHistory::TransactionHistory()
+    : archivedCount(0), digest(0), baseDigest(0), baseCount(0), openingBalance(0.0) {}
+
+// Record a transaction and extend the digest, sealing the oldest hot
+// entries once a full block has built up behind the ones kept uncompressed
+void TransactionHistory::add(const Transaction& transaction) {
+    recent.push_back(transaction);
+    digest = hashEntry(digest, transaction);
+    if (recent.size() >= HOT_ENTRIES + BLOCK_ENTRIES) {
+        sealOldest();
+    }
+}
+
+// Digest after one more entry. Amounts and balances are hashed in cents,
+// as sealed blocks hold them.
+uint64_t TransactionHistory::hashEntry(uint64_t previous, const Transaction& entry) {
+    int64_t fields[3] = { static_cast<int64_t>(entry.timestamp), toCents(entry.amount), toCents(entry.balanceAfter) };
+    uint64_t hash = MerkleTree::hashBytes(fields, sizeof(fields), previous);
+    return MerkleTree::hashBytes(entry.type.data(), entry.type.size(), hash);
+}
+
+// Extend a digest over entries starting at a history position, leaving
+// out entries from before the last rebase
+uint64_t TransactionHistory::chain(uint64_t start, const Transaction* entries, size_t count,
+                                   size_t firstPosition) const {
+    for (size_t i = 0; i < count; i++) {
+        if (firstPosition + i >= baseCount) {
+            start = hashEntry(start, entries[i]);
+        }
+    }
+    return start;
+}
+
+// Move the oldest BLOCK_ENTRIES hot entries into a new block
+void TransactionHistory::sealOldest() {
+    HistoryBlock block;
+    encode(recent.data(), BLOCK_ENTRIES, block);
+    block.digest = chain(blocks.empty() ? baseDigest : blocks.back().digest, recent.data(), BLOCK_ENTRIES,
+                         archivedCount);
+    blocks.push_back(move(block));
+    recent.erase(recent.begin(), recent.begin() + BLOCK_ENTRIES);
+    archivedCount += BLOCK_ENTRIES;
+}
+
+// Encode entries into a block. Times and balances are deltas from the
+// previous entry (starting at minTime and zero), so each block decodes on
+// its own.
+void TransactionHistory::encode(const Transaction* entries, size_t count, HistoryBlock& block) {
+    block.minTime = static_cast<int64_t>(entries[0].timestamp);
+    block.maxTime = block.minTime;
+    for (size_t i = 1; i < count; i++) {
+        int64_t when = static_cast<int64_t>(entries[i].timestamp);
+        block.minTime = when < block.minTime ? when : block.minTime;
+        block.maxTime = when > block.maxTime ? when : block.maxTime;
+    }
+    block.count = static_cast<uint32_t>(count);
+    block.bytes.clear();
+
+    int64_t previousTime = block.minTime;
+    int64_t previousBalance = 0;
+    for (size_t i = 0; i < count; i++) {
+        const Transaction& entry = entries[i];
+        uint8_t code = typeCode(entry.type);
+        block.bytes.push_back(code);
+        if (code == 0) {
+            putVarint(block.bytes, entry.type.size());
+            block.bytes.insert(block.bytes.end(), entry.type.begin(), entry.type.end());
+        }
+        int64_t when = static_cast<int64_t>(entry.timestamp);
+        int64_t balance = toCents(entry.balanceAfter);
+        putSigned(block.bytes, when - previousTime);
+        putSigned(block.bytes, toCents(entry.amount));
+        putSigned(block.bytes, balance - previousBalance);
+        previousTime = when;
+        previousBalance = balance;
+    }
+    block.bytes.shrink_to_fit();
+}
+
+// Decode a block's entries, appending them in order
+void TransactionHistory::decode(const HistoryBlock& block, vector<Transaction>& entries) {
+    size_t pos = 0;
+    int64_t previousTime = block.minTime;
+    int64_t previousBalance = 0;
+    for (uint32_t i = 0; i < block.count && pos < block.bytes.size(); i++) {
+        Transaction entry;
+        uint8_t code = block.bytes[pos++];
+        if (code == 0) {
+            size_t length = static_cast<size_t>(getVarint(block.bytes, pos));
+            if (length > block.bytes.size() - pos) {
+                length = block.bytes.size() - pos;
+            }
+            entry.type.assign(block.bytes.begin() + pos, block.bytes.begin() + pos + length);
+            pos += length;
+        } else if (code < KNOWN_TYPE_COUNT) {
+            entry.type = KNOWN_TYPES[code];
+        }
+        previousTime += getSigned(block.bytes, pos);
+        int64_t amountCents = getSigned(block.bytes, pos);
+        previousBalance += getSigned(block.bytes, pos);
+        entry.timestamp = static_cast<time_t>(previousTime);
+        entry.amount = amountCents / 100.0;
+        entry.balanceAfter = previousBalance / 100.0;
+        entries.push_back(entry);
+    }
+}
+
+// Number of transactions recorded
+size_t TransactionHistory::size() const {
+    return archivedCount + recent.size();
+}
+
+// Whether nothing has been recorded
+bool TransactionHistory::empty() const {
+    return size() == 0;
+}
+
+// Visit the entries timed within [from, to] in order. Blocks whose time
+// range misses the query are skipped without being decoded.
+void TransactionHistory::forEach(time_t from, time_t to,
+                                 const function<void(size_t, const Transaction&)>& visit) const {
+    auto inRange = [from, to](time_t when) {
+        return (from == 0 || when >= from) && (to == 0 || when <= to);
+    };
+    size_t position = 0;
+    vector<Transaction> decoded;
+    for (const auto& block : blocks) {
+        if ((from != 0 && block.maxTime < from) || (to != 0 && block.minTime > to)) {
+            position += block.count;
+            continue;
+        }
+        decoded.clear();
+        decode(block, decoded);
+        for (const auto& entry : decoded) {
+            if (inRange(entry.timestamp)) {
+                visit(position, entry);
+            }
+            position++;
+        }
+    }
+    for (const auto& entry : recent) {
+        if (inRange(entry.timestamp)) {
+            visit(position, entry);
+        }
+        position++;
+    }
+}
+
+// Copy out the entries timed within [from, to] (0 = unbounded)
+vector<Transaction> TransactionHistory::range(time_t from, time_t to) const {
+    vector<Transaction> entries;
+    forEach(from, to, [&entries](size_t, const Transaction& entry) { entries.push_back(entry); });
+    return entries;
+}
+
+// Digest over the entries since the last rebase
+uint64_t TransactionHistory::getDigest() const {
+    return digest;
+}
+
+// Continue the digest from one saved earlier. The entries held now (those
+// rebuilt at load) are left out, and balance checks start from balance.
+void TransactionHistory::rebase(uint64_t startDigest, double balance) {
+    digest = startDigest;
+    baseDigest = startDigest;
+    baseCount = size();
+    openingBalance = balance;
+    for (auto& block : blocks) {
+        block.digest = startDigest;
+    }
+}
+
+// Recompute the digest over every entry since the last rebase, checking
+// each block's digest on the way and each entry's change in balance
+// against its type. False with a description of the first problem found.
+bool TransactionHistory::audit(double balance, string& problem) const {
+    uint64_t value = baseDigest;
+    int64_t previousBalance = toCents(openingBalance);
+    size_t position = 0;
+    auto check = [&](const Transaction& entry) {
+        if (position++ < baseCount) {
+            return true;
+        }
+        int64_t balanceCents = toCents(entry.balanceAfter);
+        int64_t change = balanceCents - previousBalance;
+        int64_t amount = toCents(entry.amount);
+        uint8_t code = typeCode(entry.type);
+        bool matches;
+        switch (TYPE_EFFECTS[code]) {
+            case EFFECT_CREDIT: matches = llabs(change - amount) <= 1; break;
+            case EFFECT_DEBIT: matches = llabs(change + amount) <= 1; break;
+            case EFFECT_NONE: matches = llabs(change) <= 1; break;
+            default: matches = llabs(llabs(change) - amount) <= 1; break;
+        }
+        if (!matches) {
+            problem = "entry " + to_string(position) + " (" + entry.type + ") changes the balance by " +
+                      centsText(change) + " for an amount of " + centsText(amount);
+            return false;
+        }
+        previousBalance = balanceCents;
+        value = hashEntry(value, entry);
+        return true;
+    };
+    
+    vector<Transaction> decoded;
+    for (size_t b = 0; b < blocks.size(); b++) {
+        decoded.clear();
+        decode(blocks[b], decoded);
+        for (const auto& entry : decoded) {
+            if (!check(entry)) {
+                return false;
+            }
+        }
+        if (value != blocks[b].digest) {
+            problem = "compressed block " + to_string(b) + " does not match its digest";
+            return false;
+        }
+    }
+    for (const auto& entry : recent) {
+        if (!check(entry)) {
+            return false;
+        }
+    }
+    if (value != digest) {
+        problem = "recent entries do not match the history digest";
+        return false;
+    }
+    if (llabs(previousBalance - toCents(balance)) > 1) {
+        problem = "balance " + centsText(toCents(balance)) + " differs from the history's " +
+                  centsText(previousBalance);
+        return false;
+    }
+    return true;
+}
+
+// Write every field: the counters and digests, each block with its
+// encoded bytes, then the hot entries at full precision
+void TransactionHistory::save(vector<uint8_t>& bytes) const {
+    putVarint(bytes, archivedCount);
+    putVarint(bytes, baseCount);
+    putWord(bytes, &digest);
+    putWord(bytes, &baseDigest);
+    putWord(bytes, &openingBalance);
+    putVarint(bytes, blocks.size());
+    for (const auto& block : blocks) {
+        putSigned(bytes, block.minTime);
+        putSigned(bytes, block.maxTime);
+        putVarint(bytes, block.count);
+        putWord(bytes, &block.digest);
+        putVarint(bytes, block.bytes.size());
+        bytes.insert(bytes.end(), block.bytes.begin(), block.bytes.end());
+    }
+    putVarint(bytes, recent.size());
+    for (const auto& entry : recent) {
+        putVarint(bytes, entry.type.size());
+        bytes.insert(bytes.end(), entry.type.begin(), entry.type.end());
+        putWord(bytes, &entry.amount);
+        putWord(bytes, &entry.balanceAfter);
+        putSigned(bytes, static_cast<int64_t>(entry.timestamp));
+    }
+}
+
+// Replace this history with one written by save()
+bool TransactionHistory::restore(const vector<uint8_t>& bytes, size_t pos) {
+    TransactionHistory loaded;
+    size_t count = 0;
+    loaded.archivedCount = static_cast<size_t>(getVarint(bytes, pos));
+    loaded.baseCount = static_cast<size_t>(getVarint(bytes, pos));
+    if (!getWord(bytes, pos, &loaded.digest) || !getWord(bytes, pos, &loaded.baseDigest) ||
+        !getWord(bytes, pos, &loaded.openingBalance) || !getLength(bytes, pos, count)) {
+        return false;
+    }
+    loaded.blocks.resize(count);
+    for (auto& block : loaded.blocks) {
+        size_t length = 0;
+        block.minTime = getSigned(bytes, pos);
+        block.maxTime = getSigned(bytes, pos);
+        block.count = static_cast<uint32_t>(getVarint(bytes, pos));
+        if (!getWord(bytes, pos, &block.digest) || !getLength(bytes, pos, length)) {
+            return false;
+        }
+        block.bytes.assign(bytes.begin() + pos, bytes.begin() + pos + length);
+        pos += length;
+    }
+    if (!getLength(bytes, pos, count)) {
+        return false;
+    }
+    loaded.recent.resize(count);
+    for (auto& entry : loaded.recent) {
+        size_t length = 0;
+        if (!getLength(bytes, pos, length)) {
+            return false;
+        }
+        entry.type.assign(bytes.begin() + pos, bytes.begin() + pos + length);
+        pos += length;
+        if (!getWord(bytes, pos, &entry.amount) || !getWord(bytes, pos, &entry.balanceAfter)) {
+            return false;
+        }
+        entry.timestamp = static_cast<time_t>(getSigned(bytes, pos));
+    }
+    if (pos > bytes.size()) {
+        return false;
+    }
+    *this = move(loaded);
+    return true;
+}
+
+// Transactions sealed into blocks
+size_t TransactionHistory::getArchivedCount() const {
+    return archivedCount;
+}
+
+// Sealed blocks
+size_t TransactionHistory::getBlockCount() const {
+    return blocks.size();
+}
+
+// Bytes held by the history: the hot entries at full width plus each
+// block's header and encoded bytes
+size_t TransactionHistory::memoryBytes() const {
+    size_t bytes = sizeof(*this) + recent.capacity() * sizeof(Transaction) + blocks.capacity() * sizeof(HistoryBlock);
+    for (const auto& block : blocks) {
+        bytes += block.bytes.capacity();
+    }
+    return bytes;
+}
@@ -0,0 +1,96 @@
+#ifndef TRANSACTIONHISTORY_H
+#define TRANSACTIONHISTORY_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <ctime>
+#include <cstdint>
+
+using namespace std;
+
+// Transaction structure to store transaction history
+struct Transaction {
+    string type = "";        // "Deposit", "Withdrawal", "Transfer", "Interest", "Maintenance Fee"
+    double amount = 0.0;
+    double balanceAfter = 0.0;
+    time_t timestamp = 0;
+};
+
+// Older transactions sealed into a compressed block. Each entry is a type
+// code, then zig-zag varints of the time since the previous entry, the
+// amount in cents and the change in balance in cents; the time range in
+// the header lets a query skip the block without decoding it.
+struct HistoryBlock {
+    int64_t minTime;
+    int64_t maxTime;
+    uint32_t count;
+    uint64_t digest;          // History digest after the block's last entry
+    vector<uint8_t> bytes;
+};
+
+// An account's transactions in two tiers. The newest entries stay as
+// plain Transaction values; once enough have built up behind them, the
+// oldest are sealed into a HistoryBlock at a few bytes per entry. Sealed
+// amounts and balances are kept to the cent, the precision they are shown
+// with. Not thread-safe; the owning shard's lock guards it.
+//
+// Every entry also extends a running digest: a hash of the previous digest
+// and the entry (to the cent, so sealing does not change it). Each block
+// keeps the digest reached at its end, so an audit can tell which segment
+// was altered. History is not saved with the ledger; after a load the
+// digest is rebased onto the one saved at the last checkpoint and the
+// entries rebuilt at load are left out of it.
+class TransactionHistory {
+private:
+    static const size_t HOT_ENTRIES = 64;     // Newest entries always kept uncompressed
+    static const size_t BLOCK_ENTRIES = 64;   // Entries sealed per block
+
+    vector<HistoryBlock> blocks;              // Oldest first
+    vector<Transaction> recent;               // Follow the last block
+    size_t archivedCount;
+    uint64_t digest;                          // Over every entry from baseCount on
+    uint64_t baseDigest;                      // Digest the chain started from
+    size_t baseCount;                         // Entries before the last rebase, not in the digest
+    double openingBalance;                    // Balance at the last rebase
+
+    void sealOldest();
+    uint64_t chain(uint64_t start, const Transaction* entries, size_t count, size_t firstPosition) const;
+    static void encode(const Transaction* entries, size_t count, HistoryBlock& block);
+    static void decode(const HistoryBlock& block, vector<Transaction>& entries);
+
+public:
+    // Constructor
+    TransactionHistory();
+
+    void add(const Transaction& transaction);
+    size_t size() const;
+    bool empty() const;
+
+    // Calls visit(position, transaction) in order for entries timed within
+    // [from, to] (0 = unbounded); positions count from 0 over the whole history
+    void forEach(time_t from, time_t to, const function<void(size_t, const Transaction&)>& visit) const;
+    vector<Transaction> range(time_t from, time_t to) const;
+
+    // Digest of the entries and its audit. audit() recomputes the chain,
+    // checks each block's digest and each entry's change in balance against
+    // its type and amount, and checks the last balance against balance.
+    uint64_t getDigest() const;
+    void rebase(uint64_t startDigest, double balance);
+    bool audit(double balance, string& problem) const;
+
+    static uint64_t hashEntry(uint64_t previous, const Transaction& entry);
+
+    // The whole history as bytes and back, so an account can leave memory
+    // and return unchanged (digest, rebase point and blocks included).
+    // restore() reads from bytes[pos] on and fails on a truncated copy.
+    void save(vector<uint8_t>& bytes) const;
+    bool restore(const vector<uint8_t>& bytes, size_t pos);
+
+    // Footprint
+    size_t getArchivedCount() const;
+    size_t getBlockCount() const;
+    size_t memoryBytes() const;               // Approximate bytes held, including the hot tier
+};
+
+#endif
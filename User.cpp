@@ -1,4 +1,5 @@
 #include "User.h"
+#include "StringArena.h"
 #include <sstream>
 #include <iomanip>
 
@@ -16,15 +17,15 @@ string User::hashPassword(const string& password) {
 }
 
 // Constructor
-User::User(string uname, string pwdHash, UserRole r, bool locked)
-    : username(uname), passwordHash(pwdHash), role(r), isLocked(locked), failedAttempts(0) {}
+User::User(string_view uname, string_view pwdHash, UserRole r)
+    : username(StringArena::shared().intern(uname)), passwordHash(StringArena::shared().intern(pwdHash)), role(r) {}
 
 // Getters
-string User::getUsername() const {
+string_view User::getUsername() const {
     return username;
 }
 
-string User::getPasswordHash() const {
+string_view User::getPasswordHash() const {
     return passwordHash;
 }
 
@@ -32,44 +33,12 @@ UserRole User::getRole() const {
     return role;
 }
 
-bool User::getLocked() const {
-    return isLocked;
-}
-
-int User::getFailedAttempts() const {
-    return failedAttempts;
-}
-
-// Setters
-void User::setLocked(bool locked) {
-    isLocked = locked;
-}
-
-void User::incrementFailedAttempts() {
-    failedAttempts++;
-    if (failedAttempts >= 3) {
-        isLocked = true;
-    }
-}
-
-void User::resetFailedAttempts() {
-    failedAttempts = 0;
-}
-
 // Authenticate user
-bool User::authenticate(string pwd) const {
-    if (isLocked) {
-        return false;
-    }
+bool User::authenticate(const string& pwd) const {
     return passwordHash == hashPassword(pwd);
 }
 
 // Get role name as string
-string User::getRoleName() const {
-    switch (role) {
-        case ADMIN: return "Admin";
-        case USER: return "User";
-        case GUEST: return "Guest";
-        default: return "Unknown";
-    }
+string_view User::getRoleName() const {
+    return role >= ADMIN && role <= GUEST ? ROLE_NAMES[role] : "Unknown";
 }
@@ -2,6 +2,8 @@
 #define USER_H
 
 #include <string>
+#include <string_view>
+#include <cstdint>
 using namespace std;
 
 enum UserRole {
@@ -10,35 +12,59 @@ enum UserRole {
     GUEST
 };
 
+// Permission bits; each command declares the bits it needs
+enum Permission : uint32_t {
+    PERM_VIEW_ACCOUNTS  = 1u << 0,  // Balances, history and the account list
+    PERM_TRANSACT       = 1u << 1,  // Deposit, withdraw and transfer
+    PERM_OPEN_ACCOUNT   = 1u << 2,
+    PERM_CLOSE_ACCOUNT  = 1u << 3,
+    PERM_EXPORT         = 1u << 4,
+    PERM_MANAGE_USERS   = 1u << 5,  // List, register and unlock users
+    PERM_RUN_POSTING    = 1u << 6,  // Interest posting and the rate table
+    PERM_VIEW_SYSTEM    = 1u << 7,  // System logs and performance statistics
+    PERM_SET_LIMITS     = 1u << 8,  // Overdraft lines and daily withdrawal limits
+    PERM_REVIEW_RISK    = 1u << 9,  // Risk review queue
+    PERM_RUN_BATCH      = 1u << 10  // Batch files, which open any path the process can read
+};
+
+// Bits granted to each role, indexed by UserRole
+constexpr uint32_t ROLE_PERMISSIONS[] = {
+    0xFFFFFFFFu,                                                            // ADMIN
+    PERM_VIEW_ACCOUNTS | PERM_TRANSACT | PERM_OPEN_ACCOUNT | PERM_EXPORT,   // USER
+    PERM_VIEW_ACCOUNTS                                                      // GUEST
+};
+
+// Display name of each role, indexed by UserRole
+constexpr string_view ROLE_NAMES[] = { "Admin", "User", "Guest" };
+
+// True if the role holds every bit in required
+constexpr bool roleHasPermissions(UserRole role, uint32_t required) {
+    return (ROLE_PERMISSIONS[role] & required) == required;
+}
+
+static_assert(roleHasPermissions(ADMIN, PERM_RUN_BATCH) && !roleHasPermissions(USER, PERM_RUN_BATCH) &&
+              !roleHasPermissions(GUEST, PERM_RUN_BATCH), "batch files must stay admin-only");
+
 class User {
 private:
-    string username;
-    string passwordHash;  // Stored as hash, not plain text
+    string_view username;       // Interned in StringArena::shared()
+    string_view passwordHash;   // Stored as hash, not plain text; interned
     UserRole role;
-    bool isLocked;
-    int failedAttempts;
 
 public:
-    // Constructor
-    User(string uname, string pwdHash, UserRole r, bool locked = false);
+    // Constructor (interns the name and hash)
+    User(string_view uname, string_view pwdHash, UserRole r);
     
-    // Getters
-    string getUsername() const;
-    string getPasswordHash() const;
+    // Getters (views stay valid for the life of the program)
+    string_view getUsername() const;
+    string_view getPasswordHash() const;
     UserRole getRole() const;
-    bool getLocked() const;
-    int getFailedAttempts() const;
-    
-    // Setters
-    void setLocked(bool locked);
-    void incrementFailedAttempts();
-    void resetFailedAttempts();
     
-    // Authentication
-    bool authenticate(string pwd) const;
+    // Authentication (lockouts are enforced by LockoutPolicy before this is called)
+    bool authenticate(const string& pwd) const;
     
-    // Role name converter
-    string getRoleName() const;
+    // Role name from ROLE_NAMES
+    string_view getRoleName() const;
     
     // Static hash function
     static string hashPassword(const string& password);
@@ -1,11 +1,126 @@
 #include "BankingSystem.h"
+#include "Trace.h"
+#include "ChangeFeed.h"
 #include <iostream>
+#include <string>
+#include <cstdlib>
 
 using namespace std;
 
-int main() {
+int main(int argc, char* argv[]) {
+    string mode = argc >= 3 ? argv[1] : "";
+    if (argc == 2 && string(argv[1]) == "--changes-bench") {
+        mode = argv[1];
+    }
+    
+    // "--generate-trace FILE [--accounts N] [--operations N] [--skew S]
+    // [--streams N] [--rate OPS] [--seed N]" writes a synthetic trace
+    if (mode == "--generate-trace") {
+        TraceProfile profile;
+        for (int i = 3; i + 1 < argc; i += 2) {
+            string option = argv[i];
+            const char* value = argv[i + 1];
+            if (option == "--accounts") {
+                profile.accounts = atoi(value);
+            } else if (option == "--operations") {
+                profile.operations = atoi(value);
+            } else if (option == "--skew") {
+                profile.skew = atof(value);
+            } else if (option == "--streams") {
+                profile.streams = atoi(value);
+            } else if (option == "--rate") {
+                profile.opsPerSecond = atof(value);
+            } else if (option == "--seed") {
+                profile.seed = strtoull(value, nullptr, 10);
+            } else {
+                cout << "Error: Unknown option " << option << "!" << endl;
+                return 1;
+            }
+        }
+        if (!TraceFile::generate(argv[2], profile)) {
+            return 1;
+        }
+        cout << "Wrote " << profile.operations << " operation(s) on " << profile.accounts << " account(s) to "
+             << argv[2] << endl;
+        return 0;
+    }
+    
+    // "--replay FILE [--pace original|max|FACTOR] [--threads N]" runs a
+    // trace against the (empty) ledger in this directory
+    if (mode == "--replay") {
+        ReplayOptions options;
+        options.traceFile = argv[2];
+        for (int i = 3; i + 1 < argc; i += 2) {
+            string option = argv[i];
+            string value = argv[i + 1];
+            if (option == "--pace") {
+                options.speed = value == "original" ? 1.0 : (value == "max" ? 0.0 : atof(value.c_str()));
+            } else if (option == "--threads") {
+                options.threads = atoi(value.c_str());
+            } else {
+                cout << "Error: Unknown option " << option << "!" << endl;
+                return 1;
+            }
+        }
+        BankingSystem bank;
+        return bank.replayTrace(options) ? 0 : 1;
+    }
+    
+    // "--changes DIR [--name NAME] [--show events|rate] [--seconds N]"
+    // follows the change feed of the ledger running in DIR
+    if (mode == "--changes") {
+        string name = ChangeConsumer::configuredName(argv[2]);
+        bool quiet = false;
+        int seconds = 0;
+        for (int i = 3; i + 1 < argc; i += 2) {
+            string option = argv[i];
+            string value = argv[i + 1];
+            if (option == "--name") {
+                name = value;
+            } else if (option == "--show") {
+                quiet = value == "rate";
+            } else if (option == "--seconds") {
+                seconds = atoi(value.c_str());
+            } else {
+                cout << "Error: Unknown option " << option << "!" << endl;
+                return 1;
+            }
+        }
+        ChangeConsumer consumer(argv[2], quiet);
+        return consumer.follow(name, seconds) ? 0 : 1;
+    }
+    
+    // "--changes-bench [--events N] [--consumers N] [--ring N]" measures
+    // the change feed ring on its own
+    if (mode == "--changes-bench") {
+        uint64_t events = 20000000;
+        int consumers = 2;
+        size_t ring = 65536;
+        for (int i = 2; i + 1 < argc; i += 2) {
+            string option = argv[i];
+            const char* value = argv[i + 1];
+            if (option == "--events") {
+                events = strtoull(value, nullptr, 10);
+            } else if (option == "--consumers") {
+                consumers = atoi(value);
+            } else if (option == "--ring") {
+                ring = static_cast<size_t>(strtoull(value, nullptr, 10));
+            } else {
+                cout << "Error: Unknown option " << option << "!" << endl;
+                return 1;
+            }
+        }
+        return ChangeConsumer::benchmark(events, consumers, ring) ? 0 : 1;
+    }
+    
+    // "--standby DIR" follows the primary running in DIR as a hot standby
+    string standbyOf;
+    if (mode == "--standby") {
+        standbyOf = argv[2];
+    }
+    
     // Create and run the banking system
-    BankingSystem bank;
+    BankingSystem bank(standbyOf);
     bank.run();
     
     return 0;
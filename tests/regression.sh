@@ -0,0 +1,188 @@
+#!/bin/bash
+# Regression tests that drive the banking binary through replay traces and
+# stop it at crash points (BANK_CRASH_POINT), then restart it and check the
+# ledger it recovers.
+#
+# Usage: tests/regression.sh [path to banking binary]
+
+BANKING=$(realpath "${1:-./banking}")
+FAILED=0
+PASSED=0
+
+# Fresh working directory with a settings file holding the given lines
+make_ledger_dir() {
+    local dir
+    dir=$(mktemp -d)
+    printf '%s\n' "$@" > "$dir/settings.txt"
+    echo "$dir"
+}
+
+# Replay a trace (read from stdin) in dir, with an optional crash point
+replay_trace() {
+    local dir=$1 crash=$2
+    cat > "$dir/trace.txt"
+    (cd "$dir" && BANK_CRASH_POINT=$crash timeout 60 "$BANKING" --replay trace.txt --pace max --threads 1 \
+        > replay.out 2>&1)
+}
+
+# Restart the ledger in dir, log in as admin and list every account
+list_accounts() {
+    local dir=$1
+    (cd "$dir" && printf '1\nadmin\nadmin123\n6\n28\n3\n' | timeout 60 "$BANKING" > restart.out 2>&1)
+    grep -E '^[0-9]{4,} ' "$dir/restart.out" | awk '{ print $1, $(NF-1) }'
+}
+
+# Compare what a test got with what it expected
+check() {
+    local name=$1 expected=$2 actual=$3
+    if [ "$expected" == "$actual" ]; then
+        echo "PASS  $name"
+        PASSED=$((PASSED + 1))
+    else
+        echo "FAIL  $name"
+        echo "      expected: $(echo $expected)"
+        echo "      got:      $(echo $actual)"
+        FAILED=$((FAILED + 1))
+    fi
+}
+
+# A transfer between shards, crashed after both legs but before END, with a
+# checkpoint after every journal record. Recovery must not apply a leg twice.
+test_transfer_crash_before_end() {
+    local backend=$1 dir
+    dir=$(make_ledger_dir "storage_backend = $backend" "journal_checkpoint_records = 1")
+    replay_trace "$dir" transfer-before-end <<'EOF'
+0 1 0 login admin 0
+0 1 0 create "Source" 1000 1
+0 1 0 create "Destination" 0 1
+0 1 0 transfer 1001 1002 100
+EOF
+    check "transfer crash before END ($backend)" $'1001 900.00\n1002 100.00' "$(list_accounts "$dir")"
+    rm -rf "$dir"
+}
+
+# A transfer crashed just after END on a queued backend. The fdatasync of
+# each batch keeps the legs' appends queued behind it, so END must not be
+# logged until both legs are on disk.
+test_transfer_crash_after_end() {
+    local backend=$1 dir
+    dir=$(make_ledger_dir "storage_backend = $backend" "storage_fsync = 1")
+    replay_trace "$dir" transfer-after-end <<'EOF'
+0 1 0 login admin 0
+0 1 0 create "Source" 1000 1
+0 1 0 create "Destination" 0 1
+0 1 0 transfer 1001 1002 100
+EOF
+    check "transfer crash after END ($backend)" $'1001 900.00\n1002 100.00' "$(list_accounts "$dir")"
+    rm -rf "$dir"
+}
+
+# An unknown user, a login refused by the rate limiter (which waits and goes
+# back to the menu), then input closed at the password prompt. The program
+# must exit with one audit record per attempt rather than spin on the closed
+# stream.
+test_login_input_closed() {
+    local dir status
+    dir=$(make_ledger_dir "login_burst = 1" "login_rate_per_minute = 60")
+    (cd "$dir" && printf '1\nnobody\nnobody\n1\nadmin\n' | timeout 20 "$BANKING" > login.out 2>&1)
+    status=$?
+    check "login exits when input closes" "0 2" "$status $(cat "$dir"/audit*.log | wc -l)"
+    rm -rf "$dir"
+}
+
+# Batch files open any path the process can read, so only admins may run
+# them: the USER menu must not offer Run Batch File, while the admin's does.
+test_batch_admin_only() {
+    local dir user admin
+    dir=$(make_ledger_dir "storage_backend = sync")
+    user=$(cd "$dir" && printf '1\nuser1\npass123\n12\n3\n' | timeout 20 "$BANKING" | grep -c "Run Batch File")
+    admin=$(cd "$dir" && printf '1\nadmin\nadmin123\n28\n3\n' | timeout 20 "$BANKING" | grep -c "Run Batch File")
+    check "batch refused to a USER session" "0 1" "$user $admin"
+    rm -rf "$dir"
+}
+
+# Closing an account, alone or in bulk, releases its open holds, so a later
+# settle or release of those holds is refused rather than debiting the
+# tombstone or, once compaction purged the account, crashing.
+test_holds_on_closed_accounts() {
+    local dir status results
+    dir=$(make_ledger_dir "storage_backend = sync" "shard_count = 1" "tombstone_retention_days = 0")
+    replay_trace "$dir" "" <<'EOF'
+0 1 0 login admin 0
+0 1 0 create "Held" 1000 1
+0 1 0 create "Bulk" 1000 1
+0 1 0 create "Open" 1000 1
+0 1 0 hold 1001 100
+0 1 0 hold 1002 100
+0 1 0 delete 1001
+0 1 0 close-accounts 1002
+0 1 0 settle 4 50
+0 1 0 compact
+0 1 0 release 5
+EOF
+    status=$?
+    results=$(grep -oE '"action":"(settle|release)_hold".*"ok":[a-z]+' "$dir"/audit*.log | grep -oE '[a-z]+$')
+    check "holds released with their accounts" "0 false false 1003 1000.00" \
+        "$status $(echo $results) $(list_accounts "$dir")"
+    rm -rf "$dir"
+}
+
+# A retired number written twice to retired_accounts.txt (as a late append
+# racing a rewrite once could) must still be reissued only once.
+test_retired_number_reissued_once() {
+    local dir
+    dir=$(make_ledger_dir "storage_backend = sync" "shard_count = 1" "tombstone_retention_days = 0" \
+        "reuse_retired_numbers = 1" "retired_quarantine_days = 0")
+    replay_trace "$dir" "" <<'EOF'
+0 1 0 login admin 0
+0 1 0 create "Retired" 1000 1
+0 1 0 create "Kept" 1000 1
+0 1 0 delete 1001
+0 1 0 compact
+EOF
+    head -1 "$dir/retired_accounts.txt" >> "$dir/retired_accounts.txt"
+    (cd "$dir" && printf '1\nadmin\nadmin123\n1\nC\n10\n1\nUSD\n1\nD\n20\n1\nUSD\n28\n3\n' |
+        timeout 20 "$BANKING" > create.out 2>&1)
+    check "retired number reissued once" $'1001 10.00\n1002 1000.00\n1003 20.00' "$(list_accounts "$dir")"
+    rm -rf "$dir"
+}
+
+# A holder name that fits the slot (71 bytes) comes back whole after a
+# restart; one byte more, or a UTF-8 name that crosses the limit, is refused
+# rather than cut.
+test_holder_name_limit() {
+    local dir fits long wide accounts
+    dir=$(make_ledger_dir "storage_backend = sync")
+    fits=$(printf 'a%.0s' $(seq 71))
+    long=$(printf 'b%.0s' $(seq 72))
+    wide=$(printf '\xc3\xa9%.0s' $(seq 36))
+    printf '0 1 0 login admin 0\n0 1 0 create "%s" 1 1\n0 1 0 create "%s" 2 1\n0 1 0 create "%s" 3 1\n' \
+        "$fits" "$long" "$wide" | replay_trace "$dir" ""
+    accounts=$(list_accounts "$dir")
+    check "holder names refused, not cut" "1001 1.00 1" "$(echo $accounts) $(grep -c "$fits " "$dir/restart.out")"
+    rm -rf "$dir"
+}
+
+# A control character in a holder name is written to the audit log as a
+# \u00XX escape, so the line stays valid JSON.
+test_audit_escapes_controls() {
+    local dir
+    dir=$(make_ledger_dir "storage_backend = sync")
+    (cd "$dir" && printf '1\nadmin\nadmin123\n1\nTab\there\n5\n1\nUSD\n28\n3\n' | timeout 20 "$BANKING" > create.out 2>&1)
+    check "audit log escapes control characters" "1" "$(grep -c 'Tab\\u0009here' "$dir"/audit*.log)"
+    rm -rf "$dir"
+}
+
+test_transfer_crash_before_end sync
+test_transfer_crash_before_end threads
+test_transfer_crash_after_end threads
+test_transfer_crash_after_end io_uring
+test_login_input_closed
+test_batch_admin_only
+test_holds_on_closed_accounts
+test_retired_number_reissued_once
+test_holder_name_limit
+test_audit_escapes_controls
+
+echo "$PASSED passed, $FAILED failed"
+[ "$FAILED" -eq 0 ]